@@ -0,0 +1,169 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+// Boost
+#include <boost/program_options.hpp>
+
+// HDF5
+#include <hdf5.h>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// GE
+#include "BatchedDatasetSink.h"
+#include "DatasetSink.h"
+
+namespace po = boost::program_options;
+
+/**
+ * Writes synthetic acquisitions to a new HDF5 file, as ge2ismrmrd -b would
+ *
+ * @param batchSize Acquisitions per write; 0 appends each one through ISMRMRD::Dataset
+ * @returns seconds taken, including closing the file
+ */
+static double writeAcquisitions(const std::string& path, size_t batchSize, size_t chunkBytes,
+                                GEToIsmrmrd::SampleFormat format, size_t acquisitions,
+                                unsigned int samples, unsigned int channels, size_t& bytes)
+{
+   ISMRMRD::Acquisition acq;
+   acq.resize(samples, channels);
+   for (size_t n = 0 ; n < acq.getNumberOfDataElements() ; n++) {
+      acq.getDataPtr()[n] = complex_float_t(n % 4096, -static_cast<float>(n % 1024));
+   }
+
+   std::remove(path.c_str());
+   auto const start = std::chrono::steady_clock::now();
+
+   if (batchSize == 0) {
+      ISMRMRD::Dataset dataset(path.c_str(), "dataset", true);
+      GEToIsmrmrd::DatasetSink sink(dataset);
+      for (size_t n = 0 ; n < acquisitions ; n++) {
+         acq.scan_counter() = n;
+         sink.consume(acq);
+      }
+      bytes = sink.bytesWritten();
+   } else {
+      // the batched writer appends to a file that ge2ismrmrd has written the header to
+      hid_t const file = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+      if (file < 0) {
+         throw std::runtime_error("Failed to create " + path);
+      }
+      H5Fclose(file);
+
+      GEToIsmrmrd::BatchedDatasetSink sink(path, "dataset", batchSize, chunkBytes, format);
+      for (size_t n = 0 ; n < acquisitions ; n++) {
+         acq.scan_counter() = n;
+         sink.consume(acq);
+      }
+      sink.flush();
+      bytes = sink.bytesWritten();
+   }
+
+   std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+   return elapsed.count();
+}
+
+/**
+ * Measures the throughput of the HDF5 writers of ge2ismrmrd on synthetic acquisitions
+ *
+ * Every batch size is written runs times, and the fastest run is reported, so
+ * that the numbers depend as little as possible on other load on the machine.
+ */
+int main (int argc, char *argv[])
+{
+   std::string output, sampleFormat;
+   std::vector<size_t> batchSizes;
+   unsigned int samples, channels, runs;
+   size_t acquisitions, chunkKB;
+
+   std::string usage = std::string(argv[0]) + " [options] [batch size]...";
+
+   po::options_description options("Options");
+   options.add_options()
+      ("help,h", "print help message")
+      ("output,o", po::value<std::string>(&output)->default_value("writer_benchmark.h5"), "HDF5 file written and overwritten by every run")
+      ("acquisitions,n", po::value<size_t>(&acquisitions)->default_value(20000), "acquisitions written per run")
+      ("samples", po::value<unsigned int>(&samples)->default_value(256), "samples per channel")
+      ("channels", po::value<unsigned int>(&channels)->default_value(32), "channels per acquisition")
+      ("chunk-kb", po::value<size_t>(&chunkKB)->default_value(1024), "approximate sample data per HDF5 chunk of the batched writer")
+      ("sample-format", po::value<std::string>(&sampleFormat)->default_value("float"), "samples written by the batched writer: float, int16 or int32")
+      ("runs", po::value<unsigned int>(&runs)->default_value(3), "runs per batch size, of which the fastest is reported")
+      ("batch-size", po::value<std::vector<size_t> >(&batchSizes), "acquisitions per write (0 = one ISMRMRD append per acquisition); default 0 1 16 64 256")
+      ;
+
+   po::positional_options_description positionals;
+   positionals.add("batch-size", -1);
+
+   po::variables_map vm;
+   try {
+      po::store(po::command_line_parser(argc, argv).options(options).positional(positionals).run(), vm);
+      po::notify(vm);
+   } catch (const po::error& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << usage << std::endl << options << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   if (vm.count("help")) {
+      std::cerr << usage << std::endl << options << std::endl;
+      return EXIT_SUCCESS;
+   }
+
+   if (batchSizes.empty()) {
+      batchSizes = {0, 1, 16, 64, 256};
+   }
+   if (runs == 0) {
+      runs = 1;
+   }
+
+   GEToIsmrmrd::SampleFormat format;
+   try {
+      format = GEToIsmrmrd::parseSampleFormat(sampleFormat);
+   } catch (const std::invalid_argument& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (format == GEToIsmrmrd::SAMPLE_FORMAT_NATIVE) {
+      std::cerr << "ERROR: synthetic samples have no native format" << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   std::cout << acquisitions << " acquisitions of " << samples << " samples x " << channels << " channels, "
+             << GEToIsmrmrd::sampleFormatName(format) << " samples in batches, best of " << runs << " runs" << std::endl;
+   std::printf("%10s %10s %14s %10s\n", "batch", "seconds", "acquisitions/s", "MiB/s");
+
+   try {
+      for (size_t n = 0 ; n < batchSizes.size() ; n++) {
+         double best = 0.0;
+         size_t bytes = 0;
+         for (unsigned int run = 0 ; run < runs ; run++) {
+            double const seconds = writeAcquisitions(output, batchSizes[n], chunkKB * 1024, format,
+                                                     acquisitions, samples, channels, bytes);
+            if (run == 0 || seconds < best) {
+               best = seconds;
+            }
+         }
+
+         std::ostringstream batch;
+         if (batchSizes[n] == 0) {
+            batch << "ismrmrd";
+         } else {
+            batch << batchSizes[n];
+         }
+         std::printf("%10s %10.3f %14.0f %10.1f\n", batch.str().c_str(), best,
+                     acquisitions / best, bytes / best / (1024.0 * 1024.0));
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   std::remove(output.c_str());
+   return EXIT_SUCCESS;
+}
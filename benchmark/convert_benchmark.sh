@@ -0,0 +1,96 @@
+#!/bin/sh
+
+# -------------------------------------------------------------------------------
+#
+# Times ge2ismrmrd converting one raw file, optionally against a second build
+# of it, e.g. one from an earlier commit:
+#
+#    git worktree add /tmp/ge2ismrmrd-before <commit>
+#    (build /tmp/ge2ismrmrd-before as usual)
+#    benchmark/convert_benchmark.sh -b /tmp/ge2ismrmrd-before/build/src/ge2ismrmrd \
+#        build/src/ge2ismrmrd sampleData/P20480_GRE.7
+#
+# Each build converts the file once to warm the page cache, then -n more times.
+# The whole process is timed, so builds that do not report their own
+# conversion time can be compared too. The minimum and median wall clock
+# times are printed.
+#
+# -------------------------------------------------------------------------------
+
+usage()
+{
+    echo "usage: $0 [-n runs] [-b baseline-ge2ismrmrd] ge2ismrmrd [raw file] [-- ge2ismrmrd options]" >&2
+    exit 1
+}
+
+runs=10
+baseline=""
+while getopts "n:b:" opt; do
+    case $opt in
+        n) runs=$OPTARG ;;
+        b) baseline=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+[ $# -ge 1 ] || usage
+candidate=$1
+shift
+rawfile=$(dirname "$0")/../sampleData/P20480_GRE.7
+if [ $# -ge 1 ] && [ "$1" != "--" ]; then
+    rawfile=$1
+    shift
+fi
+[ "$1" = "--" ] && shift
+options="$*"
+
+if [ ! -f "$rawfile" ]; then
+    echo "$0: $rawfile not found" >&2
+    exit 1
+fi
+
+output=$(mktemp -d)
+trap 'rm -rf "$output"' EXIT
+
+# seconds since the epoch, with nanoseconds
+now()
+{
+    date +%s.%N
+}
+
+# prints "min median" of the wall clock times of runs conversions by $1
+time_build()
+{
+    exe=$1
+    "$exe" -o "$output/warmup.h5" $options "$rawfile" > /dev/null || return 1
+    rm -f "$output/warmup.h5"
+
+    : > "$output/times"
+    run=0
+    while [ $run -lt $runs ]; do
+        start=$(now)
+        "$exe" -o "$output/run.h5" $options "$rawfile" > /dev/null || return 1
+        end=$(now)
+        rm -f "$output/run.h5"
+        echo "$start $end" | awk '{ printf "%.6f\n", $2 - $1 }' >> "$output/times"
+        run=$((run + 1))
+    done
+
+    sort -n "$output/times" | awk '{ t[NR] = $1 } END { printf "%.3f %.3f\n", t[1], t[int((NR + 1) / 2)] }'
+}
+
+echo "$rawfile, $runs runs each"
+printf "%-12s %10s %10s\n" "build" "min (s)" "median (s)"
+
+if [ -n "$baseline" ]; then
+    before=$(time_build "$baseline") || exit 1
+    printf "%-12s %10s %10s\n" "baseline" $before
+fi
+
+after=$(time_build "$candidate") || exit 1
+printf "%-12s %10s %10s\n" "candidate" $after
+
+if [ -n "$baseline" ]; then
+    echo "$before $after" | awk '{ printf "speedup of the median: %.2fx\n", $2 / $4 }'
+fi
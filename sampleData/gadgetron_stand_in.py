@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+
+# -------------------------------------------------------------------------------
+#
+# Stand-in for a Gadgetron, to try out "ge2ismrmrd --gadgetron host:port"
+# without a reconstruction server.  Accepts one connection, checks the stream
+# of messages and reports what it received.  Like a Gadgetron, it answers with
+# a text message and an image: the k-space magnitude of the first channel, one
+# row per acquisition, e.g.:
+#
+#    ./gadgetron_stand_in.py 9002 &
+#    ge2ismrmrd --gadgetron localhost:9002 --gadgetron-config default.xml \
+#               --gadgetron-images returned.h5 P20480_GRE.7
+#
+# -------------------------------------------------------------------------------
+
+import math
+import socket
+import struct
+import sys
+
+MESSAGE_CONFIG_FILE      = 1
+MESSAGE_CONFIG_SCRIPT    = 2
+MESSAGE_PARAMETER_SCRIPT = 3
+MESSAGE_CLOSE            = 4
+MESSAGE_TEXT             = 5
+MESSAGE_ACQUISITION      = 1008
+MESSAGE_IMAGE            = 1022
+
+ACQUISITION_HEADER_SIZE  = 340
+IMAGE_HEADER_FORMAT      = "<HHQI3H3fH3f3f3f3f3f6HI3I3H8i8fI"
+ISMRMRD_FLOAT            = 5
+
+
+def read_exactly(connection, size):
+    data = bytearray()
+    while len(data) < size:
+        chunk = connection.recv(size - len(data))
+        if not chunk:
+            raise EOFError("connection closed after %d of %d bytes" % (len(data), size))
+        data.extend(chunk)
+    return bytes(data)
+
+
+def image_message(rows):
+    """Image message of float rows, padded to the longest one"""
+    width = max(len(row) for row in rows)
+    head = [0] * 56
+    head[0] = 1                                  # version
+    head[1] = ISMRMRD_FLOAT                      # data_type
+    head[4:7] = [width, len(rows), 1]            # matrix_size
+    head[10] = 1                                 # channels
+    head[38] = 1                                 # image_series_index
+    samples = [value for row in rows for value in row + [0.0] * (width - len(row))]
+    attributes = b"<ismrmrdMeta/>\0"
+    return (struct.pack("<H", MESSAGE_IMAGE) + struct.pack(IMAGE_HEADER_FORMAT, *head) +
+            struct.pack("<Q", len(attributes)) + attributes + struct.pack("<%df" % len(samples), *samples))
+
+
+def text_message(text):
+    data = text.encode()
+    return struct.pack("<HI", MESSAGE_TEXT, len(data)) + data
+
+
+def serve(port):
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(("", port))
+    listener.listen(1)
+
+    connection, peer = listener.accept()
+    acquisitions = 0
+    samples = 0
+    rows = []
+    while True:
+        (message,) = struct.unpack("<H", read_exactly(connection, 2))
+        if message == MESSAGE_CONFIG_FILE:
+            name = read_exactly(connection, 1024).split(b"\0", 1)[0]
+            print("config file: %s" % name.decode())
+        elif message in (MESSAGE_CONFIG_SCRIPT, MESSAGE_PARAMETER_SCRIPT):
+            (length,) = struct.unpack("<I", read_exactly(connection, 4))
+            read_exactly(connection, length)
+            print("%s: %d bytes" % ("config script" if message == MESSAGE_CONFIG_SCRIPT else "header", length))
+        elif message == MESSAGE_ACQUISITION:
+            head = read_exactly(connection, ACQUISITION_HEADER_SIZE)
+            number_of_samples, active_channels = struct.unpack_from("<H2xH", head, 34)
+            (trajectory_dimensions,) = struct.unpack_from("<H", head, 176)
+            read_exactly(connection, 4 * trajectory_dimensions * number_of_samples)
+            data = read_exactly(connection, 8 * number_of_samples * active_channels)
+            first = struct.unpack_from("<%df" % (2 * number_of_samples), data)
+            rows.append([math.hypot(first[2 * n], first[2 * n + 1]) for n in range(number_of_samples)])
+            acquisitions += 1
+            samples += number_of_samples * active_channels
+        elif message == MESSAGE_CLOSE:
+            summary = "%d acquisitions, %d complex samples" % (acquisitions, samples)
+            print("close: " + summary)
+            connection.sendall(text_message("stand-in received " + summary))
+            if rows:
+                connection.sendall(image_message(rows))
+            connection.sendall(struct.pack("<H", MESSAGE_CLOSE))
+            break
+        else:
+            raise ValueError("unknown message id %d" % message)
+
+    connection.close()
+    listener.close()
+
+
+if __name__ == "__main__":
+    serve(int(sys.argv[1]) if len(sys.argv) > 1 else 9002)
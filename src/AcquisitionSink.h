@@ -0,0 +1,49 @@
+/** @file AcquisitionSink.h */
+#ifndef ACQUISITION_SINK_H
+#define ACQUISITION_SINK_H
+
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Receives ISMRMRD acquisitions from a SequenceConverter as soon as they are decoded.
+ *
+ * The acquisition handed to consume() is only valid for the duration of the call.
+ * Converters reuse its storage for the next readout, so a sink that needs to keep
+ * the data around must copy it.
+ */
+class AcquisitionSink
+{
+public:
+    virtual ~AcquisitionSink() { }
+
+    virtual void consume(const ISMRMRD::Acquisition& acq) = 0;
+};
+
+/**
+ * Collects every acquisition into a caller-owned vector.
+ *
+ * Used to implement the vector-returning getAcquisitions() calls on top of the
+ * streaming interface.
+ */
+class AcquisitionVectorSink : public AcquisitionSink
+{
+public:
+    AcquisitionVectorSink(std::vector<ISMRMRD::Acquisition>& acqs) : acqs_(acqs) { }
+
+    void consume(const ISMRMRD::Acquisition& acq)
+    {
+        acqs_.push_back(acq);
+    }
+
+private:
+    std::vector<ISMRMRD::Acquisition>& acqs_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* ACQUISITION_SINK_H */
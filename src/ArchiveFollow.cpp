@@ -0,0 +1,24 @@
+/** @file ArchiveFollow.cpp */
+#include <algorithm>
+#include <cmath>
+
+#include "ArchiveFollow.h"
+
+namespace GEToIsmrmrd {
+
+double FollowStatistics::latencyPercentile(double percent) const
+{
+    if (latencies.empty()) {
+        return 0.0;
+    }
+
+    std::vector<double> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest rank: the smallest latency that at least percent of the volumes did not exceed
+    double const rank = std::ceil(std::max(0.0, std::min(percent, 100.0)) / 100.0 * sorted.size());
+    size_t const index = rank < 1.0 ? 0 : size_t(rank) - 1;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,113 @@
+/** @file ArchiveFollow.h */
+#ifndef ARCHIVE_FOLLOW_H
+#define ARCHIVE_FOLLOW_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+
+namespace GEToIsmrmrd {
+
+/** Settings of GERawConverter::followAcquisitions() */
+struct FollowOptions
+{
+    FollowOptions() : pollMillis(100), idleSeconds(30), volumes(0) { }
+
+    unsigned int pollMillis;    ///< interval between looks at the archive
+    unsigned int idleSeconds;   ///< stop once the archive has not grown for this long
+    unsigned int volumes;       ///< stop once this many volumes were emitted (0 = when idle)
+};
+
+/** What GERawConverter::followAcquisitions() did */
+struct FollowStatistics
+{
+    FollowStatistics() : polls(0), reopens(0), failedReopens(0), packets(0), volumes(0), incompleteVolumes(0) { }
+
+    size_t polls;               ///< looks at the archive
+    size_t reopens;             ///< times the archive was opened again after it grew
+    size_t failedReopens;       ///< reopens that failed, e.g. on a packet being written, and were retried
+    size_t packets;             ///< packets read, including scan control packets
+    size_t volumes;             ///< volumes emitted complete
+    size_t incompleteVolumes;   ///< volumes still missing slices when following stopped
+
+    /** Seconds from the arrival of the last packet of each volume to its emission */
+    std::vector<double> latencies;
+
+    /**
+     * Latency below which a share of the volumes were emitted, by nearest rank
+     *
+     * @param percent e.g. 50 for the median
+     * @returns seconds, or 0 if no volume was emitted
+     */
+    double latencyPercentile(double percent) const;
+};
+
+/**
+ * Passes acquisitions on, and reports each volume once all its acquisitions have passed.
+ *
+ * A packet arrives when followAcquisitions() first sees it in the archive; the
+ * latency of a volume runs from the arrival of its last packet until onVolume
+ * has returned, e.g. after flushing the downstream sink.
+ */
+class VolumeTracker : public AcquisitionSink
+{
+public:
+    typedef std::function<void(unsigned int volume)> VolumeCallback;
+
+    /**
+     * @param downstream Sink the acquisitions are passed to
+     * @param acquisitionsPerVolume Acquisitions that make up one volume
+     * @param onVolume Called as each volume is complete
+     */
+    VolumeTracker(AcquisitionSink& downstream, size_t acquisitionsPerVolume, const VolumeCallback& onVolume)
+        : downstream_(downstream)
+        , perVolume_(acquisitionsPerVolume)
+        , onVolume_(onVolume)
+    {
+    }
+
+    /** Sets the arrival time of the packets converted next */
+    void setArrival(std::chrono::steady_clock::time_point arrival) { arrival_ = arrival; }
+
+    void consume(const ISMRMRD::Acquisition& acq)
+    {
+        downstream_.consume(acq);
+
+        unsigned int const volume = acq.idx().repetition;
+        if (++pending_[volume] < perVolume_) {
+            return;
+        }
+        pending_.erase(volume);
+
+        if (onVolume_) {
+            onVolume_(volume);
+        }
+        latencies_.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - arrival_).count());
+    }
+
+    /** Latencies of the volumes emitted so far, in order */
+    const std::vector<double>& latencies() const { return latencies_; }
+
+    /** Volumes with some but not all of their acquisitions passed on */
+    size_t incompleteVolumes() const { return pending_.size(); }
+
+private:
+    AcquisitionSink& downstream_;
+    size_t perVolume_;
+    VolumeCallback onVolume_;
+
+    std::chrono::steady_clock::time_point arrival_;
+    std::map<unsigned int, size_t> pending_;    // acquisitions passed on, by volume
+    std::vector<double> latencies_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* ARCHIVE_FOLLOW_H */
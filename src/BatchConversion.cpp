@@ -0,0 +1,356 @@
+/** @file BatchConversion.cpp */
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+// ISMRMRD
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "BatchConversion.h"
+#include "BatchedDatasetSink.h"
+#include "DatasetSink.h"
+#include "Hdf5Lock.h"
+
+namespace GEToIsmrmrd {
+
+struct BatchConversion::FileState
+{
+    FileState() : sink(NULL), nextUnit(0), unitsLeft(0), writing(false) { }
+
+    BatchJob job;
+    std::chrono::steady_clock::time_point queued;
+    std::chrono::steady_clock::time_point start;
+    std::shared_ptr<GERawConverter> converter;
+
+    // Output, only touched with the HDF5 lock held
+    std::shared_ptr<ISMRMRD::Dataset> dataset;
+    std::shared_ptr<DatasetSink> datasetSink;
+    std::shared_ptr<BatchedDatasetSink> batchedSink;
+    AcquisitionSink* sink;
+
+    std::mutex mutex;                                           // guards the members below
+    std::vector<std::vector<ISMRMRD::Acquisition> > units;      // converted, not yet written
+    std::vector<bool> unitDone;
+    size_t nextUnit;                                            // next unit to write
+    size_t unitsLeft;                                           // units not converted yet
+    bool writing;                                               // a thread is writing units
+    std::string error;
+};
+
+static size_t fileSize(const std::string& path)
+{
+    struct stat info;
+    return (stat(path.c_str(), &info) == 0) ? static_cast<size_t>(info.st_size) : 0;
+}
+
+BatchConversion::BatchConversion(const Opener& open, const ConversionRange& range, size_t batchSize, size_t chunkBytes,
+                                 SampleFormat format)
+    : open_(open)
+    , range_(range)
+    , batchSize_(batchSize)
+    , chunkBytes_(chunkBytes)
+    , format_(format)
+    , inFlight_(0)
+{
+}
+
+std::vector<BatchJob> BatchConversion::readManifest(const std::string& path)
+{
+    std::ifstream stream(path.c_str());
+    if (!stream) {
+        throw std::runtime_error("Failed to read manifest: " + path);
+    }
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.rawFile) || job.rawFile[0] == '#') {
+            continue;
+        }
+        fields >> job.outputFile;
+        jobs.push_back(job);
+    }
+
+    return jobs;
+}
+
+void BatchConversion::nameOutputs(std::vector<BatchJob>& jobs, const std::string& outputDir)
+{
+    std::string dir = outputDir.empty() ? "." : outputDir;
+    if (dir[dir.size() - 1] != '/') {
+        dir += "/";
+    }
+
+    // Names given in the manifest are taken before any is generated
+    std::set<std::string> taken;
+    for (size_t n = 0 ; n < jobs.size() ; n++) {
+        if (!jobs[n].outputFile.empty()) {
+            taken.insert(jobs[n].outputFile);
+        }
+    }
+
+    std::map<std::string, unsigned int> uses;
+    for (size_t n = 0 ; n < jobs.size() ; n++) {
+        if (!jobs[n].outputFile.empty()) {
+            continue;
+        }
+
+        // A numbered name may be the plain name of another input, e.g. P1_2.7 next to two P1.7
+        std::string const stem = outputStem(jobs[n].rawFile);
+        unsigned int& use = uses[stem];
+        std::string name;
+        do {
+            std::ostringstream candidate;
+            candidate << dir << stem;
+            if (++use > 1) {
+                candidate << "_" << use;
+            }
+            candidate << ".h5";
+            name = candidate.str();
+        } while (taken.count(name));
+
+        taken.insert(name);
+        jobs[n].outputFile = name;
+    }
+}
+
+std::string BatchConversion::outputStem(const std::string& rawFile)
+{
+    std::string stem = rawFile.substr(rawFile.find_last_of('/') + 1);
+    size_t const dot = stem.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        stem.erase(dot);
+    }
+    return stem;
+}
+
+BatchSummary BatchConversion::run(const std::vector<BatchJob>& jobs, WorkStealingPool& pool, const Reporter& report)
+{
+    {
+        std::lock_guard<std::mutex> lock(resultsMutex_);
+        totals_ = BatchSummary();
+        report_ = report;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0 ; n < jobs.size() ; n++) {
+        submit(jobs[n], pool);
+    }
+    pool.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    BatchSummary summary = totals();
+    summary.seconds = elapsed.count();
+    summary.pool = pool.statistics();
+
+    return summary;
+}
+
+void BatchConversion::submit(const BatchJob& job, WorkStealingPool& pool)
+{
+    std::shared_ptr<FileState> state = std::make_shared<FileState>();
+    state->job = job;
+    state->queued = std::chrono::steady_clock::now();
+
+    inFlight_++;
+    pool.submit([this, state, &pool]() { convertFile(state, pool); });
+}
+
+void BatchConversion::setReporter(const Reporter& report)
+{
+    std::lock_guard<std::mutex> lock(resultsMutex_);
+    report_ = report;
+}
+
+BatchSummary BatchConversion::totals() const
+{
+    std::lock_guard<std::mutex> lock(resultsMutex_);
+    return totals_;
+}
+
+/**
+ * Opens a raw file and its output, then converts it whole or queues its slices
+ */
+void BatchConversion::convertFile(const std::shared_ptr<FileState>& state, WorkStealingPool& pool)
+{
+    state->start = std::chrono::steady_clock::now();
+
+    try {
+        state->converter = open_(state->job.rawFile);
+        SampleFormat const format = state->converter->resolveSampleFormat(format_);
+        std::string const header = state->converter->getIsmrmrdXMLHeader(range_);
+
+        {
+            Hdf5Lock lock;
+            state->dataset = std::make_shared<ISMRMRD::Dataset>(state->job.outputFile.c_str(), "dataset", true);
+            state->dataset->writeHeader(header);
+
+            if (batchSize_ > 0 || format != SAMPLE_FORMAT_FLOAT) {
+                // the batched writer opens the file itself, so close it here first
+                state->dataset.reset();
+                state->batchedSink = std::make_shared<BatchedDatasetSink>(state->job.outputFile, "dataset",
+                                                                          batchSize_, chunkBytes_, format);
+                state->sink = state->batchedSink.get();
+            } else {
+                state->datasetSink = std::make_shared<DatasetSink>(*state->dataset);
+                state->sink = state->datasetSink.get();
+            }
+        }
+
+        std::vector<unsigned int> slices;
+        if (state->converter->getRawObjectType() == PFILE_RAW_TYPE &&
+                state->converter->getConverter()->supportsConcurrentRanges()) {
+            slices = range_.selectedSlices(state->converter->getContext().scan.numSlices);
+        }
+
+        if (slices.size() > 1) {
+            // The slices are converted by tasks of their own, the last of which finishes the file
+            state->units.resize(slices.size());
+            state->unitDone.resize(slices.size(), false);
+            state->unitsLeft = slices.size();
+
+            for (size_t n = 0 ; n < slices.size() ; n++) {
+                ConversionRange unitRange = range_;
+                unitRange.slices.clear();
+                unitRange.slices.insert(slices[n]);
+                pool.submit([this, state, n, unitRange]() { convertUnit(state, n, unitRange); });
+            }
+            return;
+        }
+
+        // The sinks take the HDF5 lock for each write, and the converter for each archive read
+        state->converter->convertAcquisitions(range_, *state->sink);
+    } catch (const std::exception& e) {
+        state->error = e.what();
+    }
+
+    finishFile(state);
+}
+
+/**
+ * Converts one slice of a P-file, then writes the converted slices that are next in order
+ */
+void BatchConversion::convertUnit(const std::shared_ptr<FileState>& state, size_t unit, const ConversionRange& range)
+{
+    std::vector<ISMRMRD::Acquisition> acqs;
+    std::string error;
+    try {
+        acqs = state->converter->getAcquisitions(range);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (!error.empty() && state->error.empty()) {
+        state->error = error;
+    }
+    state->units[unit].swap(acqs);
+    state->unitDone[unit] = true;
+    state->unitsLeft--;
+
+    // The thread already writing picks this unit up when its turn comes
+    if (state->writing) {
+        return;
+    }
+
+    state->writing = true;
+    while (state->nextUnit < state->units.size() && state->unitDone[state->nextUnit]) {
+        std::vector<ISMRMRD::Acquisition> ready;
+        ready.swap(state->units[state->nextUnit]);
+        state->nextUnit++;
+        bool const failed = !state->error.empty();
+        lock.unlock();
+
+        error.clear();
+        if (!failed) {
+            try {
+                Hdf5Lock hdf5Lock;
+                for (size_t n = 0 ; n < ready.size() ; n++) {
+                    state->sink->consume(ready[n]);
+                }
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+        }
+
+        lock.lock();
+        if (!error.empty() && state->error.empty()) {
+            state->error = error;
+        }
+    }
+    state->writing = false;
+
+    bool const last = (state->unitsLeft == 0 && state->nextUnit == state->units.size());
+    lock.unlock();
+
+    if (last) {
+        finishFile(state);
+    }
+}
+
+/**
+ * Closes the output of a file and reports it
+ */
+void BatchConversion::finishFile(const std::shared_ptr<FileState>& state)
+{
+    BatchFileResult result;
+    result.rawFile = state->job.rawFile;
+    result.outputFile = state->job.outputFile;
+    result.units = state->units.empty() ? 1 : state->units.size();
+    result.rawBytes = fileSize(state->job.rawFile);
+
+    // The converter may hold the whole raw file in memory; it closes a ScanArchive under the HDF5 lock
+    state->converter.reset();
+
+    {
+        Hdf5Lock lock;
+        try {
+            if (state->batchedSink) {
+                state->batchedSink->flush();
+                result.acquisitions = state->batchedSink->count();
+                result.sampleBytes = state->batchedSink->bytesWritten();
+            } else if (state->datasetSink) {
+                result.acquisitions = state->datasetSink->count();
+                result.sampleBytes = state->datasetSink->bytesWritten();
+            }
+        } catch (const std::exception& e) {
+            if (state->error.empty()) {
+                state->error = e.what();
+            }
+        }
+
+        // Closes the output file
+        state->sink = NULL;
+        state->batchedSink.reset();
+        state->datasetSink.reset();
+        state->dataset.reset();
+    }
+
+    result.error = state->error;
+    result.waitSeconds = std::chrono::duration<double>(state->start - state->queued).count();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state->start).count();
+
+    std::lock_guard<std::mutex> lock(resultsMutex_);
+    totals_.files++;
+    if (!result.error.empty()) {
+        totals_.failed++;
+    }
+    totals_.acquisitions += result.acquisitions;
+    totals_.rawBytes += result.rawBytes;
+    totals_.sampleBytes += result.sampleBytes;
+
+    inFlight_--;
+    if (report_) {
+        report_(result);
+    }
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,151 @@
+/** @file BatchConversion.h */
+#ifndef BATCH_CONVERSION_H
+#define BATCH_CONVERSION_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Local
+#include "ConversionRange.h"
+#include "SampleFormat.h"
+#include "GERawConverter.h"
+#include "WorkStealingPool.h"
+
+namespace GEToIsmrmrd {
+
+/** One raw file of a batch and the HDF5 file it is converted to */
+struct BatchJob
+{
+    std::string rawFile;
+    std::string outputFile;
+};
+
+/** Outcome of the conversion of one file of a batch */
+struct BatchFileResult
+{
+    BatchFileResult() : acquisitions(0), rawBytes(0), sampleBytes(0), units(0), waitSeconds(0), seconds(0) { }
+
+    std::string rawFile;
+    std::string outputFile;
+    std::string error;          ///< empty if the file was converted
+    size_t acquisitions;
+    size_t rawBytes;            ///< size of the raw file
+    size_t sampleBytes;         ///< sample and trajectory bytes written
+    size_t units;               ///< pool tasks the conversion was split into
+    double waitSeconds;         ///< queued before a thread took the file up
+    double seconds;             ///< from opening the raw file to closing the output
+};
+
+/** Totals of a batch */
+struct BatchSummary
+{
+    BatchSummary() : files(0), failed(0), acquisitions(0), rawBytes(0), sampleBytes(0), seconds(0) { }
+
+    size_t files;
+    size_t failed;
+    size_t acquisitions;
+    unsigned long long rawBytes;
+    unsigned long long sampleBytes;
+    double seconds;
+    WorkStealingPool::Statistics pool;
+};
+
+/**
+ * Converts many raw files to HDF5 in one process, on a shared WorkStealingPool.
+ *
+ * Each file is a pool task. A P-file whose converter supportsConcurrentRanges()
+ * is split further into one task per selected slice; converted slices are
+ * written in slice order, so the output is the same as that of a single
+ * conversion. ScanArchives are converted by one task each, as their control
+ * packets can only be read in sequence.
+ *
+ * The HDF5 library is not built thread-safe, so every HDF5 call of a batch,
+ * from opening and reading ScanArchives to writing the outputs, is made with
+ * the process-wide Hdf5Lock held. Conversions overlap freely between those
+ * calls; P-files are not HDF5 files and are read without the lock.
+ */
+class BatchConversion
+{
+public:
+    /** Creates and configures the converter of a raw file */
+    typedef std::function<std::shared_ptr<GERawConverter>(const std::string& rawFile)> Opener;
+
+    /** Called as each file finishes, one file at a time */
+    typedef std::function<void(const BatchFileResult& result)> Reporter;
+
+    /**
+     * @param open Creates the converter of each file
+     * @param range Part of each scan to convert
+     * @param batchSize Acquisitions written per HDF5 write, as for BatchedDatasetSink (0 = one append per acquisition)
+     * @param chunkBytes Approximate sample bytes per HDF5 chunk in batched mode
+     * @param format How samples are stored; integer formats are written in batches of at least one
+     */
+    BatchConversion(const Opener& open, const ConversionRange& range, size_t batchSize, size_t chunkBytes,
+                    SampleFormat format = SAMPLE_FORMAT_FLOAT);
+
+    /**
+     * Reads a manifest: one raw file per line, optionally followed by its output
+     * file. Blank lines and lines starting with # are skipped.
+     *
+     * @throws std::runtime_error if the manifest cannot be read
+     */
+    static std::vector<BatchJob> readManifest(const std::string& path);
+
+    /**
+     * Names the outputs of jobs that have none after their raw file:
+     * <outputDir>/<stem>.h5, with _2, _3, ... appended to repeated stems. No
+     * name is given twice, nor one already given in the manifest.
+     */
+    static void nameOutputs(std::vector<BatchJob>& jobs, const std::string& outputDir);
+
+    /** Name of a raw file without its directory and extension */
+    static std::string outputStem(const std::string& rawFile);
+
+    /**
+     * Converts every job on the pool and waits for them
+     *
+     * A file that fails is reported and counted, and does not stop the others.
+     */
+    BatchSummary run(const std::vector<BatchJob>& jobs, WorkStealingPool& pool, const Reporter& report);
+
+    /**
+     * Queues one file on the pool without waiting for it, e.g. for files that
+     * arrive over time; it is reported to the reporter set last
+     */
+    void submit(const BatchJob& job, WorkStealingPool& pool);
+
+    void setReporter(const Reporter& report);
+
+    /** Files submitted and not finished yet */
+    size_t inFlight() const { return inFlight_; }
+
+    /** Totals of the files finished since the last run() */
+    BatchSummary totals() const;
+
+private:
+    struct FileState;
+
+    void convertFile(const std::shared_ptr<FileState>& state, WorkStealingPool& pool);
+    void convertUnit(const std::shared_ptr<FileState>& state, size_t unit, const ConversionRange& range);
+    void finishFile(const std::shared_ptr<FileState>& state);
+
+    Opener open_;
+    ConversionRange range_;
+    size_t batchSize_;
+    size_t chunkBytes_;
+    SampleFormat format_;
+
+    std::atomic<size_t> inFlight_;
+
+    mutable std::mutex resultsMutex_;   // guards totals_ and report_
+    BatchSummary totals_;
+    Reporter report_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* BATCH_CONVERSION_H */
@@ -0,0 +1,290 @@
+/** @file BatchedDatasetSink.cpp */
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "BatchedDatasetSink.h"
+#include "Hdf5Lock.h"
+
+namespace GEToIsmrmrd {
+
+constexpr const char* BatchedDatasetSink::SAMPLE_FORMAT_ATTRIBUTE;
+constexpr const char* BatchedDatasetSink::SAMPLE_SCALE_ATTRIBUTE;
+
+/** Throws if an HDF5 call returned an error code */
+static hid_t checked(hid_t status, const char* what)
+{
+    if (status < 0) {
+        throw std::runtime_error(std::string("BatchedDatasetSink: failed to ") + what);
+    }
+    return status;
+}
+
+static void writeAttribute(hid_t object, const char* name, hid_t type, const void* value)
+{
+    hid_t const space = checked(H5Screate(H5S_SCALAR), "create attribute dataspace");
+    hid_t const attribute = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t const status = (attribute >= 0) ? H5Awrite(attribute, type, value) : -1;
+    if (attribute >= 0) {
+        H5Aclose(attribute);
+    }
+    H5Sclose(space);
+    checked(status, "write attribute");
+}
+
+static void insertArray(hid_t compound, const char* name, size_t offset, hid_t base, hsize_t length)
+{
+    hid_t const array = checked(H5Tarray_create2(base, 1, &length), "create array type");
+    H5Tinsert(compound, name, offset, array);
+    H5Tclose(array);
+}
+
+BatchedDatasetSink::BatchedDatasetSink(const std::string& filename, const std::string& groupname,
+                                       size_t batchSize, size_t chunkBytes, SampleFormat format)
+    : path_("/" + groupname + "/data")
+    , batchSize_(std::max(batchSize, static_cast<size_t>(1)))
+    , chunkBytes_(chunkBytes)
+    , chunkRecords_(0)
+    , format_(format)
+    , file_(-1)
+    , dataset_(-1)
+    , recordType_(-1)
+    , batch_(batchSize_)
+    , records_(batchSize_)
+    , packed_(format == SAMPLE_FORMAT_FLOAT ? 0 : batchSize_)
+    , buffered_(0)
+    , written_(0)
+    , bytes_(0)
+{
+    if (format_ == SAMPLE_FORMAT_NATIVE) {
+        throw std::runtime_error("BatchedDatasetSink: the native sample format must be resolved for a scan");
+    }
+
+    Hdf5Lock lock;
+    file_ = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    if (file_ < 0) {
+        throw std::runtime_error("BatchedDatasetSink: failed to open " + filename);
+    }
+
+    try {
+        recordType_ = createRecordType(format_);
+
+        if (H5Lexists(file_, groupname.c_str(), H5P_DEFAULT) <= 0) {
+            H5Gclose(checked(H5Gcreate2(file_, groupname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT),
+                             "create group"));
+        }
+
+        // Append to the acquisitions already in the group, if any
+        if (H5Lexists(file_, path_.c_str(), H5P_DEFAULT) > 0) {
+            dataset_ = checked(H5Dopen2(file_, path_.c_str(), H5P_DEFAULT), "open dataset");
+
+            hid_t const space = checked(H5Dget_space(dataset_), "get dataspace");
+            hsize_t dims = 0;
+            H5Sget_simple_extent_dims(space, &dims, NULL);
+            H5Sclose(space);
+            written_ = dims;
+        }
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+BatchedDatasetSink::~BatchedDatasetSink()
+{
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    close();
+}
+
+void BatchedDatasetSink::consume(const ISMRMRD::Acquisition& acq)
+{
+    batch_[buffered_++] = acq;
+
+    if (buffered_ == batchSize_) {
+        flush();
+    }
+}
+
+void BatchedDatasetSink::flush()
+{
+    if (buffered_ == 0) {
+        return;
+    }
+
+    Hdf5Lock lock;
+    if (dataset_ < 0) {
+        openDataset(batch_[0]);
+    }
+
+    for (size_t n = 0 ; n < buffered_ ; n++) {
+        ISMRMRD::Acquisition& acq = batch_[n];
+        Record& record = records_[n];
+
+        record.head = acq.getHead();
+        record.traj.len = acq.getNumberOfTrajElements();
+        record.traj.p = acq.getTrajPtr();
+        // Samples are stored as interleaved real and imaginary parts
+        record.data.len = 2 * acq.getNumberOfDataElements();
+        if (format_ == SAMPLE_FORMAT_FLOAT) {
+            record.data.p = acq.getDataPtr();
+        } else {
+            packed_[n].resize(record.data.len * sampleComponentBytes(format_));
+            packSamples(acq, format_, packed_[n].data());
+            record.data.p = packed_[n].data();
+        }
+
+        bytes_ += acq.getTrajSize() + record.data.len * sampleComponentBytes(format_);
+    }
+
+    // Extend the dataset once and write the whole batch as a single hyperslab
+    hsize_t const offset = written_;
+    hsize_t const count = buffered_;
+    hsize_t const size = written_ + buffered_;
+
+    checked(H5Dset_extent(dataset_, &size), "extend dataset");
+
+    hid_t const fileSpace = checked(H5Dget_space(dataset_), "get dataspace");
+    hid_t const memSpace = H5Screate_simple(1, &count, NULL);
+
+    herr_t status = H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, &offset, NULL, &count, NULL);
+    if (status >= 0) {
+        status = H5Dwrite(dataset_, recordType_, memSpace, fileSpace, H5P_DEFAULT, &records_[0]);
+    }
+
+    H5Sclose(memSpace);
+    H5Sclose(fileSpace);
+    checked(status, "write acquisitions");
+
+    written_ += buffered_;
+    buffered_ = 0;
+}
+
+void BatchedDatasetSink::openDataset(const ISMRMRD::Acquisition& first)
+{
+    // Chunks hold whole readouts of the first acquisition's samples x channels
+    size_t const sampleBytes = 2 * first.getNumberOfDataElements() * sampleComponentBytes(format_);
+    size_t const readoutBytes = std::max(sampleBytes + first.getTrajSize(), static_cast<size_t>(1));
+    chunkRecords_ = std::max(chunkBytes_ / readoutBytes, static_cast<size_t>(1));
+
+    hsize_t const initial = 0;
+    hsize_t const unlimited = H5S_UNLIMITED;
+    hsize_t const chunk = chunkRecords_;
+
+    hid_t const space = checked(H5Screate_simple(1, &initial, &unlimited), "create dataspace");
+    hid_t const properties = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(properties, 1, &chunk);
+
+    dataset_ = H5Dcreate2(file_, path_.c_str(), recordType_, space, H5P_DEFAULT, properties, H5P_DEFAULT);
+
+    H5Pclose(properties);
+    H5Sclose(space);
+    checked(dataset_, "create dataset");
+
+    // Integer samples are described, so that readers of the raw parts can scale them
+    if (format_ != SAMPLE_FORMAT_FLOAT) {
+        const char* const name = sampleFormatName(format_);
+        hid_t const stringType = checked(H5Tcopy(H5T_C_S1), "copy string type");
+        H5Tset_size(stringType, strlen(name) + 1);
+        try {
+            writeAttribute(dataset_, SAMPLE_FORMAT_ATTRIBUTE, stringType, name);
+        } catch (...) {
+            H5Tclose(stringType);
+            throw;
+        }
+        H5Tclose(stringType);
+
+        double const scale = SAMPLE_SCALE;
+        writeAttribute(dataset_, SAMPLE_SCALE_ATTRIBUTE, H5T_NATIVE_DOUBLE, &scale);
+    }
+}
+
+void BatchedDatasetSink::close()
+{
+    Hdf5Lock lock;
+    if (dataset_ >= 0) {
+        H5Dclose(dataset_);
+        dataset_ = -1;
+    }
+    if (recordType_ >= 0) {
+        H5Tclose(recordType_);
+        recordType_ = -1;
+    }
+    if (file_ >= 0) {
+        H5Fclose(file_);
+        file_ = -1;
+    }
+}
+
+/**
+ * Builds the HDF5 type of an acquisition record.
+ *
+ * Member names and classes follow the ISMRMRD library's own acquisition type,
+ * as HDF5 matches compound members by name when reading. Integer samples are
+ * converted to the floats of the ISMRMRD type by HDF5 on reading.
+ */
+hid_t BatchedDatasetSink::createRecordType(SampleFormat format)
+{
+    typedef ISMRMRD::ISMRMRD_EncodingCounters Counters;
+    typedef ISMRMRD::ISMRMRD_AcquisitionHeader Header;
+
+    hid_t const idx = H5Tcreate(H5T_COMPOUND, sizeof(Counters));
+    H5Tinsert(idx, "kspace_encode_step_1", HOFFSET(Counters, kspace_encode_step_1), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "kspace_encode_step_2", HOFFSET(Counters, kspace_encode_step_2), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "average", HOFFSET(Counters, average), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "slice", HOFFSET(Counters, slice), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "contrast", HOFFSET(Counters, contrast), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "phase", HOFFSET(Counters, phase), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "repetition", HOFFSET(Counters, repetition), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "set", HOFFSET(Counters, set), H5T_NATIVE_UINT16);
+    H5Tinsert(idx, "segment", HOFFSET(Counters, segment), H5T_NATIVE_UINT16);
+    insertArray(idx, "user", HOFFSET(Counters, user), H5T_NATIVE_UINT16, ISMRMRD::ISMRMRD_USER_INTS);
+
+    hid_t const head = H5Tcreate(H5T_COMPOUND, sizeof(Header));
+    H5Tinsert(head, "version", HOFFSET(Header, version), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "flags", HOFFSET(Header, flags), H5T_NATIVE_UINT64);
+    H5Tinsert(head, "measurement_uid", HOFFSET(Header, measurement_uid), H5T_NATIVE_UINT32);
+    H5Tinsert(head, "scan_counter", HOFFSET(Header, scan_counter), H5T_NATIVE_UINT32);
+    H5Tinsert(head, "acquisition_time_stamp", HOFFSET(Header, acquisition_time_stamp), H5T_NATIVE_UINT32);
+    insertArray(head, "physiology_time_stamp", HOFFSET(Header, physiology_time_stamp), H5T_NATIVE_UINT32, ISMRMRD::ISMRMRD_PHYS_STAMPS);
+    H5Tinsert(head, "number_of_samples", HOFFSET(Header, number_of_samples), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "available_channels", HOFFSET(Header, available_channels), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "active_channels", HOFFSET(Header, active_channels), H5T_NATIVE_UINT16);
+    insertArray(head, "channel_mask", HOFFSET(Header, channel_mask), H5T_NATIVE_UINT64, ISMRMRD::ISMRMRD_CHANNEL_MASKS);
+    H5Tinsert(head, "discard_pre", HOFFSET(Header, discard_pre), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "discard_post", HOFFSET(Header, discard_post), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "center_sample", HOFFSET(Header, center_sample), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "encoding_space_ref", HOFFSET(Header, encoding_space_ref), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "trajectory_dimensions", HOFFSET(Header, trajectory_dimensions), H5T_NATIVE_UINT16);
+    H5Tinsert(head, "sample_time_us", HOFFSET(Header, sample_time_us), H5T_NATIVE_FLOAT);
+    insertArray(head, "position", HOFFSET(Header, position), H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_POSITION_LENGTH);
+    insertArray(head, "read_dir", HOFFSET(Header, read_dir), H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_DIRECTION_LENGTH);
+    insertArray(head, "phase_dir", HOFFSET(Header, phase_dir), H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_DIRECTION_LENGTH);
+    insertArray(head, "slice_dir", HOFFSET(Header, slice_dir), H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_DIRECTION_LENGTH);
+    insertArray(head, "patient_table_position", HOFFSET(Header, patient_table_position), H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_POSITION_LENGTH);
+    H5Tinsert(head, "idx", HOFFSET(Header, idx), idx);
+    insertArray(head, "user_int", HOFFSET(Header, user_int), H5T_NATIVE_INT32, ISMRMRD::ISMRMRD_USER_INTS);
+    insertArray(head, "user_float", HOFFSET(Header, user_float), H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_USER_FLOATS);
+
+    hid_t const floats = H5Tvlen_create(H5T_NATIVE_FLOAT);
+    hid_t const samples = H5Tvlen_create(format == SAMPLE_FORMAT_INT16 ? H5T_NATIVE_INT16 :
+                                         format == SAMPLE_FORMAT_INT32 ? H5T_NATIVE_INT32 : H5T_NATIVE_FLOAT);
+
+    hid_t const record = H5Tcreate(H5T_COMPOUND, sizeof(Record));
+    H5Tinsert(record, "head", HOFFSET(Record, head), head);
+    H5Tinsert(record, "traj", HOFFSET(Record, traj), floats);
+    H5Tinsert(record, "data", HOFFSET(Record, data), samples);
+
+    H5Tclose(samples);
+    H5Tclose(floats);
+    H5Tclose(head);
+    H5Tclose(idx);
+
+    return record;
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,112 @@
+/** @file BatchedDatasetSink.h */
+#ifndef BATCHED_DATASET_SINK_H
+#define BATCHED_DATASET_SINK_H
+
+#include <string>
+#include <vector>
+
+// HDF5
+#include <hdf5.h>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+#include "SampleFormat.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Appends acquisitions to the "data" dataset of an ISMRMRD HDF5 group in batches.
+ *
+ * ISMRMRD::Dataset::appendAcquisition() extends the dataset and writes a single
+ * record per call. This sink buffers up to batchSize acquisitions and writes them
+ * with one extend and one hyperslab write. Records use the same compound type as
+ * the ISMRMRD library (member names and classes), so the file reads back with
+ * ISMRMRD::Dataset as usual.
+ *
+ * With SAMPLE_FORMAT_INT16 or SAMPLE_FORMAT_INT32 the samples are stored as
+ * integers, which HDF5 converts back to the ISMRMRD floats when the file is
+ * read, so readers see exactly the samples they would in a float file. The
+ * "data" dataset then has a sample_format attribute naming the format and a
+ * sample_scale attribute, the factor from a stored part to the float sample.
+ *
+ * The dataset is created on the first flush. Its chunks hold a whole number of
+ * readouts, sized from the samples and channels of the first acquisition so that
+ * one chunk describes about chunkBytes of sample data.
+ *
+ * The file must not be open through ISMRMRD::Dataset while this sink writes to it.
+ */
+class BatchedDatasetSink : public AcquisitionSink
+{
+public:
+    /**
+     * @param filename HDF5 file, which must already exist (e.g. holding the XML header)
+     * @param groupname ISMRMRD group in the file, e.g. "dataset"
+     * @param batchSize Acquisitions buffered per write
+     * @param chunkBytes Approximate sample bytes per HDF5 chunk
+     * @param format How samples are stored; resolved, i.e. not SAMPLE_FORMAT_NATIVE
+     */
+    BatchedDatasetSink(const std::string& filename, const std::string& groupname,
+                       size_t batchSize, size_t chunkBytes, SampleFormat format = SAMPLE_FORMAT_FLOAT);
+
+    /** Writes any buffered acquisitions and closes the file */
+    ~BatchedDatasetSink();
+
+    void consume(const ISMRMRD::Acquisition& acq);
+
+    /** Writes the buffered acquisitions */
+    void flush();
+
+    /** Number of acquisitions written or buffered so far */
+    size_t count() const { return written_ + buffered_; }
+
+    /** Bytes of sample and trajectory data written so far, as stored */
+    size_t bytesWritten() const { return bytes_; }
+
+    /** Acquisitions per HDF5 chunk; 0 until the first flush */
+    size_t chunkRecords() const { return chunkRecords_; }
+
+    /** Attributes of the dataset describing integer samples */
+    static constexpr const char* SAMPLE_FORMAT_ATTRIBUTE = "sample_format";
+    static constexpr const char* SAMPLE_SCALE_ATTRIBUTE = "sample_scale";
+
+private:
+    // Non-copyable
+    BatchedDatasetSink(const BatchedDatasetSink& other);
+    BatchedDatasetSink& operator=(const BatchedDatasetSink& other);
+
+    /** In-memory layout of one record, matching the ISMRMRD library */
+    struct Record
+    {
+        ISMRMRD::ISMRMRD_AcquisitionHeader head;
+        hvl_t traj;
+        hvl_t data;
+    };
+
+    static hid_t createRecordType(SampleFormat format);
+    void openDataset(const ISMRMRD::Acquisition& first);
+    void close();
+
+    std::string path_;
+    size_t batchSize_;
+    size_t chunkBytes_;
+    size_t chunkRecords_;
+    SampleFormat format_;
+
+    hid_t file_;
+    hid_t dataset_;
+    hid_t recordType_;
+
+    std::vector<ISMRMRD::Acquisition> batch_;
+    std::vector<Record> records_;
+    std::vector<std::vector<char> > packed_;    // integer samples of each record, unless stored as floats
+    size_t buffered_;
+    size_t written_;
+    size_t bytes_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* BATCHED_DATASET_SINK_H */
@@ -0,0 +1,69 @@
+/** @file ChecksumSink.h */
+#ifndef CHECKSUM_SINK_H
+#define CHECKSUM_SINK_H
+
+#include <cstdint>
+#include <string>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Reduces the acquisitions of a conversion to a checksum, without keeping them.
+ *
+ * Acquisition and physiology time stamps are left out, as converters stamp
+ * acquisitions with the time of conversion. Two conversions of the same file
+ * with the same settings therefore give the same checksum.
+ */
+class ChecksumSink : public AcquisitionSink
+{
+public:
+    ChecksumSink() : hash_(FNV_OFFSET), count_(0) { }
+
+    void consume(const ISMRMRD::Acquisition& acq)
+    {
+        ISMRMRD::AcquisitionHeader head = acq.getHead();
+        head.acquisition_time_stamp = 0;
+        for (int p = 0 ; p < ISMRMRD::ISMRMRD_PHYS_STAMPS ; p++) {
+            head.physiology_time_stamp[p] = 0;
+        }
+
+        add(&head, sizeof(head));
+        add(acq.getTrajPtr(), acq.getTrajSize());
+        add(acq.getDataPtr(), acq.getDataSize());
+        count_++;
+    }
+
+    /** Adds other output of the conversion, such as the ISMRMRD header */
+    void add(const std::string& text) { add(text.data(), text.size()); }
+
+    /** FNV-1a hash of everything consumed so far */
+    uint64_t checksum() const { return hash_; }
+
+    /** Number of acquisitions consumed so far */
+    size_t count() const { return count_; }
+
+private:
+    static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+    static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    void add(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t n = 0 ; n < size ; n++) {
+            hash_ = (hash_ ^ bytes[n]) * FNV_PRIME;
+        }
+    }
+
+    uint64_t hash_;
+    size_t count_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* CHECKSUM_SINK_H */
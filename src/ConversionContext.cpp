@@ -0,0 +1,58 @@
+/** @file ConversionContext.cpp */
+#include <algorithm>
+
+#include "ConversionContext.h"
+
+namespace GEToIsmrmrd {
+
+ScanParameters::ScanParameters(const GERecon::Control::ProcessingControlPointer& processingControl)
+    : acquiredXRes    (processingControl->Value<int>("AcquiredXRes")),
+      acquiredYRes    (processingControl->Value<int>("AcquiredYRes")),
+      numEchoes       (processingControl->Value<int>("NumEchoes")),
+      numChannels     (processingControl->Value<int>("NumChannels")),
+      numSlices       (processingControl->Value<int>("NumSlices")),
+      chopY           (processingControl->Value<bool>("ChopY")),
+      dataSampleSize  (processingControl->Value<int>("DataSampleSize")),
+      patientEntry    (processingControl->Value<int>("PatientEntry")),
+      patientPosition (processingControl->Value<int>("PatientPosition")),
+      sliceTable      (processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable")),
+      sliceGeometry   (sliceTable, numSlices, patientEntry, patientPosition)
+{
+}
+
+EpiParameters::EpiParameters(const GERecon::Control::ProcessingControlPointer& epiProcessingControl)
+    : processingControl       (epiProcessingControl),
+      scan                    (epiProcessingControl),
+      extraFramesTop          (epiProcessingControl->Value<int>("ExtraFramesTop")),
+      extraFramesBottom       (epiProcessingControl->Value<int>("ExtraFramesBottom")),
+      integratedReferenceScan (epiProcessingControl->Value<bool>("IntegratedReferenceScan")),
+      multibandEnabled        (epiProcessingControl->Value<bool>("MultibandEnabled")),
+      packetsPerVolume        (std::max(scan.numSlices, 1u) * std::max(scan.numEchoes, 1u))
+{
+}
+
+static std::shared_ptr<const EpiParameters> createEpiParameters(GERecon::Legacy::LxDownloadDataPointer lxData)
+{
+    if (!lxData->IsEpi()) {
+        return std::shared_ptr<const EpiParameters>();
+    }
+
+    // Create EPI processing control object, so all relevant variables within that object are
+    // available and accessible.
+    boost::shared_ptr<GERecon::Epi::LxControlSource> const controlSource = boost::make_shared<GERecon::Epi::LxControlSource>(lxData);
+
+    return std::shared_ptr<const EpiParameters>(new EpiParameters(controlSource->CreateOrchestraProcessingControl()));
+}
+
+ConversionContext::ConversionContext(const std::string& rawFilePath,
+                                     GERecon::Legacy::LxDownloadDataPointer lxData,
+                                     GERecon::Control::ProcessingControlPointer processingControl)
+    : rawFilePath       (rawFilePath),
+      lxData            (lxData),
+      processingControl (processingControl),
+      scan              (processingControl),
+      epi               (createEpiParameters(lxData))
+{
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,83 @@
+/** @file ConversionContext.h */
+#ifndef CONVERSION_CONTEXT_H
+#define CONVERSION_CONTEXT_H
+
+#include <memory>
+#include <string>
+
+#include "PacketIndex.h"
+#include "SequenceConverter.h"
+#include "SliceGeometry.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Typed snapshot of the ProcessingControl values used while converting acquisitions
+ */
+struct ScanParameters
+{
+    ScanParameters(const GERecon::Control::ProcessingControlPointer& processingControl);
+
+    const unsigned int            acquiredXRes;      /**< Samples per readout */
+    const unsigned int            acquiredYRes;      /**< Phase encoding lines per slice */
+    const unsigned int            numEchoes;         /**< Echoes per slice */
+    const unsigned int            numChannels;       /**< Receive channels */
+    const unsigned int            numSlices;         /**< Slices per volume */
+    const bool                    chopY;             /**< RF chopping already removed along Y */
+    const unsigned int            dataSampleSize;    /**< Bytes per digitized real or imaginary sample, 2 or 4 */
+    const int                     patientEntry;      /**< Orchestra PatientEntry value */
+    const int                     patientPosition;   /**< Orchestra PatientPosition value */
+    const GERecon::SliceInfoTable sliceTable;        /**< Acquired / geometric slice mapping and corners */
+    const SliceGeometryTable      sliceGeometry;     /**< Patient-space vectors of each geometric slice */
+};
+
+/**
+ * Values only available from the EPI flavor of the Orchestra control source
+ */
+struct EpiParameters
+{
+    EpiParameters(const GERecon::Control::ProcessingControlPointer& epiProcessingControl);
+
+    const GERecon::Control::ProcessingControlPointer processingControl;  /**< EPI processing control */
+    const ScanParameters          scan;                    /**< Scan values as seen by the EPI control source */
+    const int                     extraFramesTop;          /**< Reference views before the image views */
+    const int                     extraFramesBottom;       /**< Reference views after the image views */
+    const bool                    integratedReferenceScan; /**< Reference scan is part of the image packets */
+    const bool                    multibandEnabled;        /**< Multiband (SMS) acquisition */
+    const unsigned int            packetsPerVolume;        /**< Hyperframe packets of one volume: one per slice and echo */
+};
+
+/**
+ * Per-file state shared by GERawConverter and the SequenceConverter plugins.
+ *
+ * Built once when the raw file is opened, so that converters neither look up
+ * ProcessingControl values by name for every acquisition nor re-create the
+ * Orchestra download data and control objects. Every member is immutable except
+ * the packet index of a ScanArchive, which only GERawConverter sets: when it is
+ * loaded from a sidecar or built for the header, and dropped by followAcquisitions()
+ * once the archive has grown past it. Converters get the context as const and must handle a
+ * NULL index by describing the packets as they read them.
+ */
+class ConversionContext
+{
+public:
+    ConversionContext(const std::string& rawFilePath,
+                      GERecon::Legacy::LxDownloadDataPointer lxData,
+                      GERecon::Control::ProcessingControlPointer processingControl);
+
+    const std::string                                rawFilePath;        /**< Raw file the values were read from */
+    const GERecon::Legacy::LxDownloadDataPointer     lxData;             /**< Download data of the raw file */
+    const GERecon::Control::ProcessingControlPointer processingControl;  /**< Legacy / P-file processing control */
+    const ScanParameters                             scan;               /**< Values from processingControl */
+    const std::shared_ptr<const EpiParameters>       epi;                /**< EPI values, NULL unless lxData is EPI */
+    std::shared_ptr<const PacketIndex>               packets;            /**< ScanArchive packet index, NULL unless built or loaded; set by GERawConverter only */
+
+private:
+    // Non-copyable
+    ConversionContext(const ConversionContext& other);
+    ConversionContext& operator=(const ConversionContext& other);
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* CONVERSION_CONTEXT_H */
@@ -0,0 +1,54 @@
+/** @file ConversionOptions.h */
+#ifndef CONVERSION_OPTIONS_H
+#define CONVERSION_OPTIONS_H
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace GEToIsmrmrd {
+
+/**
+ * How the ISMRMRD XML header is produced from the raw file header
+ */
+enum HeaderPath
+{
+    HEADER_PATH_AUTO = 0,       /**< Native builder for the built-in stylesheets, XSLT otherwise */
+    HEADER_PATH_NATIVE,         /**< Native builder only; fails for custom stylesheets */
+    HEADER_PATH_XSLT            /**< Always apply the stylesheet */
+};
+
+/**
+ * Caller-selected settings that control how, rather than what, a converter converts
+ */
+struct ConversionOptions
+{
+    ConversionOptions() : numThreads(1), pfileReaders(2), headerPath(HEADER_PATH_AUTO), packetIndexSidecar(false),
+                          readoutOversampling(1), headerVolumes(0) { }
+
+    unsigned int numThreads;    /**< Worker threads; 1 converts serially, 0 uses one per core */
+    unsigned int pfileReaders;  /**< P-file objects read at once; each beyond the first loads the P-file again */
+    HeaderPath headerPath;      /**< How GERawConverter builds the ISMRMRD XML header */
+    bool packetIndexSidecar;    /**< Reuse or save the ScanArchive packet index in a file next to the archive */
+    unsigned int readoutOversampling; /**< Readout oversampling removed from acquisitions and header; 1 keeps every sample */
+    unsigned int headerVolumes; /**< EPI volumes the header reports, e.g. of an archive still being written; 0 counts the packets */
+};
+
+/**
+ * Number of threads to actually use for a requested thread count
+ *
+ * @param requested Thread count from ConversionOptions (0 = one per core)
+ * @returns at least 1; always 1 when built without OpenMP
+ */
+inline int resolveThreadCount(unsigned int requested)
+{
+#ifdef _OPENMP
+    return (requested == 0) ? omp_get_num_procs() : (int) requested;
+#else
+    return 1;
+#endif
+}
+
+} // namespace GEToIsmrmrd
+
+#endif /* CONVERSION_OPTIONS_H */
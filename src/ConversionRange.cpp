@@ -0,0 +1,163 @@
+/** @file ConversionRange.cpp */
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <libxml/tree.h>
+
+#include "ConversionRange.h"
+#include "HeaderEditor.h"
+
+namespace GEToIsmrmrd {
+
+// Far more indices than any dimension of a scan has
+static const unsigned int MAX_RANGE_SPAN = 65536;
+
+/**
+ * Parses one index of a list
+ */
+static unsigned int parseIndex(const std::string& text, const std::string& list)
+{
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::invalid_argument("Invalid index '" + text + "' in '" + list + "'");
+    }
+
+    errno = 0;
+    unsigned long const value = std::strtoul(text.c_str(), NULL, 10);
+    if (errno == ERANGE || value > 0xffffffffUL) {
+        throw std::invalid_argument("Index '" + text + "' out of range in '" + list + "'");
+    }
+    return (unsigned int) value;
+}
+
+std::set<unsigned int> ConversionRange::parseList(const std::string& list)
+{
+    std::set<unsigned int> indices;
+
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string const item = list.substr(start, end - start);
+
+        size_t const dash = item.find('-');
+        if (dash == std::string::npos) {
+            indices.insert(parseIndex(item, list));
+        } else {
+            unsigned int const first = parseIndex(item.substr(0, dash), list);
+            unsigned int const last = parseIndex(item.substr(dash + 1), list);
+            if (last < first) {
+                throw std::invalid_argument("Empty range '" + item + "' in '" + list + "'");
+            }
+            if (last - first >= MAX_RANGE_SPAN) {
+                throw std::invalid_argument("Range '" + item + "' is too long in '" + list + "'");
+            }
+            for (unsigned int n = first ; ; n++) {
+                indices.insert(n);
+                if (n == last) {
+                    break;
+                }
+            }
+        }
+
+        start = end + 1;
+    }
+
+    return indices;
+}
+
+std::vector<unsigned int> ConversionRange::selected(const std::set<unsigned int>& set, unsigned int count)
+{
+    std::vector<unsigned int> indices;
+
+    if (set.empty()) {
+        indices.reserve(count);
+        for (unsigned int n = 0 ; n < count ; n++) {
+            indices.push_back(n);
+        }
+    } else {
+        for (std::set<unsigned int>::const_iterator it = set.begin() ; it != set.end() && *it < count ; ++it) {
+            indices.push_back(*it);
+        }
+    }
+
+    return indices;
+}
+
+/**
+ * Rejects the indices of one dimension that are not below count
+ */
+static void checkIndices(const std::set<unsigned int>& set, unsigned int count, const std::string& what)
+{
+    if (!set.empty() && *set.rbegin() >= count) {
+        throw std::invalid_argument(what + " " + std::to_string(*set.rbegin()) + " is not in the scan, which has " +
+                                    std::to_string(count) + " " + what + (count == 1 ? "" : "s"));
+    }
+}
+
+void ConversionRange::check(unsigned int numSlices, unsigned int numEchoes, unsigned int numChannels,
+                            unsigned int numVolumes) const
+{
+    checkIndices(slices, numSlices, "slice");
+    checkIndices(echoes, numEchoes, "echo");
+    checkIndices(channels, numChannels, "channel");
+    if (numVolumes > 0) {
+        checkIndices(volumes, numVolumes, "volume");
+    }
+}
+
+/**
+ * Narrows the minimum, maximum and center of an encoding limit to the selected indices within it
+ */
+static void narrowLimit(xmlNodePtr limit, const std::set<unsigned int>& set)
+{
+    xmlNodePtr minimum = HeaderEditor::find(limit, "minimum");
+    xmlNodePtr maximum = HeaderEditor::find(limit, "maximum");
+    if (set.empty() || !minimum || !maximum) {
+        return;
+    }
+
+    double const low = HeaderEditor::number(minimum);
+    double const high = HeaderEditor::number(maximum);
+    std::set<unsigned int>::const_iterator first = set.lower_bound(low < 0 ? 0 : static_cast<unsigned int>(low));
+    if (first == set.end() || *first > high) {
+        return;
+    }
+    std::set<unsigned int>::const_iterator last = set.upper_bound(static_cast<unsigned int>(high));
+    --last;
+
+    HeaderEditor::setNumber(minimum, *first);
+    HeaderEditor::setNumber(maximum, *last);
+
+    xmlNodePtr center = HeaderEditor::find(limit, "center");
+    if (center && (HeaderEditor::number(center) < *first || HeaderEditor::number(center) > *last)) {
+        HeaderEditor::setNumber(center, *first);
+    }
+}
+
+std::string ConversionRange::updateHeader(const std::string& xml) const
+{
+    HeaderEditor header(xml);
+
+    std::vector<xmlNodePtr> const systems = header.elements("acquisitionSystemInformation");
+    for (size_t n = 0 ; n < systems.size() && !channels.empty() ; n++) {
+        xmlNodePtr receiverChannels = HeaderEditor::find(systems[n], "receiverChannels");
+        if (receiverChannels) {
+            double const count = HeaderEditor::number(receiverChannels);
+            HeaderEditor::setNumber(receiverChannels, selected(channels, count < 0 ? 0 : static_cast<unsigned int>(count)).size());
+        }
+    }
+
+    std::vector<xmlNodePtr> const encodings = header.elements("encoding");
+    for (size_t n = 0 ; n < encodings.size() ; n++) {
+        narrowLimit(HeaderEditor::find(encodings[n], "encodingLimits/slice"), slices);
+        narrowLimit(HeaderEditor::find(encodings[n], "encodingLimits/contrast"), echoes);
+        narrowLimit(HeaderEditor::find(encodings[n], "encodingLimits/repetition"), volumes);
+    }
+
+    return header.str();
+}
+
+} // namespace GEToIsmrmrd
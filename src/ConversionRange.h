@@ -0,0 +1,82 @@
+/** @file ConversionRange.h */
+#ifndef CONVERSION_RANGE_H
+#define CONVERSION_RANGE_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/**
+ * The part of a scan to convert.
+ *
+ * Each set selects indices of one dimension, counted from 0; an empty set
+ * selects all of them. Slices are geometric slice numbers, echoes become
+ * ISMRMRD contrasts, volumes ISMRMRD repetitions and channels the receiver
+ * channels of each acquisition. A default constructed range converts the
+ * whole scan.
+ *
+ * Acquisitions keep the scan counters they have in a full conversion, so a
+ * partial conversion holds a subset of the acquisitions of the full one.
+ */
+struct ConversionRange
+{
+    std::set<unsigned int> slices;
+    std::set<unsigned int> echoes;
+    std::set<unsigned int> volumes;
+    std::set<unsigned int> channels;
+
+    /** True if nothing is left out */
+    bool everything() const { return slices.empty() && echoes.empty() && volumes.empty() && channels.empty(); }
+
+    bool hasSlice   (unsigned int slice)   const { return selects(slices, slice); }
+    bool hasEcho    (unsigned int echo)    const { return selects(echoes, echo); }
+    bool hasVolume  (unsigned int volume)  const { return selects(volumes, volume); }
+    bool hasChannel (unsigned int channel) const { return selects(channels, channel); }
+
+    /** Selected slices below count, in ascending order */
+    std::vector<unsigned int> selectedSlices   (unsigned int count) const { return selected(slices, count); }
+    std::vector<unsigned int> selectedEchoes   (unsigned int count) const { return selected(echoes, count); }
+    std::vector<unsigned int> selectedChannels (unsigned int count) const { return selected(channels, count); }
+
+    /**
+     * Parses a list of indices and inclusive ranges, e.g. "0-3,7"
+     *
+     * @throws std::invalid_argument if the list is malformed
+     */
+    static std::set<unsigned int> parseList(const std::string& list);
+
+    /**
+     * Rejects indices that are not in a scan
+     *
+     * @param numVolumes Volumes of the scan, or 0 while unknown, in which case volumes are not checked
+     * @throws std::invalid_argument naming the first index that is not in the scan
+     */
+    void check(unsigned int numSlices, unsigned int numEchoes, unsigned int numChannels,
+               unsigned int numVolumes) const;
+
+    /**
+     * Describes the acquisitions of the range in an ISMRMRD header of the whole scan
+     *
+     * Sets receiverChannels to the number of selected channels, and narrows the
+     * slice, contrast and repetition encoding limits to the selected slices,
+     * echoes and volumes. Acquisitions keep their scan counters, so the limits
+     * keep the indices of the full scan.
+     *
+     * @throws std::runtime_error if the header cannot be parsed
+     */
+    std::string updateHeader(const std::string& xml) const;
+
+private:
+    static bool selects(const std::set<unsigned int>& set, unsigned int index)
+    {
+        return set.empty() || set.count(index) > 0;
+    }
+
+    static std::vector<unsigned int> selected(const std::set<unsigned int>& set, unsigned int count);
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* CONVERSION_RANGE_H */
@@ -0,0 +1,45 @@
+/** @file DatasetSink.h */
+#ifndef DATASET_SINK_H
+#define DATASET_SINK_H
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "AcquisitionSink.h"
+#include "Hdf5Lock.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Appends each acquisition to an ISMRMRD HDF5 dataset as soon as it is received.
+ */
+class DatasetSink : public AcquisitionSink
+{
+public:
+    DatasetSink(ISMRMRD::Dataset& dataset) : dataset_(dataset), count_(0), bytes_(0) { }
+
+    void consume(const ISMRMRD::Acquisition& acq)
+    {
+        Hdf5Lock lock;
+        dataset_.appendAcquisition(acq);
+        count_++;
+        bytes_ += acq.getTrajSize() + acq.getDataSize();
+    }
+
+    /** Number of acquisitions written so far */
+    size_t count() const { return count_; }
+
+    /** Bytes of sample and trajectory data written so far */
+    size_t bytesWritten() const { return bytes_; }
+
+private:
+    ISMRMRD::Dataset& dataset_;
+    size_t count_;
+    size_t bytes_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* DATASET_SINK_H */
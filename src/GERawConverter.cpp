@@ -1,7 +1,15 @@
 /** @file GERawConverter.cpp */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 
+#include <sys/stat.h>
+
+#include <libxml/parser.h>
 #include <libxml/xmlschemas.h>
 #include <libxslt/xslt.h>
 #include <libxslt/transform.h>
@@ -9,6 +17,9 @@
 
 // Local
 #include "GERawConverter.h"
+#include "Hdf5Lock.h"
+#include "HeaderFields.h"
+#include "StylesheetCache.h"
 #include "XMLWriter.h"
 #include "ge_tools_path.h"
 
@@ -44,17 +55,152 @@ const std::string g_schema = "\
  * Creates a GERawConverter from an ifstream of the raw data file header
  *
  * @param fp raw FILE pointer to raw data file
- * @throws std::runtime_error if raw data file cannot be read
+ * @throws std::runtime_error if raw data file cannot be read, or the plugin class is unknown
  */
 GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string& classname, bool logging)
-    : log_(logging)
+    : nativeMapping_(NativeHeaderBuilder::NO_NATIVE_MAPPING)
+    , headerOnly_(false)
+    , log_(logging)
 {
-   psdname_ = ""; // TODO: find PSD Name in Orchestra Pfile class
-   log_ << "PSDName: " << psdname_ << std::endl;
+   openRawFile(rawFilePath);
+
+   usePlugin(classname);
+
+   // Testing dumping of raw file header as XML.
+   // processingControl_->SaveAsXml("rawHeader.xml");  // As of Orchestra 1.8-1, this is causing a crash, with
+                                                    // an incomplete file written.
+}
+
+/**
+ * Creates a GERawConverter using a converter class from a plugin library
+ *
+ * @param rawFilePath P-file or ScanArchive path
+ * @param classname Converter class exported by the library
+ * @param libraryPath Plugin library, or empty for a class built into this library
+ * @param logging Enable logging to std::clog
+ * @throws std::runtime_error if the raw data file cannot be read, or the plugin cannot be loaded
+ */
+GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string& classname,
+                               const std::string& libraryPath, bool logging)
+    : nativeMapping_(NativeHeaderBuilder::NO_NATIVE_MAPPING)
+    , headerOnly_(false)
+    , log_(logging)
+{
+   openRawFile(rawFilePath);
+
+   usePlugin(classname, libraryPath);
+}
+
+/**
+ * Creates a GERawConverter without a conversion plugin
+ */
+GERawConverter::GERawConverter(bool logging)
+    : nativeMapping_(NativeHeaderBuilder::NO_NATIVE_MAPPING)
+    , headerOnly_(true)
+    , log_(logging)
+{
+}
+
+/**
+ * Closes the ScanArchive, if any, with the HDF5 lock held
+ */
+GERawConverter::~GERawConverter()
+{
+   Hdf5Lock lock;
+   scanArchive_.reset();
+}
+
+/**
+ * Opens a raw data file for its header only
+ *
+ * Only the download data and processing control are loaded: P-files are opened with
+ * a single acquisition instead of all of them. Orchestra has no header-only mode for
+ * ScanArchives, so they are opened with LoadMode as for a conversion, but the storage
+ * holding the packets is only walked if the header reads the EPI volume count and no
+ * packet index sidecar is saved. The returned converter can build the ISMRMRD header,
+ * but has no plugin and cannot convert acquisitions.
+ *
+ * @param rawFilePath P-file or ScanArchive path
+ * @param logging Enable logging to std::clog
+ * @throws std::runtime_error if the raw data file cannot be read
+ */
+std::shared_ptr<GERawConverter> GERawConverter::openHeaderOnly(const std::string& rawFilePath, bool logging)
+{
+    std::shared_ptr<GERawConverter> converter(new GERawConverter(logging));
+    converter->openRawFile(rawFilePath);
+    return converter;
+}
+
+/**
+ * Reads the ISMRMRD header of a raw data file without loading any raw data
+ *
+ * @param rawFilePath P-file or ScanArchive path
+ * @param stylesheet Stylesheet text mapping the raw file header to ISMRMRD
+ * @param options Conversion settings; only the header path is used
+ * @param logging Enable logging to std::clog
+ * @returns header and the time taken to open the file and build the header
+ * @throws std::runtime_error if the file cannot be read or the header cannot be built
+ */
+ProbeResult GERawConverter::probe(const std::string& rawFilePath, const std::string& stylesheet,
+                                  const ConversionOptions& options, bool logging)
+{
+    ProbeResult result;
+    result.rawFile = rawFilePath;
+
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<GERawConverter> converter = openHeaderOnly(rawFilePath, logging);
+    auto opened = std::chrono::steady_clock::now();
+
+    converter->setOptions(options);
+    converter->useStylesheetString(stylesheet);
+    result.header = converter->getIsmrmrdXMLHeader();
+    auto done = std::chrono::steady_clock::now();
+
+    result.rawType = (converter->getRawObjectType() == SCAN_ARCHIVE_RAW_TYPE) ? "ScanArchive" : "Pfile";
+    result.openMillis = std::chrono::duration<double, std::milli>(opened - start).count();
+    result.headerMillis = std::chrono::duration<double, std::milli>(done - opened).count();
+
+    return result;
+}
+
+/**
+ * Name of the pulse sequence that acquired the raw data, from the image header
+ */
+static std::string pulseSequenceName(const GERecon::Legacy::LxDownloadDataPointer& lxData)
+{
+    const char* name = lxData->ImageHeaderData().psdname;
+    return std::string(name, strnlen(name, sizeof(lxData->ImageHeaderData().psdname)));
+}
+
+/**
+ * Initializes libxml2 and libxslt once per process
+ *
+ * xmlInitParser() is not thread-safe in every libxml2 version, so it is called
+ * before the first converter uses libxml2, from whichever thread that is. The
+ * libraries are never cleaned up, as other converters may still be using them.
+ */
+static void initializeXmlLibraries()
+{
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        xmlInitParser();
+        xsltInit();
+    });
+}
+
+/**
+ * Opens the raw data file and snapshots its header values
+ */
+void GERawConverter::openRawFile(const std::string& rawFilePath)
+{
+   initializeXmlLibraries();
+
+   rawFilePath_ = rawFilePath;
 
    // Use Orchestra to figure out if P-File or ScanArchive
    if (GERecon::ScanArchive::IsArchiveFilePath(rawFilePath))
    {
+      Hdf5Lock lock;
       scanArchive_ = GERecon::ScanArchive::Create(rawFilePath, GESystem::Archive::LoadMode);
       lxData_ = boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(scanArchive_->LoadDownloadData());
 
@@ -65,8 +211,9 @@ GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string
    }
    else
    {
+      // The header is the same whichever acquisitions are loaded
       pfile_ = GERecon::Legacy::Pfile::Create(rawFilePath,
-                                              GERecon::Legacy::Pfile::AllAvailableAcquisitions,
+                                              headerOnly_ ? 1 : GERecon::Legacy::Pfile::AllAvailableAcquisitions,
                                               GERecon::AnonymizationPolicy(GERecon::AnonymizationPolicy::None));
 
       lxData_ = pfile_->DownloadData();
@@ -75,28 +222,75 @@ GERawConverter::GERawConverter(const std::string& rawFilePath, const std::string
       rawObjectType_ = PFILE_RAW_TYPE;
    }
 
-   if (!classname.compare("GenericConverter"))
-   {
-      converter_ = std::shared_ptr<SequenceConverter>(new GenericConverter());
-   }
-   else if (!classname.compare("NIH2dfastConverter"))
-   {
-      converter_ = std::shared_ptr<SequenceConverter>(new NIH2dfastConverter());
-   }
-   else if (!classname.compare("NIHepiConverter"))
-   {
-      converter_ = std::shared_ptr<SequenceConverter>(new NIHepiConverter());
-   }
-   else
-   {
-      std::cerr << "Plugin class name: " << classname << " not implemented. Exiting..." << std::endl;
+   // Selects the sequence mapping of a conversion configuration
+   psdname_ = pulseSequenceName(lxData_);
+   log_ << "PSDName: " << psdname_ << std::endl;
 
-      exit(EXIT_FAILURE);
-   }
+   // Snapshot every value the converters need, so they don't have to look them up per acquisition
+   context_ = std::shared_ptr<ConversionContext>(new ConversionContext(rawFilePath, lxData_, processingControl_));
+}
 
-   // Testing dumping of raw file header as XML.
-   // processingControl_->SaveAsXml("rawHeader.xml");  // As of Orchestra 1.8-1, this is causing a crash, with
-                                                    // an incomplete file written.
+/**
+ * Gets the plugin that converts the acquisitions
+ *
+ * @returns the converter, or NULL if the raw file was opened for its header only
+ */
+std::shared_ptr<SequenceConverter> GERawConverter::getConverter()
+{
+    return converter_;
+}
+
+/**
+ * Selects the plugin that converts the acquisitions
+ *
+ * @param classname Converter class
+ * @param libraryPath Plugin library exporting the class, or empty for a class built into this library
+ * @throws std::runtime_error if the library cannot be loaded or does not export the class
+ */
+void GERawConverter::usePlugin(const std::string& classname, const std::string& libraryPath)
+{
+    log_ << "Using plugin class " << classname;
+    if (!libraryPath.empty()) {
+        log_ << " from " << libraryPath;
+    }
+    log_ << std::endl;
+
+    std::shared_ptr<SequenceConverter> converter = PluginRegistry::instance().create(classname, libraryPath);
+    converter->setOptions(options_);
+    converter->setLogging(log_.enabled);
+
+    converter_ = converter;
+    headerOnly_ = false;
+}
+
+/**
+ * Kind of raw data file that was opened
+ */
+GE_RAW_TYPES GERawConverter::getRawObjectType() const
+{
+    return static_cast<GE_RAW_TYPES>(rawObjectType_);
+}
+
+/**
+ * Selects threading and other settings used by the converter plugin
+ *
+ * Settings the opened raw file cannot be converted with are rejected here,
+ * before any header or output is written.
+ *
+ * @param options Conversion settings
+ * @throws std::invalid_argument if readout oversampling is to be removed from an EPI scan,
+ *         whose ramp sampled readouts cannot just be cropped
+ */
+void GERawConverter::setOptions(const ConversionOptions& options)
+{
+    if (options.readoutOversampling > 1 && context_ && context_->epi) {
+        throw std::invalid_argument("Readout oversampling cannot be removed from EPI scans");
+    }
+
+    options_ = options;
+    if (converter_) {
+        converter_->setOptions(options);
+    }
 }
 
 void GERawConverter::useStylesheetFilename(const std::string& filename)
@@ -118,45 +312,248 @@ void GERawConverter::useStylesheetStream(std::ifstream& stream)
 void GERawConverter::useStylesheetString(const std::string& sheet)
 {
     stylesheet_ = sheet;
+
+    // Built-in stylesheets can be applied without XSLT
+    nativeMapping_ = NativeHeaderBuilder::identify(sheet);
+
+    // Only the header elements the stylesheet reads need to be computed
+    headerReferences_ = HeaderReferences::fromStylesheet(sheet);
+    if (headerReferences_.referencesEverything()) {
+        log_ << "Stylesheet may read any raw file header element" << std::endl;
+    } else {
+        log_ << "Stylesheet reads " << headerReferences_.paths().size() << " raw file header elements" << std::endl;
+    }
+}
+
+/**
+ * Routes the raw file through a conversion configuration
+ *
+ * The configuration maps pulse sequence names to a plugin class and library, a
+ * stylesheet and a Gadgetron reconstruction configuration, see src/schema/geismrmrd.xsd.
+ * If a sequence mapping names the pulse sequence of this raw file, its plugin and
+ * stylesheet are used from then on and its reconstruction configuration is
+ * returned by getReconConfigName(). Relative stylesheet paths are relative to the
+ * configuration file.
+ *
+ * @param filename Conversion configuration file
+ * @returns true if a sequence mapping matched
+ * @throws std::runtime_error if the configuration is invalid, or its plugin or stylesheet cannot be loaded
+ */
+bool GERawConverter::useConfigFilename(const std::string& filename)
+{
+    log_ << "Loading conversion configuration: " << filename << std::endl;
+    std::ifstream stream(filename.c_str(), std::ios::binary);
+    if (!stream) {
+        throw std::runtime_error("Failed to read conversion configuration " + filename);
+    }
+
+    std::string config((std::istreambuf_iterator<char>(stream)),
+            std::istreambuf_iterator<char>());
+    return useConfig(config, filename);
+}
+
+bool GERawConverter::useConfigStream(std::ifstream& stream)
+{
+    stream.seekg(0, std::ios::beg);
+
+    std::string config((std::istreambuf_iterator<char>(stream)),
+            std::istreambuf_iterator<char>());
+    return useConfigString(config);
+}
+
+/**
+ * Same as useConfigFilename(); relative stylesheet paths are relative to the installed config directory
+ */
+bool GERawConverter::useConfigString(const std::string& config)
+{
+    return useConfig(config, "");
+}
+
+bool GERawConverter::useConfig(const std::string& config, const std::string& url)
+{
+    std::shared_ptr<xmlDoc> doc = std::shared_ptr<xmlDoc>(
+            xmlReadMemory(config.c_str(), config.size(), url.empty() ? NULL : url.c_str(), NULL, XML_PARSE_NONET),
+            xmlFreeDoc);
+    if (!doc) {
+        throw std::runtime_error("Failed to parse conversion configuration");
+    }
+
+    if (!validateConfig(doc)) {
+        throw std::runtime_error("Conversion configuration does not match its schema");
+    }
+
+    for (xmlNode* node = xmlDocGetRootElement(doc.get())->children ; node != NULL ; node = node->next) {
+        if (node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, BAD_CAST "sequenceMapping") == 0) {
+            if (trySequenceMapping(doc, node)) {
+                return true;
+            }
+        }
+    }
+
+    log_ << "No sequence mapping for " << psdname_ << std::endl;
+    return false;
+}
+
+/**
+ * Checks a conversion configuration against the schema
+ *
+ * @returns true if the configuration is valid
+ * @throws std::runtime_error if the schema itself cannot be compiled
+ */
+bool GERawConverter::validateConfig(std::shared_ptr<xmlDoc> config_doc)
+{
+    std::shared_ptr<xmlSchemaParserCtxt> parser = std::shared_ptr<xmlSchemaParserCtxt>(
+            xmlSchemaNewMemParserCtxt(g_schema.c_str(), g_schema.size()), xmlSchemaFreeParserCtxt);
+    if (!parser) {
+        throw std::runtime_error("Failed to create conversion configuration schema parser");
+    }
+
+    std::shared_ptr<xmlSchema> schema = std::shared_ptr<xmlSchema>(xmlSchemaParse(parser.get()), xmlSchemaFree);
+    if (!schema) {
+        throw std::runtime_error("Failed to parse conversion configuration schema");
+    }
+
+    std::shared_ptr<xmlSchemaValidCtxt> validator = std::shared_ptr<xmlSchemaValidCtxt>(
+            xmlSchemaNewValidCtxt(schema.get()), xmlSchemaFreeValidCtxt);
+    if (!validator) {
+        throw std::runtime_error("Failed to create conversion configuration validator");
+    }
+
+    return xmlSchemaValidateDoc(validator.get(), config_doc.get()) == 0;
+}
+
+/**
+ * Text of an element, or empty if it is empty
+ */
+static std::string elementText(xmlNode* element)
+{
+    xmlChar* content = xmlNodeGetContent(element);
+    if (!content) {
+        return std::string();
+    }
+    std::string text((const char*)content);
+    xmlFree(content);
+    return text;
+}
+
+/**
+ * Applies a sequence mapping if it names the pulse sequence of this raw file
+ *
+ * @returns true if the mapping was applied
+ */
+bool GERawConverter::trySequenceMapping(std::shared_ptr<xmlDoc> doc, xmlNode* mapping)
+{
+    std::string psdname, libraryPath, className, stylesheet, reconConfigName;
+
+    for (xmlNode* node = mapping->children ; node != NULL ; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+
+        if (xmlStrcmp(node->name, BAD_CAST "psdname") == 0) {
+            psdname = elementText(node);
+        } else if (xmlStrcmp(node->name, BAD_CAST "libraryPath") == 0) {
+            libraryPath = elementText(node);
+        } else if (xmlStrcmp(node->name, BAD_CAST "className") == 0) {
+            className = elementText(node);
+        } else if (xmlStrcmp(node->name, BAD_CAST "stylesheet") == 0) {
+            stylesheet = elementText(node);
+        } else if (xmlStrcmp(node->name, BAD_CAST "reconConfigName") == 0) {
+            reconConfigName = elementText(node);
+        }
+    }
+
+    if (psdname != psdname_) {
+        return false;
+    }
+
+    log_ << "Sequence mapping for " << psdname_ << ": " << className << std::endl;
+
+    usePlugin(className, libraryPath);
+
+    if (!stylesheet.empty()) {
+        if (stylesheet[0] != '/') {
+            std::string base = get_ge_tools_home() + "share/ge-tools/config/";
+            if (doc->URL) {
+                std::string const url((const char*)doc->URL);
+                size_t const slash = url.find_last_of('/');
+                base = (slash == std::string::npos) ? std::string() : url.substr(0, slash + 1);
+            }
+            stylesheet = base + stylesheet;
+        }
+        useStylesheetFilename(stylesheet);
+    }
+
+    recon_config_ = reconConfigName;
+
+    return true;
 }
 
 /**
  * Converts the XSD ISMRMRD XML header object into a C++ string
  *
+ * The built-in stylesheets are applied natively unless ConversionOptions::headerPath
+ * asks for XSLT; any other stylesheet is applied with libxslt. With
+ * ConversionOptions::readoutOversampling the encoded space is reduced to match
+ * the acquisitions, and for a partial conversion the receiver channels and
+ * encoding limits describe the range only.
+ *
+ * @param range Slices, echoes, volumes and channels that will be converted
  * @returns string represenatation of ISMRMRD XML header
  * @throws std::runtime_error
+ * @throws std::invalid_argument if the range selects indices that are not in the scan
  */
-std::string GERawConverter::getIsmrmrdXMLHeader()
+std::string GERawConverter::getIsmrmrdXMLHeader(const ConversionRange& range)
 {
+    // Before any header is built, so that a bad range is reported before any output is written
+    checkRange(range, false);
+
     if (stylesheet_.size() == 0) {
         throw std::runtime_error("No stylesheet configured");
     }
 
-    std::string ge_raw_file_header(ge_header_to_xml(lxData_, processingControl_));
+    std::string header;
+    if (options_.headerPath != HEADER_PATH_XSLT && nativeMapping_ != NativeHeaderBuilder::NO_NATIVE_MAPPING) {
+        header = getNativeXMLHeader(nativeMapping_);
+    } else if (options_.headerPath == HEADER_PATH_NATIVE) {
+        throw std::runtime_error("Stylesheet is not a built-in one, so the header cannot be built natively");
+    } else {
+        header = getXsltXMLHeader();
+    }
+
+    unsigned int const oversampling = oversamplingFactor();
+    if (oversampling > 1) {
+        header = OversamplingRemoval::updateHeader(header, oversampling);
+    }
+    if (!range.everything()) {
+        header = range.updateHeader(header);
+    }
+    return header;
+}
 
-    // DEBUG: std::cout << "Converted header as XML string is: " << ge_raw_file_header << std::endl;
+/**
+ * Builds the header of a built-in stylesheet straight from the raw file header values
+ */
+std::string GERawConverter::getNativeXMLHeader(NativeHeaderBuilder::Mapping mapping)
+{
+    log_ << "Building header natively" << std::endl;
 
-    xmlSubstituteEntitiesDefault(1);
-    xmlLoadExtDtdDefaultValue = 1;
+    HeaderFields fields;
+    writeHeaderXML(fields, lxData_, processingControl_, headerReferences_);
 
-    // Normal pointer here because the xsltStylesheet takes ownership
-    xmlDocPtr stylesheet_doc = xmlParseMemory(stylesheet_.c_str(), stylesheet_.size());
-    if (NULL == stylesheet_doc) {
-        throw std::runtime_error("Failed to parse stylesheet");
-    }
+    return NativeHeaderBuilder::build(mapping, fields);
+}
 
-    std::shared_ptr<xsltStylesheet> sheet = std::shared_ptr<xsltStylesheet>(
-            xsltParseStylesheetDoc(stylesheet_doc), xsltFreeStylesheet);
-    if (!sheet) {
-        xmlFreeDoc(stylesheet_doc);
-        throw std::runtime_error("Failed to parse stylesheet");
-    }
+/**
+ * Applies the stylesheet to the raw file header XML
+ */
+std::string GERawConverter::getXsltXMLHeader()
+{
+    // Compiled once per process for each distinct stylesheet
+    std::shared_ptr<xsltStylesheet> sheet = StylesheetCache::instance().get(stylesheet_);
 
-    std::shared_ptr<xmlDoc> pfile_doc = std::shared_ptr<xmlDoc>(
-            xmlParseMemory(ge_raw_file_header.c_str(), ge_raw_file_header.size()), xmlFreeDoc);
-    if (!pfile_doc) {
-        throw std::runtime_error("Failed to parse P-File XML");
-    }
+    // The raw file header is built as a document tree, so it need not be serialized and parsed again
+    std::shared_ptr<xmlDoc> pfile_doc = ge_header_to_doc(lxData_, processingControl_);
 
     log_ << "Applying stylesheet" << std::endl;
     const char *params[1] = { NULL };
@@ -179,22 +576,408 @@ std::string GERawConverter::getIsmrmrdXMLHeader()
 
 
 /**
- * Gets the acquisitions corresponding to a view in memory.
+ * Builds the header with both the native builder and XSLT, and compares them
+ *
+ * Times each path over a number of iterations and writes the timings to report.
+ *
+ * @param iterations Headers to build with each path
+ * @param report Receives the timings and the first difference, if any
+ * @returns true if both paths produce the same header text
+ * @throws std::runtime_error if the stylesheet is not a built-in one
+ */
+bool GERawConverter::compareHeaderPaths(unsigned int iterations, std::ostream& report)
+{
+    if (nativeMapping_ == NativeHeaderBuilder::NO_NATIVE_MAPPING) {
+        throw std::runtime_error("Stylesheet is not a built-in one, so the header cannot be built natively");
+    }
+
+    iterations = std::max(iterations, 1u);
+
+    std::string native, xslt;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int n = 0 ; n < iterations ; n++) {
+        native = getNativeXMLHeader(nativeMapping_);
+    }
+    std::chrono::duration<double> const nativeTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned int n = 0 ; n < iterations ; n++) {
+        xslt = getXsltXMLHeader();
+    }
+    std::chrono::duration<double> const xsltTime = std::chrono::steady_clock::now() - start;
+
+    report << "Native header: " << 1000.0 * nativeTime.count() / iterations << " ms per header" << std::endl;
+    report << "XSLT header:   " << 1000.0 * xsltTime.count() / iterations << " ms per header" << std::endl;
+
+    if (native == xslt) {
+        report << "Headers are identical" << std::endl;
+        return true;
+    }
+
+    size_t const at = std::mismatch(native.begin(), native.begin() + std::min(native.size(), xslt.size()),
+                                    xslt.begin()).first - native.begin();
+    size_t const from = (at > 40) ? at - 40 : 0;
+    report << "Headers differ at character " << at << ":" << std::endl
+           << "  native: " << native.substr(from, 80) << std::endl
+           << "  xslt:   " << xslt.substr(from, 80) << std::endl;
+    return false;
+}
+
+/**
+ * Gets the acquisitions of a range of the scan in memory.
+ *
+ * For P-files whose converter supportsConcurrentRanges(), this may be called
+ * from several threads at once for disjoint ranges.
  *
- * @param view_num View number to get
- * @param vacq Vector of acquisitions
+ * @param range Slices, echoes, volumes and channels to get; all by default
+ * @returns Vector of acquisitions
  * @throws std::runtime_error { if plugin fails to copy the data }
  */
-std::vector<ISMRMRD::Acquisition> GERawConverter::getAcquisitions(unsigned int view_num)
+std::vector<ISMRMRD::Acquisition> GERawConverter::getAcquisitions(const ConversionRange& range)
 {
+   if (!converter_) {
+      throw std::runtime_error("Raw file was opened for its header only");
+   }
+
+   checkRange(range, true);
+
+   std::vector<ISMRMRD::Acquisition> acqs;
    if (rawObjectType_ == SCAN_ARCHIVE_RAW_TYPE)
    {
-      return converter_->getAcquisitions(scanArchive_, view_num);
+      // Without an index to save, the converter describes the packets as it reads them
+      getPacketIndex(options_.packetIndexSidecar);
+      acqs = converter_->getAcquisitions(*context_, scanArchive_, range);
    }
    else
    {
-      return converter_->getAcquisitions(pfile_, view_num);
+      acqs = converter_->getAcquisitions(*context_, pfile_, range);
+   }
+
+   std::vector<ISMRMRD::Acquisition> cropped;
+   AcquisitionVectorSink collect(cropped);
+   std::unique_ptr<OversamplingRemoval> removal = removeOversampling(collect);
+   if (!removal) {
+      return acqs;
    }
+
+   cropped.reserve(acqs.size());
+   for (size_t n = 0 ; n < acqs.size() ; n++) {
+      removal->consume(acqs[n]);
+   }
+   removal->flush();
+   return cropped;
+}
+
+/**
+ * Streams the acquisitions of a range of the scan to a sink, one at a time.
+ *
+ * ScanArchive packets outside the range are passed over without reading their
+ * data, and P-file slices, echoes and channels outside it are not read at all.
+ * The archive is walked once, unless the packet index is built first to be saved
+ * as a sidecar or was already built for the header.
+ *
+ * @param range Slices, echoes, volumes and channels to convert
+ * @param sink Receiver of each acquisition as soon as it is decoded
+ * @throws std::runtime_error { if plugin fails to copy the data }
+ */
+void GERawConverter::convertAcquisitions(const ConversionRange& range, AcquisitionSink& sink)
+{
+   if (!converter_) {
+      throw std::runtime_error("Raw file was opened for its header only");
+   }
+
+   checkRange(range, true);
+
+   std::unique_ptr<OversamplingRemoval> removal = removeOversampling(sink);
+   AcquisitionSink& target = removal ? *removal : sink;
+
+   if (rawObjectType_ == SCAN_ARCHIVE_RAW_TYPE)
+   {
+      // Without an index to save, the converter describes the packets as it reads them
+      getPacketIndex(options_.packetIndexSidecar);
+      converter_->convertAcquisitions(*context_, scanArchive_, range, target);
+   }
+   else
+   {
+      converter_->convertAcquisitions(*context_, pfile_, range, target);
+   }
+
+   if (removal) {
+      removal->flush();
+   }
+}
+
+/**
+ * Rejects a range that selects slices, echoes, channels or volumes the scan does not have
+ *
+ * P-files hold one volume, and EPI ScanArchives as many as their packet index counts.
+ * The volumes of other ScanArchives, and of EPI ScanArchives whose packets were not
+ * counted yet, are not checked.
+ *
+ * @param countVolumes Check volumes against the packet index; false while the archive may still grow
+ * @throws std::invalid_argument naming the first index that is not in the scan
+ */
+void GERawConverter::checkRange(const ConversionRange& range, bool countVolumes)
+{
+    const ScanParameters& scan = context_->epi ? context_->epi->scan : context_->scan;
+
+    unsigned int numVolumes = 0;
+    if (rawObjectType_ == PFILE_RAW_TYPE) {
+        numVolumes = 1;
+    } else if (countVolumes && context_->epi && context_->packets) {
+        numVolumes = this->countVolumes(*context_->packets);
+    }
+
+    range.check(scan.numSlices, scan.numEchoes, scan.numChannels, numVolumes);
+}
+
+/**
+ * Volumes of an EPI ScanArchive, counting a last volume that is missing slices
+ *
+ * Scan control packets are not counted, wherever they are in the archive.
+ */
+unsigned int GERawConverter::countVolumes(const PacketIndex& packets) const
+{
+    unsigned int const perVolume = context_->epi->packetsPerVolume;
+    return (packets.dataPacketCount() + perVolume - 1) / perVolume;
+}
+
+/**
+ * Resolves the sample format of the outputs of this raw file, before any is written
+ *
+ * Integer formats need samples that are whole numbers: they are rejected if
+ * readout oversampling is removed, or if the converter interpolates samples,
+ * e.g. in an EPI row flip that does not only reorder them.
+ *
+ * @param format Requested format; SAMPLE_FORMAT_NATIVE is resolved for the scan
+ * @returns the format the outputs are written in
+ * @throws std::runtime_error if the samples of this conversion cannot be stored in it without loss
+ */
+SampleFormat GERawConverter::resolveSampleFormat(SampleFormat format)
+{
+    SampleFormat const resolved = GEToIsmrmrd::resolveSampleFormat(format, context_->scan);
+    if (resolved == SAMPLE_FORMAT_FLOAT) {
+        return resolved;
+    }
+
+    if (options_.readoutOversampling > 1) {
+        throw std::runtime_error("Samples with their readout oversampling removed cannot be stored as integers");
+    }
+    if (converter_ && !converter_->preservesSampleValues(*context_)) {
+        throw std::runtime_error("The samples of this scan are interpolated and cannot be stored as integers");
+    }
+    return resolved;
+}
+
+/**
+ * Readout oversampling to remove, from ConversionOptions::readoutOversampling
+ *
+ * setOptions() has already refused a factor for EPI scans.
+ *
+ * @returns 1 if the acquisitions are kept as acquired
+ */
+unsigned int GERawConverter::oversamplingFactor() const
+{
+   return std::max(options_.readoutOversampling, 1u);
+}
+
+/**
+ * Sets up the removal of readout oversampling
+ *
+ * @param sink Receiver of the acquisitions once their oversampling is removed
+ * @returns the stage to pass acquisitions to, or NULL if they are kept as acquired
+ */
+std::unique_ptr<OversamplingRemoval> GERawConverter::removeOversampling(AcquisitionSink& sink)
+{
+   unsigned int const factor = oversamplingFactor();
+   if (factor <= 1) {
+      return std::unique_ptr<OversamplingRemoval>();
+   }
+   return std::unique_ptr<OversamplingRemoval>(new OversamplingRemoval(sink, factor));
+}
+
+/**
+ * Gets the size of a file, or -1 if it cannot be read
+ */
+static long long fileSize(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? (long long) info.st_size : -1;
+}
+
+/**
+ * Converts the acquisitions of a ScanArchive while the scanner is still writing it.
+ *
+ * Orchestra reads an archive as it was when it was opened, so the archive is
+ * opened again each time its size changes, and the packets that were not there
+ * before are converted. A packet arrives when a poll first sees it. Volumes are
+ * reported to onVolume, e.g. to flush the sink, as soon as their last slice and
+ * echo is converted. Opening the archive while a packet is half written may
+ * fail; it is then retried at the next poll.
+ *
+ * Each reopened archive is walked once: the converter passes over the packets
+ * converted before without decoding them and converts the new ones, and no
+ * packet index is built. Passing over the earlier packets is still linear in
+ * their number, so following a run of N packets costs O(N^2) packet steps over
+ * all polls. This cannot be avoided with Orchestra, whose ArchiveStorage only
+ * steps forward from the first packet and does not see packets added after the
+ * archive was opened. A step is cheap next to decoding a packet, and the archive
+ * is only reopened when it grew, at most once per FollowOptions::pollMillis.
+ *
+ * Only converters that implement SequenceConverter::convertNewAcquisitions(),
+ * i.e. EPI, can follow an archive.
+ *
+ * @param range Slices, echoes, volumes and channels to convert
+ * @param sink Receiver of each acquisition as soon as it is decoded
+ * @param options When to look at the archive and when to stop
+ * @param onVolume Called with each volume once all its selected slices were converted
+ * @returns packet, volume and latency counts
+ * @throws std::runtime_error if the raw file is not an EPI ScanArchive, or
+ *         { if the archive cannot be read once it stopped growing }
+ */
+FollowStatistics GERawConverter::followAcquisitions(const ConversionRange& range, AcquisitionSink& sink,
+                                                    const FollowOptions& options,
+                                                    const VolumeTracker::VolumeCallback& onVolume)
+{
+   if (!converter_) {
+      throw std::runtime_error("Raw file was opened for its header only");
+   }
+   if (rawObjectType_ != SCAN_ARCHIVE_RAW_TYPE || !context_->epi) {
+      throw std::runtime_error("Only EPI ScanArchives can be followed while they are written");
+   }
+   checkRange(range, false);
+
+   // Every hyperframe packet holds all the views of one slice and echo
+   const EpiParameters& epi = *context_->epi;
+   size_t const viewsPerPacket = epi.extraFramesTop + epi.scan.acquiredYRes + epi.extraFramesBottom;
+   size_t const perVolume = range.selectedSlices(epi.scan.numSlices).size() *
+                            range.selectedEchoes(epi.scan.numEchoes).size() * viewsPerPacket;
+
+   FollowStatistics stats;
+   VolumeTracker tracker(sink, perVolume, [&](unsigned int volume) {
+       stats.volumes++;
+       if (onVolume) {
+           onVolume(volume);
+       }
+   });
+   std::unique_ptr<OversamplingRemoval> removal = removeOversampling(tracker);
+   AcquisitionSink& target = removal ? *removal : static_cast<AcquisitionSink&>(tracker);
+
+   // The archive opened with the converter is converted as it is now
+   long long size = fileSize(rawFilePath_);
+   bool stale = false;
+   bool pending = true;
+   size_t converted = 0;
+   std::string lastError;
+   auto lastGrowth = std::chrono::steady_clock::now();
+
+   for (;;) {
+      stats.polls++;
+      auto const now = std::chrono::steady_clock::now();
+
+      long long const currentSize = fileSize(rawFilePath_);
+      if (currentSize != size) {
+         size = currentSize;
+         lastGrowth = now;
+         stale = true;
+      }
+
+      if (stale) {
+         try {
+            Hdf5Lock lock;
+            scanArchive_ = GERecon::ScanArchive::Create(rawFilePath_, GESystem::Archive::LoadMode);
+            stats.reopens++;
+            stale = false;
+            pending = true;
+            lastError.clear();
+
+            // Describes fewer packets than the archive now has; the converter describes them as it reads
+            context_->packets.reset();
+         } catch (const std::exception& e) {
+            stats.failedReopens++;
+            lastError = e.what();
+         }
+      }
+
+      if (!stale && pending) {
+         tracker.setArrival(now);
+         size_t const available = converter_->convertNewAcquisitions(*context_, scanArchive_, range, converted, target);
+         if (removal) {
+            removal->flush();
+         }
+         if (available > converted) {
+            log_ << "Converted packets " << converted << " to " << available - 1 << std::endl;
+            stats.packets += available - converted;
+            converted = available;
+         }
+         pending = false;
+      }
+
+      if (options.volumes > 0 && stats.volumes >= options.volumes) {
+         break;
+      }
+      if (now - lastGrowth >= std::chrono::seconds(options.idleSeconds)) {
+         if (stale) {
+            throw std::runtime_error("Failed to read " + rawFilePath_ + " after it stopped growing: " + lastError);
+         }
+         break;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(options.pollMillis));
+   }
+
+   stats.latencies = tracker.latencies();
+   stats.incompleteVolumes = tracker.incompleteVolumes();
+   return stats;
+}
+
+/**
+ * Gets the index of the control packets of a ScanArchive
+ *
+ * The index is built at most once per converter. With ConversionOptions::packetIndexSidecar
+ * it is read from the sidecar file next to the archive if that is still current, and
+ * saved there after a scan otherwise.
+ *
+ * @param scanIfMissing Walk the archive if no index is known yet
+ * @returns the index, or NULL for P-files, or if it is not known and scanIfMissing is false
+ */
+std::shared_ptr<const PacketIndex> GERawConverter::getPacketIndex(bool scanIfMissing)
+{
+    if (rawObjectType_ != SCAN_ARCHIVE_RAW_TYPE || context_->packets) {
+        return context_->packets;
+    }
+
+    std::string const sidecar = PacketIndex::sidecarPath(rawFilePath_);
+
+    if (options_.packetIndexSidecar) {
+        context_->packets = PacketIndex::load(sidecar, rawFilePath_);
+        if (context_->packets) {
+            log_ << "Loaded packet index from " << sidecar << std::endl;
+            return context_->packets;
+        }
+    }
+
+    if (!scanIfMissing) {
+        return context_->packets;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    context_->packets = PacketIndex::build(scanArchive_, *context_);
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+    log_ << "Indexed " << context_->packets->size() << " packets in " << elapsed.count() << " s" << std::endl;
+
+    if (options_.packetIndexSidecar) {
+        try {
+            context_->packets->save(sidecar, rawFilePath_);
+            log_ << "Saved packet index to " << sidecar << std::endl;
+        } catch (const std::exception& e) {
+            // The index is only a cache, so conversion goes on without it
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+
+    return context_->packets;
 }
 
 /**
@@ -212,8 +995,80 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
 {
     // DEBUG: std::cerr << "Starting conversion of raw file header to XML string" << std::endl;
 
+    // The complete raw file header, whatever the stylesheet reads
     XMLWriter writer;
+    writeHeaderXML(writer, lxData, processingControl, HeaderReferences());
 
+    // DEBUG: std::cerr << "XML stream from GE is: " << writer.getXML().c_str() << std::endl;
+
+    return writer.getXML();
+}
+
+/**
+ * Builds the raw file header as a document tree ready for the stylesheet,
+ * leaving out the elements the stylesheet cannot read.
+ */
+std::shared_ptr<struct _xmlDoc> GERawConverter::ge_header_to_doc(GERecon::Legacy::LxDownloadDataPointer lxData,
+                                                                 GERecon::Control::ProcessingControlPointer processingControl)
+{
+    XMLWriter writer(true);
+    writeHeaderXML(writer, lxData, processingControl, headerReferences_);
+
+    std::shared_ptr<xmlDoc> doc = std::shared_ptr<xmlDoc>(writer.takeDocument(), xmlFreeDoc);
+    if (!doc) {
+        throw std::runtime_error("Failed to build raw file header XML");
+    }
+
+    return doc;
+}
+
+/** Header elements that come from each DICOM module */
+static const char* const SERIES_MODULE_ELEMENTS[] = {
+    "UID", "Description", "Laterality", "Date", "Time", "ProtocolName", "OperatorName", "PpsDescription"
+};
+static const char* const STUDY_MODULE_ELEMENTS[] = {
+    "UID", "Description", "Date", "Time", "ReferringPhysician", "AccessionNumber", "ReadingPhysician"
+};
+static const char* const EQUIPMENT_MODULE_ELEMENTS[] = {
+    "Manufacturer", "Institution", "Station", "ManufacturerModel", "DeviceSerialNumber",
+    "SoftwareVersion", "PpsPerformedStation", "PpsPerformedLocation"
+};
+static const char* const IMAGE_MODULE_ELEMENTS[] = {
+    "EchoTime", "RepetitionTime", "InversionTime", "ImageType", "ScanSequence", "SequenceVariant",
+    "ScanOptions", "AcquisitionType", "PhaseEncodeDirection", "ImagingFrequency",
+    "MagneticFieldStrength", "SliceSpacing", "FlipAngle", "EchoTrainLength"
+};
+static const char* const IMAGE_MODULE_BASE_ELEMENTS[] = {
+    "AcquisitionDate", "AcquisitionTime", "ImageDate", "ImageTime"
+};
+static const char* const IMAGE_PLANE_MODULE_ELEMENTS[] = {
+    "ImageOrientation", "ImagePosition", "SliceThickness", "SliceLocation", "PixelSizeX", "PixelSizeY"
+};
+
+/** Whether refs may read any of the named elements of group */
+template <size_t N>
+static bool needsAny(const HeaderReferences& refs, const std::string& group, const char* const (&names)[N])
+{
+    for (size_t i = 0 ; i < N ; ++i) {
+        if (refs.needs(group + "/" + names[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Writes the raw file header values to an XMLWriter, or records them in HeaderFields
+ *
+ * The DICOM modules, fresh UIDs and the EPI volume count are costly to compute,
+ * so they are only written where refs says the stylesheet may read them. The
+ * DICOM series and image are built only for the modules whose elements are read.
+ */
+template <typename Writer>
+void GERawConverter::writeHeaderXML(Writer& writer, GERecon::Legacy::LxDownloadDataPointer lxData,
+                                    GERecon::Control::ProcessingControlPointer processingControl,
+                                    const HeaderReferences& refs)
+{
     writer.startDocument();
 
     writer.startElement("Header");
@@ -243,68 +1098,105 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
 
     writer.formatElement("SliceCount", "%d",       processingControl->Value<int>("NumSlices"));
     writer.formatElement("ChannelCount", "%d",     processingControl->Value<int>("NumChannels"));
-    writer.formatElement("OtherUID", "%s",         GEDicom::UID::Create(GEDicom::UID::OtherUID).c_str());
-
-    GERecon::Legacy::DicomSeries legacySeries(lxData);
-    GEDicom::SeriesPointer series = legacySeries.Series();
-    GEDicom::SeriesModulePointer seriesModule = series->GeneralModule();
-    writer.startElement("Series");
-    // writer.formatElement("Number", "%d",           lxData->SeriesNumber());
-    writer.formatElement("Number", "%d",           processingControl->Value<int>("SeriesNumber"));
-    writer.formatElement("UID", "%s",              seriesModule->UID().c_str());
-    writer.formatElement("Description", "%s",      seriesModule->SeriesDescription().c_str());
-    // writer.formatElement("Modality", "%s",         seriesModule->Modality());
-    writer.formatElement("Laterality", "%s",       seriesModule->Laterality().c_str());
-    writer.formatElement("Date", "%s",             seriesModule->Date().c_str());
-    writer.formatElement("Time", "%s",             seriesModule->Time().c_str());
-    writer.formatElement("ProtocolName", "%s",     seriesModule->ProtocolName().c_str());
-    writer.formatElement("OperatorName", "%s",     seriesModule->OperatorName().c_str());
-    writer.formatElement("PpsDescription", "%s",   seriesModule->PpsDescription().c_str());
-    // writer.formatElement("PatientEntry", "%s",     seriesModule->Entry());
-    // writer.formatElement("PatientOrientation", "%s", seriesModule->Orientation());
-    writer.endElement();
+    if (refs.needs("Header/OtherUID")) {
+        writer.formatElement("OtherUID", "%s",     GEDicom::UID::Create(GEDicom::UID::OtherUID).c_str());
+    }
 
-    GEDicom::StudyPointer study = series->Study();
-    GEDicom::StudyModulePointer studyModule = study->GeneralModule();
-    writer.startElement("Study");
-    // writer.formatElement("Number", "%d",           studyModule->StudyNumber());
-    // writer.formatElement("Number", "%d",           lxData->ExamNumber()); // seems to be lxData equivalent
-    writer.formatElement("Number", "%u",           processingControl->Value<int>("ExamNumber"));
-    writer.formatElement("UID", "%s",              studyModule->UID().c_str());
-    writer.formatElement("Description", "%s",      studyModule->StudyDescription().c_str());
-    writer.formatElement("Date", "%s",             studyModule->Date().c_str());
-    writer.formatElement("Time", "%s",             studyModule->Time().c_str());
-    writer.formatElement("ReferringPhysician", "%s",  studyModule->ReferringPhysician().c_str());
-    writer.formatElement("AccessionNumber", "%s",  studyModule->AccessionNumber().c_str());
-    writer.formatElement("ReadingPhysician", "%s", studyModule->ReadingPhysician().c_str());
-    writer.endElement();
+    // The DICOM series and image are only built if the stylesheet reads one of their elements
+    const bool needsImageModule = needsAny(refs, "Header/Image", IMAGE_MODULE_ELEMENTS);
+    const bool needsImageModuleBase = needsAny(refs, "Header/Image", IMAGE_MODULE_BASE_ELEMENTS);
+    const bool needsImagePlaneModule = needsAny(refs, "Header/Image", IMAGE_PLANE_MODULE_ELEMENTS);
+    const bool needsPrivateAcquisitionModule = refs.needs("Header/Image/SecondEcho");
+    const bool needsDicomImage = needsImageModule || needsImageModuleBase ||
+                                 needsImagePlaneModule || needsPrivateAcquisitionModule;
+    const bool needsSeriesModule = needsAny(refs, "Header/Series", SERIES_MODULE_ELEMENTS);
+    const bool needsStudyModule = needsAny(refs, "Header/Study", STUDY_MODULE_ELEMENTS);
+
+    std::shared_ptr<GERecon::Legacy::DicomSeries> legacySeries;
+    GEDicom::SeriesPointer series;
+    if (needsSeriesModule || needsStudyModule || refs.needs("Header/Patient") ||
+            needsAny(refs, "Header/Equipment", EQUIPMENT_MODULE_ELEMENTS) || needsDicomImage) {
+        legacySeries = std::make_shared<GERecon::Legacy::DicomSeries>(lxData);
+        series = legacySeries->Series();
+    }
 
-    GEDicom::PatientStudyModulePointer patientStudyModule = study->PatientStudyModule();
-    GEDicom::PatientPointer patient = study->Patient();
-    GEDicom::PatientModulePointer patientModule = patient->GeneralModule();
-    writer.startElement("Patient");
-    writer.formatElement("Name", "%s",             patientModule->Name().c_str());
-    writer.formatElement("ID", "%s",               patientModule->ID().c_str());
-    writer.formatElement("Birthdate", "%s",        patientModule->Birthdate().c_str());
-    writer.formatElement("Gender", "%s",           patientModule->Gender().c_str());
-    writer.formatElement("Age", "%s",              patientStudyModule->Age().c_str());
-    writer.formatElement("Weight", "%s",           patientStudyModule->Weight().c_str());
-    writer.formatElement("History", "%s",          patientStudyModule->History().c_str());
-    writer.endElement();
+    if (refs.needs("Header/Series")) {
+        writer.startElement("Series");
+        // writer.formatElement("Number", "%d",           lxData->SeriesNumber());
+        writer.formatElement("Number", "%d",           processingControl->Value<int>("SeriesNumber"));
+        if (needsSeriesModule) {
+            GEDicom::SeriesModulePointer seriesModule = series->GeneralModule();
+            writer.formatElement("UID", "%s",              seriesModule->UID().c_str());
+            writer.formatElement("Description", "%s",      seriesModule->SeriesDescription().c_str());
+            // writer.formatElement("Modality", "%s",         seriesModule->Modality());
+            writer.formatElement("Laterality", "%s",       seriesModule->Laterality().c_str());
+            writer.formatElement("Date", "%s",             seriesModule->Date().c_str());
+            writer.formatElement("Time", "%s",             seriesModule->Time().c_str());
+            writer.formatElement("ProtocolName", "%s",     seriesModule->ProtocolName().c_str());
+            writer.formatElement("OperatorName", "%s",     seriesModule->OperatorName().c_str());
+            writer.formatElement("PpsDescription", "%s",   seriesModule->PpsDescription().c_str());
+            // writer.formatElement("PatientEntry", "%s",     seriesModule->Entry());
+            // writer.formatElement("PatientOrientation", "%s", seriesModule->Orientation());
+        }
+        writer.endElement();
+    }
 
-    GEDicom::EquipmentPointer equipment = series->Equipment();
-    GEDicom::EquipmentModulePointer equipmentModule = equipment->GeneralModule();
-    writer.startElement("Equipment");
-    writer.formatElement("Manufacturer", "%s",     equipmentModule->Manufacturer().c_str());
-    writer.formatElement("Institution", "%s",      equipmentModule->Institution().c_str());
-    writer.formatElement("Station", "%s",          equipmentModule->Station().c_str());
-    writer.formatElement("ManufacturerModel", "%s",   equipmentModule->ManufacturerModel().c_str());
-    writer.formatElement("DeviceSerialNumber", "%s",  equipmentModule->DeviceSerialNumber().c_str());
-    writer.formatElement("UID", "%s",              GEDicom::UID::Create(GEDicom::UID::Equipment).c_str());
-    writer.formatElement("SoftwareVersion", "%s",  equipmentModule->SoftwareVersion().c_str());
-    writer.formatElement("PpsPerformedStation", "%s", equipmentModule->PpsPerformedStation().c_str());
-    writer.formatElement("PpsPerformedLocation", "%s",equipmentModule->PpsPerformedLocation().c_str());
-    writer.endElement();
+    if (refs.needs("Header/Study")) {
+        writer.startElement("Study");
+        // writer.formatElement("Number", "%d",           studyModule->StudyNumber());
+        // writer.formatElement("Number", "%d",           lxData->ExamNumber()); // seems to be lxData equivalent
+        writer.formatElement("Number", "%u",           processingControl->Value<int>("ExamNumber"));
+        if (needsStudyModule) {
+            GEDicom::StudyPointer study = series->Study();
+            GEDicom::StudyModulePointer studyModule = study->GeneralModule();
+            writer.formatElement("UID", "%s",              studyModule->UID().c_str());
+            writer.formatElement("Description", "%s",      studyModule->StudyDescription().c_str());
+            writer.formatElement("Date", "%s",             studyModule->Date().c_str());
+            writer.formatElement("Time", "%s",             studyModule->Time().c_str());
+            writer.formatElement("ReferringPhysician", "%s",  studyModule->ReferringPhysician().c_str());
+            writer.formatElement("AccessionNumber", "%s",  studyModule->AccessionNumber().c_str());
+            writer.formatElement("ReadingPhysician", "%s", studyModule->ReadingPhysician().c_str());
+        }
+        writer.endElement();
+    }
+
+    if (refs.needs("Header/Patient")) {
+        GEDicom::StudyPointer study = series->Study();
+        GEDicom::PatientStudyModulePointer patientStudyModule = study->PatientStudyModule();
+        GEDicom::PatientPointer patient = study->Patient();
+        GEDicom::PatientModulePointer patientModule = patient->GeneralModule();
+        writer.startElement("Patient");
+        writer.formatElement("Name", "%s",             patientModule->Name().c_str());
+        writer.formatElement("ID", "%s",               patientModule->ID().c_str());
+        writer.formatElement("Birthdate", "%s",        patientModule->Birthdate().c_str());
+        writer.formatElement("Gender", "%s",           patientModule->Gender().c_str());
+        writer.formatElement("Age", "%s",              patientStudyModule->Age().c_str());
+        writer.formatElement("Weight", "%s",           patientStudyModule->Weight().c_str());
+        writer.formatElement("History", "%s",          patientStudyModule->History().c_str());
+        writer.endElement();
+    }
+
+    if (refs.needs("Header/Equipment")) {
+        writer.startElement("Equipment");
+        if (series) {
+            GEDicom::EquipmentPointer equipment = series->Equipment();
+            GEDicom::EquipmentModulePointer equipmentModule = equipment->GeneralModule();
+            writer.formatElement("Manufacturer", "%s",     equipmentModule->Manufacturer().c_str());
+            writer.formatElement("Institution", "%s",      equipmentModule->Institution().c_str());
+            writer.formatElement("Station", "%s",          equipmentModule->Station().c_str());
+            writer.formatElement("ManufacturerModel", "%s",   equipmentModule->ManufacturerModel().c_str());
+            writer.formatElement("DeviceSerialNumber", "%s",  equipmentModule->DeviceSerialNumber().c_str());
+            if (refs.needs("Header/Equipment/UID")) {
+                writer.formatElement("UID", "%s",          GEDicom::UID::Create(GEDicom::UID::Equipment).c_str());
+            }
+            writer.formatElement("SoftwareVersion", "%s",  equipmentModule->SoftwareVersion().c_str());
+            writer.formatElement("PpsPerformedStation", "%s", equipmentModule->PpsPerformedStation().c_str());
+            writer.formatElement("PpsPerformedLocation", "%s",equipmentModule->PpsPerformedLocation().c_str());
+        } else if (refs.needs("Header/Equipment/UID")) {
+            writer.formatElement("UID", "%s",              GEDicom::UID::Create(GEDicom::UID::Equipment).c_str());
+        }
+        writer.endElement();
+    }
 
     writer.formatElement("AcquiredXRes", "%d",     processingControl->Value<int>("AcquiredXRes"));
     writer.formatElement("AcquiredYRes", "%d",     processingControl->Value<int>("AcquiredYRes"));
@@ -328,9 +1220,9 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
     writer.formatElement("scanType",        "%s",  lxData->ScanType().c_str());
     writer.formatElement("seriesDscrption", "%s",  lxData->SeriesDescription().c_str());
 
-    std::cout << "Coverting series with description: " <<   lxData->SeriesDescription().c_str() << std::endl;
-    std::cout << "Patient entry: "    << processingControl->Value<int>("PatientEntry")    << std::endl;
-    std::cout << "Patient position: " << processingControl->Value<int>("PatientPosition") << std::endl;
+    log_ << "Coverting series with description: " <<   lxData->SeriesDescription().c_str() << std::endl;
+    log_ << "Patient entry: "    << processingControl->Value<int>("PatientEntry")    << std::endl;
+    log_ << "Patient position: " << processingControl->Value<int>("PatientPosition") << std::endl;
 
     writer.formatElement("NumBaselineViews", "%d", processingControl->Value<int>("NumBaselineViews"));
     writer.formatElement("NumVolumes", "%d",       processingControl->Value<int>("NumVolumes"));
@@ -365,58 +1257,71 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
     // GERecon::ArchiveHeader archiveHeader("ScanArchive", prepData);
     // DEBUG: archiveHeader.Print(std::cout); // Does not seem to currently work as expected
 
-    const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
-
-    auto imageCorners = GERecon::ImageCorners(sliceTable.AcquiredSliceCorners(0),
-					      sliceTable.SliceOrientation(0));
-    auto grayscaleImage = GEDicom::GrayscaleImage(128, 128);
-    auto dicomImage = GERecon::Legacy::DicomImage(grayscaleImage, 0, imageCorners, series, *lxData);
-    auto imageModule = dicomImage.ImageModule();
-    // auto privateIdentityModule = dicomImage.PrivateIdentityModule();
-
-    writer.startElement("Image");
-    writer.formatElement("EchoTime", "%s",         imageModule->EchoTime().c_str());
-    writer.formatElement("RepetitionTime", "%s",   imageModule->RepetitionTime().c_str());
-    writer.formatElement("InversionTime", "%s",    imageModule->InversionTime().c_str());
-    writer.formatElement("ImageType", "%s",        imageModule->ImageType().c_str());
-    writer.formatElement("ScanSequence", "%s",     imageModule->ScanSequence().c_str());
-    writer.formatElement("SequenceVariant", "%s",  imageModule->SequenceVariant().c_str());
-    writer.formatElement("ScanOptions", "%s",      imageModule->ScanOptions().c_str());
-    writer.formatElement("AcquisitionType", "%d",  imageModule->AcqType());
-    writer.formatElement("PhaseEncodeDirection", "%d",   imageModule->PhaseEncodeDirection());
-    writer.formatElement("ImagingFrequency", "%s", imageModule->ImagingFrequency().c_str());
-    writer.formatElement("MagneticFieldStrength", "%s",  imageModule->MagneticFieldStrength().c_str());
-    writer.formatElement("SliceSpacing", "%s",     imageModule->SliceSpacing().c_str());
-    writer.formatElement("FlipAngle", "%s",        imageModule->FlipAngle().c_str());
-    writer.formatElement("EchoTrainLength", "%s",  imageModule->EchoTrainLength().c_str());
-    // TODO: map SliceOrder to a string
-    // std::string sliceOrder = GERecon::SliceOrderAsString(processingControl->ReconstructionParameters::SliceOrder());
-    // writer.formatElement("SliceOrder", "%s",       sliceOrder.c_str());
-
-    // Image Parameters
-    writer.formatElement("ImageXRes", "%d",        processingControl->Value<int>("ImageXRes"));
-    writer.formatElement("ImageYRes", "%d",        processingControl->Value<int>("ImageYRes"));
-
-    auto imageModuleBase = dicomImage.ImageModuleBase();
-    writer.formatElement("AcquisitionDate", "%s",  imageModuleBase->AcquisitionDate().c_str());
-    writer.formatElement("AcquisitionTime", "%s",  imageModuleBase->AcquisitionTime().c_str());
-    writer.formatElement("ImageDate", "%s",        imageModuleBase->ImageDate().c_str());
-    writer.formatElement("ImageTime", "%s",        imageModuleBase->ImageTime().c_str());
-
-    auto imagePlaneModule = dicomImage.ImagePlaneModule();
-    writer.formatElement("ImageOrientation", "%s", imagePlaneModule->ImageOrientation().c_str());
-    writer.formatElement("ImagePosition", "%s",    imagePlaneModule->ImagePosition().c_str());
-    writer.formatElement("SliceThickness", "%f",   imagePlaneModule->SliceThickness());
-    writer.formatElement("SliceLocation", "%f",    imagePlaneModule->SliceLocation());
-    writer.formatElement("PixelSizeX", "%f",       imagePlaneModule->PixelSizeX());
-    writer.formatElement("PixelSizeY", "%f",       imagePlaneModule->PixelSizeY());
-
-    auto privateAcquisitionModule = dicomImage.PrivateAcquisitionModule();
-    writer.formatElement("SecondEcho", "%s",       privateAcquisitionModule->SecondEcho().c_str());
-
-    // std::cout << "Table position: " << privateAcquisitionModule->TableDelta() << std::endl; // always seems to be 0.000 - so not sure if useful
-
-    writer.endElement();
+    if (refs.needs("Header/Image")) {
+        std::shared_ptr<GERecon::Legacy::DicomImage> dicomImage;
+        if (needsDicomImage) {
+            const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
+
+            auto imageCorners = GERecon::ImageCorners(sliceTable.AcquiredSliceCorners(0),
+                                                      sliceTable.SliceOrientation(0));
+            auto grayscaleImage = GEDicom::GrayscaleImage(128, 128);
+            dicomImage = std::make_shared<GERecon::Legacy::DicomImage>(grayscaleImage, 0, imageCorners, series, *lxData);
+        }
+        // auto privateIdentityModule = dicomImage->PrivateIdentityModule();
+
+        writer.startElement("Image");
+        if (needsImageModule) {
+            auto imageModule = dicomImage->ImageModule();
+            writer.formatElement("EchoTime", "%s",         imageModule->EchoTime().c_str());
+            writer.formatElement("RepetitionTime", "%s",   imageModule->RepetitionTime().c_str());
+            writer.formatElement("InversionTime", "%s",    imageModule->InversionTime().c_str());
+            writer.formatElement("ImageType", "%s",        imageModule->ImageType().c_str());
+            writer.formatElement("ScanSequence", "%s",     imageModule->ScanSequence().c_str());
+            writer.formatElement("SequenceVariant", "%s",  imageModule->SequenceVariant().c_str());
+            writer.formatElement("ScanOptions", "%s",      imageModule->ScanOptions().c_str());
+            writer.formatElement("AcquisitionType", "%d",  imageModule->AcqType());
+            writer.formatElement("PhaseEncodeDirection", "%d",   imageModule->PhaseEncodeDirection());
+            writer.formatElement("ImagingFrequency", "%s", imageModule->ImagingFrequency().c_str());
+            writer.formatElement("MagneticFieldStrength", "%s",  imageModule->MagneticFieldStrength().c_str());
+            writer.formatElement("SliceSpacing", "%s",     imageModule->SliceSpacing().c_str());
+            writer.formatElement("FlipAngle", "%s",        imageModule->FlipAngle().c_str());
+            writer.formatElement("EchoTrainLength", "%s",  imageModule->EchoTrainLength().c_str());
+        }
+        // TODO: map SliceOrder to a string
+        // std::string sliceOrder = GERecon::SliceOrderAsString(processingControl->ReconstructionParameters::SliceOrder());
+        // writer.formatElement("SliceOrder", "%s",       sliceOrder.c_str());
+
+        // Image Parameters
+        writer.formatElement("ImageXRes", "%d",        processingControl->Value<int>("ImageXRes"));
+        writer.formatElement("ImageYRes", "%d",        processingControl->Value<int>("ImageYRes"));
+
+        if (needsImageModuleBase) {
+            auto imageModuleBase = dicomImage->ImageModuleBase();
+            writer.formatElement("AcquisitionDate", "%s",  imageModuleBase->AcquisitionDate().c_str());
+            writer.formatElement("AcquisitionTime", "%s",  imageModuleBase->AcquisitionTime().c_str());
+            writer.formatElement("ImageDate", "%s",        imageModuleBase->ImageDate().c_str());
+            writer.formatElement("ImageTime", "%s",        imageModuleBase->ImageTime().c_str());
+        }
+
+        if (needsImagePlaneModule) {
+            auto imagePlaneModule = dicomImage->ImagePlaneModule();
+            writer.formatElement("ImageOrientation", "%s", imagePlaneModule->ImageOrientation().c_str());
+            writer.formatElement("ImagePosition", "%s",    imagePlaneModule->ImagePosition().c_str());
+            writer.formatElement("SliceThickness", "%f",   imagePlaneModule->SliceThickness());
+            writer.formatElement("SliceLocation", "%f",    imagePlaneModule->SliceLocation());
+            writer.formatElement("PixelSizeX", "%f",       imagePlaneModule->PixelSizeX());
+            writer.formatElement("PixelSizeY", "%f",       imagePlaneModule->PixelSizeY());
+        }
+
+        if (needsPrivateAcquisitionModule) {
+            auto privateAcquisitionModule = dicomImage->PrivateAcquisitionModule();
+            writer.formatElement("SecondEcho", "%s",       privateAcquisitionModule->SecondEcho().c_str());
+        }
+
+        // std::cout << "Table position: " << privateAcquisitionModule->TableDelta() << std::endl; // always seems to be 0.000 - so not sure if useful
+
+        writer.endElement();
+    }
 
     writer.startElement("UserVariables");
     writer.formatElement("rdb_hdr_user0",  "%d",   processingControl->Value<int>("UserValue0"));
@@ -441,33 +1346,46 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
     writer.formatElement("rdb_hdr_user19", "%d",   processingControl->Value<int>("UserValue19"));
     writer.endElement();
 
-    if (lxData->IsEpi())
+    if (lxData->IsEpi() && context_->epi && refs.needs("Header/epiParameters"))
     {
-        // Create EPI processing control object, so all relevant varaibles within that object are
-        // avaliable and accessible.
-
-        boost::shared_ptr<GERecon::Epi::LxControlSource> const controlSource = boost::make_shared<GERecon::Epi::LxControlSource>(lxData);
-        GERecon::Control::ProcessingControlPointer               procCtrlEPI = controlSource->CreateOrchestraProcessingControl();
-        GERecon::Acquisition::ArchiveStoragePointer      archive_storage_ptr = GERecon::Acquisition::ArchiveStorage::Create(scanArchive_);
-
-        int ref_views                                        = procCtrlEPI->Value<int>("ExtraFramesTop") + procCtrlEPI->Value<int>("ExtraFramesBottom");
-
-        // In EPI ScanArchive files, the number of acquisitions == (number of slices per volume + 1 (control packet)) * number of volumes.
-        //
-        // So to recover number of volumes / repetitions, just invert this relationship.  This may be fragile, if other types of packets,
-        // with different OpCodes - start getting included in the ScanArvhive.
-        int num_volumes                                      = archive_storage_ptr->AvailableControlCount() /
-                                                               (processingControl->Value<int>("NumSlices") + 1);
+        // The EPI processing control object was created along with the conversion context, so
+        // all relevant variables within that object are available and accessible.
+
+        const EpiParameters                                     &epi = *context_->epi;
+        GERecon::Control::ProcessingControlPointer       procCtrlEPI = epi.processingControl;
+        int ref_views                                        = epi.extraFramesTop + epi.extraFramesBottom;
+
+        // The volumes are counted from the hyperframe packets of the packet index, as checkRange()
+        // does, so scan control packets are left out wherever they are, and a last volume that is
+        // missing slices is counted as the conversion writes it. The index, which the conversion
+        // reuses, is only built if this value is read, and header-only converters count the same
+        // way, so a probe reports the volumes the conversion will write. P-files have no packet
+        // index and use the volume count of the processing control. An archive still being written
+        // would only give the volumes written so far, so ConversionOptions::headerVolumes, if set,
+        // is reported instead.
+        int num_volumes = 0;
+        if (refs.needs("Header/epiParameters/num_volumes")) {
+            std::shared_ptr<const PacketIndex> packets;
+            if (options_.headerVolumes > 0) {
+                num_volumes = options_.headerVolumes;
+            } else if ((packets = getPacketIndex())) {
+                num_volumes = countVolumes(*packets);
+            } else {
+                num_volumes = processingControl->Value<int>("NumVolumes");
+            }
+        }
 
         writer.startElement("epiParameters");
-          writer.addBooleanElement("isEpiRefScanIntegrated",   procCtrlEPI->Value<bool>("IntegratedReferenceScan"));
-          writer.addBooleanElement("MultibandEnabled",         procCtrlEPI->ValueStrict<bool>("MultibandEnabled"));
-          writer.formatElement("ExtraFramesTop", "%d",         procCtrlEPI->Value<int>("ExtraFramesTop"));
-          writer.formatElement("AcquiredYRes", "%d",           procCtrlEPI->Value<int>("AcquiredYRes"));
-          writer.formatElement("ExtraFramesBottom", "%d",      procCtrlEPI->Value<int>("ExtraFramesBottom"));
+          writer.addBooleanElement("isEpiRefScanIntegrated",   epi.integratedReferenceScan);
+          writer.addBooleanElement("MultibandEnabled",         epi.multibandEnabled);
+          writer.formatElement("ExtraFramesTop", "%d",         epi.extraFramesTop);
+          writer.formatElement("AcquiredYRes", "%d",           epi.scan.acquiredYRes);
+          writer.formatElement("ExtraFramesBottom", "%d",      epi.extraFramesBottom);
           // writer.formatElement("NumRefViews", "%d",            procCtrlEPI->Value<int>("NumRefViews")); // not found at run time up to Orchestra 1.10.1
           writer.formatElement("NumRefViews", "%d",            ref_views);
-          writer.formatElement("num_volumes", "%d",            num_volumes);
+          if (refs.needs("Header/epiParameters/num_volumes")) {
+            writer.formatElement("num_volumes", "%d",          num_volumes);
+          }
           // writer.formatElement("nMultiBandSlices", "%d",    procCtrlEPI->ValueStrict<int>("MultibandNumAcquiredSlices"));
           // writer.formatElement("NumberOfShots", "%d",       procCtrlEPI->Value<unsigned int>("NumberOfShots"));
           // writer.formatElement("NumAcqsPerRep", "%d",       procCtrlEPI->Value<int>("NumAcquisitionsPerRepetition"));
@@ -476,10 +1394,6 @@ std::string GERawConverter::ge_header_to_xml(GERecon::Legacy::LxDownloadDataPoin
     }
 
     writer.endDocument();
-
-    // DEBUG: std::cerr << "XML stream from GE is: " << writer.getXML().c_str() << std::endl;
-
-    return writer.getXML();
 }
 
 } // namespace GEToIsmrmrd
@@ -9,7 +9,16 @@
 
 // Local
 #include "SequenceConverter.h"
+#include "ArchiveFollow.h"
+#include "ConversionContext.h"
 #include "GenericConverter.h"
+#include "HeaderProbe.h"
+#include "HeaderReferences.h"
+#include "LogStream.h"
+#include "NativeHeaderBuilder.h"
+#include "OversamplingRemoval.h"
+#include "PluginRegistry.h"
+#include "SampleFormat.h"
 #include "NIHPlugins/2dfastConverter.h"
 #include "NIHPlugins/epiConverter.h"
 
@@ -19,24 +28,6 @@ struct _xmlNode;
 
 namespace GEToIsmrmrd {
 
-struct logstream {
-    logstream(bool enable) : enabled(enable) {}
-    bool enabled;
-};
-
-template <typename T>
-logstream& operator<<(logstream& s, T const& v)
-{
-    if (s.enabled) { std::clog << v; }
-    return s;
-}
-
-logstream& operator<<(logstream& s, std::ostream& (*f)(std::ostream&))
-{
-    if (s.enabled) { f(std::clog); }
-    return s;
-}
-
 enum GE_RAW_TYPES
 {
    SCAN_ARCHIVE_RAW_TYPE = 0,
@@ -49,19 +40,49 @@ class GERawConverter
 {
 public:
     GERawConverter(const std::string& pfilepath, const std::string& classname, bool logging=false);
+    GERawConverter(const std::string& pfilepath, const std::string& classname,
+                   const std::string& libraryPath, bool logging=false);
+    ~GERawConverter();
+
+    static std::shared_ptr<GERawConverter> openHeaderOnly(const std::string& rawFilePath, bool logging=false);
+    static ProbeResult probe(const std::string& rawFilePath, const std::string& stylesheet,
+                             const ConversionOptions& options, bool logging=false);
+
+    GE_RAW_TYPES getRawObjectType() const;
+    const ConversionContext& getContext() const { return *context_; }
 
     std::shared_ptr<SequenceConverter> getConverter();
+    void usePlugin(const std::string& classname, const std::string& libraryPath="");
+
+    bool useConfigFilename(const std::string& filename);
+    bool useConfigStream(std::ifstream& stream);
+    bool useConfigString(const std::string& config);
+
+    std::string getPsdName() const { return psdname_; }
+
+    void setOptions(const ConversionOptions& options);
 
     void useStylesheetFilename(const std::string& filename);
     void useStylesheetStream(std::ifstream& stream);
     void useStylesheetString(const std::string& sheet);
+    bool hasStylesheet() const { return !stylesheet_.empty(); }
+
+    std::string getIsmrmrdXMLHeader(const ConversionRange& range = ConversionRange());
 
-    std::string getIsmrmrdXMLHeader();
+    SampleFormat resolveSampleFormat(SampleFormat format);
 
-    std::vector<ISMRMRD::Acquisition> getAcquisitions(unsigned int view_num);
+    bool compareHeaderPaths(unsigned int iterations, std::ostream& report);
+
+    std::vector<ISMRMRD::Acquisition> getAcquisitions(const ConversionRange& range = ConversionRange());
+    void convertAcquisitions(const ConversionRange& range, AcquisitionSink& sink);
+    FollowStatistics followAcquisitions(const ConversionRange& range, AcquisitionSink& sink,
+                                        const FollowOptions& options,
+                                        const VolumeTracker::VolumeCallback& onVolume = VolumeTracker::VolumeCallback());
 
     std::string getReconConfigName(void);
 
+    std::shared_ptr<const PacketIndex> getPacketIndex(bool scanIfMissing=true);
+
     std::string ge_header_to_xml(GERecon::Legacy::LxDownloadDataPointer lxData,
                                  GERecon::Control::ProcessingControlPointer processingControl);
 private:
@@ -69,12 +90,35 @@ private:
     GERawConverter(const GERawConverter& other);
     GERawConverter& operator=(const GERawConverter& other);
 
+    explicit GERawConverter(bool logging);
+    void openRawFile(const std::string& rawFilePath);
+
+    std::string getNativeXMLHeader(NativeHeaderBuilder::Mapping mapping);
+    std::string getXsltXMLHeader();
+
+    void checkRange(const ConversionRange& range, bool countVolumes);
+    unsigned int countVolumes(const PacketIndex& packets) const;
+    unsigned int oversamplingFactor() const;
+    std::unique_ptr<OversamplingRemoval> removeOversampling(AcquisitionSink& sink);
+
+    std::shared_ptr<struct _xmlDoc> ge_header_to_doc(GERecon::Legacy::LxDownloadDataPointer lxData,
+                                                     GERecon::Control::ProcessingControlPointer processingControl);
+    template <typename Writer>
+    void writeHeaderXML(Writer& writer, GERecon::Legacy::LxDownloadDataPointer lxData,
+                        GERecon::Control::ProcessingControlPointer processingControl,
+                        const HeaderReferences& refs);
+
+    bool useConfig(const std::string& config, const std::string& url);
     bool validateConfig(std::shared_ptr<struct _xmlDoc> config_doc);
     bool trySequenceMapping(std::shared_ptr<struct _xmlDoc> doc, struct _xmlNode* mapping);
 
+    std::string rawFilePath_;
     std::string psdname_;
     std::string recon_config_;
     std::string stylesheet_;
+    NativeHeaderBuilder::Mapping nativeMapping_;
+    HeaderReferences headerReferences_;
+    ConversionOptions options_;
 
     GERecon::Legacy::PfilePointer pfile_;
 
@@ -82,6 +126,8 @@ private:
     GERecon::Legacy::LxDownloadDataPointer lxData_;
     GERecon::Control::ProcessingControlPointer processingControl_;
     int rawObjectType_; // to allow reference to a P-File or ScanArchive object
+    bool headerOnly_;   // opened by openHeaderOnly(), without a plugin
+    std::shared_ptr<ConversionContext> context_;
     std::shared_ptr<GEToIsmrmrd::SequenceConverter> converter_;
 
     logstream log_;
@@ -0,0 +1,324 @@
+/** @file GadgetronSink.cpp */
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "GadgetronSink.h"
+
+namespace GEToIsmrmrd {
+
+GadgetronSink::GadgetronSink(const std::string& host, unsigned short port, size_t bufferBytes)
+    : socket_(-1)
+    , bufferBytes_(bufferBytes)
+    , count_(0)
+    , sent_(0)
+    , received_(0)
+    , closed_(false)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::string const service = std::to_string(port);
+    struct addrinfo* addresses = NULL;
+    int const status = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+    if (status != 0) {
+        throw std::runtime_error("Failed to resolve " + host + ": " + gai_strerror(status));
+    }
+
+    int error = 0;
+    for (struct addrinfo* a = addresses ; a != NULL && socket_ < 0 ; a = a->ai_next) {
+        socket_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (socket_ < 0) {
+            error = errno;
+            continue;
+        }
+        if (connect(socket_, a->ai_addr, a->ai_addrlen) != 0) {
+            error = errno;
+            ::close(socket_);
+            socket_ = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (socket_ < 0) {
+        throw std::runtime_error("Failed to connect to " + host + ":" + service + ": " + strerror(error));
+    }
+
+    // Sends are already batched in the buffer, so don't hold back the last partial segment
+    int const on = 1;
+    setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    buffer_.reserve(bufferBytes_);
+    receiver_ = std::thread(&GadgetronSink::receive, this);
+}
+
+GadgetronSink::~GadgetronSink()
+{
+    if (socket_ >= 0) {
+        // Unblocks the receiver thread
+        shutdown(socket_, SHUT_RDWR);
+    }
+    if (receiver_.joinable()) {
+        receiver_.join();
+    }
+    if (socket_ >= 0) {
+        ::close(socket_);
+    }
+}
+
+void GadgetronSink::sendConfigName(const std::string& name)
+{
+    if (name.size() >= CONFIG_NAME_LENGTH) {
+        throw std::runtime_error("Gadgetron configuration name too long: " + name);
+    }
+
+    char field[CONFIG_NAME_LENGTH];
+    memset(field, 0, sizeof(field));
+    memcpy(field, name.data(), name.size());
+
+    appendId(MESSAGE_CONFIG_FILE);
+    append(field, sizeof(field));
+    flush();
+}
+
+void GadgetronSink::sendHeader(const std::string& xml)
+{
+    // The length counts the terminating null, which is sent too
+    uint32_t const length = xml.size() + 1;
+
+    appendId(MESSAGE_PARAMETER_SCRIPT);
+    append(&length, sizeof(length));
+    append(xml.c_str(), length);
+    flush();
+}
+
+void GadgetronSink::consume(const ISMRMRD::Acquisition& acq)
+{
+    appendId(MESSAGE_ACQUISITION);
+    append(&acq.getHead(), sizeof(ISMRMRD::ISMRMRD_AcquisitionHeader));
+    append(acq.getTrajPtr(), acq.getTrajSize());
+    append(acq.getDataPtr(), acq.getDataSize());
+    count_++;
+}
+
+void GadgetronSink::flush()
+{
+    if (!buffer_.empty()) {
+        sendAll(buffer_.data(), buffer_.size());
+        sent_ += buffer_.size();
+        buffer_.clear();
+    }
+}
+
+void GadgetronSink::close()
+{
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+
+    appendId(MESSAGE_CLOSE);
+    flush();
+
+    // Nothing more is sent; the endpoint closes the connection once its results are out
+    shutdown(socket_, SHUT_WR);
+    receiver_.join();
+
+    if (!receiveError_.empty()) {
+        throw std::runtime_error("Failed to receive from Gadgetron: " + receiveError_);
+    }
+}
+
+void GadgetronSink::parseAddress(const std::string& address, std::string& host, unsigned short& port)
+{
+    size_t const colon = address.find_last_of(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+        throw std::invalid_argument("Gadgetron address must be host:port, not " + address);
+    }
+
+    char* end = NULL;
+    unsigned long const number = strtoul(address.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || number == 0 || number > 65535) {
+        throw std::invalid_argument("Invalid Gadgetron port in " + address);
+    }
+
+    host = address.substr(0, colon);
+    port = static_cast<unsigned short>(number);
+}
+
+void GadgetronSink::append(const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    if (buffer_.size() + size > bufferBytes_) {
+        flush();
+    }
+    if (size > bufferBytes_) {
+        sendAll(bytes, size);
+        sent_ += size;
+        return;
+    }
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+}
+
+void GadgetronSink::appendId(uint16_t id)
+{
+    append(&id, sizeof(id));
+}
+
+void GadgetronSink::sendAll(const char* data, size_t size)
+{
+    while (size > 0) {
+        // MSG_NOSIGNAL: a closed connection is reported as EPIPE instead of killing the process
+        ssize_t const n = send(socket_, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Failed to send to Gadgetron: ") + strerror(errno));
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+/**
+ * Bytes of one sample of an ISMRMRD image data type, or 0 if it is not one
+ */
+static size_t sampleBytes(uint16_t dataType)
+{
+    switch (dataType) {
+        case ISMRMRD::ISMRMRD_USHORT:
+        case ISMRMRD::ISMRMRD_SHORT:
+            return 2;
+        case ISMRMRD::ISMRMRD_UINT:
+        case ISMRMRD::ISMRMRD_INT:
+        case ISMRMRD::ISMRMRD_FLOAT:
+            return 4;
+        case ISMRMRD::ISMRMRD_DOUBLE:
+        case ISMRMRD::ISMRMRD_CXFLOAT:
+            return 8;
+        case ISMRMRD::ISMRMRD_CXDOUBLE:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// Larger images are taken for a corrupt stream rather than allocated
+static const uint64_t MAX_IMAGE_BYTES = uint64_t(1) << 32;
+
+/**
+ * Parses what the endpoint sends until it closes the connection
+ */
+void GadgetronSink::receive()
+{
+    try {
+        uint16_t id;
+        while (receiveExactly(&id, sizeof(id), true)) {
+            messages_[id]++;
+
+            if (id == MESSAGE_IMAGE) {
+                receiveImage();
+            } else if (id == MESSAGE_TEXT) {
+                uint32_t length;
+                receiveExactly(&length, sizeof(length), false);
+                std::string text(length, '\0');
+                receiveExactly(&text[0], length, false);
+                texts_.push_back(text);
+            } else if (id != MESSAGE_CLOSE) {
+                // Its length is unknown, so nothing after it can be parsed
+                char discard[65536];
+                ssize_t n;
+                while ((n = recv(socket_, discard, sizeof(discard), 0)) != 0) {
+                    if (n > 0) {
+                        received_ += n;
+                    } else if (errno != EINTR) {
+                        throw std::runtime_error(strerror(errno));
+                    }
+                }
+                return;
+            }
+        }
+    } catch (const std::exception& e) {
+        receiveError_ = e.what();
+    }
+}
+
+/**
+ * Reads size bytes
+ *
+ * @return false if the endpoint closed the connection before the first byte
+ *         of a message, which is the end of its stream
+ * @throws std::runtime_error if it closed it anywhere else, or reading failed
+ */
+bool GadgetronSink::receiveExactly(void* data, size_t size, bool atMessageStart)
+{
+    char* bytes = static_cast<char*>(data);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t const n = recv(socket_, bytes + done, size - done, 0);
+        if (n > 0) {
+            done += n;
+            received_ += n;
+        } else if (n == 0) {
+            if (done == 0 && atMessageStart) {
+                return false;
+            }
+            throw std::runtime_error("connection closed in the middle of a message");
+        } else if (errno != EINTR) {
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads an image message after its identifier: the ISMRMRD image header, the
+ * length of its attributes as 64 bits, the attributes and the samples
+ */
+void GadgetronSink::receiveImage()
+{
+    GadgetronImage image;
+    receiveExactly(&image.head, sizeof(image.head), false);
+
+    uint64_t attributesLength;
+    receiveExactly(&attributesLength, sizeof(attributesLength), false);
+    if (attributesLength > MAX_IMAGE_BYTES) {
+        throw std::runtime_error("image attributes of " + std::to_string(attributesLength) + " bytes");
+    }
+    image.attributes.resize(attributesLength);
+    receiveExactly(&image.attributes[0], attributesLength, false);
+
+    // The attributes may be sent with a terminating null
+    while (!image.attributes.empty() && image.attributes[image.attributes.size() - 1] == '\0') {
+        image.attributes.erase(image.attributes.size() - 1);
+    }
+
+    uint64_t bytes = sampleBytes(image.head.data_type);
+    if (bytes == 0) {
+        throw std::runtime_error("image of unknown data type " + std::to_string(image.head.data_type));
+    }
+    uint64_t const dimensions[] = { image.head.matrix_size[0], image.head.matrix_size[1],
+                                    image.head.matrix_size[2], image.head.channels };
+    for (uint64_t dimension : dimensions) {
+        bytes *= dimension;
+        if (bytes > MAX_IMAGE_BYTES) {
+            throw std::runtime_error("image larger than " + std::to_string(MAX_IMAGE_BYTES) + " bytes");
+        }
+    }
+
+    image.data.resize(bytes);
+    receiveExactly(image.data.data(), bytes, false);
+    images_.push_back(std::move(image));
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,145 @@
+/** @file GadgetronSink.h */
+#ifndef GADGETRON_SINK_H
+#define GADGETRON_SINK_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+
+namespace GEToIsmrmrd {
+
+/** An image the endpoint sent back, as it arrived */
+struct GadgetronImage
+{
+    ISMRMRD::ISMRMRD_ImageHeader head;
+    std::string attributes;     ///< ISMRMRD meta attributes, as XML
+    std::vector<char> data;     ///< samples of head.data_type, channel by channel
+};
+
+/**
+ * Streams a conversion to a Gadgetron over TCP, as the Gadgetron ISMRMRD client does.
+ *
+ * The configuration to run and the ISMRMRD header are sent first, then each
+ * acquisition as it is consumed, without an intermediate HDF5 file. Messages
+ * are buffered and written in large sends.
+ *
+ * What the endpoint sends back is read on a separate thread, so that it can
+ * never stall the endpoint while acquisitions are still being sent. Images are
+ * kept for images(), text messages are kept for texts(), and every message is
+ * counted by its identifier. The rest of a stream after a message of any other
+ * kind cannot be parsed, and is read and discarded.
+ */
+class GadgetronSink : public AcquisitionSink
+{
+public:
+    /** Gadgetron message identifiers */
+    enum MessageId
+    {
+        MESSAGE_CONFIG_FILE      = 1,    ///< name of a configuration installed on the endpoint
+        MESSAGE_CONFIG_SCRIPT    = 2,    ///< configuration XML
+        MESSAGE_PARAMETER_SCRIPT = 3,    ///< ISMRMRD header XML
+        MESSAGE_CLOSE            = 4,    ///< end of the stream
+        MESSAGE_TEXT             = 5,    ///< log text from the endpoint
+        MESSAGE_ACQUISITION      = 1008, ///< one ISMRMRD acquisition
+        MESSAGE_IMAGE            = 1022  ///< one ISMRMRD image, with its meta attributes
+    };
+
+    /** Length of the configuration name field of MESSAGE_CONFIG_FILE */
+    static const size_t CONFIG_NAME_LENGTH = 1024;
+
+    /**
+     * Connects to the endpoint
+     *
+     * @param host Name or address of the endpoint
+     * @param port TCP port, e.g. 9002
+     * @param bufferBytes Bytes buffered before a send
+     * @throws std::runtime_error if the endpoint cannot be reached
+     */
+    GadgetronSink(const std::string& host, unsigned short port, size_t bufferBytes = 1 << 20);
+
+    /** Closes the connection, without the close message if close() was not called */
+    ~GadgetronSink();
+
+    /** Selects a configuration installed on the endpoint by name */
+    void sendConfigName(const std::string& name);
+
+    /** Sends the ISMRMRD XML header, which must follow the configuration */
+    void sendHeader(const std::string& xml);
+
+    void consume(const ISMRMRD::Acquisition& acq);
+
+    /** Sends what is buffered */
+    void flush();
+
+    /**
+     * Sends the close message, then waits until the endpoint has finished and
+     * closed the connection
+     *
+     * @throws std::runtime_error if sending or receiving failed, or the
+     *         endpoint sent back a truncated or invalid message
+     */
+    void close();
+
+    /** Acquisitions sent so far */
+    size_t count() const { return count_; }
+
+    /** Bytes sent so far, including buffered ones */
+    size_t bytesSent() const { return sent_ + buffer_.size(); }
+
+    /** Bytes received from the endpoint so far */
+    size_t bytesReceived() const { return received_; }
+
+    /** Images the endpoint sent back; complete once close() has returned */
+    const std::vector<GadgetronImage>& images() const { return images_; }
+
+    /** Text messages the endpoint sent back; complete once close() has returned */
+    const std::vector<std::string>& texts() const { return texts_; }
+
+    /** Number of messages received by identifier; complete once close() has returned */
+    const std::map<uint16_t, size_t>& messagesReceived() const { return messages_; }
+
+    /**
+     * Splits an endpoint "host:port" into its parts
+     *
+     * @throws std::invalid_argument if it has no valid port
+     */
+    static void parseAddress(const std::string& address, std::string& host, unsigned short& port);
+
+private:
+    // Non-copyable
+    GadgetronSink(const GadgetronSink& other);
+    GadgetronSink& operator=(const GadgetronSink& other);
+
+    void append(const void* data, size_t size);
+    void appendId(uint16_t id);
+    void sendAll(const char* data, size_t size);
+    void receive();
+    bool receiveExactly(void* data, size_t size, bool atMessageStart);
+    void receiveImage();
+
+    int socket_;
+    size_t bufferBytes_;
+    std::vector<char> buffer_;
+    size_t count_;
+    size_t sent_;
+
+    std::thread receiver_;
+    std::atomic<size_t> received_;
+    std::string receiveError_;          // why receiving stopped early; read after the receiver is joined
+    std::vector<GadgetronImage> images_;
+    std::vector<std::string> texts_;
+    std::map<uint16_t, size_t> messages_;
+    bool closed_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* GADGETRON_SINK_H */
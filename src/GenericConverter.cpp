@@ -1,11 +1,16 @@
 
 /** @file GenericConverter.cpp */
+#include <algorithm>
+#include <exception>
 #include <iostream>
 #include <iomanip>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <stdexcept>
 
 #include "GenericConverter.h"
+#include "Hdf5Lock.h"
 
 struct LOADTEST {
    LOADTEST() { std::cerr << __FILE__ << ": shared object loaded"   << std::endl; }
@@ -14,7 +19,7 @@ struct LOADTEST {
 
 namespace GEToIsmrmrd {
 
-int GenericConverter::get_view_idx(GERecon::Control::ProcessingControlPointer processingControl,
+int GenericConverter::get_view_idx(const ScanParameters &scan,
                                    unsigned int view_num, ISMRMRD::EncodingCounters &idx)
 {
     // set all the ones we don't care about to zero
@@ -28,8 +33,8 @@ int GenericConverter::get_view_idx(GERecon::Control::ProcessingControlPointer pr
         idx.user[n] = 0;
     }
 
-    unsigned int nframes   = processingControl->Value<int>("AcquiredYRes");
-    unsigned int numSlices = processingControl->Value<int>("NumSlices");
+    unsigned int nframes   = scan.acquiredYRes;
+    unsigned int numSlices = scan.numSlices;
 
     idx.repetition = view_num / (numSlices * (1 + nframes));
 
@@ -43,139 +48,288 @@ int GenericConverter::get_view_idx(GERecon::Control::ProcessingControlPointer pr
 
 
 
-std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
-                                                                    unsigned int acqMode)
+/**
+ * Claims the Pfile of a converter for one conversion, if no other conversion
+ * holds it, until the claim goes out of scope
+ */
+class PfileClaim
 {
-    std::vector<ISMRMRD::Acquisition> acqs;
+public:
+    explicit PfileClaim(std::atomic<bool> &inUse) : inUse_(inUse), claimed_(!inUse.exchange(true)) { }
+    ~PfileClaim() { if (claimed_) inUse_ = false; }
 
-    const GERecon::Control::ProcessingControlPointer processingControl(pfile->CreateOrchestraProcessingControl());
-    unsigned int nPhases   = processingControl->Value<int>("AcquiredYRes");
-    unsigned int nEchoes   = processingControl->Value<int>("NumEchoes");
-    unsigned int nChannels = processingControl->Value<int>("NumChannels");
-    unsigned int numSlices = processingControl->Value<int>("NumSlices");
+    bool claimed() const { return claimed_; }
 
-    // Make number of acquisitions to be converted
-    acqs.resize(numSlices * nEchoes * nPhases);
+private:
+    // Non-copyable
+    PfileClaim(const PfileClaim& other);
+    PfileClaim& operator=(const PfileClaim& other);
+
+    std::atomic<bool> &inUse_;
+    bool const claimed_;
+};
 
-    unsigned int acq_num = 0;
 
-    // Orchestra API provides size in bytes.
-    // frame_size is the number of complex points in a single channel
-    size_t frame_size = processingControl->Value<int>("AcquiredXRes");
 
-    for (int sliceCount = 0 ; sliceCount < numSlices ; sliceCount++)
+void GenericConverter::convertAcquisitions(const ConversionContext &context,
+                                           GERecon::Legacy::PfilePointer &pfile,
+                                           const ConversionRange &range, AcquisitionSink &sink)
+{
+    const ScanParameters &scan = context.scan;
+    unsigned int nPhases   = scan.acquiredYRes;
+    unsigned int nEchoes   = scan.numEchoes;
+    unsigned int numSlices = scan.numSlices;
+
+    // KSpaceData holds a single volume
+    if (!range.hasVolume(0)) {
+        return;
+    }
+
+    // KSpaceData reads any slice, echo and channel directly, so only the
+    // selected ones are read from the P-file
+    std::vector<unsigned int> const slices   = range.selectedSlices(numSlices);
+    std::vector<unsigned int> const echoes   = range.selectedEchoes(nEchoes);
+    std::vector<unsigned int> const channels = range.selectedChannels(scan.numChannels);
+
+    // Every (slice, echo) block is independent of the others, so blocks are
+    // converted in waves of one block per thread.  Each wave is handed to the
+    // sink in serial (slice, echo, phase) order, so the output does not depend
+    // on the number of threads.
+    int const numBlocks = slices.size() * echoes.size();
+    int const numThreads = resolveThreadCount(options_.numThreads);
+    int const waveSize = std::min(numThreads, std::max(numBlocks, 1));
+
+    // One time stamp for the whole conversion, so that it is reproducible
+    uint32_t const timeStamp = time(NULL); // TODO: can we get a timestamp?
+
+    std::vector<std::vector<ISMRMRD::Acquisition> > wave(waveSize, std::vector<ISMRMRD::Acquisition>(nPhases));
+
+    // Orchestra does not document a Pfile as thread-safe, so each Pfile is
+    // read by one thread at a time. Opening a Pfile loads every acquisition
+    // of the raw file, so a reader of its own for every thread would multiply
+    // the memory and I/O of a conversion by --threads. Instead, at most
+    // options_.pfileReaders Pfiles are read at once, and the threads of a
+    // wave share them in turn; the copying and unchopping after each read
+    // still runs on every thread. The Pfile passed in is the first reader,
+    // unless another conversion on this converter is reading through it
+    // already, e.g. one slice of a batch conversion. Further readers are only
+    // opened when a wave has threads to read through them.
+    PfileClaim const claim(pfileInUse_);
+    int const numReaders = std::min(waveSize, std::max((int) options_.pfileReaders, 1));
+    std::vector<GERecon::Legacy::PfilePointer> readers(numReaders);
+    std::vector<std::mutex> readerLocks(numReaders);
+    for (int r = 0 ; r < numReaders ; r++)
     {
-        for (int echoCount = 0 ; echoCount < nEchoes ; echoCount++)
+        readers[r] = (r == 0 && claim.claimed()) ? pfile
+            : GERecon::Legacy::Pfile::Create(context.rawFilePath, GERecon::Legacy::Pfile::AllAvailableAcquisitions,
+                                             GERecon::AnonymizationPolicy(GERecon::AnonymizationPolicy::None));
+    }
+
+    for (int waveStart = 0 ; waveStart < numBlocks ; waveStart += waveSize)
+    {
+        int const blocksInWave = std::min(waveSize, numBlocks - waveStart);
+
+        std::exception_ptr error;
+
+        #pragma omp parallel for num_threads(blocksInWave) schedule(static, 1) if (blocksInWave > 1)
+        for (int w = 0 ; w < blocksInWave ; w++)
+        {
+            try
+            {
+                int const block = waveStart + w;
+                convertPfileBlock(scan, readers[w % numReaders], readerLocks[w % numReaders],
+                                  slices[block / echoes.size()], echoes[block % echoes.size()],
+                                  channels, timeStamp, wave[w]);
+            }
+            catch (...)
+            {
+                #pragma omp critical(GEToIsmrmrdPfileError)
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        for (int w = 0 ; w < blocksInWave ; w++)
         {
             for (int phaseCount = 0 ; phaseCount < nPhases ; phaseCount++)
             {
-                // Grab a reference to the acquisition
-                ISMRMRD::Acquisition& acq = acqs.at(acq_num);
+                sink.consume(wave[w][phaseCount]);
+            }
+        }
+    }
+}
 
-                // Set size of this data frame to receive raw data
-                acq.resize(frame_size, nChannels, 0);
-                acq.clearAllFlags();
 
-                // Initialize the encoding counters for this acquisition.
-                ISMRMRD::EncodingCounters idx;
-                get_view_idx(processingControl, 0, idx);
 
-                idx.slice = sliceCount;
-                idx.contrast  = echoCount;
-                idx.kspace_encode_step_1 = phaseCount;
+void GenericConverter::convertPfileBlock(const ScanParameters &scan, GERecon::Legacy::PfilePointer &pfile,
+                                         std::mutex &pfileLock, unsigned int sliceCount, unsigned int echoCount,
+                                         const std::vector<unsigned int> &channels, uint32_t timeStamp,
+                                         std::vector<ISMRMRD::Acquisition> &acqs)
+{
+    unsigned int nPhases   = scan.acquiredYRes;
+    unsigned int nEchoes   = scan.numEchoes;
+    unsigned int nChannels = scan.numChannels;
+    unsigned int nSelected = channels.size();
 
-                acq.idx() = idx;
+    // Acquisitions are numbered in serial (slice, echo, phase) order
+    unsigned int acq_num = (sliceCount * nEchoes + echoCount) * nPhases;
 
-                // Fill in the rest of the header
-                // acq.measurement_uid() = pfile->RunNumber();
-                acq.scan_counter() = acq_num;
-                acq.acquisition_time_stamp() = time(NULL); // TODO: can we get a timestamp?
-                for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
-                    acq.physiology_time_stamp()[p] = 0;
-                }
-                acq.available_channels() = nChannels;
-                acq.discard_pre() = 0;
-                acq.discard_post() = 0;;
-                acq.center_sample() = frame_size/2;
-                acq.encoding_space_ref() = 0;
-                //acq.sample_time_us() = pfile->sample_time * 1e6;
-
-                for (int ch = 0 ; ch < nChannels ; ch++) {
-                    acq.setChannelActive(ch);
-                }
+    // Orchestra API provides size in bytes.
+    // frame_size is the number of complex points in a single channel
+    size_t frame_size = scan.acquiredXRes;
+
+    bool const chopY = scan.chopY;
+
+    // K-space matrices of every selected channel for this slice / echo
+    std::vector<ComplexFloatMatrix> channelData(nSelected);
+
+    // Get data from P-file using KSpaceData object.
+    //
+    // VR + JAD - 2016.01.15 - looking at various schemes to stride and read in
+    // K-space data.
+    //
+    // ViewData - will read in "acquisitions", including baselines, starting at
+    //            index 0, going up to slices * echo * (view + baselines)
+    //
+    // KSpaceData (slice, echo, channel, phase = 0) - reads in data, assuming "GE
+    //            native" data order in P-file, gives one slice / image worth of
+    //            K-space data, with baseline views automagically excluded.
+    //
+    // KSpaceData can return different numerical data types.  Picked float to
+    // be consistent with ISMRMRD data type.  This implementation of KSpaceData
+    // is used for data acquired in the "native" GE order.
+    //
+    // Each slice / echo / channel matrix is read once here, and every phase
+    // encoding line is copied out of it below.  pfile may be shared with other
+    // threads of the wave, so it is only read while pfileLock is held.
+    {
+        std::lock_guard<std::mutex> lock(pfileLock);
+        for (int c = 0 ; c < nSelected ; c++)
+        {
+            channelData[c].reference(pfile->KSpaceData<float>(sliceCount, echoCount, channels[c]));
+        }
+    }
 
-                setISMRMRDSliceVectors(processingControl, acq);
-
-                // Set first acquisition flag
-                if (idx.kspace_encode_step_1 == 0)
-                    acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
-
-                // Set last acquisition flag
-                if (idx.kspace_encode_step_1 == nPhases - 1)
-                    acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
-
-                // Get data from P-file using KSpaceData object, and copy
-                // into ISMRMRD space.
-                for (int channelID = 0 ; channelID < nChannels ; channelID++)
-                {
-                    // VR + JAD - 2016.01.15 - looking at various schemes to stride and read in
-                    // K-space data.
-                    //
-                    // ViewData - will read in "acquisitions", including baselines, starting at
-                    //            index 0, going up to slices * echo * (view + baselines)
-                    //
-                    // KSpaceData (slice, echo, channel, phase = 0) - reads in data, assuming "GE
-                    //            native" data order in P-file, gives one slice / image worth of
-                    //            K-space data, with baseline views automagically excluded.
-                    //
-                    // KSpaceData can return different numerical data types.  Picked float to
-                    // be consistent with ISMRMRD data type.  This implementation of KSpaceData
-                    // is used for data acquired in the "native" GE order.
-
-                    auto kData = pfile->KSpaceData<float>(sliceCount, echoCount, channelID);
-
-                    if (processingControl->Value<bool>("ChopY") == 0) {
-                       if (idx.kspace_encode_step_1 % 2 == 1) {
-                          kData *= -1.0f;
-                       }
-                    }
-
-                    for (int i = 0 ; i < frame_size ; i++)
-                    {
-                       acq.data(i, channelID) = kData(i, phaseCount);
-                    }
-                }
+    for (int phaseCount = 0 ; phaseCount < nPhases ; phaseCount++)
+    {
+        ISMRMRD::Acquisition &acq = acqs.at(phaseCount);
+
+        // Set size of this data frame to receive raw data
+        acq.resize(frame_size, nSelected, 0);
+        acq.clearAllFlags();
+
+        // Initialize the encoding counters for this acquisition.
+        ISMRMRD::EncodingCounters idx;
+        get_view_idx(scan, 0, idx);
+
+        idx.slice = sliceCount;
+        idx.contrast  = echoCount;
+        idx.kspace_encode_step_1 = phaseCount;
+
+        acq.idx() = idx;
+
+        // Fill in the rest of the header
+        // acq.measurement_uid() = pfile->RunNumber();
+        acq.scan_counter() = acq_num;
+        acq.acquisition_time_stamp() = timeStamp;
+        for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
+            acq.physiology_time_stamp()[p] = 0;
+        }
+        acq.available_channels() = nChannels;
+        acq.discard_pre() = 0;
+        acq.discard_post() = 0;;
+        acq.center_sample() = frame_size/2;
+        acq.encoding_space_ref() = 0;
+        //acq.sample_time_us() = pfile->sample_time * 1e6;
+
+        for (int c = 0 ; c < nSelected ; c++) {
+            acq.setChannelActive(channels[c]);
+        }
+
+        setISMRMRDSliceVectors(scan, acq);
+
+        // Set first acquisition flag
+        if (idx.kspace_encode_step_1 == 0)
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+
+        // Set last acquisition flag
+        if (idx.kspace_encode_step_1 == nPhases - 1)
+            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+
+        // Unchop odd lines of RF-chopped data while copying them into
+        // ISMRMRD space.
+        float const sign = (!chopY && (phaseCount % 2 == 1)) ? -1.0f : 1.0f;
+
+        for (int c = 0 ; c < nSelected ; c++)
+        {
+            const ComplexFloatMatrix& kData = channelData[c];
 
-                acq_num++;
-            } // end of phaseCount loop
-        } // end of echoCount loop
-    } // end of sliceCount loop
+            for (int i = 0 ; i < frame_size ; i++)
+            {
+               acq.data(i, c) = sign * kData(i, phaseCount);
+            }
+        }
 
-    return acqs;
+        acq_num++;
+    } // end of phaseCount loop
 }
 
 
 
-std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::ScanArchivePointer &scanArchivePtr,
-                                                                    unsigned int acqMode)
+void GenericConverter::convertAcquisitions(const ConversionContext &context,
+                                           GERecon::ScanArchivePointer &scanArchivePtr,
+                                           const ConversionRange &range, AcquisitionSink &sink)
 {
-   std::vector<ISMRMRD::Acquisition> acqs;
+   const ScanParameters &scan = context.scan;
 
-   GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
-   GERecon::Legacy::LxDownloadDataPointer lxData = boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(scanArchivePtr->LoadDownloadData());
-   boost::shared_ptr<GERecon::Legacy::LxControlSource> const controlSource = boost::make_shared<GERecon::Legacy::LxControlSource>(lxData);
-   GERecon::Control::ProcessingControlPointer processingControl = controlSource->CreateOrchestraProcessingControl();
+   // Slice, view and echo of every packet, if already known, so that none are read after the last one in range
+   std::shared_ptr<const PacketIndex> const packets = context.packets;
 
-   int const   packetQuantity = archiveStoragePointer->AvailableControlCount();
+   // Archive reads take the HDF5 lock; acquisitions are handed to the sink without it
+   GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer;
+   Hdf5Release<GERecon::Acquisition::ArchiveStoragePointer> const release(archiveStoragePointer);
+   int packetQuantity = 0;
+   {
+      Hdf5Lock lock;
+      archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
+
+      // ArchiveStorage only steps through packets in order, so packets outside the
+      // range are passed over without reading their data. Without an index, each
+      // packet is described as it is read, and the archive is walked only once.
+      packetQuantity = archiveStoragePointer->AvailableControlCount();
+   }
+   if (packets)
+   {
+      int lastPacket = -1;
+      for (int n = 0 ; n < (int) packets->size() ; n++)
+      {
+         if (selectsPacket(scan, (*packets)[n], range))
+         {
+            lastPacket = n;
+         }
+      }
+      packetQuantity = lastPacket + 1;
+   }
 
    int            packetCount = 0;
    int              dataIndex = 0;
    int                acqType = 0;
-   unsigned int       nPhases = processingControl->Value<int>("AcquiredYRes");
-   unsigned int       nEchoes = processingControl->Value<int>("NumEchoes");
-   unsigned int     nChannels = processingControl->Value<int>("NumChannels");
-   unsigned int     numSlices = processingControl->Value<int>("NumSlices");
-   size_t          frame_size = processingControl->Value<int>("AcquiredXRes");
+   unsigned int       nPhases = scan.acquiredYRes;
+   unsigned int       nEchoes = scan.numEchoes;
+   unsigned int     nChannels = scan.numChannels;
+   unsigned int     numSlices = scan.numSlices;
+   size_t          frame_size = scan.acquiredXRes;
+
+   std::vector<unsigned int> const channels = range.selectedChannels(nChannels);
+   unsigned int     nSelected = channels.size();
+
+   // A single acquisition is filled in and handed to the sink for each image packet
+   ISMRMRD::Acquisition acq;
 
    while (packetCount < packetQuantity)
    {
@@ -183,45 +337,53 @@ std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::Sca
       unsigned int   sliceID = 0;
       unsigned int    viewID = 0;
 
-      GERecon::Acquisition::FrameControlPointer const thisPacket = archiveStoragePointer->NextFrameControl();
-
-      // Need to identify opcode(s) here that will mark acquisition / reference / control
-      if (thisPacket->Control().Opcode() != GERecon::Acquisition::ScanControlOpcode)
+      GERecon::Acquisition::FrameControlPointer thisPacket;
       {
-         GERecon::Acquisition::ProgrammableControlPacket const packetContents = thisPacket->Control().Packet().As<GERecon::Acquisition::ProgrammableControlPacket>();
+         Hdf5Lock lock;
+         thisPacket = archiveStoragePointer->NextFrameControl();
+      }
+      PacketIndexEntry const entry = packets ? (*packets)[packetCount] : PacketIndex::describe(thisPacket, packetCount, context);
 
-         const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
+      if (thisPacket->Control().Opcode() != entry.opcode)
+      {
+         throw std::runtime_error("GenericConverter: packet index does not match the archive");
+      }
 
-         viewID  = GERecon::Acquisition::GetPacketValue(packetContents.viewNumH,  packetContents.viewNumL);
-         // Convert acquired slice index to spatial / geometric slice index
-         sliceID = sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH, packetContents.sliceNumL));
+      // Need to identify opcode(s) here that will mark acquisition / reference / control
+      if (!entry.isScanControl())
+      {
+         viewID  = entry.firstView;
+         // Already converted from acquired to spatial / geometric slice index
+         sliceID = entry.slice;
 
          if ((viewID < 1) || (viewID > nPhases))
          {
             acqType = GERecon::Acquisition::BaselineFrame;
             // nothing else to be done here for basic 2D case
          }
+         else if (!selectsPacket(scan, entry, range))
+         {
+            // Counted, so that scan counters match those of a full conversion
+            dataIndex++;
+         }
          else
          {
             acqType = GERecon::Acquisition::ImageFrame;
 
-            acqs.resize(dataIndex + 1);
-
+            std::unique_lock<std::recursive_mutex> hdf5Lock(Hdf5Lock::mutex());
             auto kData = thisPacket->Data();
-
-            // Grab a reference to the acquisition
-            ISMRMRD::Acquisition& acq = acqs.at(dataIndex);
+            hdf5Lock.unlock();
 
             // Set size of this data frame to receive raw data
-            acq.resize(frame_size, nChannels, 0);
+            acq.resize(frame_size, nSelected, 0);
             acq.clearAllFlags();
 
             // Initialize the encoding counters for this acquisition.
             ISMRMRD::EncodingCounters idx;
-            get_view_idx(processingControl, viewID, idx);
+            get_view_idx(scan, viewID, idx);
 
             idx.slice                  = sliceID;
-            idx.contrast               = packetContents.echoNum;
+            idx.contrast               = entry.echo;
             idx.kspace_encode_step_1   = viewID - 1;
 
             acq.idx() = idx;
@@ -240,11 +402,11 @@ std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::Sca
             acq.encoding_space_ref()   = 0;
             // acq.sample_time_us()       = pfile->sample_time * 1e6;
 
-            for (int ch = 0 ; ch < nChannels ; ch++) {
-               acq.setChannelActive(ch);
+            for (int c = 0 ; c < nSelected ; c++) {
+               acq.setChannelActive(channels[c]);
             }
 
-            setISMRMRDSliceVectors(processingControl, acq);
+            setISMRMRDSliceVectors(scan, acq);
 
             // Set first acquisition flag
             if (idx.kspace_encode_step_1 == 0)
@@ -254,13 +416,13 @@ std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::Sca
             if (idx.kspace_encode_step_1 == nPhases - 1)
                acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
 
-            if (processingControl->Value<bool>("ChopY") == 0) {
+            if (scan.chopY == 0) {
                if (idx.kspace_encode_step_1 % 2 == 1) {
                   kData *= -1.0f;
                }
             }
 
-            for (int channelID = 0 ; channelID < nChannels ; channelID++)
+            for (int c = 0 ; c < nSelected ; c++)
             {
                for (int i = 0 ; i < frame_size ; i++)
                {
@@ -270,34 +432,96 @@ std::vector<ISMRMRD::Acquisition> GenericConverter::getAcquisitions(GERecon::Sca
                   // can be programatically determined, and if so, use
                   // it. Will be needed for cases where multiple lines
                   // of data are contained in a single packet.
-		  acq.data(i, channelID) = kData(i, channelID, 0);
+		  acq.data(i, c) = kData(i, channels[c], 0);
                }
             }
 
+            sink.consume(acq);
+
             dataIndex++;
          }
       }
 
       packetCount++;
    }
+}
+
+
+
+size_t GenericConverter::estimateAcquisitionCount(const ConversionContext &context,
+                                                 GERecon::Legacy::PfilePointer &pfile,
+                                                 const ConversionRange &range)
+{
+   if (!range.hasVolume(0))
+   {
+      return 0;
+   }
 
-   return acqs;
+   // One acquisition per phase encoding line of every selected slice and echo
+   return range.selectedSlices(context.scan.numSlices).size() *
+          range.selectedEchoes(context.scan.numEchoes).size() * context.scan.acquiredYRes;
 }
 
 
 
-int GenericConverter::setISMRMRDSliceVectors(GERecon::Control::ProcessingControlPointer processingControl,
-                                             ISMRMRD::Acquisition& acq)
+size_t GenericConverter::estimateAcquisitionCount(const ConversionContext &context,
+                                                 GERecon::ScanArchivePointer &scanArchivePtr,
+                                                 const ConversionRange &range)
 {
-   static geRawDataSliceVectors_t sliceVectors;
+   if (context.packets)
+   {
+      // One acquisition per selected packet of an image view; baseline and scan control packets produce none
+      size_t count = 0;
+      for (size_t n = 0 ; n < context.packets->size() ; n++)
+      {
+         if (selectsPacket(context.scan, (*context.packets)[n], range))
+         {
+            count++;
+         }
+      }
+      return count;
+   }
+
+   // At most one acquisition per control packet; baseline and scan control packets produce none
+   Hdf5Lock lock;
+   GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
+
+   return archiveStoragePointer->AvailableControlCount();
+}
+
 
+
+/**
+ * Whether a packet holds an image view in the range
+ *
+ * Baseline and scan control packets produce no acquisitions, so they are never selected.
+ */
+bool GenericConverter::selectsPacket(const ScanParameters &scan, const PacketIndexEntry &entry,
+                                     const ConversionRange &range)
+{
+   if (entry.isScanControl() || (entry.firstView < 1) || (entry.firstView > (int) scan.acquiredYRes))
+   {
+      return false;
+   }
+
+   ISMRMRD::EncodingCounters idx;
+   get_view_idx(scan, entry.firstView, idx);
+
+   return range.hasSlice(entry.slice) && range.hasEcho(entry.echo) && range.hasVolume(idx.repetition);
+}
+
+
+
+int GenericConverter::setISMRMRDSliceVectors(const ScanParameters &scan,
+                                             ISMRMRD::Acquisition& acq)
+{
    // Patient table off-center
    // TODO: fix the patient table position
    acq.patient_table_position()[0] = 0.0;
    acq.patient_table_position()[1] = 0.0;
    acq.patient_table_position()[2] = 0.0;
 
-   getSliceVectors(processingControl, acq.idx().slice, &sliceVectors);
+   const geRawDataSliceVectors_t sliceVectors = scan.sliceGeometry.vectors(scan.sliceTable, acq.idx().slice);
 
    acq.read_dir()[0]  = sliceVectors.read_dir.x;
    acq.read_dir()[1]  = sliceVectors.read_dir.y;
@@ -317,232 +541,32 @@ int GenericConverter::setISMRMRDSliceVectors(GERecon::Control::ProcessingControl
 
 
 
-int GenericConverter::getSliceVectors(GERecon::Control::ProcessingControlPointer processingControl,
+int GenericConverter::getSliceVectors(const ScanParameters &scan,
                                       unsigned int sliceNumber, geRawDataSliceVectors_t* vecs)
 {
-   float gwp1[3],   gwp2[3],   gwp3[3];
-   float gwp1_0[3], gwp2_0[3], gwp3_0[3];
-
-   const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
-
-   // const GERecon::ImageCorners imageCorners = GERecon::ImageCorners(sliceTable.AcquiredSliceCorners(sliceNumber),
-                                                                    // sliceTable.SliceOrientation(sliceNumber));
-
-   // std::cout << "Slice[" << sliceNumber << "] corners are:    " << sliceTable.AcquiredSliceCorners(sliceNumber) << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] orientation is: " <<   sliceTable.SliceOrientation(sliceNumber)   << std::endl;
-
-   GERecon::SliceCorners sliceCorners = sliceTable.AcquiredSliceCorners(sliceNumber);
-
-   // std::cout << "Slice[" << sliceNumber << "] UL   corner is:   " << sliceCorners.UpperLeft()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UR   corner is:   " << sliceCorners.UpperRight() << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] LL   corner is:   " << sliceCorners.LowerLeft()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UL.x corner is:   " << sliceCorners.UpperLeft().X_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UL.y corner is:   " << sliceCorners.UpperLeft().Y_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UL.z corner is:   " << sliceCorners.UpperLeft().Z_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UR.x corner is:   " << sliceCorners.UpperRight().X_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UR.y corner is:   " << sliceCorners.UpperRight().Y_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] UR.z corner is:   " << sliceCorners.UpperRight().Z_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] LL.x corner is:   " << sliceCorners.LowerLeft().X_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] LL.y corner is:   " << sliceCorners.LowerLeft().Y_mm()  << std::endl;
-   // std::cout << "Slice[" << sliceNumber << "] LL.z corner is:   " << sliceCorners.LowerLeft().Z_mm()  << std::endl;
-
-   /* TODO - need to make sure these are consistent with how they are treated in rotateVectorOnPatient function.
-    *
-    * These did not seem to be consisent.  'patientEntry' seemed okay though looked like it could get much more
-    * complicated.  'patientPosition' required more checking.
-    *
-
-    * int patientEntry    = processingControl->Value<int>("PatientEntry")    - 1;
-    * int patientPosition = processingControl->Value<int>("PatientPosition") - 1;
-
-    * grab the gw_points from this slice's info entry
-    * gwp1_0 = slice_info[sliceNumber].gw_point1;
-    * gwp2_0 = slice_info[sliceNumber].gw_point2;
-    * gwp3_0 = slice_info[sliceNumber].gw_point3;
-
-    */
-
-   int patientEntry, patientPosition;
-
-   // std::cout << "Patient entry: "    << processingControl->Value<int>("PatientEntry")    << std::endl;
-   // std::cout << "Patient position: " << processingControl->Value<int>("PatientPosition") << std::endl;
-
-   switch (processingControl->Value<int>("PatientEntry"))
-   {
-      case 2 :
-         patientEntry = 1;      /* Feet first */
-         break;
-
-      default :
-         patientEntry = 0;      /* Head first */
-   }
-
-   switch (processingControl->Value<int>("PatientPosition"))
-   {
-      case 2 :
-         patientPosition = 1;   /* Prone */
-         break;
-
-      case 4 :
-         patientPosition = 2;   /* Left Decubitus */
-         break;
-
-      case 8 :
-         patientPosition = 3;   /* Right Decubitus */
-         break;
-
-      default :
-         patientPosition = 0;   /* Supine */
-   }
-
-   gwp1_0[0] = sliceCorners.UpperLeft().X_mm();
-   gwp1_0[1] = sliceCorners.UpperLeft().Y_mm();
-   gwp1_0[2] = sliceCorners.UpperLeft().Z_mm();
-
-   gwp2_0[0] = sliceCorners.UpperRight().X_mm();
-   gwp2_0[1] = sliceCorners.UpperRight().Y_mm();
-   gwp2_0[2] = sliceCorners.UpperRight().Z_mm();
-
-   gwp3_0[0] = sliceCorners.LowerLeft().X_mm();
-   gwp3_0[1] = sliceCorners.LowerLeft().Y_mm();
-   gwp3_0[2] = sliceCorners.LowerLeft().Z_mm();
-
-   // rotate each coordinate according to the patient's position
-   // this also puts the coordinates into DICOM/patient coordinate space
-   rotateVectorOnPatient(patientEntry, patientPosition, gwp1_0, gwp1);
-   rotateVectorOnPatient(patientEntry, patientPosition, gwp2_0, gwp2);
-   rotateVectorOnPatient(patientEntry, patientPosition, gwp3_0, gwp3);
-
-   // // Add the Z table offset back to each coordinate
-   // // table_offset_z = image_hdr->ctr_S - (gwp3[2] + gwp2[2]) / 2;
-   // gwp1[2] += pfile->table_offset_z;
-   // gwp2[2] += pfile->table_offset_z;
-   // gwp3[2] += pfile->table_offset_z;
-
-   // calculate the direction cosines from the corners of the plane
-   float read_dir[3];
-   float phase_dir[3];
-   float slice_dir[3];
-   makeDirectionVectors(gwp1, gwp2, gwp3, read_dir, phase_dir, slice_dir);
-   vecs->read_dir.x  = read_dir[0];
-   vecs->read_dir.y  = read_dir[1];
-   vecs->read_dir.z  = read_dir[2];
-   vecs->phase_dir.x = phase_dir[0];
-   vecs->phase_dir.y = phase_dir[1];
-   vecs->phase_dir.z = phase_dir[2];
-   vecs->slice_dir.x = slice_dir[0];
-   vecs->slice_dir.y = slice_dir[1];
-   vecs->slice_dir.z = slice_dir[2];
-   vecs->center.x    = (gwp3[0] + gwp2[0]) / 2.0;
-   vecs->center.y    = (gwp3[1] + gwp2[1]) / 2.0;
-   vecs->center.z    = (gwp3[2] + gwp2[2]) / 2.0;
+   *vecs = scan.sliceGeometry.vectors(scan.sliceTable, sliceNumber);
 
    return 0;
 }
 
 
 
-/**
- * Rotate based on patient position and convert to patient coordinate system
- * by swapping signs of X and Y
- *
- * @param entry 0="Head First", 1="Feet First"
- * @param pos 0="Supine", 1="Prone", 2="Decubitus Left", 3="Decubitus Right"
- * @param in original direction vector
- * @param out rotated direction vector
- * @returns 1 on success, -1 on failure
- */
 int GenericConverter::rotateVectorOnPatient(unsigned int entry, unsigned int pos,
                                             float in[3], float out[3])
 {
-   if (entry > 1) {
-      return -1;
-   }
-   if (pos > 3) {
-      return -1;
-   }
-
-   float rot_hfs[3][3] = {{-1, 0, 0}, {0, -1, 0}, {0, 0, 1}};
-   float rot_hfp[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
-   float rot_hfdl[3][3] = {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}};
-   float rot_hfdr[3][3] = {{0, 1, 0}, {-1, 0, 0}, {0, 0, 1}};
-   float rot_ffs[3][3] = {{1, 0, 0}, {0, -1, 0}, {0, 0, -1}};
-   float rot_ffp[3][3] = {{-1, 0, 0}, {0, 1, 0}, {0, 0, -1}};
-   float rot_ffdl[3][3] = {{0, -1, 0}, {-1, 0, 0}, {0, 0, -1}};
-   float rot_ffdr[3][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, -1}};
-
-   typedef float (*rot_mat_type)[3];
-   rot_mat_type patient_rotations[2][4] = {
-      { rot_hfs, rot_hfp, rot_hfdl, rot_hfdr },
-      { rot_ffs, rot_ffp, rot_ffdl, rot_ffdr }
-   };
-
-   rot_mat_type rot = patient_rotations[entry][pos];
-
-   out[0] = rot[0][0] * in[0] + rot[0][1] * in[1] + rot[0][2] * in[2];
-   out[1] = rot[1][0] * in[0] + rot[1][1] * in[1] + rot[1][2] * in[2];
-   out[2] = rot[2][0] * in[0] + rot[2][1] * in[1] + rot[2][2] * in[2];
-
-   return 1;
+   return SliceGeometryTable::rotateVectorOnPatient(entry, pos, in, out);
 }
 
 
 
-/**
- * Calculates read, phase, and slice direction vectors from three corners of plane
- *
- * | r1 p1 s1 |   | x1 y1 z1 |
- * | r2 p2 s2 | = | x2 y2 z2 |
- * | r3 p3 s3 |   | x3 y3 z3 |
- *
- * @param
- * @param
- * @param
- * @param
- * @param
- * @param
- * @return
- */
 void GenericConverter::makeDirectionVectors(float gwp1[3],     float gwp2[3],      float gwp3[3],
                                             float read_dir[3], float phase_dir[3], float slice_dir[3])
 {
-   /****Angulation of acquisition ****/
-   /* Calculate rotation matrix */
-   float x1 = gwp1[0], y1 = gwp1[1], z1 = gwp1[2];
-   float x2 = gwp2[0], y2 = gwp2[1], z2 = gwp2[2];
-   float x3 = gwp3[0], y3 = gwp3[1], z3 = gwp3[2];
-
-   /* Calculate column 1 */
-   float r1, r2, r3, xd;
-   r1 = (x2 - x1);
-   r2 = (y2 - y1);
-   r3 = (z2 - z1);
-   xd = sqrt(r1 * r1 + r2 * r2 + r3 * r3);
-
-   /* Calculate column 2 */
-   float p1, p2, p3, yd;
-   p1 = (x3 - x1);
-   p2 = (y3 - y1);
-   p3 = (z3 - z1);
-   yd = sqrt(p1 * p1 + p2 * p2 + p3 * p3);
-
-   /* Calculate column 3, cross-product (column 1 x column 2) */
-   float s1, s2, s3, zd;
-   s1 = (r2 * p3) - (r3 * p2);
-   s2 = (r3 * p1) - (r1 * p3);
-   s3 = (r1 * p2) - (r2 * p1);
-   zd = sqrt(s1 * s1 + s2 * s2 + s3 * s3);
-
-   /* Fix cases where column length == 0 */
-   if (xd == 0.0l) { r1 = 1.0l; r2 = r3 = 0.0l; xd = 1.0l; }
-   if (yd == 0.0l) { p2 = 1.0l; p1 = p3 = 0.0l; yd = 1.0l; }
-   if (zd == 0.0l) { s3 = 1.0l; s1 = s2 = 0.0l; zd = 1.0l; }
-
-   /* Normalize columns */
-   read_dir[0] =  r1 / xd; read_dir[1]  = r2 / xd; read_dir[2]  = r3 / xd;
-   phase_dir[0] = p1 / yd; phase_dir[1] = p2 / yd; phase_dir[2] = p3 / yd;
-   slice_dir[0] = s1 / zd; slice_dir[1] = s2 / zd; slice_dir[2] = s3 / zd;
+   SliceGeometryTable::makeDirectionVectors(gwp1, gwp2, gwp3, read_dir, phase_dir, slice_dir);
 }
 
 } // namespace GEToIsmrmrd
 
+// Lets libg2i itself be named as the libraryPath of a sequence mapping
+using GEToIsmrmrd::GenericConverter;
+SEQUENCE_CONVERTER_FACTORY_DECLARE(GenericConverter)
@@ -3,41 +3,42 @@
 #ifndef GENERIC_CONVERTER_H
 #define GENERIC_CONVERTER_H
 
-#include "SequenceConverter.h"
+#include <atomic>
+#include <mutex>
 
-/** A 3-D vector representation */
-struct geRawDataVector {
-   float x;    /**< X-coordinate */
-   float y;    /**< Y-coordinate */
-   float z;    /**< Z-coordinate */
-};
-typedef struct geRawDataVector geRawDataVector_t;
-
-/** A convenience structure used to obtain slice vectors for a given slice */
-struct geRawDataSliceVectors {
-   geRawDataVector_t center;      /**< Center coordinate */
-   geRawDataVector_t read_dir;    /**< Readout direction vector */
-   geRawDataVector_t phase_dir;   /**< Phase direction vector */
-   geRawDataVector_t slice_dir;   /**< Slice direction vector */
-};
-typedef struct geRawDataSliceVectors geRawDataSliceVectors_t;
+#include "SequenceConverter.h"
+#include "ConversionContext.h"
 
 namespace GEToIsmrmrd {
 
 class GenericConverter: public SequenceConverter
 {
 public:
-    std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::Legacy::PfilePointer &pfile,
-                                                       unsigned int view_num);
+    GenericConverter() : pfileInUse_(false) { }
+
+    void                          convertAcquisitions (const ConversionContext &context,
+                                                       GERecon::Legacy::PfilePointer &pfile,
+                                                       const ConversionRange &range, AcquisitionSink &sink);
+
+    void                          convertAcquisitions (const ConversionContext &context,
+                                                       GERecon::ScanArchivePointer &scanArchivePtr,
+                                                       const ConversionRange &range, AcquisitionSink &sink);
 
-    std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::ScanArchivePointer &scanArchivePtr,
-                                                       unsigned int view_num);
+    bool                     supportsConcurrentRanges () const { return true; }
 
+    size_t                   estimateAcquisitionCount (const ConversionContext &context,
+                                                       GERecon::Legacy::PfilePointer &pfile,
+                                                       const ConversionRange &range);
 
-    int                        setISMRMRDSliceVectors (GERecon::Control::ProcessingControlPointer processingControl,
+    size_t                   estimateAcquisitionCount (const ConversionContext &context,
+                                                       GERecon::ScanArchivePointer &scanArchivePtr,
+                                                       const ConversionRange &range);
+
+
+    int                        setISMRMRDSliceVectors (const ScanParameters &scan,
                                                        ISMRMRD::Acquisition& acq);
 
-    int                               getSliceVectors (GERecon::Control::ProcessingControlPointer processingControl,
+    int                               getSliceVectors (const ScanParameters &scan,
                                                        unsigned int sliceNumber, geRawDataSliceVectors_t* vecs);
 
     int                         rotateVectorOnPatient (unsigned int entry, unsigned int pos,
@@ -47,8 +48,19 @@ public:
                                                        float read_dir[3], float phase_dir[3], float slice_dir[3]);
 
 protected:
-    int                                  get_view_idx (GERecon::Control::ProcessingControlPointer processingControl,
+    int                                  get_view_idx (const ScanParameters &scan,
                                                        unsigned int view_num, ISMRMRD::EncodingCounters &idx);
+
+    bool                                selectsPacket (const ScanParameters &scan, const PacketIndexEntry &entry,
+                                                       const ConversionRange &range);
+
+    void                            convertPfileBlock (const ScanParameters &scan, GERecon::Legacy::PfilePointer &pfile,
+                                                       std::mutex &pfileLock, unsigned int slice, unsigned int echo,
+                                                       const std::vector<unsigned int> &channels, uint32_t timeStamp,
+                                                       std::vector<ISMRMRD::Acquisition> &acqs);
+
+private:
+    std::atomic<bool> pfileInUse_;      // a P-file conversion is reading through the Pfile it was given
 };
 
 } // namespace GEToIsmrmrd
@@ -0,0 +1,12 @@
+/** @file Hdf5Lock.cpp */
+#include "Hdf5Lock.h"
+
+namespace GEToIsmrmrd {
+
+std::recursive_mutex& Hdf5Lock::mutex()
+{
+    static std::recursive_mutex hdf5Mutex;
+    return hdf5Mutex;
+}
+
+} // namespace GEToIsmrmrd
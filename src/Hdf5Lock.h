@@ -0,0 +1,66 @@
+/** @file Hdf5Lock.h */
+#ifndef HDF5_LOCK_H
+#define HDF5_LOCK_H
+
+#include <mutex>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Holds the process-wide lock of the HDF5 library while in scope.
+ *
+ * Orchestra reads ScanArchives, and ISMRMRD and BatchedDatasetSink write
+ * their outputs, through the one HDF5 library of the process, which is not
+ * built thread-safe. This library only calls into it with the lock held:
+ * GERawConverter opens and closes archives, the converters read packets, and
+ * the HDF5 sinks write, each under the lock. The lock is recursive, so code
+ * holding it may call functions taking it again. It is never held while
+ * acquisitions are handed to a sink, which may be waiting for a writer thread
+ * that needs the lock itself.
+ *
+ * Host programs calling HDF5 on other threads while converters are in use
+ * must hold the lock as well.
+ */
+class Hdf5Lock
+{
+public:
+    Hdf5Lock() : lock_(mutex()) { }
+
+    /** The lock shared by all users of HDF5 in this process */
+    static std::recursive_mutex& mutex();
+
+private:
+    // Non-copyable
+    Hdf5Lock(const Hdf5Lock& other);
+    Hdf5Lock& operator=(const Hdf5Lock& other);
+
+    std::lock_guard<std::recursive_mutex> lock_;
+};
+
+/**
+ * Resets a pointer with the HDF5 lock held when going out of scope, also on
+ * an exception, for Orchestra objects that close HDF5 files when destroyed
+ */
+template <typename Pointer>
+class Hdf5Release
+{
+public:
+    explicit Hdf5Release(Pointer& pointer) : pointer_(pointer) { }
+
+    ~Hdf5Release()
+    {
+        Hdf5Lock lock;
+        pointer_.reset();
+    }
+
+private:
+    // Non-copyable
+    Hdf5Release(const Hdf5Release& other);
+    Hdf5Release& operator=(const Hdf5Release& other);
+
+    Pointer& pointer_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* HDF5_LOCK_H */
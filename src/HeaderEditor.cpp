@@ -0,0 +1,84 @@
+/** @file HeaderEditor.cpp */
+#include <cstdlib>
+#include <stdexcept>
+
+#include <libxml/parser.h>
+#include <libxml/xmlsave.h>
+#include <libxml/xpath.h>
+
+#include "HeaderEditor.h"
+
+namespace GEToIsmrmrd {
+
+HeaderEditor::HeaderEditor(const std::string& xml)
+    : doc_(xmlReadMemory(xml.c_str(), xml.size(), NULL, NULL, XML_PARSE_NONET), xmlFreeDoc)
+{
+    if (!doc_ || !xmlDocGetRootElement(doc_.get())) {
+        throw std::runtime_error("Failed to parse ISMRMRD header");
+    }
+}
+
+std::vector<xmlNodePtr> HeaderEditor::elements(const std::string& name) const
+{
+    std::vector<xmlNodePtr> found;
+    for (xmlNodePtr child = xmlDocGetRootElement(doc_.get())->children ; child != NULL ; child = child->next) {
+        if (child->type == XML_ELEMENT_NODE && xmlStrcmp(child->name, BAD_CAST name.c_str()) == 0) {
+            found.push_back(child);
+        }
+    }
+    return found;
+}
+
+xmlNodePtr HeaderEditor::find(xmlNodePtr parent, const std::string& path)
+{
+    size_t start = 0;
+    while (parent != NULL && start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::string const name = path.substr(start, end - start);
+
+        xmlNodePtr child = parent->children;
+        while (child != NULL && (child->type != XML_ELEMENT_NODE || xmlStrcmp(child->name, BAD_CAST name.c_str()) != 0)) {
+            child = child->next;
+        }
+        parent = child;
+        start = end + 1;
+    }
+    return parent;
+}
+
+double HeaderEditor::number(xmlNodePtr element)
+{
+    xmlChar* content = xmlNodeGetContent(element);
+    double const value = content ? atof(reinterpret_cast<const char*>(content)) : 0.0;
+    xmlFree(content);
+    return value;
+}
+
+void HeaderEditor::setNumber(xmlNodePtr element, double value)
+{
+    xmlChar* formatted = xmlXPathCastNumberToString(value);
+    xmlNodeSetContent(element, formatted);
+    xmlFree(formatted);
+}
+
+std::string HeaderEditor::str() const
+{
+    std::shared_ptr<xmlBuffer> buffer = std::shared_ptr<xmlBuffer>(xmlBufferCreate(), xmlBufferFree);
+    xmlSaveCtxtPtr save = buffer ? xmlSaveToBuffer(buffer.get(), "UTF-8", XML_SAVE_NO_DECL) : NULL;
+    if (save == NULL) {
+        throw std::runtime_error("Failed to save ISMRMRD header to string");
+    }
+
+    long const saved = xmlSaveDoc(save, doc_.get());
+    xmlSaveClose(save);
+    if (saved < 0) {
+        throw std::runtime_error("Failed to save ISMRMRD header to string");
+    }
+
+    return std::string("<?xml version=\"1.0\"?>\n") + reinterpret_cast<const char*>(xmlBufferContent(buffer.get()));
+}
+
+} // namespace GEToIsmrmrd
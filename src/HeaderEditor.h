@@ -0,0 +1,51 @@
+/** @file HeaderEditor.h */
+#ifndef HEADER_EDITOR_H
+#define HEADER_EDITOR_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Libxml2 forward declarations
+struct _xmlDoc;
+struct _xmlNode;
+
+namespace GEToIsmrmrd {
+
+/**
+ * Edits values of a serialized ISMRMRD header.
+ *
+ * Used where a conversion option changes what the acquisitions hold after the
+ * header was built, so that the header describes them. Numbers are written as
+ * XSLT formats them, so an edited header reads like one a stylesheet wrote.
+ */
+class HeaderEditor
+{
+public:
+    /** @throws std::runtime_error if xml cannot be parsed */
+    explicit HeaderEditor(const std::string& xml);
+
+    /** Child elements of the ismrmrdHeader element with a name, e.g. "encoding" */
+    std::vector<struct _xmlNode*> elements(const std::string& name) const;
+
+    /**
+     * First element at a path of child element names below parent
+     *
+     * @param path Element names separated by '/', e.g. "encodedSpace/matrixSize/x"
+     * @returns NULL if parent is NULL or there is no such element
+     */
+    static struct _xmlNode* find(struct _xmlNode* parent, const std::string& path);
+
+    static double number(struct _xmlNode* element);
+    static void setNumber(struct _xmlNode* element, double value);
+
+    /** @throws std::runtime_error if the header cannot be serialized */
+    std::string str() const;
+
+private:
+    std::shared_ptr<struct _xmlDoc> doc_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* HEADER_EDITOR_H */
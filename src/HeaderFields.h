@@ -0,0 +1,78 @@
+/** @file HeaderFields.h */
+#ifndef HEADER_FIELDS_H
+#define HEADER_FIELDS_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Records the raw file header in memory instead of writing it as XML.
+ *
+ * Has the same element-writing calls as XMLWriter, so the code that reads the
+ * Orchestra header values can write to either. Each value is stored under its
+ * element path, e.g. "Header/Image/PixelSizeX", in the order it was written.
+ */
+class HeaderFields
+{
+public:
+    void startDocument() { path_.clear(); }
+    void endDocument() { }
+
+    void startElement(const std::string& name)
+    {
+        path_.push_back(path_.empty() ? name : path_.back() + "/" + name);
+    }
+
+    void endElement()
+    {
+        if (!path_.empty()) {
+            path_.pop_back();
+        }
+    }
+
+    template <typename... Args>
+    void formatElement(const std::string& name, const std::string& format, Args... args)
+    {
+        char buffer[1024];
+        int const len = snprintf(buffer, sizeof(buffer), format.c_str(), args...);
+
+        std::string value;
+        if (len >= static_cast<int>(sizeof(buffer))) {
+            std::vector<char> large(len + 1);
+            snprintf(&large[0], large.size(), format.c_str(), args...);
+            value.assign(&large[0], len);
+        } else if (len > 0) {
+            value.assign(buffer, len);
+        }
+
+        std::string const key = path_.empty() ? name : path_.back() + "/" + name;
+        values_[key].push_back(value);
+    }
+
+    void addBooleanElement(const std::string& name, bool value) {
+        formatElement(name, "%s", value ? "true" : "false");
+    }
+
+    /** All values written at path, in order */
+    const std::vector<std::string>& values(const std::string& path) const
+    {
+        static const std::vector<std::string> none;
+        std::map<std::string, std::vector<std::string> >::const_iterator it = values_.find(path);
+        return (it == values_.end()) ? none : it->second;
+    }
+
+    /** Whether anything was written at path */
+    bool has(const std::string& path) const { return values_.count(path) > 0; }
+
+private:
+    std::vector<std::string> path_;
+    std::map<std::string, std::vector<std::string> > values_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* HEADER_FIELDS_H */
@@ -0,0 +1,160 @@
+/** @file HeaderProbe.cpp */
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "HeaderProbe.h"
+
+namespace GEToIsmrmrd {
+
+static void appendJsonString(std::string& out, const std::string& value)
+{
+    out += '"';
+    for (size_t i = 0 ; i < value.size() ; i++) {
+        unsigned char const c = value[i];
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    out += '"';
+}
+
+static void appendJsonNumber(std::string& out, double value)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    out += buffer;
+}
+
+static bool hasElementChildren(xmlNode* node)
+{
+    for (xmlNode* n = node->children; n; n = n->next) {
+        if (n->type == XML_ELEMENT_NODE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void appendElement(std::string& out, xmlNode* node);
+
+/**
+ * Writes the element children of node as the members of a JSON object
+ */
+static void appendChildren(std::string& out, xmlNode* node)
+{
+    // Member order follows the first occurrence of each element name
+    std::vector<std::string> names;
+    std::vector<std::vector<xmlNode*> > members;
+
+    for (xmlNode* n = node->children; n; n = n->next) {
+        if (n->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        std::string const name = reinterpret_cast<const char*>(n->name);
+        size_t i = 0;
+        while (i < names.size() && names[i] != name) {
+            i++;
+        }
+        if (i == names.size()) {
+            names.push_back(name);
+            members.push_back(std::vector<xmlNode*>());
+        }
+        members[i].push_back(n);
+    }
+
+    out += '{';
+    for (size_t i = 0 ; i < names.size() ; i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendJsonString(out, names[i]);
+        out += ':';
+        if (members[i].size() == 1) {
+            appendElement(out, members[i][0]);
+        } else {
+            out += '[';
+            for (size_t j = 0 ; j < members[i].size() ; j++) {
+                if (j > 0) {
+                    out += ',';
+                }
+                appendElement(out, members[i][j]);
+            }
+            out += ']';
+        }
+    }
+    out += '}';
+}
+
+static void appendElement(std::string& out, xmlNode* node)
+{
+    if (hasElementChildren(node)) {
+        appendChildren(out, node);
+        return;
+    }
+
+    xmlChar* content = xmlNodeGetContent(node);
+    appendJsonString(out, content ? reinterpret_cast<const char*>(content) : "");
+    xmlFree(content);
+}
+
+std::string ismrmrdHeaderToJson(const std::string& xml)
+{
+    std::shared_ptr<xmlDoc> doc = std::shared_ptr<xmlDoc>(
+            xmlReadMemory(xml.c_str(), xml.size(), NULL, NULL, XML_PARSE_NONET), xmlFreeDoc);
+    if (!doc || !xmlDocGetRootElement(doc.get())) {
+        throw std::runtime_error("Failed to parse ISMRMRD header");
+    }
+
+    std::string json;
+    appendChildren(json, xmlDocGetRootElement(doc.get()));
+    return json;
+}
+
+std::string probeResultToJson(const ProbeResult& result)
+{
+    std::string json = "{\"file\":";
+    appendJsonString(json, result.rawFile);
+    json += ",\"type\":";
+    appendJsonString(json, result.rawType);
+    json += ",\"openMs\":";
+    appendJsonNumber(json, result.openMillis);
+    json += ",\"headerMs\":";
+    appendJsonNumber(json, result.headerMillis);
+    json += ",\"totalMs\":";
+    appendJsonNumber(json, result.openMillis + result.headerMillis);
+    json += ",\"header\":";
+    json += ismrmrdHeaderToJson(result.header);
+    json += '}';
+    return json;
+}
+
+std::string probeErrorToJson(const std::string& rawFile, const std::string& error, double elapsedMillis)
+{
+    std::string json = "{\"file\":";
+    appendJsonString(json, rawFile);
+    json += ",\"totalMs\":";
+    appendJsonNumber(json, elapsedMillis);
+    json += ",\"error\":";
+    appendJsonString(json, error);
+    json += '}';
+    return json;
+}
+
+} // namespace GEToIsmrmrd
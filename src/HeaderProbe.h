@@ -0,0 +1,46 @@
+/** @file HeaderProbe.h */
+#ifndef HEADER_PROBE_H
+#define HEADER_PROBE_H
+
+#include <string>
+
+namespace GEToIsmrmrd {
+
+/**
+ * ISMRMRD header of a raw file read by GERawConverter::probe(), without any raw data
+ */
+struct ProbeResult
+{
+    ProbeResult() : openMillis(0.0), headerMillis(0.0) { }
+
+    std::string rawFile;        /**< Path that was probed */
+    std::string rawType;        /**< "ScanArchive" or "Pfile" */
+    std::string header;         /**< ISMRMRD XML header */
+    double openMillis;          /**< Time to open the file and read its download data, in ms */
+    double headerMillis;        /**< Time to build the ISMRMRD header, in ms */
+};
+
+/**
+ * Converts an ISMRMRD XML header to JSON
+ *
+ * Each element becomes a member named after it; elements with children become
+ * objects and the others strings, and repeated elements become arrays.
+ * Attributes and namespaces are dropped.
+ *
+ * @throws std::runtime_error if the header is not well-formed XML
+ */
+std::string ismrmrdHeaderToJson(const std::string& xml);
+
+/**
+ * One-line JSON object with the file, its type, the latencies and the header as JSON
+ */
+std::string probeResultToJson(const ProbeResult& result);
+
+/**
+ * One-line JSON object reporting a file that could not be probed
+ */
+std::string probeErrorToJson(const std::string& rawFile, const std::string& error, double elapsedMillis);
+
+} // namespace GEToIsmrmrd
+
+#endif /* HEADER_PROBE_H */
@@ -0,0 +1,601 @@
+/** @file HeaderReferences.cpp */
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <vector>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "HeaderReferences.h"
+
+namespace GEToIsmrmrd {
+
+static const char* XSLT_NAMESPACE = "http://www.w3.org/1999/XSL/Transform";
+
+enum XPathTokenType
+{
+    XPATH_NAME,
+    XPATH_STAR,
+    XPATH_SLASH,
+    XPATH_DOUBLE_SLASH,
+    XPATH_DOT,
+    XPATH_DOUBLE_DOT,
+    XPATH_AT,
+    XPATH_LPAREN,
+    XPATH_RPAREN,
+    XPATH_LBRACKET,
+    XPATH_RBRACKET,
+    XPATH_COMMA,
+    XPATH_DOUBLE_COLON,
+    XPATH_LITERAL,
+    XPATH_NUMBER,
+    XPATH_VARIABLE,
+    XPATH_OPERATOR
+};
+
+struct XPathToken
+{
+    XPathTokenType type;
+    std::string text;
+};
+
+static bool isNameStart(char c)
+{
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || (c & 0x80);
+}
+
+static bool isNameChar(char c)
+{
+    return isNameStart(c) || std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '.';
+}
+
+/**
+ * Splits an XPath 1.0 expression into tokens
+ *
+ * @returns false if the expression is not lexically valid
+ */
+static bool tokenizeXPath(const std::string& expr, std::vector<XPathToken>& tokens)
+{
+    size_t i = 0;
+    size_t const n = expr.size();
+
+    while (i < n) {
+        char const c = expr[i];
+        XPathToken token;
+
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            i++;
+            continue;
+        }
+
+        if (isNameStart(c)) {
+            size_t start = i;
+            while (i < n && isNameChar(expr[i])) {
+                i++;
+            }
+            // Prefixed name or prefix:*, but not an axis
+            if (i + 1 < n && expr[i] == ':' && expr[i + 1] != ':') {
+                i++;
+                if (expr[i] == '*') {
+                    i++;
+                } else {
+                    while (i < n && isNameChar(expr[i])) {
+                        i++;
+                    }
+                }
+            }
+            token.type = XPATH_NAME;
+            token.text = expr.substr(start, i - start);
+        } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                   (c == '.' && i + 1 < n && std::isdigit(static_cast<unsigned char>(expr[i + 1])))) {
+            size_t start = i;
+            while (i < n && (std::isdigit(static_cast<unsigned char>(expr[i])) || expr[i] == '.')) {
+                i++;
+            }
+            token.type = XPATH_NUMBER;
+            token.text = expr.substr(start, i - start);
+        } else if (c == '\'' || c == '"') {
+            size_t const end = expr.find(c, i + 1);
+            if (end == std::string::npos) {
+                return false;
+            }
+            token.type = XPATH_LITERAL;
+            token.text = expr.substr(i + 1, end - i - 1);
+            i = end + 1;
+        } else if (c == '$') {
+            size_t start = ++i;
+            while (i < n && (isNameChar(expr[i]) || expr[i] == ':')) {
+                i++;
+            }
+            token.type = XPATH_VARIABLE;
+            token.text = expr.substr(start, i - start);
+        } else if (expr.compare(i, 2, "//") == 0) {
+            token.type = XPATH_DOUBLE_SLASH;
+            i += 2;
+        } else if (expr.compare(i, 2, "..") == 0) {
+            token.type = XPATH_DOUBLE_DOT;
+            i += 2;
+        } else if (expr.compare(i, 2, "::") == 0) {
+            token.type = XPATH_DOUBLE_COLON;
+            i += 2;
+        } else if (expr.compare(i, 2, "!=") == 0 || expr.compare(i, 2, "<=") == 0 ||
+                   expr.compare(i, 2, ">=") == 0) {
+            token.type = XPATH_OPERATOR;
+            token.text = expr.substr(i, 2);
+            i += 2;
+        } else {
+            switch (c) {
+                case '/': token.type = XPATH_SLASH; break;
+                case '.': token.type = XPATH_DOT; break;
+                case '@': token.type = XPATH_AT; break;
+                case '*': token.type = XPATH_STAR; break;
+                case '(': token.type = XPATH_LPAREN; break;
+                case ')': token.type = XPATH_RPAREN; break;
+                case '[': token.type = XPATH_LBRACKET; break;
+                case ']': token.type = XPATH_RBRACKET; break;
+                case ',': token.type = XPATH_COMMA; break;
+                case '|': case '+': case '-': case '=': case '<': case '>':
+                    token.type = XPATH_OPERATOR;
+                    token.text = std::string(1, c);
+                    break;
+                default:
+                    return false;
+            }
+            i++;
+        }
+
+        tokens.push_back(token);
+    }
+
+    return true;
+}
+
+static std::string childPath(const std::string& parent, const std::string& name)
+{
+    return parent.empty() ? name : parent + "/" + name;
+}
+
+static std::string parentPath(const std::string& path)
+{
+    size_t const slash = path.rfind('/');
+    return (slash == std::string::npos) ? std::string() : path.substr(0, slash);
+}
+
+/**
+ * Whether a function called without arguments reads the string value of the context node
+ */
+static bool isContextFunction(const std::string& name)
+{
+    return name == "string" || name == "normalize-space" || name == "string-length" || name == "number";
+}
+
+static std::string getAttribute(xmlNode* node, const char* name, bool* present = NULL)
+{
+    std::string value;
+    xmlChar* prop = xmlGetProp(node, BAD_CAST name);
+    if (present) {
+        *present = (prop != NULL);
+    }
+    if (prop) {
+        value = reinterpret_cast<const char*>(prop);
+        xmlFree(prop);
+    }
+    return value;
+}
+
+/**
+ * Collects the location paths read by the expressions of a stylesheet
+ */
+class XPathScanner
+{
+public:
+    XPathScanner(HeaderReferences& refs) : refs_(refs), everything_(false) { }
+
+    void scanStylesheet(xmlNode* root);
+
+private:
+    void scanElement(xmlNode* node, const std::string& context);
+    void scanChildren(xmlNode* node, const std::string& context);
+    void scanAttributeTemplates(xmlNode* node, const std::string& context);
+    bool scanExpression(const std::string& expr, const std::string& context, std::string* onlyPath = NULL);
+
+    void record(const std::string& path);
+    void everything() { refs_.addEverything(); everything_ = true; }
+
+    HeaderReferences& refs_;
+    bool everything_;
+};
+
+void XPathScanner::scanStylesheet(xmlNode* root)
+{
+    bool const isStylesheet = root->ns && xmlStrEqual(root->ns->href, BAD_CAST XSLT_NAMESPACE) &&
+        (xmlStrEqual(root->name, BAD_CAST "stylesheet") || xmlStrEqual(root->name, BAD_CAST "transform"));
+
+    if (!isStylesheet) {
+        // Simplified stylesheet: the root element is the template for "/"
+        scanElement(root, "");
+        return;
+    }
+
+    // Without a template for "/", the built-in templates copy all header text
+    bool rootTemplate = false;
+    for (xmlNode* n = root->children; n; n = n->next) {
+        if (n->type == XML_ELEMENT_NODE && xmlStrEqual(n->name, BAD_CAST "template") &&
+                getAttribute(n, "match") == "/") {
+            rootTemplate = true;
+        }
+    }
+    if (!rootTemplate) {
+        everything();
+        return;
+    }
+
+    scanChildren(root, "");
+}
+
+void XPathScanner::scanChildren(xmlNode* node, const std::string& context)
+{
+    for (xmlNode* n = node->children; n && !everything_; n = n->next) {
+        if (n->type == XML_ELEMENT_NODE) {
+            scanElement(n, context);
+        }
+    }
+}
+
+void XPathScanner::scanElement(xmlNode* node, const std::string& context)
+{
+    bool const isXslt = node->ns && xmlStrEqual(node->ns->href, BAD_CAST XSLT_NAMESPACE);
+    if (!isXslt) {
+        scanAttributeTemplates(node, context);
+        scanChildren(node, context);
+        return;
+    }
+
+    std::string const name = reinterpret_cast<const char*>(node->name);
+
+    if (name == "template") {
+        bool hasMatch = false;
+        std::string const match = getAttribute(node, "match", &hasMatch);
+        if (!hasMatch || match != "/") {
+            everything();
+            return;
+        }
+        scanChildren(node, "");
+    } else if (name == "for-each") {
+        // Relative paths inside the loop are read from the selected elements
+        std::string selected;
+        if (!scanExpression(getAttribute(node, "select"), context, &selected)) {
+            everything();
+            return;
+        }
+        scanChildren(node, selected);
+    } else if (name == "apply-templates" || name == "apply-imports" || name == "call-template" ||
+               name == "import" || name == "include" || name == "key" || name == "number") {
+        everything();
+    } else {
+        scanExpression(getAttribute(node, "select"), context);
+        scanExpression(getAttribute(node, "test"), context);
+        scanAttributeTemplates(node, context);
+        scanChildren(node, context);
+    }
+}
+
+/**
+ * Scans the {expressions} in attribute values
+ */
+void XPathScanner::scanAttributeTemplates(xmlNode* node, const std::string& context)
+{
+    for (xmlAttr* attr = node->properties; attr && !everything_; attr = attr->next) {
+        std::string const value = getAttribute(node, reinterpret_cast<const char*>(attr->name));
+
+        size_t i = 0;
+        while (i < value.size()) {
+            if (value.compare(i, 2, "{{") == 0 || value.compare(i, 2, "}}") == 0) {
+                i += 2;
+            } else if (value[i] == '{') {
+                size_t end = i + 1;
+                char quote = 0;
+                while (end < value.size() && (quote || value[end] != '}')) {
+                    if (quote && value[end] == quote) {
+                        quote = 0;
+                    } else if (!quote && (value[end] == '\'' || value[end] == '"')) {
+                        quote = value[end];
+                    }
+                    end++;
+                }
+                scanExpression(value.substr(i + 1, end - i - 1), context);
+                i = end + 1;
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+void XPathScanner::record(const std::string& path)
+{
+    // The root's string value is all of the header text
+    if (path.empty()) {
+        everything();
+    } else {
+        refs_.addPath(path);
+    }
+}
+
+/**
+ * Records the location paths an expression reads
+ *
+ * @param expr XPath expression
+ * @param context Path of the context node the expression is evaluated at
+ * @param onlyPath If given, receives the path when the whole expression is one plain location path
+ * @returns false if onlyPath was given but the expression is not a plain location path
+ */
+bool XPathScanner::scanExpression(const std::string& expr, const std::string& context, std::string* onlyPath)
+{
+    if (expr.empty()) {
+        return !onlyPath;
+    }
+
+    std::vector<XPathToken> tokens;
+    if (!tokenizeXPath(expr, tokens)) {
+        everything();
+        return false;
+    }
+
+    bool plain = true;
+
+    struct Frame
+    {
+        std::string context;
+        std::string path;
+        bool inPath;
+    };
+    std::vector<Frame> frames;
+
+    std::string ctx = context;
+    std::string path;
+    bool inPath = false;
+    bool expectStep = false;
+    bool skipName = false;
+
+    std::vector<bool> isOperator(tokens.size(), false);
+
+    for (size_t i = 0 ; i < tokens.size() && !everything_ ; i++) {
+        XPathToken const& token = tokens[i];
+        XPathTokenType const next = (i + 1 < tokens.size()) ? tokens[i + 1].type : XPATH_OPERATOR;
+        bool const hasNext = (i + 1 < tokens.size());
+
+        // XPath 1.0 lexical rule: after anything but @ :: ( [ , or an operator,
+        // a * is multiplication and a name is an operator name
+        bool operatorContext = false;
+        if (i > 0) {
+            XPathTokenType const prev = tokens[i - 1].type;
+            operatorContext = !(prev == XPATH_AT || prev == XPATH_DOUBLE_COLON || prev == XPATH_LPAREN ||
+                                prev == XPATH_LBRACKET || prev == XPATH_COMMA || prev == XPATH_OPERATOR ||
+                                prev == XPATH_SLASH || prev == XPATH_DOUBLE_SLASH || isOperator[i - 1]);
+        }
+
+        if (token.type != XPATH_NAME && token.type != XPATH_SLASH &&
+                token.type != XPATH_DOT && token.type != XPATH_DOUBLE_DOT) {
+            plain = false;
+        }
+
+        switch (token.type) {
+            case XPATH_STAR:
+                if (!operatorContext) {
+                    everything();
+                    break;
+                }
+                isOperator[i] = true;
+                if (inPath) { record(path); inPath = false; }
+                break;
+
+            case XPATH_NAME:
+                if (operatorContext) {
+                    // and, or, div, mod
+                    isOperator[i] = true;
+                    plain = false;
+                    if (inPath) { record(path); inPath = false; }
+                } else if (hasNext && next == XPATH_LPAREN) {
+                    plain = false;
+                    if (token.text == "text" || token.text == "comment" || token.text == "processing-instruction") {
+                        // Reads the element the step is on
+                        if (!inPath) { path = ctx; inPath = true; }
+                        expectStep = false;
+                        int depth = 0;
+                        for (i++ ; i < tokens.size() ; i++) {
+                            if (tokens[i].type == XPATH_LPAREN) depth++;
+                            if (tokens[i].type == XPATH_RPAREN && --depth == 0) break;
+                        }
+                    } else if (token.text == "node") {
+                        everything();
+                    } else {
+                        // Function call; its arguments are scanned as they come
+                        if (inPath) { record(path); inPath = false; }
+
+                        // Without an argument, these read the string value of the context node
+                        bool const noArguments = (i + 2 < tokens.size() && tokens[i + 2].type == XPATH_RPAREN);
+                        if (noArguments && isContextFunction(token.text)) {
+                            record(ctx);
+                        }
+                    }
+                } else if (hasNext && next == XPATH_DOUBLE_COLON) {
+                    plain = false;
+                    if (token.text != "child" && token.text != "attribute" && token.text != "self") {
+                        everything();
+                        break;
+                    }
+                    if (!inPath) { path = ctx; inPath = true; }
+                    expectStep = true;
+                    skipName = (token.text != "child");
+                    i++;
+                } else if (skipName) {
+                    // Attribute or self name test: stays on the same element
+                    skipName = false;
+                    expectStep = false;
+                } else if (inPath && expectStep) {
+                    path = childPath(path, token.text);
+                    expectStep = false;
+                } else if (!inPath) {
+                    path = childPath(ctx, token.text);
+                    inPath = true;
+                    expectStep = false;
+                } else {
+                    everything();
+                }
+                break;
+
+            case XPATH_AT:
+                if (!inPath) { path = ctx; inPath = true; }
+                skipName = true;
+                expectStep = true;
+                break;
+
+            case XPATH_SLASH:
+                if (!inPath) { path.clear(); inPath = true; }
+                expectStep = true;
+                break;
+
+            case XPATH_DOUBLE_SLASH:
+                everything();
+                break;
+
+            case XPATH_DOT:
+            case XPATH_DOUBLE_DOT:
+                if (!inPath) {
+                    path = ctx;
+                    inPath = true;
+                } else if (!expectStep) {
+                    everything();
+                    break;
+                }
+                if (token.type == XPATH_DOUBLE_DOT) {
+                    path = parentPath(path);
+                }
+                expectStep = false;
+                break;
+
+            case XPATH_LBRACKET:
+                // A predicate is evaluated at the element its step selects
+                frames.push_back(Frame{ctx, path, inPath});
+                ctx = inPath ? path : ctx;
+                inPath = false;
+                break;
+
+            case XPATH_LPAREN:
+                if (inPath) { record(path); inPath = false; }
+                frames.push_back(Frame{ctx, std::string(), false});
+                break;
+
+            case XPATH_RBRACKET:
+            case XPATH_RPAREN:
+                if (inPath) { record(path); inPath = false; }
+                if (frames.empty()) {
+                    everything();
+                    break;
+                }
+                ctx = frames.back().context;
+                path = frames.back().path;
+                inPath = frames.back().inPath;
+                frames.pop_back();
+                expectStep = false;
+
+                // Paths from a parenthesized expression cannot be followed
+                if (token.type == XPATH_RPAREN && hasNext &&
+                        (next == XPATH_SLASH || next == XPATH_DOUBLE_SLASH || next == XPATH_LBRACKET)) {
+                    everything();
+                }
+                break;
+
+            case XPATH_VARIABLE:
+                if (inPath) { record(path); inPath = false; }
+                if (hasNext && (next == XPATH_SLASH || next == XPATH_DOUBLE_SLASH || next == XPATH_LBRACKET)) {
+                    everything();
+                }
+                break;
+
+            default:
+                if (inPath) { record(path); inPath = false; }
+                break;
+        }
+    }
+
+    if (everything_) {
+        return false;
+    }
+
+    // Unclosed predicate or parenthesis
+    if (!frames.empty()) {
+        everything();
+        return false;
+    }
+
+    if (onlyPath) {
+        // The selected elements are only iterated, their text is not read
+        if (!plain || !inPath || path.empty()) {
+            return false;
+        }
+        *onlyPath = path;
+        return true;
+    }
+
+    if (inPath) {
+        record(path);
+    }
+
+    return true;
+}
+
+HeaderReferences::HeaderReferences()
+    : all_(true)
+{
+}
+
+HeaderReferences HeaderReferences::fromStylesheet(const std::string& stylesheet)
+{
+    HeaderReferences refs;
+
+    std::shared_ptr<xmlDoc> doc = std::shared_ptr<xmlDoc>(
+            xmlReadMemory(stylesheet.c_str(), stylesheet.size(), NULL, NULL,
+                          XML_PARSE_NOENT | XML_PARSE_DTDLOAD | XML_PARSE_NOERROR | XML_PARSE_NOWARNING),
+            xmlFreeDoc);
+    if (!doc || !xmlDocGetRootElement(doc.get())) {
+        return refs;
+    }
+
+    refs.all_ = false;
+    XPathScanner scanner(refs);
+    scanner.scanStylesheet(xmlDocGetRootElement(doc.get()));
+
+    return refs;
+}
+
+bool HeaderReferences::needs(const std::string& path) const
+{
+    if (all_) {
+        return true;
+    }
+
+    for (std::set<std::string>::const_iterator it = paths_.begin() ; it != paths_.end() ; ++it) {
+        const std::string& ref = *it;
+        size_t const shorter = std::min(ref.size(), path.size());
+
+        // Equal, an ancestor of path (its string value includes path), or below path
+        if (ref.compare(0, shorter, path, 0, shorter) == 0 &&
+                (ref.size() == path.size() ||
+                 (ref.size() < path.size() && path[ref.size()] == '/') ||
+                 (ref.size() > path.size() && ref[path.size()] == '/'))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void HeaderReferences::addPath(const std::string& path)
+{
+    paths_.insert(path);
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,54 @@
+/** @file HeaderReferences.h */
+#ifndef HEADER_REFERENCES_H
+#define HEADER_REFERENCES_H
+
+#include <set>
+#include <string>
+
+namespace GEToIsmrmrd {
+
+/**
+ * The raw file header elements a stylesheet can read.
+ *
+ * Built by scanning the XPath expressions of the stylesheet for the location
+ * paths they select, e.g. "Header/Image/PixelSizeX". Paths are resolved from
+ * the root template and through xsl:for-each. Anything the scan cannot
+ * resolve (wildcards, "//", other axes, variable paths, apply-templates,
+ * imports) makes every element referenced, so an element is only left out
+ * when the stylesheet cannot possibly read it.
+ */
+class HeaderReferences
+{
+public:
+    /** References every element */
+    HeaderReferences();
+
+    /** Scans a stylesheet; a stylesheet that cannot be parsed references every element */
+    static HeaderReferences fromStylesheet(const std::string& stylesheet);
+
+    /**
+     * Whether the element at path, or anything below it, may be read.
+     *
+     * @param path Element path from the document root, e.g. "Header/epiParameters"
+     */
+    bool needs(const std::string& path) const;
+
+    /** True unless the scan could narrow down the referenced elements */
+    bool referencesEverything() const { return all_; }
+
+    /** Referenced location paths */
+    const std::set<std::string>& paths() const { return paths_; }
+
+private:
+    friend class XPathScanner;
+
+    void addPath(const std::string& path);
+    void addEverything() { all_ = true; }
+
+    bool all_;
+    std::set<std::string> paths_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* HEADER_REFERENCES_H */
@@ -0,0 +1,32 @@
+/** @file LogStream.h */
+#ifndef LOG_STREAM_H
+#define LOG_STREAM_H
+
+#include <iostream>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Diagnostics of a converter, written to std::clog when enabled and dropped otherwise
+ */
+struct logstream {
+    logstream(bool enable) : enabled(enable) {}
+    bool enabled;
+};
+
+template <typename T>
+inline logstream& operator<<(logstream& s, T const& v)
+{
+    if (s.enabled) { std::clog << v; }
+    return s;
+}
+
+inline logstream& operator<<(logstream& s, std::ostream& (*f)(std::ostream&))
+{
+    if (s.enabled) { f(std::clog); }
+    return s;
+}
+
+} // namespace GEToIsmrmrd
+
+#endif /* LOG_STREAM_H */
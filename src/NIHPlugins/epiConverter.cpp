@@ -1,46 +1,219 @@
 
 /** @file NIHepiConverter.cpp */
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 
 #include "epiConverter.h"
+#include "Hdf5Lock.h"
 
 
-std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
-                                                                   unsigned int acqMode)
+void NIHepiConverter::convertAcquisitions(const GEToIsmrmrd::ConversionContext &context,
+                                          GERecon::Legacy::PfilePointer &pfile,
+                                          const GEToIsmrmrd::ConversionRange &range, GEToIsmrmrd::AcquisitionSink &sink)
 {
-   std::cerr << "Currently, conversion of EPI P-files is __NOT__ supported." << std::endl;
+   throw std::runtime_error("NIHepiConverter: conversion of EPI P-files is not supported");
+}
+
+
+
+/**
+ * Marks the hyperframe packets that hold a slice, echo and volume of the range
+ *
+ * The volume of a packet is its place among the data packets divided by the
+ * number of packets per volume, one per slice and echo, as in the repetition
+ * counter set by decodePacket().
+ *
+ * @param packets Index of the control packets of the archive
+ * @param packetsPerVolume Data packets per volume
+ * @param range Slices, echoes and volumes to convert
+ * @returns one flag per packet, false for scan control packets
+ */
+std::vector<bool> NIHepiConverter::selectPackets(const GEToIsmrmrd::PacketIndex &packets, unsigned int packetsPerVolume,
+                                                 const GEToIsmrmrd::ConversionRange &range)
+{
+   std::vector<bool> selected(packets.size(), false);
+   unsigned int dataPackets = 0;
+
+   for (size_t n = 0 ; n < packets.size() ; n++)
+   {
+      const GEToIsmrmrd::PacketIndexEntry &entry = packets[n];
+
+      if (entry.isScanControl())
+      {
+         continue;
+      }
+
+      unsigned int const volume = dataPackets++ / std::max(packetsPerVolume, 1u);
+      selected[n] = selectsPacket(entry, volume, range);
+   }
+
+   return selected;
+}
 
-   exit (EXIT_FAILURE);
+
+
+/**
+ * Whether a hyperframe packet holds a slice, echo and volume of the range
+ *
+ * @param volume Place of the packet among the data packets divided by the packets per volume
+ */
+bool NIHepiConverter::selectsPacket(const GEToIsmrmrd::PacketIndexEntry &entry, unsigned int volume,
+                                    const GEToIsmrmrd::ConversionRange &range)
+{
+   return range.hasSlice(entry.slice) && range.hasEcho(entry.echo) && range.hasVolume(volume);
 }
 
 
 
-std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::ScanArchivePointer &scanArchivePtr,
-                                                                   unsigned int acqMode)
+/**
+ * Describes the row flip applied by RowFlipPlugin as a map of source samples
+ *
+ * Runs the plugin on a probe matrix whose samples hold their own readout index
+ * plus one. If the plugin only moves samples within each row, the result is the
+ * source sample of every output sample, and the flip can be fused into the copy
+ * of each view. Otherwise the map is set to the identity.
+ *
+ * Interpolating between neighbours, with weights that sum to one, maps a linear
+ * probe to whole numbers in range as well, so it alone cannot tell a reordering
+ * from an interpolation. The plugin is therefore run a second time on the
+ * squares of the same values; only a plugin that moves every sample unchanged
+ * gives the square of the source found by the first probe.
+ *
+ * @param rowFlipPlugin Row flip plugin for this scan
+ * @param frameSize Samples per readout
+ * @param numViews Views per packet
+ * @param rowFlipIndex Receives numViews x frameSize source sample indices
+ * @returns true if the flip is a pure reordering that rowFlipIndex describes
+ */
+bool NIHepiConverter::getRowFlipIndex(RowFlipPlugin &rowFlipPlugin, int frameSize, int numViews,
+                                      std::vector<int> &rowFlipIndex)
 {
-   std::cerr << "Using NIHepi ScanArchive converter." << std::endl;
+   ComplexFloatMatrix probe(frameSize, numViews);
+   ComplexFloatMatrix squares(frameSize, numViews);
+
+   for (int view = 0 ; view < numViews ; view++)
+   {
+      for (int x = 0 ; x < frameSize ; x++)
+      {
+         float const value = x + 1;
+         probe(x, view) = std::complex<float>(value, 0.0f);
+         squares(x, view) = std::complex<float>(value * value, 0.0f);
+      }
+   }
 
-   GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer    = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
-   GERecon::Legacy::LxDownloadDataPointer lxData                        = boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(scanArchivePtr->LoadDownloadData());
-   boost::shared_ptr<GERecon::Epi::LxControlSource> const controlSource = boost::make_shared<GERecon::Epi::LxControlSource>(lxData);
-   GERecon::Control::ProcessingControlPointer processingControl         = controlSource->CreateOrchestraProcessingControl();
+   rowFlipPlugin.ApplyImageDataRowFlip(probe);
+   rowFlipPlugin.ApplyImageDataRowFlip(squares);
 
-   scanArchivePtr->LoadSavedFiles();
+   rowFlipIndex.resize(frameSize * numViews);
 
-   int const    packetQuantity = archiveStoragePointer->AvailableControlCount();
+   bool isPermutation = true;
+
+   for (int view = 0 ; view < numViews && isPermutation ; view++)
+   {
+      for (int x = 0 ; x < frameSize ; x++)
+      {
+         std::complex<float> const value = probe(x, view);
+         std::complex<float> const square = squares(x, view);
+         int const source = static_cast<int>(value.real()) - 1;
+
+         if ((value.imag() != 0.0f) || (value.real() != source + 1) || (source < 0) || (source >= frameSize) ||
+             (square.imag() != 0.0f) || (square.real() != value.real() * value.real()))
+         {
+            isPermutation = false;
+            break;
+         }
+
+         rowFlipIndex[view * frameSize + x] = source;
+      }
+   }
+
+   if (!isPermutation)
+   {
+      for (int i = 0 ; i < frameSize * numViews ; i++)
+      {
+         rowFlipIndex[i] = i % frameSize;
+      }
+   }
+
+   return isPermutation;
+}
+
+
+
+void NIHepiConverter::convertAcquisitions(const GEToIsmrmrd::ConversionContext &context,
+                                          GERecon::ScanArchivePointer &scanArchivePtr,
+                                          const GEToIsmrmrd::ConversionRange &range, GEToIsmrmrd::AcquisitionSink &sink)
+{
+   log_ << "Using NIHepi ScanArchive converter." << std::endl;
+
+   convertNewAcquisitions(context, scanArchivePtr, range, 0, sink);
+}
+
+
+
+size_t NIHepiConverter::convertNewAcquisitions(const GEToIsmrmrd::ConversionContext &context,
+                                             GERecon::ScanArchivePointer &scanArchivePtr,
+                                             const GEToIsmrmrd::ConversionRange &range, size_t firstPacket,
+                                             GEToIsmrmrd::AcquisitionSink &sink)
+{
+   if (!context.epi)
+   {
+      throw std::runtime_error("NIHepiConverter: download data does not describe an EPI scan");
+   }
+
+   const GEToIsmrmrd::EpiParameters &epi = *context.epi;
+   const GEToIsmrmrd::ScanParameters &scan = epi.scan;
+
+   // Which packets are scan control packets, if already known, so that none are read after the last one in range
+   std::shared_ptr<const GEToIsmrmrd::PacketIndex> const packets = context.packets;
+
+   // Archive reads take the HDF5 lock; acquisitions are handed to the sink without it
+   GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer;
+   GEToIsmrmrd::Hdf5Release<GERecon::Acquisition::ArchiveStoragePointer> const release(archiveStoragePointer);
+   int packetQuantity = 0;
+   {
+      GEToIsmrmrd::Hdf5Lock lock;
+      archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
+
+      scanArchivePtr->LoadSavedFiles();
+
+      // ArchiveStorage only steps through packets in order, so packets outside the
+      // range are passed over without reading their data.  Packets converted by an
+      // earlier call are passed over the same way.  Without an index, each packet is
+      // described as it is read, and the archive is walked only once.
+      packetQuantity = archiveStoragePointer->AvailableControlCount();
+   }
+   if (packets)
+   {
+      std::vector<bool> const selected = selectPackets(*packets, epi.packetsPerVolume, range);
+
+      int lastPacket = -1;
+      for (int n = firstPacket ; n < (int) selected.size() ; n++)
+      {
+         if (selected[n])
+         {
+            lastPacket = n;
+         }
+      }
+      packetQuantity = lastPacket + 1;
+   }
 
    int                 acqType = 0;
-   unsigned int        nEchoes = processingControl->Value<int>("NumEchoes");
-   unsigned int      nChannels = processingControl->Value<int>("NumChannels");
-   unsigned int      numSlices = processingControl->Value<int>("NumSlices");
-   size_t           frame_size = processingControl->Value<int>("AcquiredXRes");
-   int const          topViews = processingControl->Value<int>("ExtraFramesTop");
-   int const              yAcq = processingControl->Value<int>("AcquiredYRes");
-   int const       bottomViews = processingControl->Value<int>("ExtraFramesBottom");
+   unsigned int        nEchoes = scan.numEchoes;
+   unsigned int      nChannels = scan.numChannels;
+   size_t           frame_size = scan.acquiredXRes;
+   int const          topViews = epi.extraFramesTop;
+   int const              yAcq = scan.acquiredYRes;
+   int const       bottomViews = epi.extraFramesBottom;
    // unsigned int     nRefViews = processingControl->Value<int>("NumRefViews"); // Variable not found at run time
    unsigned int      nRefViews = topViews + bottomViews;
 
-   bool isEpiRefScanIntegrated = processingControl->Value<bool>("IntegratedReferenceScan");
-   bool     isMultiBandEnabled = processingControl->Value<bool>("MultibandEnabled");
+   bool isEpiRefScanIntegrated = epi.integratedReferenceScan;
+   bool     isMultiBandEnabled = epi.multibandEnabled;
  
    // Commented out for now, as these don't seem to hold necessary values for EPI.
    // int                nVolumes = processingControl->Value<int>("NumAcquisitions");
@@ -48,167 +221,411 @@ std::vector<ISMRMRD::Acquisition> NIHepiConverter::getAcquisitions(GERecon::Scan
    // float         acqSampleTime = processingControl->Value<float>("A2DSampleTime"); // does not exist in the Epi::LxControlSource object
 
    const RowFlipParametersPointer rowFlipper = boost::make_shared<RowFlipParameters>(yAcq + nRefViews);
-   RowFlipPlugin rowFlipPlugin(rowFlipper, *processingControl);
+   RowFlipPlugin rowFlipPlugin(rowFlipper, *epi.processingControl);
 
-   int dataIndex = 0;
-   std::vector<ISMRMRD::Acquisition> acqs;
+   PacketLayout layout;
+   layout.frameSize   = frame_size;
+   layout.numChannels = nChannels;
+   layout.packetsPerVolume = epi.packetsPerVolume;
+   layout.topViews    = topViews;
+   layout.yAcq        = yAcq;
+   layout.totalViews  = topViews + yAcq + bottomViews;
+   layout.numRefViews = nRefViews;
+   layout.channels    = range.selectedChannels(nChannels);
 
-   Range refViewsRange;
-   int   refViewsStart, refViewsEnd;
+   // One time stamp for the whole conversion, so that it is reproducible
+   layout.timeStamp   = time(NULL);
+
+   // Note: Using ApplyImageDataRowFlip seems to work for all
+   // rows (image and reference)
+   layout.fusedRowFlip = getRowFlipIndex(rowFlipPlugin, frame_size, yAcq + nRefViews, layout.rowFlipIndex);
+
+   layout.refViewsStart = 0;
+   layout.refViewsEnd   = 0;
 
    if (nRefViews > 0)
    {
       if (topViews > 0)
       {
-         refViewsStart = 0;
-         refViewsEnd   = topViews - 1;
+         layout.refViewsStart = 0;
+         layout.refViewsEnd   = topViews - 1;
       }
       else if (bottomViews > 0)
       {
-         refViewsStart = yAcq;
-         refViewsEnd   = yAcq + bottomViews - 1;
+         layout.refViewsStart = yAcq;
+         layout.refViewsEnd   = yAcq + bottomViews - 1;
       }
-      else
+      Range refViewsRange(layout.refViewsStart, layout.refViewsEnd);
+
+      if (firstPacket == 0)
       {
-         refViewsStart = 0;
-         refViewsEnd   = 0;
+         log_ << "Reference views range: " << refViewsRange << std::endl;
+         log_ << "yAcq: " << yAcq << ", topViews: " << topViews << ", bottomViews: " << bottomViews << std::endl;
       }
-      refViewsRange = Range (refViewsStart, refViewsEnd);
-
-      std::cout << "Reference views range: " << refViewsRange << std::endl;
-      std::cout << "yAcq: " << yAcq << ", topViews: " << topViews << ", bottomViews: " << bottomViews << std::endl;
    }
 
-   for (int packetCount=0; packetCount < packetQuantity; packetCount++)
+   // Hyperframe packets are independent of each other once read. ArchiveStorage is
+   // not thread safe, so the calling thread reads every packet, data included, and
+   // hands it to a task that decodes it on any thread of the team. Decoded packets
+   // wait in a bounded reorder buffer until the packets before them are done, and
+   // are then passed to the sink in packet order by the calling thread. A slow
+   // packet only holds back the packets behind it, and the output does not depend
+   // on the number of threads.
+   int const    numThreads  = GEToIsmrmrd::resolveThreadCount(options_.numThreads);
+   size_t const reorderSize = 2 * numThreads;
+
+   std::vector<DecodedPacket> reorder(reorderSize);
+   for (size_t n = 0 ; n < reorderSize ; n++)
    {
-      GERecon::Acquisition::FrameControlPointer const thisPacket = archiveStoragePointer->NextFrameControl();
+      reorder[n].acqs.resize(layout.totalViews);
+   }
+
+   std::atomic<bool> failed(false);
+   std::exception_ptr error;
 
-      // Need to identify opcode(s) here that will mark acquisition / reference / control
-      if (thisPacket->Control().Opcode() != GERecon::Acquisition::ScanControlOpcode)
+   #pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+   {
+      // The other threads decode packets while they wait at the end of the region
+      #pragma omp master
       {
-         // For EPI scans, packets are now HyperFrameControl type
-         GERecon::Acquisition::HyperFrameControlPacket const packetContents = thisPacket->Control().Packet().As<GERecon::Acquisition::HyperFrameControlPacket>();
+         size_t read   = 0;   // packets handed to a task
+         size_t passed = 0;   // packets passed to the sink
 
-         const GERecon::SliceInfoTable sliceTable = processingControl->ValueStrict<GERecon::SliceInfoTable>("SliceTable");
+         // Passes decoded packets on in order, waiting until at least minimum have been passed
+         auto passOn = [&](size_t minimum)
+         {
+            while ((passed < read) && !failed)
+            {
+               DecodedPacket &decoded = reorder[passed % reorderSize];
 
-         int viewSkip = static_cast<short>(Acquisition::GetPacketValue(packetContents.viewSkipH, packetContents.viewSkipL));
+               if (!decoded.done.load(std::memory_order_acquire))
+               {
+                  if (passed >= minimum)
+                  {
+                     break;
+                  }
+                  #pragma omp taskyield
+                  std::this_thread::yield();
+                  continue;
+               }
 
-         acqType = GERecon::Acquisition::ImageFrame;
-         auto pktData = thisPacket->Data();
+               for (int view = 0; view < layout.totalViews; ++view)
+               {
+                  sink.consume(decoded.acqs[view]);
+               }
+               passed++;
+            }
+         };
 
-         // Transpose the pktData - swapping channel (2) and phase (1) dimensions. This does not move data around in
-         // memory - this just manipulates the strides.
-         pktData.transposeSelf( 0, 2, 1 );
+         try
+         {
+            int dataIndex = 0;
+            unsigned int dataPackets = 0;
 
-         // Flip Y dimension (for all x samples and all channels)
-         if (viewSkip < 0) {
-            pktData.reverseSelf(1);
-            // std::cout << "Data was FLIPPED alonig y-axis using reverseSelf()\n";
-         }
+            for (int packetCount = 0 ; (packetCount < packetQuantity) && !failed ; packetCount++)
+            {
+               GERecon::Acquisition::FrameControlPointer thisPacket;
+               {
+                  GEToIsmrmrd::Hdf5Lock lock;
+                  thisPacket = archiveStoragePointer->NextFrameControl();
+               }
+               GEToIsmrmrd::PacketIndexEntry const entry = packets ? (*packets)[packetCount] :
+                  GEToIsmrmrd::PacketIndex::describe(thisPacket, packetCount, context);
 
-         // Copy (and sort) the packet data into a new array, kdata.
-         ComplexFloatCube kData( pktData.shape() );
-         kData = pktData;
+               if (thisPacket->Control().Opcode() != entry.opcode)
+               {
+                  throw std::runtime_error("NIHepiConverter: packet index does not match the archive");
+               }
 
-         // Do the row-flipping.
-         //
-         // Note: Using ApplyImageDataRowFlip seems to work for all
-         // rows (image and reference)
-         for (int channelID = 0 ; channelID < nChannels ; channelID++)
-         {
-           ComplexFloatMatrix tempData = kData(Range::all(), Range::all(), channelID);
-           rowFlipPlugin.ApplyImageDataRowFlip(tempData);
-         }
+               // Need to identify opcode(s) here that will mark acquisition / reference / control
+               if (entry.isScanControl())
+               {
+                  continue;
+               }
 
-         // Unchop RF-chopped data
-         kData(Range::all(), Range(fromStart, toEnd, 2), Range::all()) *= -1.0f;
+               int const packetIndex = dataIndex;
+               dataIndex += layout.totalViews;
+               unsigned int const volume = dataPackets++ / epi.packetsPerVolume;
 
-         // Copy data out of ScanArchive into ISMRMRD object
-         int totalViews = topViews + yAcq + bottomViews;
+               // Counted above, so that scan counters and repetitions match those of a full conversion
+               if ((packetCount < (int) firstPacket) || !selectsPacket(entry, volume, range))
+               {
+                  continue;
+               }
 
-         // Pre-allocate memory for incoming views
-         acqs.resize(dataIndex + totalViews);
+               // Make room in the reorder buffer
+               if (read - passed == reorderSize)
+               {
+                  passOn(passed + 1);
+                  if (failed)
+                  {
+                     break;
+                  }
+               }
 
-         int ref_count = 0;
-         int pe1_index = 0;
+               // For EPI scans, packets are now HyperFrameControl type
+               GERecon::Acquisition::HyperFrameControlPacket const packetContents =
+                  thisPacket->Control().Packet().As<GERecon::Acquisition::HyperFrameControlPacket>();
 
-         for (int view = 0; view < totalViews; ++view)
-         {
-            // Figure out where to put this view (i.e. effectively
-            // re-sorting the views in the packet so that the reference
-            // data comes first.
+               // Copies of a Blitz array share its memory block through a reference count that is not
+               // thread-safe, so the task gets a deep copy of its own, shared with it through a
+               // std::shared_ptr; no Blitz array is then referenced from two threads.
+               std::shared_ptr<const ComplexFloatCube> pktData;
+               {
+                  GEToIsmrmrd::Hdf5Lock lock;
+                  pktData = std::make_shared<const ComplexFloatCube>(thisPacket->Data().copy());
+               }
 
-            int acq_index = 0;
+               DecodedPacket *decoded = &reorder[read++ % reorderSize];
+               decoded->done.store(false, std::memory_order_relaxed);
 
-            if ((nRefViews > 0) && (view >= refViewsStart) && (view <= refViewsEnd)) {
-               // This view contains reference scan data
-               pe1_index = yAcq/2;
-               acq_index = dataIndex + ref_count++;
+               #pragma omp task firstprivate(packetContents, pktData, decoded, packetIndex) if (numThreads > 1)
+               {
+                  try
+                  {
+                     decodePacket(scan, layout, rowFlipPlugin, packetContents, *pktData, packetIndex, decoded->acqs);
+                     decoded->done.store(true, std::memory_order_release);
+                  }
+                  catch (...)
+                  {
+                     #pragma omp critical(NIHepiPacketError)
+                     if (!error) {
+                        error = std::current_exception();
+                     }
+                     failed = true;
+                  }
+               }
+
+               passOn(0);
             }
-            else {
-               // This view constains (k-space) image data
-               pe1_index = view - topViews;
-               acq_index = dataIndex + nRefViews + pe1_index;
+
+            passOn(read);
+         }
+         catch (...)
+         {
+            #pragma omp critical(NIHepiPacketError)
+            if (!error) {
+               error = std::current_exception();
             }
+            failed = true;
+         }
+      }
+   }
+
+   if (error) {
+      std::rethrow_exception(error);
+   }
 
-            // Grab a reference to the acquisition
-            ISMRMRD::Acquisition &acq = acqs.at(acq_index);
+   return std::max<size_t>(firstPacket, packetQuantity);
+}
 
-            // Set size of this data frame to receive raw data
-            acq.resize(frame_size, nChannels, 0);
-            acq.clearAllFlags();
 
-            // Initialize the encoding counters for this acquisition.
-            ISMRMRD::EncodingCounters &idx = acq.idx();
 
-            idx.kspace_encode_step_1   = pe1_index;
-            idx.slice                  = sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH,
-                                                                                                              packetContents.sliceNumL));
-            idx.repetition             = (int) (dataIndex / (numSlices * totalViews));
-            idx.contrast               = packetContents.echoNum;
+/**
+ * Whether the row flip of the scan only reorders samples, rather than interpolating them
+ */
+bool NIHepiConverter::preservesSampleValues(const GEToIsmrmrd::ConversionContext &context) const
+{
+   if (!context.epi)
+   {
+      return true;
+   }
 
-            // acq.measurement_uid() = pfile->RunNumber();
-            acq.scan_counter()         = dataIndex + view;
-            acq.acquisition_time_stamp() = time(NULL);
-            for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
-               acq.physiology_time_stamp()[p] = 0;
-            }
-            acq.available_channels()   = nChannels;
-            acq.center_sample()        = frame_size/2;
-            // acq.sample_time_us()       = pfile->sample_time * 1e6;
+   const GEToIsmrmrd::EpiParameters &epi = *context.epi;
+   int const numViews = epi.extraFramesTop + epi.scan.acquiredYRes + epi.extraFramesBottom;
 
-            // Set first acquisition flag
-            if (view == 0)
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+   const RowFlipParametersPointer rowFlipper = boost::make_shared<RowFlipParameters>(numViews);
+   RowFlipPlugin rowFlipPlugin(rowFlipper, *epi.processingControl);
 
-            // Set last acquisition flag
-            if (view == totalViews - 1)
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+   std::vector<int> rowFlipIndex;
+   return getRowFlipIndex(rowFlipPlugin, epi.scan.acquiredXRes, numViews, rowFlipIndex);
+}
 
-            // Label reference scan data
-            // if (view < topViews || view >= topViews + yAcq)
-            if ((nRefViews > 0) && (view >= refViewsStart) && (view <= refViewsEnd))
-            {
-               // std::cout << "Setting view: " << view << " as phase correction line." << std::endl;
 
-               acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_PHASECORR_DATA);
-            }
 
-            // Copy view data to ISMRMRD Acq data packet
-            for (int channelID = 0 ; channelID < nChannels ; channelID++)
-            {
-               for (int x = 0 ; x < frame_size ; x++)
-               {
-                  acq.data(x, channelID) = kData(x, view, channelID);
-               }
-               acq.setChannelActive(channelID);
-            }
+/**
+ * Decodes one hyperframe packet into its ISMRMRD acquisitions
+ *
+ * The views are re-sorted so that reference data comes first. Safe to call
+ * concurrently for different packets and acquisition vectors, as the packet
+ * was read from the archive beforehand.
+ *
+ * @param scan Scan parameters of this conversion
+ * @param layout Layout of the views in each packet
+ * @param rowFlipPlugin Row flip plugin, only used if the flip could not be fused
+ * @param packetContents Control packet of the hyperframe to decode
+ * @param pktData Samples of the hyperframe, in (x, channel, view) order
+ * @param dataIndex Number of views in the packets before this one
+ * @param acqs Receives layout.totalViews acquisitions
+ */
+void NIHepiConverter::decodePacket(const GEToIsmrmrd::ScanParameters &scan, const PacketLayout &layout,
+                                   RowFlipPlugin &rowFlipPlugin,
+                                   const GERecon::Acquisition::HyperFrameControlPacket &packetContents,
+                                   ComplexFloatCube pktData,
+                                   int dataIndex, std::vector<ISMRMRD::Acquisition> &acqs)
+{
+   int const  frame_size = layout.frameSize;
+   int const   nChannels = layout.channels.size();
+   int const  totalViews = layout.totalViews;
+   int const   nRefViews = layout.numRefViews;
+   int const    topViews = layout.topViews;
+   int const        yAcq = layout.yAcq;
+
+   int viewSkip = static_cast<short>(Acquisition::GetPacketValue(packetContents.viewSkipH, packetContents.viewSkipL));
+
+   // Views are stored in reverse order when viewSkip is negative
+   bool reversed = (viewSkip < 0);
+
+   if (!layout.fusedRowFlip)
+   {
+      // The row flip is not a plain reordering of samples, so let the plugin flip a
+      // sorted copy of the packet, and copy the result out below without reordering.
+      //
+      // Transpose the pktData - swapping channel (2) and phase (1) dimensions. This does not move data around in
+      // memory - this just manipulates the strides.
+      pktData.transposeSelf( 0, 2, 1 );
+
+      // Flip Y dimension (for all x samples and all channels)
+      if (reversed) {
+         pktData.reverseSelf(1);
+      }
+
+      ComplexFloatCube kData( pktData.shape() );
+      kData = pktData;
+
+      // The plugin is shared by all packets of the conversion
+      #pragma omp critical(NIHepiRowFlip)
+      for (int c = 0 ; c < nChannels ; c++)
+      {
+        ComplexFloatMatrix tempData = kData(Range::all(), Range::all(), layout.channels[c]);
+        rowFlipPlugin.ApplyImageDataRowFlip(tempData);
+      }
+
+      // Back to the (x, channel, view) order of the packet
+      kData.transposeSelf( 0, 2, 1 );
+      pktData.reference(kData);
+      reversed = false;
+   }
+
+   unsigned int const slice = scan.sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH,
+                                                                                                     packetContents.sliceNumL));
+
+   // Copy data out of ScanArchive into ISMRMRD object
+   int ref_count = 0;
+   int pe1_index = 0;
+
+   for (int view = 0; view < totalViews; ++view)
+   {
+      // Figure out where to put this view (i.e. effectively
+      // re-sorting the views in the packet so that the reference
+      // data comes first.
+
+      int acq_index = 0;
+      bool const isRefView = (nRefViews > 0) && (view >= layout.refViewsStart) && (view <= layout.refViewsEnd);
+
+      if (isRefView) {
+         // This view contains reference scan data
+         pe1_index = yAcq/2;
+         acq_index = ref_count++;
+      }
+      else {
+         // This view constains (k-space) image data
+         pe1_index = view - topViews;
+         acq_index = nRefViews + pe1_index;
+      }
+
+      // Grab a reference to the acquisition
+      ISMRMRD::Acquisition &acq = acqs.at(acq_index);
+
+      // Set size of this data frame to receive raw data
+      acq.resize(frame_size, nChannels, 0);
+      acq.clearAllFlags();
+
+      // Initialize the encoding counters for this acquisition.
+      ISMRMRD::EncodingCounters &idx = acq.idx();
+
+      idx.kspace_encode_step_1   = pe1_index;
+      idx.slice                  = slice;
+      idx.repetition             = (int) (dataIndex / (layout.packetsPerVolume * totalViews));
+      idx.contrast               = packetContents.echoNum;
+
+      // acq.measurement_uid() = pfile->RunNumber();
+      acq.scan_counter()         = dataIndex + view;
+      acq.acquisition_time_stamp() = layout.timeStamp;
+      for (int p=0; p<ISMRMRD::ISMRMRD_PHYS_STAMPS; p++) {
+         acq.physiology_time_stamp()[p] = 0;
+      }
+      acq.available_channels()   = layout.numChannels;
+      acq.center_sample()        = frame_size/2;
+      // acq.sample_time_us()       = pfile->sample_time * 1e6;
+
+      // Set first acquisition flag
+      if (view == 0)
+         acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+
+      // Set last acquisition flag
+      if (view == totalViews - 1)
+         acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+
+      // Label reference scan data
+      if (isRefView)
+      {
+         acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_PHASECORR_DATA);
+      }
+
+      // Copy view data to ISMRMRD Acq data packet in a single pass, which
+      //  - undoes the view reversal of packets with a negative viewSkip,
+      //  - applies the row flip through the precomputed sample map,
+      //  - unchops RF-chopped data (even views are negated), and
+      //  - transposes from packet (x, channel, view) to ISMRMRD (x, channel) order.
+      int const srcView = reversed ? (totalViews - 1 - view) : view;
+      float const sign  = (view % 2 == 0) ? -1.0f : 1.0f;
+      const int *xMap   = &layout.rowFlipIndex[view * frame_size];
+      int const xStride = pktData.stride(0);
+
+      for (int c = 0 ; c < nChannels ; c++)
+      {
+         const std::complex<float> *src = &pktData(0, layout.channels[c], srcView);
+         complex_float_t *dst = acq.getDataPtr() + c * frame_size;
 
-            setISMRMRDSliceVectors(processingControl, acq);
+         for (int x = 0 ; x < frame_size ; x++)
+         {
+            dst[x] = sign * src[xMap[x] * xStride];
          }
-         dataIndex += totalViews;
+         acq.setChannelActive(layout.channels[c]);
       }
+
+      setISMRMRDSliceVectors(scan, acq);
    }
-   return acqs;
 }
 
+
+
+size_t NIHepiConverter::estimateAcquisitionCount(const GEToIsmrmrd::ConversionContext &context,
+                                                GERecon::ScanArchivePointer &scanArchivePtr,
+                                                const GEToIsmrmrd::ConversionRange &range)
+{
+   if (!context.epi)
+   {
+      return 0;
+   }
+
+   // Every hyperframe packet carries all reference and image views of one slice
+   const GEToIsmrmrd::EpiParameters &epi = *context.epi;
+   size_t const viewsPerPacket = epi.extraFramesTop + epi.scan.acquiredYRes + epi.extraFramesBottom;
+
+   if (context.packets)
+   {
+      std::vector<bool> const selected = selectPackets(*context.packets, epi.packetsPerVolume, range);
+      return std::count(selected.begin(), selected.end(), true) * viewsPerPacket;
+   }
+
+   GEToIsmrmrd::Hdf5Lock lock;
+   GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchivePtr);
+
+   return archiveStoragePointer->AvailableControlCount() * viewsPerPacket;
+}
+
+
+
+SEQUENCE_CONVERTER_FACTORY_DECLARE(NIHepiConverter)
@@ -3,6 +3,8 @@
 #ifndef NIH_EPI_CONVERTER_H
 #define NIH_EPI_CONVERTER_H
 
+#include <atomic>
+
 #include "ismrmrd/ismrmrd.h"
 
 #include "GenericConverter.h"
@@ -11,11 +13,69 @@ class NIHepiConverter: public GEToIsmrmrd::GenericConverter
 {
 public:
 
-   std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::Legacy::PfilePointer &pfile,
-                                                      unsigned int view_num);
+   void                          convertAcquisitions (const GEToIsmrmrd::ConversionContext &context,
+                                                      GERecon::Legacy::PfilePointer &pfile,
+                                                      const GEToIsmrmrd::ConversionRange &range, GEToIsmrmrd::AcquisitionSink &sink);
+
+   void                          convertAcquisitions (const GEToIsmrmrd::ConversionContext &context,
+                                                      GERecon::ScanArchivePointer &scanArchive,
+                                                      const GEToIsmrmrd::ConversionRange &range, GEToIsmrmrd::AcquisitionSink &sink);
+
+   size_t                     convertNewAcquisitions (const GEToIsmrmrd::ConversionContext &context,
+                                                      GERecon::ScanArchivePointer &scanArchive,
+                                                      const GEToIsmrmrd::ConversionRange &range, size_t firstPacket,
+                                                      GEToIsmrmrd::AcquisitionSink &sink);
+
+   bool                        preservesSampleValues (const GEToIsmrmrd::ConversionContext &context) const;
+
+   using GEToIsmrmrd::GenericConverter::estimateAcquisitionCount;
+
+   size_t                   estimateAcquisitionCount (const GEToIsmrmrd::ConversionContext &context,
+                                                      GERecon::ScanArchivePointer &scanArchive,
+                                                      const GEToIsmrmrd::ConversionRange &range);
+
+protected:
+   /** Per-conversion layout of the views in each hyperframe packet */
+   struct PacketLayout
+   {
+      int              frameSize;
+      int              numChannels;
+      int              packetsPerVolume;
+      int              topViews;
+      int              yAcq;
+      int              totalViews;
+      int              numRefViews;
+      int              refViewsStart;
+      int              refViewsEnd;
+      uint32_t         timeStamp;
+      bool             fusedRowFlip;
+      std::vector<int> rowFlipIndex;
+      std::vector<unsigned int> channels;
+   };
+
+   /** Acquisitions of a packet waiting in the reorder buffer to be passed on in packet order */
+   struct DecodedPacket
+   {
+      DecodedPacket() : done(false) { }
+
+      std::vector<ISMRMRD::Acquisition> acqs;
+      std::atomic<bool>                 done;
+   };
+
+   void                             decodePacket (const GEToIsmrmrd::ScanParameters &scan, const PacketLayout &layout,
+                                                      RowFlipPlugin &rowFlipPlugin,
+                                                      const GERecon::Acquisition::HyperFrameControlPacket &packetContents,
+                                                      ComplexFloatCube pktData,
+                                                      int dataIndex, std::vector<ISMRMRD::Acquisition> &acqs);
+
+   static std::vector<bool>           selectPackets (const GEToIsmrmrd::PacketIndex &packets, unsigned int packetsPerVolume,
+                                                      const GEToIsmrmrd::ConversionRange &range);
+
+   static bool                         selectsPacket (const GEToIsmrmrd::PacketIndexEntry &entry, unsigned int volume,
+                                                      const GEToIsmrmrd::ConversionRange &range);
 
-   std::vector<ISMRMRD::Acquisition> getAcquisitions (GERecon::ScanArchivePointer &scanArchive,
-                                                      unsigned int view_num);
+   static bool                       getRowFlipIndex (RowFlipPlugin &rowFlipPlugin, int frameSize, int numViews,
+                                                      std::vector<int> &rowFlipIndex);
 };
 
 #endif /* NIH_EPI_CONVERTER_H */
@@ -0,0 +1,422 @@
+/** @file NativeHeaderBuilder.cpp */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include <libxml/tree.h>
+#include <libxml/xmlsave.h>
+#include <libxml/xpath.h>
+#include <openssl/sha.h>
+
+#include "NativeHeaderBuilder.h"
+
+namespace GEToIsmrmrd {
+
+/*
+ * XPath helpers, each matching how the stylesheets read the raw file header:
+ * a path stands for the node-set of all values written there.
+ */
+
+/** string(path): the first value, or "" */
+static const std::string& text(const HeaderFields& fields, const std::string& path)
+{
+    static const std::string empty;
+    const std::vector<std::string>& values = fields.values(path);
+    return values.empty() ? empty : values[0];
+}
+
+/** number(path) */
+static double number(const HeaderFields& fields, const std::string& path)
+{
+    const std::vector<std::string>& values = fields.values(path);
+    if (values.empty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return xmlXPathCastStringToNumber(BAD_CAST values[0].c_str());
+}
+
+/** string(number), e.g. "128", "0.5" or "NaN" */
+static std::string format(double value)
+{
+    xmlChar* formatted = xmlXPathCastNumberToString(value);
+    std::string result(reinterpret_cast<const char*>(formatted));
+    xmlFree(formatted);
+    return result;
+}
+
+/** path = 'literal': true if any value equals the literal */
+static bool anyEquals(const HeaderFields& fields, const std::string& path, const std::string& literal)
+{
+    const std::vector<std::string>& values = fields.values(path);
+    for (size_t n = 0 ; n < values.size() ; n++) {
+        if (values[n] == literal) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** path != '': true if any value is not empty */
+static bool anyNonEmpty(const HeaderFields& fields, const std::string& path)
+{
+    const std::vector<std::string>& values = fields.values(path);
+    for (size_t n = 0 ; n < values.size() ; n++) {
+        if (!values[n].empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** substring(value, start, length) for whole-number arguments, counting characters rather than bytes */
+static std::string substring(const std::string& value, int start, int length)
+{
+    std::string result;
+    int position = 0;
+
+    for (size_t n = 0 ; n < value.size() ; ) {
+        // Length of this UTF-8 character
+        unsigned char const lead = value[n];
+        size_t bytes = (lead < 0x80) ? 1 : (lead < 0xE0) ? 2 : (lead < 0xF0) ? 3 : 4;
+        bytes = std::min(bytes, value.size() - n);
+
+        position++;
+        if (position >= start && position < start + length) {
+            result.append(value, n, bytes);
+        }
+        n += bytes;
+    }
+
+    return result;
+}
+
+/** concat(substring(d,1,4),'-',substring(d,5,2),'-',substring(d,7,2)) */
+static std::string isoDate(const std::string& date)
+{
+    return substring(date, 1, 4) + "-" + substring(date, 5, 2) + "-" + substring(date, 7, 2);
+}
+
+/** concat(substring(t,1,2),':',substring(t,3,2),':',substring(t,5,2)) */
+static std::string isoTime(const std::string& time)
+{
+    return substring(time, 1, 2) + ":" + substring(time, 3, 2) + ":" + substring(time, 5, 2);
+}
+
+/** Adds an element; like xsl:value-of, an empty value adds no text node */
+static xmlNodePtr element(xmlNodePtr parent, const char* name, const std::string& value = std::string())
+{
+    xmlNodePtr node = xmlNewChild(parent, parent->ns, BAD_CAST name, NULL);
+    if (!value.empty()) {
+        xmlAddChild(node, xmlNewText(BAD_CAST value.c_str()));
+    }
+    return node;
+}
+
+/** Adds a <minimum>/<maximum>/<center> limit */
+static void limit(xmlNodePtr parent, const char* name,
+                  const std::string& minimum, const std::string& maximum, const std::string& center)
+{
+    xmlNodePtr node = element(parent, name);
+    element(node, "minimum", minimum);
+    element(node, "maximum", maximum);
+    element(node, "center", center);
+}
+
+static void userParameter(xmlNodePtr parent, const char* type, const char* name, const std::string& value)
+{
+    xmlNodePtr node = element(parent, type);
+    element(node, "name", name);
+    element(node, "value", value);
+}
+
+static void addSubjectInformation(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr subject = element(root, "subjectInformation");
+    element(subject, "patientName", text(fields, "Header/Patient/Name"));
+    element(subject, "patientWeight_kg", text(fields, "Header/Patient/Weight"));
+    element(subject, "patientID", text(fields, "Header/Patient/ID"));
+    if (anyNonEmpty(fields, "Header/Patient/Birthdate")) {
+        element(subject, "patientBirthdate", isoDate(text(fields, "Header/Patient/Birthdate")));
+    }
+    if (anyNonEmpty(fields, "Header/Patient/Gender")) {
+        element(subject, "patientGender", text(fields, "Header/Patient/Gender"));
+    }
+}
+
+static void addStudyInformation(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr study = element(root, "studyInformation");
+    element(study, "studyDate", isoDate(text(fields, "Header/Study/Date")));
+    element(study, "studyTime", isoTime(text(fields, "Header/Study/Time")));
+    element(study, "studyID", text(fields, "Header/Study/Number"));
+    if (anyNonEmpty(fields, "Header/Study/AccessionNumber")) {
+        element(study, "accessionNumber", text(fields, "Header/Study/AccessionNumber"));
+    } else {
+        element(study, "accessionNumber", "0");
+    }
+    if (anyNonEmpty(fields, "Header/Study/ReferringPhysician")) {
+        element(study, "referringPhysicianName", text(fields, "Header/Study/ReferringPhysician"));
+    }
+    if (anyNonEmpty(fields, "Header/Study/Description")) {
+        element(study, "studyDescription", text(fields, "Header/Study/Description"));
+    }
+    element(study, "studyInstanceUID", text(fields, "Header/Study/UID"));
+}
+
+static void addMeasurementInformation(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr measurement = element(root, "measurementInformation");
+    element(measurement, "measurementID", text(fields, "Header/Series/Number"));
+    element(measurement, "seriesDate", isoDate(text(fields, "Header/Series/Date")));
+    element(measurement, "seriesTime", isoTime(text(fields, "Header/Series/Time")));
+    element(measurement, "patientPosition", anyEquals(fields, "Header/PatientPosition", "0") ? "HFP" : "HFS");
+    element(measurement, "initialSeriesNumber", text(fields, "Header/Series/Number"));
+    element(measurement, "protocolName", text(fields, "Header/Series/ProtocolName"));
+    element(measurement, "seriesDescription", text(fields, "Header/Series/Description"));
+    element(measurement, "seriesInstanceUIDRoot", text(fields, "Header/Series/UID"));
+
+    xmlNodePtr references = element(measurement, "referencedImageSequence");
+    const std::vector<std::string>& uids = fields.values("Header/ReferencedImageUIDs");
+    for (size_t n = 0 ; n < uids.size() ; n++) {
+        if (!uids[n].empty()) {
+            element(references, "referencedSOPInstanceUID", uids[n]);
+        }
+    }
+}
+
+static void addAcquisitionSystemInformation(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr system = element(root, "acquisitionSystemInformation");
+    element(system, "systemVendor", text(fields, "Header/Equipment/Manufacturer"));
+    element(system, "systemModel", text(fields, "Header/Equipment/ManufacturerModel"));
+    element(system, "systemFieldStrength_T", text(fields, "Header/Image/MagneticFieldStrength"));
+    element(system, "relativeReceiverNoiseBandwidth", "1.0");
+    element(system, "receiverChannels", text(fields, "Header/ChannelCount"));
+    element(system, "institutionName", text(fields, "Header/Equipment/Institution"));
+    element(system, "stationName", text(fields, "Header/Equipment/Station"));
+    element(system, "deviceID", text(fields, "Header/Equipment/DeviceSerialNumber"));
+
+    xmlNodePtr conditions = element(root, "experimentalConditions");
+    element(conditions, "H1resonanceFrequency_Hz", format(number(fields, "Header/Image/ImagingFrequency") * 1000000));
+}
+
+/** <encodedSpace> and <reconSpace>, which differ between the mappings only in the encoded matrix */
+static void addSpaces(xmlNodePtr encoding, const HeaderFields& fields,
+                      const std::string& encodedX, const std::string& encodedY)
+{
+    bool const is3D = anyEquals(fields, "Header/Is3DAcquisition", "true");
+    std::string const fovX = format(number(fields, "Header/TransformXRes") * number(fields, "Header/Image/PixelSizeX"));
+    std::string const fovY = format(number(fields, "Header/TransformYRes") * number(fields, "Header/Image/PixelSizeY"));
+
+    xmlNodePtr encoded = element(encoding, "encodedSpace");
+    xmlNodePtr matrix = element(encoded, "matrixSize");
+    element(matrix, "x", encodedX);
+    element(matrix, "y", encodedY);
+    element(matrix, "z", is3D ? text(fields, "Header/AcquiredZRes") : "1");
+    xmlNodePtr fov = element(encoded, "fieldOfView_mm");
+    element(fov, "x", fovX);
+    element(fov, "y", fovY);
+    element(fov, "z", text(fields, "Header/Image/SliceThickness"));
+
+    xmlNodePtr recon = element(encoding, "reconSpace");
+    matrix = element(recon, "matrixSize");
+    element(matrix, "x", text(fields, "Header/TransformXRes"));
+    element(matrix, "y", text(fields, "Header/TransformYRes"));
+    element(matrix, "z", is3D ? text(fields, "Header/TransformZRes") : "1");
+    fov = element(recon, "fieldOfView_mm");
+    element(fov, "x", fovX);
+    element(fov, "y", fovY);
+    element(fov, "z", text(fields, "Header/Image/SliceSpacing"));
+}
+
+/** Limits running from 0 to count - 1 with center floor(count / 2) */
+static void countLimit(xmlNodePtr parent, const char* name, double count)
+{
+    limit(parent, name, "0", format(count - 1), format(std::floor(count / 2)));
+}
+
+/** Limits from an optional count, which default to a maximum of 1 and a center of 0 */
+static void optionalCountLimit(xmlNodePtr parent, const char* name, const HeaderFields& fields, const std::string& path)
+{
+    if (anyNonEmpty(fields, path)) {
+        countLimit(parent, name, number(fields, path));
+    } else {
+        limit(parent, name, "0", "1", "0");
+    }
+}
+
+static void addDefaultEncoding(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr encoding = element(root, "encoding");
+    element(encoding, "trajectory", "cartesian");
+
+    addSpaces(encoding, fields, text(fields, "Header/AcquiredXRes"), text(fields, "Header/AcquiredYRes"));
+
+    xmlNodePtr limits = element(encoding, "encodingLimits");
+    countLimit(limits, "kspace_encoding_step_1", number(fields, "Header/AcquiredYRes"));
+    limit(limits, "kspace_encoding_step_2", "0", "0", "0");
+    countLimit(limits, "slice", number(fields, "Header/SliceCount"));
+    limit(limits, "set", "0", "0", "0");
+    limit(limits, "phase", "0", "0", "0");
+    optionalCountLimit(limits, "repetition", fields, "Header/RepetitionCount");
+    limit(limits, "segment", "0", "0", "0");
+    optionalCountLimit(limits, "contrast", fields, "Header/EchoCount");
+    limit(limits, "average", "0", "0", "0");
+
+    element(encoding, "echoTrainLength", text(fields, "Header/Image/EchoTrainLength"));
+}
+
+static void addEpiEncoding(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr encoding = element(root, "encoding");
+    element(encoding, "trajectory", "epi");
+
+    xmlNodePtr trajectory = element(encoding, "trajectoryDescription");
+    element(trajectory, "identifier", "ConventionalEPI");
+    userParameter(trajectory, "userParameterLong", "etl", text(fields, "Header/AcquiredYRes"));
+    userParameter(trajectory, "userParameterLong", "numberOfNavigators", text(fields, "Header/epiParameters/NumRefViews"));
+    if (anyEquals(fields, "Header/isEpiRampsampled", "true")) {
+        userParameter(trajectory, "userParameterLong", "rampUpTime", text(fields, "Header/UserVariables/rdb_hdr_user11"));
+        userParameter(trajectory, "userParameterLong", "rampDownTime", text(fields, "Header/UserVariables/rdb_hdr_user11"));
+        userParameter(trajectory, "userParameterLong", "flatTopTime", text(fields, "Header/UserVariables/rdb_hdr_user12"));
+        userParameter(trajectory, "userParameterLong", "acqDelayTime", text(fields, "Header/UserVariables/rdb_hdr_user10"));
+    }
+    userParameter(trajectory, "userParameterLong", "numSamples", text(fields, "Header/AcquiredXRes"));
+    userParameter(trajectory, "userParameterDouble", "dwellTime", "2.0");
+
+    addSpaces(encoding, fields, text(fields, "Header/TransformXRes"), text(fields, "Header/epiParameters/AcquiredYRes"));
+
+    xmlNodePtr limits = element(encoding, "encodingLimits");
+    countLimit(limits, "kspace_encoding_step_1", number(fields, "Header/epiParameters/AcquiredYRes"));
+    limit(limits, "kspace_encoding_step_2", "0", "0", "0");
+    countLimit(limits, "slice", number(fields, "Header/SliceCount"));
+    limit(limits, "set", "0", "0", "0");
+    limit(limits, "phase", "0", "0", "0");
+    countLimit(limits, "repetition", number(fields, "Header/epiParameters/num_volumes"));
+    limit(limits, "segment", "0", "0", "0");
+    countLimit(limits, "contrast", number(fields, "Header/NumEchoes"));
+    limit(limits, "average", "0", "0", "0");
+
+    element(encoding, "echoTrainLength", text(fields, "Header/Image/EchoTrainLength"));
+}
+
+static void addSequenceParameters(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr sequence = element(root, "sequenceParameters");
+    element(sequence, "TR", format(number(fields, "Header/Image/RepetitionTime") / 1000));
+    element(sequence, "TE", format(number(fields, "Header/Image/EchoTime") / 1000));
+    element(sequence, "TE", format(number(fields, "Header/Image/SecondEcho") / 1000));
+    element(sequence, "TI", format(number(fields, "Header/Image/InversionTime") / 1000));
+    element(sequence, "flipAngle_deg", text(fields, "Header/Image/FlipAngle"));
+}
+
+static void addUserParameters(xmlNodePtr root, const HeaderFields& fields)
+{
+    xmlNodePtr user = element(root, "userParameters");
+    userParameter(user, "userParameterString", "imageType", text(fields, "Header/Image/ImageType"));
+    userParameter(user, "userParameterString", "scanningSequence", text(fields, "Header/Image/ScanSequence"));
+    userParameter(user, "userParameterString", "sequenceVariant", text(fields, "Header/Image/SequenceVariant"));
+    userParameter(user, "userParameterString", "scanOptions", text(fields, "Header/Image/ScanOptions"));
+
+    std::string acquisitionType = "Unknown";
+    if (anyEquals(fields, "Header/Image/AcquisitionType", "2025")) {
+        acquisitionType = "2D";
+    } else if (anyEquals(fields, "Header/Image/AcquisitionType", "2026")) {
+        acquisitionType = "3D";
+    }
+    userParameter(user, "userParameterString", "mrAcquisitionType", acquisitionType);
+
+    userParameter(user, "userParameterString", "triggerTime", text(fields, "Header/Image/TriggerTime"));
+
+    // Orchestra gives the phase encode direction, so the frequency encode direction is the other one
+    std::string frequencyDirection = "Unknown";
+    if (anyEquals(fields, "Header/Image/PhaseEncodeDirection", "1025")) {
+        frequencyDirection = "COL";
+    } else if (anyEquals(fields, "Header/Image/PhaseEncodeDirection", "1026")) {
+        frequencyDirection = "ROW";
+    }
+    userParameter(user, "userParameterString", "freqEncodingDirection", frequencyDirection);
+}
+
+// SHA-256 of the stylesheets this builder mirrors. A change to config/default.xsl or
+// config/epi.xsl must be made to the builder as well before its hash is updated here;
+// test/HeaderPathTest checks that the hashes are current and that both paths agree.
+static const char* DEFAULT_XSL_SHA256 = "b17511605d2c4ec5e5511eb1bb0c298ea730551f84322bd792fcda7b174ee8c5";
+static const char* EPI_XSL_SHA256     = "958d2f702dd3ffa642026615d54b4caf7be01777659e16243b5fd4e0a8511974";
+
+NativeHeaderBuilder::Mapping NativeHeaderBuilder::identify(const std::string& stylesheet)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(stylesheet.data()), stylesheet.size(), digest);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string sha256;
+    for (int n = 0 ; n < SHA256_DIGEST_LENGTH ; n++) {
+        sha256 += hex[digest[n] >> 4];
+        sha256 += hex[digest[n] & 0x0F];
+    }
+
+    if (sha256 == DEFAULT_XSL_SHA256) {
+        return DEFAULT_MAPPING;
+    }
+    if (sha256 == EPI_XSL_SHA256) {
+        return EPI_MAPPING;
+    }
+
+    return NO_NATIVE_MAPPING;
+}
+
+std::string NativeHeaderBuilder::build(Mapping mapping, const HeaderFields& fields)
+{
+    if (mapping == NO_NATIVE_MAPPING) {
+        throw std::runtime_error("No native header mapping for this stylesheet");
+    }
+
+    std::shared_ptr<xmlDoc> doc = std::shared_ptr<xmlDoc>(xmlNewDoc(BAD_CAST "1.0"), xmlFreeDoc);
+    if (!doc) {
+        throw std::runtime_error("Failed to create ISMRMRD header document");
+    }
+
+    xmlNodePtr root = xmlNewDocNode(doc.get(), NULL, BAD_CAST "ismrmrdHeader", NULL);
+    xmlDocSetRootElement(doc.get(), root);
+
+    xmlNsPtr ismrmrd = xmlNewNs(root, BAD_CAST "http://www.ismrm.org/ISMRMRD", NULL);
+    xmlNsPtr xsi = xmlNewNs(root, BAD_CAST "http://www.w3.org/2001/XMLSchema-instance", BAD_CAST "xsi");
+    xmlNewNs(root, BAD_CAST "http://www.w3.org/2001/XMLSchema", BAD_CAST "xs");
+    xmlSetNs(root, ismrmrd);
+    xmlNewNsProp(root, xsi, BAD_CAST "schemaLocation", BAD_CAST "http://www.ismrm.org/ISMRMRD ismrmrd.xsd");
+
+    addSubjectInformation(root, fields);
+    addStudyInformation(root, fields);
+    addMeasurementInformation(root, fields);
+    addAcquisitionSystemInformation(root, fields);
+
+    if (mapping == EPI_MAPPING) {
+        addEpiEncoding(root, fields);
+    } else {
+        addDefaultEncoding(root, fields);
+    }
+
+    addSequenceParameters(root, fields);
+    addUserParameters(root, fields);
+
+    // Saved like xsltSaveResultToString() with <xsl:output method="xml" indent="yes"/>:
+    // indented UTF-8 text, and a declaration that does not name the encoding
+    std::shared_ptr<xmlBuffer> buffer = std::shared_ptr<xmlBuffer>(xmlBufferCreate(), xmlBufferFree);
+    xmlSaveCtxtPtr save = buffer ? xmlSaveToBuffer(buffer.get(), "UTF-8", XML_SAVE_FORMAT | XML_SAVE_NO_DECL) : NULL;
+    if (save == NULL) {
+        throw std::runtime_error("Failed to save ISMRMRD header to string");
+    }
+
+    long const saved = xmlSaveDoc(save, doc.get());
+    xmlSaveClose(save);
+    if (saved < 0) {
+        throw std::runtime_error("Failed to save ISMRMRD header to string");
+    }
+
+    return std::string("<?xml version=\"1.0\"?>\n") + reinterpret_cast<const char*>(xmlBufferContent(buffer.get()));
+}
+
+} // namespace GEToIsmrmrd
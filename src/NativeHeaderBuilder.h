@@ -0,0 +1,47 @@
+/** @file NativeHeaderBuilder.h */
+#ifndef NATIVE_HEADER_BUILDER_H
+#define NATIVE_HEADER_BUILDER_H
+
+#include <string>
+
+// Local
+#include "HeaderFields.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Builds the ISMRMRD XML header for the stylesheets shipped with ge-tools
+ * without running XSLT.
+ *
+ * The built-in config/default.xsl and config/epi.xsl are recognised by the
+ * SHA-256 of the text this builder was written for, kept in the source, so an
+ * edited copy of either stylesheet is never mistaken for the original and
+ * still goes through XSLT.
+ * The header is built from the recorded raw file header values with the same
+ * XPath string/number conversions as the stylesheets, and serialized like
+ * libxslt's indented output, so both paths give the same text.
+ */
+class NativeHeaderBuilder
+{
+public:
+    enum Mapping
+    {
+        NO_NATIVE_MAPPING = 0,
+        DEFAULT_MAPPING,
+        EPI_MAPPING
+    };
+
+    /** Which built-in stylesheet, if any, this stylesheet text is */
+    static Mapping identify(const std::string& stylesheet);
+
+    /**
+     * Builds the ISMRMRD XML header a built-in stylesheet would produce.
+     *
+     * @throws std::runtime_error if mapping is NO_NATIVE_MAPPING or the document cannot be built
+     */
+    static std::string build(Mapping mapping, const HeaderFields& fields);
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* NATIVE_HEADER_BUILDER_H */
@@ -0,0 +1,226 @@
+/** @file OversamplingRemoval.cpp */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include <fftw3.h>
+
+#include <libxml/tree.h>
+
+#include "HeaderEditor.h"
+#include "OversamplingRemoval.h"
+
+namespace GEToIsmrmrd {
+
+// Only the execution of FFTW plans is thread-safe, not their creation or destruction
+static std::mutex g_fftwPlannerMutex;
+
+/**
+ * Plans and buffers for batches of one number of samples and channels
+ *
+ * Every readout of a batch is a row of wide, transformed in place to the image
+ * domain. The rows of narrow receive the central part of each, which is
+ * transformed back in place.
+ */
+class OversamplingRemoval::Transform
+{
+public:
+    Transform(size_t samples, size_t channels, unsigned int factor, size_t batchSize)
+        : samples(samples)
+        , channels(channels)
+        , cropped(samples / factor)
+        , wide(NULL)
+        , narrow(NULL)
+        , forward(NULL)
+        , backward(NULL)
+    {
+        size_t const rows = batchSize * channels;
+        int const wideLength = samples;
+        int const narrowLength = cropped;
+
+        std::lock_guard<std::mutex> lock(g_fftwPlannerMutex);
+
+        wide = fftwf_alloc_complex(rows * samples);
+        narrow = fftwf_alloc_complex(rows * cropped);
+        if (wide && narrow) {
+            // Planning overwrites the buffers, which hold nothing yet
+            forward = fftwf_plan_many_dft(1, &wideLength, rows, wide, NULL, 1, samples,
+                                          wide, NULL, 1, samples, FFTW_FORWARD, FFTW_MEASURE);
+            backward = fftwf_plan_many_dft(1, &narrowLength, rows, narrow, NULL, 1, cropped,
+                                           narrow, NULL, 1, cropped, FFTW_BACKWARD, FFTW_MEASURE);
+        }
+        if (!forward || !backward) {
+            release();
+            throw std::runtime_error("OversamplingRemoval: failed to plan transforms of " + std::to_string(samples) + " samples");
+        }
+
+        // Rows beyond a partial batch are transformed too, so they must not hold garbage
+        memset(wide, 0, rows * samples * sizeof(fftwf_complex));
+    }
+
+    ~Transform()
+    {
+        std::lock_guard<std::mutex> lock(g_fftwPlannerMutex);
+        release();
+    }
+
+    bool fits(const ISMRMRD::Acquisition& acq) const
+    {
+        return acq.number_of_samples() == samples && acq.active_channels() == channels;
+    }
+
+    /** Complex samples of one acquisition, channel by channel, for the entry-th acquisition of a batch */
+    complex_float_t* input(size_t entry) { return reinterpret_cast<complex_float_t*>(wide + entry * channels * samples); }
+    const complex_float_t* output(size_t entry) const { return reinterpret_cast<const complex_float_t*>(narrow + entry * channels * cropped); }
+
+    /** Removes the oversampling of the first count acquisitions of the batch */
+    void run(size_t count)
+    {
+        fftwf_execute(forward);
+
+        // Unshifted bins below cropped / 2 and from samples - cropped / 2 on make up the central
+        // part of the field of view. FFTW does not normalize, so the round trip is scaled here.
+        size_t const half = cropped / 2;
+        float const scale = 1.0f / samples;
+        for (size_t row = 0 ; row < count * channels ; row++) {
+            const float* from = reinterpret_cast<const float*>(wide + row * samples);
+            float* to = reinterpret_cast<float*>(narrow + row * cropped);
+            for (size_t n = 0 ; n < 2 * half ; n++) {
+                to[n] = from[n] * scale;
+            }
+            from += 2 * (samples - half);
+            to += 2 * half;
+            for (size_t n = 0 ; n < 2 * half ; n++) {
+                to[n] = from[n] * scale;
+            }
+        }
+
+        fftwf_execute(backward);
+    }
+
+    size_t const samples;
+    size_t const channels;
+    size_t const cropped;
+
+private:
+    // Non-copyable
+    Transform(const Transform& other);
+    Transform& operator=(const Transform& other);
+
+    void release()
+    {
+        if (forward) {
+            fftwf_destroy_plan(forward);
+        }
+        if (backward) {
+            fftwf_destroy_plan(backward);
+        }
+        fftwf_free(wide);
+        fftwf_free(narrow);
+        forward = backward = NULL;
+        wide = narrow = NULL;
+    }
+
+    fftwf_complex* wide;
+    fftwf_complex* narrow;
+    fftwf_plan forward;
+    fftwf_plan backward;
+};
+
+OversamplingRemoval::OversamplingRemoval(AcquisitionSink& downstream, unsigned int factor, size_t batchSize)
+    : downstream_(downstream)
+    , factor_(factor)
+    , batchSize_(std::max(batchSize, static_cast<size_t>(1)))
+{
+    if (factor_ < 2) {
+        throw std::runtime_error("OversamplingRemoval: the oversampling factor must be at least 2");
+    }
+    heads_.reserve(batchSize_);
+}
+
+OversamplingRemoval::~OversamplingRemoval()
+{
+}
+
+void OversamplingRemoval::consume(const ISMRMRD::Acquisition& acq)
+{
+    if (!transform_ || !transform_->fits(acq)) {
+        flush();
+        reshape(acq);
+    }
+
+    memcpy(transform_->input(heads_.size()), acq.getDataPtr(), acq.getDataSize());
+    heads_.push_back(acq.getHead());
+
+    if (heads_.size() == batchSize_) {
+        flush();
+    }
+}
+
+void OversamplingRemoval::flush()
+{
+    if (heads_.empty()) {
+        return;
+    }
+
+    transform_->run(heads_.size());
+
+    size_t const samples = transform_->channels * transform_->cropped;
+    for (size_t n = 0 ; n < heads_.size() ; n++) {
+        ISMRMRD::AcquisitionHeader head = heads_[n];
+        head.number_of_samples = transform_->cropped;
+        head.center_sample /= factor_;
+        // Samples to discard are rounded up, so none that should be discarded are kept
+        head.discard_pre = (head.discard_pre + factor_ - 1) / factor_;
+        head.discard_post = (head.discard_post + factor_ - 1) / factor_;
+        head.sample_time_us *= factor_;
+
+        out_.setHead(head);
+        memcpy(out_.getDataPtr(), transform_->output(n), samples * sizeof(complex_float_t));
+        downstream_.consume(out_);
+    }
+    heads_.clear();
+}
+
+/**
+ * Prepares plans for acquisitions of the shape of acq
+ */
+void OversamplingRemoval::reshape(const ISMRMRD::Acquisition& acq)
+{
+    size_t const samples = acq.number_of_samples();
+    if (acq.trajectory_dimensions() > 0) {
+        throw std::runtime_error("OversamplingRemoval: acquisitions with a trajectory are not Cartesian");
+    }
+    if (samples == 0 || samples % (2 * factor_) != 0) {
+        throw std::runtime_error("OversamplingRemoval: " + std::to_string(samples) + " samples cannot be cropped by a factor of "
+                                 + std::to_string(factor_));
+    }
+
+    transform_.reset();
+    transform_.reset(new Transform(samples, acq.active_channels(), factor_, batchSize_));
+}
+
+std::string OversamplingRemoval::updateHeader(const std::string& xml, unsigned int factor)
+{
+    HeaderEditor header(xml);
+
+    std::vector<xmlNodePtr> const encodings = header.elements("encoding");
+    for (size_t n = 0 ; n < encodings.size() ; n++) {
+        xmlNodePtr matrixX = HeaderEditor::find(encodings[n], "encodedSpace/matrixSize/x");
+        if (matrixX) {
+            HeaderEditor::setNumber(matrixX, static_cast<int>(HeaderEditor::number(matrixX)) / factor);
+        }
+
+        xmlNodePtr encodedFov = HeaderEditor::find(encodings[n], "encodedSpace/fieldOfView_mm/x");
+        xmlNodePtr reconFov = HeaderEditor::find(encodings[n], "reconSpace/fieldOfView_mm/x");
+        if (encodedFov && reconFov && HeaderEditor::number(encodedFov) > HeaderEditor::number(reconFov)) {
+            HeaderEditor::setNumber(encodedFov, HeaderEditor::number(encodedFov) / factor);
+        }
+    }
+
+    return header.str();
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,84 @@
+/** @file OversamplingRemoval.h */
+#ifndef OVERSAMPLING_REMOVAL_H
+#define OVERSAMPLING_REMOVAL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Removes readout oversampling from acquisitions before passing them on.
+ *
+ * Acquisitions are collected in batches of the same number of samples and
+ * channels. Each batch is Fourier transformed along the readout with a single
+ * FFTW plan covering all its channels and acquisitions, the central
+ * 1 / factor of the field of view is kept, and the batch is transformed back.
+ * The result holds the samples a readout without oversampling would have had
+ * at the same k-space positions, so their magnitudes are unchanged.
+ *
+ * number_of_samples, center_sample, discard_pre, discard_post and
+ * sample_time_us are adjusted to match; updateHeader() adjusts the ISMRMRD
+ * header. Acquisitions with a trajectory, or whose samples are not a multiple
+ * of 2 x factor, are rejected.
+ */
+class OversamplingRemoval : public AcquisitionSink
+{
+public:
+    /**
+     * @param downstream Sink the acquisitions are passed to
+     * @param factor Readout oversampling to remove, e.g. 2
+     * @param batchSize Acquisitions transformed together
+     */
+    OversamplingRemoval(AcquisitionSink& downstream, unsigned int factor, size_t batchSize = 64);
+
+    /** Acquisitions not passed on by flush() are dropped */
+    ~OversamplingRemoval();
+
+    /**
+     * @throws std::runtime_error if the acquisition cannot be cropped by the factor
+     */
+    void consume(const ISMRMRD::Acquisition& acq);
+
+    /** Transforms the acquisitions of a partial batch and passes them on */
+    void flush();
+
+    /**
+     * Describes the acquisitions after removal in an ISMRMRD header
+     *
+     * Divides the encoded matrix along x by the factor. The encoded field of
+     * view is divided as well where it is larger than the reconstructed one,
+     * i.e. where the header describes the oversampled field of view.
+     *
+     * @throws std::runtime_error if the header cannot be parsed
+     */
+    static std::string updateHeader(const std::string& xml, unsigned int factor);
+
+private:
+    // Non-copyable
+    OversamplingRemoval(const OversamplingRemoval& other);
+    OversamplingRemoval& operator=(const OversamplingRemoval& other);
+
+    class Transform;
+
+    void reshape(const ISMRMRD::Acquisition& acq);
+
+    AcquisitionSink& downstream_;
+    unsigned int factor_;
+    size_t batchSize_;
+
+    std::unique_ptr<Transform> transform_;          // plans and sample buffers for the current shape
+    std::vector<ISMRMRD::AcquisitionHeader> heads_; // headers of the acquisitions held in the buffers
+    ISMRMRD::Acquisition out_;                      // storage reused for every acquisition passed on
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* OVERSAMPLING_REMOVAL_H */
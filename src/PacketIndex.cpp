@@ -0,0 +1,251 @@
+/** @file PacketIndex.cpp */
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "ConversionContext.h"
+#include "Hdf5Lock.h"
+#include "PacketIndex.h"
+
+namespace GEToIsmrmrd {
+
+static const char* SIDECAR_MAGIC = "ge2ismrmrd-packet-index";
+static const int SIDECAR_VERSION = 2;
+
+bool PacketIndexEntry::hasView(int view) const
+{
+    if (viewCount <= 0) {
+        return false;
+    }
+    if (viewStep == 0) {
+        return view == firstView;
+    }
+
+    int const offset = view - firstView;
+    return (offset % viewStep == 0) && (offset / viewStep >= 0) && (offset / viewStep < viewCount);
+}
+
+/** Orders data packets by slice, echo and lowest view */
+struct PacketOrder
+{
+    PacketOrder(const std::vector<PacketIndexEntry>& entries) : entries(entries) { }
+
+    static int lowestView(const PacketIndexEntry& e)
+    {
+        return (e.viewStep < 0) ? e.firstView + (e.viewCount - 1) * e.viewStep : e.firstView;
+    }
+
+    bool operator()(size_t a, size_t b) const
+    {
+        const PacketIndexEntry& x = entries[a];
+        const PacketIndexEntry& y = entries[b];
+        if (x.slice != y.slice) return x.slice < y.slice;
+        if (x.echo != y.echo) return x.echo < y.echo;
+        return lowestView(x) < lowestView(y);
+    }
+
+    const std::vector<PacketIndexEntry>& entries;
+};
+
+PacketIndex::PacketIndex(const std::vector<PacketIndexEntry>& entries)
+    : entries_(entries)
+{
+    for (size_t n = 0 ; n < entries_.size() ; n++) {
+        if (!entries_[n].isScanControl()) {
+            lookup_.push_back(n);
+        }
+    }
+    std::stable_sort(lookup_.begin(), lookup_.end(), PacketOrder(entries_));
+}
+
+PacketIndexEntry PacketIndex::describe(const GERecon::Acquisition::FrameControlPointer& packet, unsigned int ordinal,
+                                       const ConversionContext& context)
+{
+    // EPI packets hold every view of a slice, as read by NIHepiConverter
+    bool const hyperFrames = (bool) context.epi;
+    const ScanParameters& scan = hyperFrames ? context.epi->scan : context.scan;
+
+    PacketIndexEntry entry;
+    entry.ordinal   = ordinal;
+    entry.opcode    = packet->Control().Opcode();
+    entry.slice     = -1;
+    entry.firstView = 0;
+    entry.viewStep  = 1;
+    entry.viewCount = 0;
+    entry.echo      = 0;
+
+    if (entry.isScanControl()) {
+        return entry;
+    }
+
+    if (hyperFrames) {
+        GERecon::Acquisition::HyperFrameControlPacket const packetContents = packet->Control().Packet().As<GERecon::Acquisition::HyperFrameControlPacket>();
+
+        entry.slice     = scan.sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH, packetContents.sliceNumL));
+        entry.firstView = GERecon::Acquisition::GetPacketValue(packetContents.viewNumH, packetContents.viewNumL);
+        entry.viewStep  = static_cast<short>(GERecon::Acquisition::GetPacketValue(packetContents.viewSkipH, packetContents.viewSkipL));
+        entry.viewCount = context.epi->extraFramesTop + scan.acquiredYRes + context.epi->extraFramesBottom;
+        entry.echo      = packetContents.echoNum;
+    } else {
+        GERecon::Acquisition::ProgrammableControlPacket const packetContents = packet->Control().Packet().As<GERecon::Acquisition::ProgrammableControlPacket>();
+
+        entry.slice     = scan.sliceTable.GeometricSliceNumber(GERecon::Acquisition::GetPacketValue(packetContents.sliceNumH, packetContents.sliceNumL));
+        entry.firstView = GERecon::Acquisition::GetPacketValue(packetContents.viewNumH, packetContents.viewNumL);
+        entry.viewCount = 1;
+        entry.echo      = packetContents.echoNum;
+    }
+
+    return entry;
+}
+
+std::shared_ptr<const PacketIndex> PacketIndex::build(GERecon::ScanArchivePointer& scanArchive,
+                                                      const ConversionContext& context)
+{
+    // Reads only control packets, so the whole walk is done with the HDF5 lock held
+    Hdf5Lock lock;
+    GERecon::Acquisition::ArchiveStoragePointer archiveStoragePointer = GERecon::Acquisition::ArchiveStorage::Create(scanArchive);
+
+    int const packetQuantity = archiveStoragePointer->AvailableControlCount();
+
+    std::vector<PacketIndexEntry> entries;
+    entries.reserve(packetQuantity);
+
+    for (int n = 0 ; n < packetQuantity ; n++) {
+        entries.push_back(describe(archiveStoragePointer->NextFrameControl(), n, context));
+    }
+
+    return std::shared_ptr<const PacketIndex>(new PacketIndex(entries));
+}
+
+/**
+ * File identity, size and modification time that identify the archive a sidecar was built from
+ */
+struct ArchiveStamp
+{
+    long long inode;
+    long long size;
+    long long mtime;       // seconds
+    long long mtimeNanos;  // within the second, 0 where the file system does not record it
+
+    bool operator==(const ArchiveStamp& other) const
+    {
+        return inode == other.inode && size == other.size &&
+               mtime == other.mtime && mtimeNanos == other.mtimeNanos;
+    }
+};
+
+static bool archiveStamp(const std::string& archivePath, ArchiveStamp& stamp)
+{
+    struct stat info;
+    if (stat(archivePath.c_str(), &info) != 0) {
+        return false;
+    }
+    stamp.inode = info.st_ino;
+    stamp.size = info.st_size;
+    stamp.mtime = info.st_mtim.tv_sec;
+    stamp.mtimeNanos = info.st_mtim.tv_nsec;
+    return true;
+}
+
+std::shared_ptr<const PacketIndex> PacketIndex::load(const std::string& path, const std::string& archivePath)
+{
+    std::ifstream in(path.c_str());
+    if (!in) {
+        return std::shared_ptr<const PacketIndex>();
+    }
+
+    std::string magic;
+    int version = 0;
+    ArchiveStamp saved = ArchiveStamp(), current = ArchiveStamp();
+    size_t count = 0;
+
+    in >> magic >> version;
+    if (!in || magic != SIDECAR_MAGIC || version != SIDECAR_VERSION) {
+        return std::shared_ptr<const PacketIndex>();
+    }
+
+    in >> saved.inode >> saved.size >> saved.mtime >> saved.mtimeNanos >> count;
+    if (!in || !archiveStamp(archivePath, current) || !(saved == current)) {
+        return std::shared_ptr<const PacketIndex>();
+    }
+
+    std::vector<PacketIndexEntry> entries(count);
+    for (size_t n = 0 ; n < count ; n++) {
+        PacketIndexEntry& entry = entries[n];
+        in >> entry.ordinal >> entry.opcode >> entry.slice >> entry.firstView
+           >> entry.viewStep >> entry.viewCount >> entry.echo;
+        if (!in || entry.ordinal != n) {
+            return std::shared_ptr<const PacketIndex>();
+        }
+    }
+
+    return std::shared_ptr<const PacketIndex>(new PacketIndex(entries));
+}
+
+void PacketIndex::save(const std::string& path, const std::string& archivePath) const
+{
+    ArchiveStamp stamp;
+    if (!archiveStamp(archivePath, stamp)) {
+        throw std::runtime_error("Cannot stat archive " + archivePath);
+    }
+
+    // Written next to the final file and renamed, so readers never see a partial index
+    std::string const temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(), std::ios::trunc);
+        out << SIDECAR_MAGIC << " " << SIDECAR_VERSION << "\n"
+            << stamp.inode << " " << stamp.size << " " << stamp.mtime << " " << stamp.mtimeNanos << "\n"
+            << entries_.size() << "\n";
+        for (size_t n = 0 ; n < entries_.size() ; n++) {
+            const PacketIndexEntry& entry = entries_[n];
+            out << entry.ordinal << " " << entry.opcode << " " << entry.slice << " " << entry.firstView << " "
+                << entry.viewStep << " " << entry.viewCount << " " << entry.echo << "\n";
+        }
+        if (!out.flush()) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Cannot write packet index " + temporary);
+        }
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot write packet index " + path);
+    }
+}
+
+size_t PacketIndex::dataPacketCount() const
+{
+    return lookup_.size();
+}
+
+const PacketIndexEntry* PacketIndex::find(int slice, int view, int echo) const
+{
+    // First data packet of the slice and echo
+    size_t lo = 0, hi = lookup_.size();
+    while (lo < hi) {
+        size_t const mid = (lo + hi) / 2;
+        const PacketIndexEntry& e = entries_[lookup_[mid]];
+        if (e.slice < slice || (e.slice == slice && e.echo < echo)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for ( ; lo < lookup_.size() ; lo++) {
+        const PacketIndexEntry& e = entries_[lookup_[lo]];
+        if (e.slice != slice || e.echo != echo) {
+            break;
+        }
+        if (e.hasView(view)) {
+            return &e;
+        }
+    }
+
+    return NULL;
+}
+
+} // namespace GEToIsmrmrd
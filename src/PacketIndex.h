@@ -0,0 +1,111 @@
+/** @file PacketIndex.h */
+#ifndef PACKET_INDEX_H
+#define PACKET_INDEX_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SequenceConverter.h"
+
+namespace GEToIsmrmrd {
+
+class ConversionContext;
+
+/**
+ * What one control packet of a ScanArchive holds
+ */
+struct PacketIndexEntry
+{
+    unsigned int ordinal;     /**< Position of the packet in ArchiveStorage order */
+    int          opcode;      /**< Control packet opcode */
+    int          slice;       /**< Geometric slice, -1 for scan control packets */
+    int          firstView;   /**< View number of the first view, as stored in the packet */
+    int          viewStep;    /**< View number increment between the views of the packet */
+    int          viewCount;   /**< Views in the packet, 0 for scan control packets */
+    int          echo;        /**< Echo number */
+
+    bool isScanControl() const { return opcode == GERecon::Acquisition::ScanControlOpcode; }
+
+    /** Whether view is one of the views of this packet */
+    bool hasView(int view) const;
+};
+
+/**
+ * Index of every control packet of a ScanArchive, built in one pass.
+ *
+ * ArchiveStorage only reads packets in order, so the index records where each
+ * packet is in that order along with its opcode, slice, views and echo. The
+ * header, the converters and callers looking for a particular slice and view
+ * can then use it without walking the archive again. It can be saved to a
+ * sidecar file next to the archive, which is only used again while the
+ * archive keeps the same inode, size and modification time. Modification
+ * times are compared to the nanosecond, but only as finely as the file
+ * system records them: an archive rewritten in place to the same size
+ * within one timestamp tick of a file system with coarse timestamps
+ * (e.g. 1 s, or 2 s on FAT) is not noticed.
+ */
+class PacketIndex
+{
+public:
+    /**
+     * Walks the control packets of an archive
+     *
+     * EPI scans (context.epi set) are read as hyperframe packets holding all
+     * the views of a slice, other scans as programmable packets of one view.
+     */
+    static std::shared_ptr<const PacketIndex> build(GERecon::ScanArchivePointer& scanArchive,
+                                                    const ConversionContext& context);
+
+    /**
+     * Describes one control packet, as build() does
+     *
+     * Lets a converter without an index walk the archive once, describing
+     * each packet as it reads it.
+     *
+     * @param ordinal Position of the packet in ArchiveStorage order
+     */
+    static PacketIndexEntry describe(const GERecon::Acquisition::FrameControlPointer& packet, unsigned int ordinal,
+                                     const ConversionContext& context);
+
+    /**
+     * Reads a sidecar file
+     *
+     * @returns NULL if the file is missing, unreadable or was saved for another state of the archive
+     */
+    static std::shared_ptr<const PacketIndex> load(const std::string& path, const std::string& archivePath);
+
+    /**
+     * Writes a sidecar file
+     *
+     * @throws std::runtime_error if the file cannot be written
+     */
+    void save(const std::string& path, const std::string& archivePath) const;
+
+    /** Default sidecar file of an archive */
+    static std::string sidecarPath(const std::string& archivePath) { return archivePath + ".packets"; }
+
+    size_t                                 size () const { return entries_.size(); }
+    const PacketIndexEntry&          operator[] (size_t ordinal) const { return entries_[ordinal]; }
+    const std::vector<PacketIndexEntry>& entries () const { return entries_; }
+
+    /** Packets that are not scan control packets */
+    size_t                      dataPacketCount () const;
+
+    /**
+     * Finds the packet holding a view of a slice and echo
+     *
+     * @returns NULL if no packet holds it
+     */
+    const PacketIndexEntry*                find (int slice, int view, int echo) const;
+
+private:
+    PacketIndex(const std::vector<PacketIndexEntry>& entries);
+
+    std::vector<PacketIndexEntry> entries_;
+    std::vector<size_t>           lookup_;     // data packets ordered by slice, echo and first view
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PACKET_INDEX_H */
@@ -0,0 +1,120 @@
+/** @file PipelineSink.cpp */
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "PipelineSink.h"
+
+namespace GEToIsmrmrd {
+
+// Number of times a stalled side yields before it starts sleeping
+static const unsigned int PIPELINE_YIELD_ROUNDS = 64;
+
+PipelineSink::PipelineSink(AcquisitionSink& downstream, size_t queueDepth, unsigned int waitMicros)
+    : downstream_(downstream)
+    , queue_(std::max(queueDepth, static_cast<size_t>(1)))
+    , waitMicros_(waitMicros)
+    , done_(false)
+    , failed_(false)
+{
+    writer_ = std::thread(&PipelineSink::writerLoop, this);
+}
+
+PipelineSink::~PipelineSink()
+{
+    stop();
+}
+
+void PipelineSink::consume(const ISMRMRD::Acquisition& acq)
+{
+    ISMRMRD::Acquisition* slot = queue_.pushSlot();
+
+    if (slot == NULL) {
+        auto const start = std::chrono::steady_clock::now();
+
+        for (unsigned int attempt = 0 ; slot == NULL ; attempt++) {
+            // The writer has given up, so nothing will ever make room
+            if (failed_.load(std::memory_order_acquire)) {
+                throw std::runtime_error("PipelineSink: writer thread failed");
+            }
+            backoff(attempt);
+            slot = queue_.pushSlot();
+        }
+
+        std::chrono::duration<double> const waited = std::chrono::steady_clock::now() - start;
+        stats_.producerStalls++;
+        stats_.producerStallSeconds += waited.count();
+    }
+
+    *slot = acq;
+    queue_.commitPush();
+
+    stats_.maxQueued = std::max(stats_.maxQueued, queue_.size());
+}
+
+void PipelineSink::finish()
+{
+    stop();
+
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void PipelineSink::stop()
+{
+    if (writer_.joinable()) {
+        done_.store(true, std::memory_order_release);
+        writer_.join();
+    }
+}
+
+void PipelineSink::writerLoop()
+{
+    for (;;) {
+        ISMRMRD::Acquisition* slot = queue_.frontSlot();
+
+        if (slot == NULL) {
+            auto const start = std::chrono::steady_clock::now();
+
+            for (unsigned int attempt = 0 ; slot == NULL ; attempt++) {
+                // Check for more data after seeing done_, as the producer
+                // may have pushed its last acquisitions just before stopping
+                bool const done = done_.load(std::memory_order_acquire);
+                slot = queue_.frontSlot();
+                if (slot == NULL && done) {
+                    return;
+                }
+                if (slot == NULL) {
+                    backoff(attempt);
+                }
+            }
+
+            std::chrono::duration<double> const waited = std::chrono::steady_clock::now() - start;
+            stats_.consumerStalls++;
+            stats_.consumerStallSeconds += waited.count();
+        }
+
+        try {
+            downstream_.consume(*slot);
+        } catch (...) {
+            error_ = std::current_exception();
+            failed_.store(true, std::memory_order_release);
+            return;
+        }
+
+        queue_.commitPop();
+        stats_.acquisitions++;
+    }
+}
+
+void PipelineSink::backoff(unsigned int attempt) const
+{
+    if (attempt < PIPELINE_YIELD_ROUNDS || waitMicros_ == 0) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(waitMicros_));
+    }
+}
+
+} // namespace GEToIsmrmrd
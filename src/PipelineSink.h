@@ -0,0 +1,91 @@
+/** @file PipelineSink.h */
+#ifndef PIPELINE_SINK_H
+#define PIPELINE_SINK_H
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+#include "SpscQueue.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Hands acquisitions to another sink on a separate writer thread.
+ *
+ * consume() copies each acquisition into a bounded lock-free queue and returns,
+ * so the converter can decode the next packet while the writer thread passes
+ * queued acquisitions to the downstream sink (e.g. a DatasetSink) in order.
+ *
+ * When the queue is full the converter waits for the writer (back-pressure), and
+ * when it is empty the writer waits for the converter. Either side first yields
+ * for a few rounds and then sleeps for the configured wait between retries.
+ * The number and duration of these stalls are reported by statistics().
+ */
+class PipelineSink : public AcquisitionSink
+{
+public:
+    struct Statistics
+    {
+        Statistics() : acquisitions(0), maxQueued(0), producerStalls(0), consumerStalls(0),
+                       producerStallSeconds(0.0), consumerStallSeconds(0.0) { }
+
+        size_t acquisitions;         ///< acquisitions passed downstream
+        size_t maxQueued;            ///< highest queue occupancy seen by the producer
+        size_t producerStalls;       ///< times the converter found the queue full
+        size_t consumerStalls;       ///< times the writer found the queue empty
+        double producerStallSeconds; ///< time the converter spent waiting for room
+        double consumerStallSeconds; ///< time the writer spent waiting for data
+    };
+
+    /**
+     * @param downstream Sink to call from the writer thread
+     * @param queueDepth Maximum number of acquisitions in flight
+     * @param waitMicros Sleep between retries once a stalled side stops yielding
+     */
+    PipelineSink(AcquisitionSink& downstream, size_t queueDepth, unsigned int waitMicros);
+
+    /** Drains the queue and stops the writer thread, if finish() was not called */
+    ~PipelineSink();
+
+    void consume(const ISMRMRD::Acquisition& acq);
+
+    /**
+     * Waits until every queued acquisition has been passed downstream.
+     *
+     * Rethrows the first exception raised by the downstream sink.
+     */
+    void finish();
+
+    /** Pipeline statistics; complete once finish() has returned */
+    Statistics statistics() const { return stats_; }
+
+private:
+    // Non-copyable
+    PipelineSink(const PipelineSink& other);
+    PipelineSink& operator=(const PipelineSink& other);
+
+    void writerLoop();
+    void stop();
+    void backoff(unsigned int attempt) const;
+
+    AcquisitionSink& downstream_;
+    SpscQueue<ISMRMRD::Acquisition> queue_;
+    unsigned int waitMicros_;
+
+    std::atomic<bool> done_;
+    std::atomic<bool> failed_;
+    std::exception_ptr error_;
+
+    Statistics stats_;
+    std::thread writer_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PIPELINE_SINK_H */
@@ -0,0 +1,146 @@
+/** @file PluginRegistry.cpp */
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "PluginRegistry.h"
+#include "GenericConverter.h"
+#include "NIHPlugins/2dfastConverter.h"
+#include "NIHPlugins/epiConverter.h"
+#include "ge_tools_path.h"
+
+namespace GEToIsmrmrd {
+
+template <typename Converter>
+static SequenceConverter* makeConverter()
+{
+    return new Converter();
+}
+
+static void destroyConverter(SequenceConverter* converter)
+{
+    delete converter;
+}
+
+/**
+ * Path dlopen is given for a plugin library
+ *
+ * Bare library names are looked for next to libg2i in the installation first.
+ */
+static std::string resolveLibraryPath(const std::string& libraryPath)
+{
+    if (libraryPath.find('/') != std::string::npos) {
+        return libraryPath;
+    }
+
+    std::string const installed = get_ge_tools_home() + "lib/" + libraryPath;
+    if (access(installed.c_str(), R_OK) == 0) {
+        return installed;
+    }
+
+    return libraryPath;
+}
+
+PluginRegistry& PluginRegistry::instance()
+{
+    static PluginRegistry registry;
+    return registry;
+}
+
+PluginRegistry::PluginRegistry()
+{
+    add("GenericConverter",   &makeConverter<GenericConverter>,   &destroyConverter);
+    add("NIH2dfastConverter", &makeConverter<NIH2dfastConverter>, &destroyConverter);
+    add("NIHepiConverter",    &makeConverter<NIHepiConverter>,    &destroyConverter);
+}
+
+void PluginRegistry::add(const std::string& className, SequenceConverterFactory make, SequenceConverterDestructor destroy)
+{
+    Factory factory;
+    factory.make = make;
+    factory.destroy = destroy;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    builtIn_[className] = factory;
+}
+
+std::shared_ptr<SequenceConverter> PluginRegistry::create(const std::string& className, const std::string& libraryPath)
+{
+    Factory factory;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (libraryPath.empty()) {
+            std::map<std::string, Factory>::const_iterator it = builtIn_.find(className);
+            if (it == builtIn_.end()) {
+                throw std::runtime_error("Plugin class name: " + className + " not implemented");
+            }
+            factory = it->second;
+        } else {
+            std::string const key = libraryPath + ":" + className;
+            std::map<std::string, Factory>::const_iterator it = loaded_.find(key);
+            if (it != loaded_.end()) {
+                factory = it->second;
+            } else {
+                factory.library = loadLibrary(libraryPath);
+
+                // POSIX guarantees that dlsym results can be cast to function pointers
+                factory.make = reinterpret_cast<SequenceConverterFactory>(
+                        dlsym(factory.library.get(), ("make_" + className).c_str()));
+                factory.destroy = reinterpret_cast<SequenceConverterDestructor>(
+                        dlsym(factory.library.get(), ("destroy_" + className).c_str()));
+                if (!factory.make || !factory.destroy) {
+                    throw std::runtime_error("Plugin library " + libraryPath + " does not export " + className);
+                }
+
+                loaded_[key] = factory;
+            }
+        }
+    }
+
+    SequenceConverter* converter = factory.make();
+    if (!converter) {
+        throw std::runtime_error("Plugin class " + className + " could not be created");
+    }
+
+    // The registry keeps the library loaded; the converter holds on to it as well, in case it outlives the registry
+    std::shared_ptr<void> const library = factory.library;
+    SequenceConverterDestructor const destroy = factory.destroy;
+    return std::shared_ptr<SequenceConverter>(converter, [library, destroy](SequenceConverter* c) { destroy(c); });
+}
+
+std::vector<std::string> PluginRegistry::classNames() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<std::string> names;
+    for (std::map<std::string, Factory>::const_iterator it = builtIn_.begin() ; it != builtIn_.end() ; ++it) {
+        names.push_back(it->first);
+    }
+    return names;
+}
+
+/**
+ * Opens a plugin library, or returns it if it is open already; called with mutex_ held
+ */
+std::shared_ptr<void> PluginRegistry::loadLibrary(const std::string& libraryPath)
+{
+    std::map<std::string, std::shared_ptr<void> >::const_iterator it = libraries_.find(libraryPath);
+    if (it != libraries_.end()) {
+        return it->second;
+    }
+
+    std::string const path = resolveLibraryPath(libraryPath);
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        const char* error = dlerror();
+        throw std::runtime_error("Failed to load plugin library " + path + ": " + (error ? error : "unknown error"));
+    }
+
+    std::shared_ptr<void> library(handle, dlclose);
+    libraries_[libraryPath] = library;
+    return library;
+}
+
+} // namespace GEToIsmrmrd
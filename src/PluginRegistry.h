@@ -0,0 +1,79 @@
+/** @file PluginRegistry.h */
+#ifndef PLUGIN_REGISTRY_H
+#define PLUGIN_REGISTRY_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SequenceConverter.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Process-wide registry of the factories of converter plugins.
+ *
+ * The converters built into this library are registered up front. Other
+ * converters are loaded from plugin libraries with dlopen, which must export
+ * make_<ClassName> and destroy_<ClassName>, see SEQUENCE_CONVERTER_FACTORY_DECLARE.
+ * A library is loaded once and stays loaded for the life of the registry,
+ * i.e. of the process; converters made from it also hold on to it, so that it
+ * is not unloaded under a converter deleted after the registry at exit. The
+ * registry is guarded by a mutex.
+ */
+class PluginRegistry
+{
+public:
+    /** The registry shared by all converters in this process */
+    static PluginRegistry& instance();
+
+    /**
+     * Registers a converter class linked into the program
+     *
+     * @param className Name the class is created by
+     * @param make Factory of the class
+     * @param destroy Deletes converters made by make
+     */
+    void add(const std::string& className, SequenceConverterFactory make, SequenceConverterDestructor destroy);
+
+    /**
+     * Creates a converter
+     *
+     * @param className Class of the converter
+     * @param libraryPath Plugin library exporting the class, or empty for a registered class.
+     *                    A name without a directory is looked for in the lib directory of the
+     *                    installation first, then where dlopen looks for libraries.
+     * @throws std::runtime_error if the library cannot be loaded or does not export the class
+     */
+    std::shared_ptr<SequenceConverter> create(const std::string& className, const std::string& libraryPath = "");
+
+    /** Names of the registered classes */
+    std::vector<std::string> classNames() const;
+
+private:
+    PluginRegistry();
+
+    // Non-copyable
+    PluginRegistry(const PluginRegistry& other);
+    PluginRegistry& operator=(const PluginRegistry& other);
+
+    struct Factory
+    {
+        SequenceConverterFactory make;
+        SequenceConverterDestructor destroy;
+        std::shared_ptr<void> library; // NULL for registered classes
+    };
+
+    std::shared_ptr<void> loadLibrary(const std::string& libraryPath);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Factory> builtIn_;
+    std::map<std::string, Factory> loaded_;                     // keyed by library path and class name
+    std::map<std::string, std::shared_ptr<void> > libraries_;   // keyed by library path
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* PLUGIN_REGISTRY_H */
@@ -0,0 +1,114 @@
+/** @file SampleFormat.cpp */
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#include "SampleFormat.h"
+#include "ConversionContext.h"
+
+namespace GEToIsmrmrd {
+
+SampleFormat parseSampleFormat(const std::string& name)
+{
+    if (name == "float") {
+        return SAMPLE_FORMAT_FLOAT;
+    } else if (name == "int16") {
+        return SAMPLE_FORMAT_INT16;
+    } else if (name == "int32") {
+        return SAMPLE_FORMAT_INT32;
+    } else if (name == "native") {
+        return SAMPLE_FORMAT_NATIVE;
+    }
+    throw std::invalid_argument("Unknown sample format " + name + " (float, int16, int32 or native)");
+}
+
+const char* sampleFormatName(SampleFormat format)
+{
+    switch (format) {
+    case SAMPLE_FORMAT_INT16:  return "int16";
+    case SAMPLE_FORMAT_INT32:  return "int32";
+    case SAMPLE_FORMAT_NATIVE: return "native";
+    default:                   return "float";
+    }
+}
+
+SampleFormat resolveSampleFormat(SampleFormat format, const ScanParameters& scan)
+{
+    if (format != SAMPLE_FORMAT_NATIVE) {
+        return format;
+    }
+
+    if (scan.dataSampleSize == 2) {
+        return SAMPLE_FORMAT_INT16;
+    } else if (scan.dataSampleSize == 4) {
+        return SAMPLE_FORMAT_INT32;
+    }
+    throw std::runtime_error("No native sample format for DataSampleSize " + std::to_string(scan.dataSampleSize));
+}
+
+size_t sampleComponentBytes(SampleFormat format)
+{
+    return (format == SAMPLE_FORMAT_INT16) ? sizeof(int16_t) : 4;
+}
+
+template <typename T>
+static void packParts(const float* parts, size_t count, T* packed, float lowest, float highest)
+{
+    // Checked without branching, so that the loop vectorizes; the offending part is looked for afterwards
+    bool exact = true;
+    for (size_t n = 0 ; n < count ; n++) {
+        float const part = parts[n];
+        // false for NaN, so those are rejected too
+        bool const inRange = (part >= lowest && part < highest);
+        T const value = inRange ? static_cast<T>(part) : 0;
+        packed[n] = value;
+        exact &= inRange && (static_cast<float>(value) == part);
+    }
+
+    if (!exact) {
+        for (size_t n = 0 ; n < count ; n++) {
+            float const part = parts[n];
+            if (!(part >= lowest && part < highest && part == std::floor(part))) {
+                throw std::runtime_error("Sample " + std::to_string(part) + " cannot be stored as an integer without loss");
+            }
+        }
+    }
+}
+
+template <typename T>
+static void unpackParts(const T* packed, size_t count, float* parts)
+{
+    for (size_t n = 0 ; n < count ; n++) {
+        parts[n] = static_cast<float>(packed[n]);
+    }
+}
+
+void packSamples(const ISMRMRD::Acquisition& acq, SampleFormat format, void* packed)
+{
+    // complex_float_t is laid out as its real part followed by its imaginary part
+    const float* parts = reinterpret_cast<const float*>(acq.getDataPtr());
+    size_t const count = 2 * acq.getNumberOfDataElements();
+
+    if (format == SAMPLE_FORMAT_INT16) {
+        packParts(parts, count, static_cast<int16_t*>(packed), -32768.0f, 32768.0f);
+    } else if (format == SAMPLE_FORMAT_INT32) {
+        packParts(parts, count, static_cast<int32_t*>(packed), -2147483648.0f, 2147483648.0f);
+    } else {
+        throw std::runtime_error(std::string("Samples cannot be packed as ") + sampleFormatName(format));
+    }
+}
+
+void unpackSamples(const void* packed, SampleFormat format, size_t count, complex_float_t* samples)
+{
+    float* parts = reinterpret_cast<float*>(samples);
+
+    if (format == SAMPLE_FORMAT_INT16) {
+        unpackParts(static_cast<const int16_t*>(packed), 2 * count, parts);
+    } else if (format == SAMPLE_FORMAT_INT32) {
+        unpackParts(static_cast<const int32_t*>(packed), 2 * count, parts);
+    } else {
+        throw std::runtime_error(std::string("Samples cannot be unpacked from ") + sampleFormatName(format));
+    }
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,81 @@
+/** @file SampleFormat.h */
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include <cstddef>
+#include <string>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+namespace GEToIsmrmrd {
+
+struct ScanParameters;
+
+/**
+ * How the real and imaginary parts of each sample are stored in an output
+ *
+ * The converters widen the digitized samples to floats without scaling them,
+ * so a sample is stored in its native integer width without loss. Samples
+ * that are not whole numbers in range, e.g. after a row flip that interpolates,
+ * cannot be stored as integers; packSamples() rejects them rather than
+ * rounding.
+ */
+enum SampleFormat
+{
+    SAMPLE_FORMAT_FLOAT = 0,    /**< 32 bit floats, as in any ISMRMRD file */
+    SAMPLE_FORMAT_INT16,        /**< 16 bit integers */
+    SAMPLE_FORMAT_INT32,        /**< 32 bit integers */
+    SAMPLE_FORMAT_NATIVE        /**< Integers as wide as the scanner's, from DataSampleSize */
+};
+
+/**
+ * Factor from a part stored in an integer format to the float sample: the
+ * digitized values are stored as they are
+ */
+static const double SAMPLE_SCALE = 1.0;
+
+/**
+ * Parses a sample format name: float, int16, int32 or native
+ *
+ * @throws std::invalid_argument if the name is not one of those
+ */
+SampleFormat parseSampleFormat(const std::string& name);
+
+/** Name of a sample format, as accepted by parseSampleFormat() */
+const char* sampleFormatName(SampleFormat format);
+
+/**
+ * Resolves SAMPLE_FORMAT_NATIVE for a scan; other formats are returned unchanged
+ *
+ * @throws std::runtime_error if the scan's DataSampleSize is neither 2 nor 4 bytes
+ */
+SampleFormat resolveSampleFormat(SampleFormat format, const ScanParameters& scan);
+
+/** Bytes of one real or imaginary part in a resolved format */
+size_t sampleComponentBytes(SampleFormat format);
+
+/**
+ * Copies the samples of an acquisition as interleaved real and imaginary
+ * parts in an integer format
+ *
+ * @param acq Acquisition whose samples are packed
+ * @param format SAMPLE_FORMAT_INT16 or SAMPLE_FORMAT_INT32
+ * @param packed Receives 2 x samples x channels parts
+ * @throws std::runtime_error if a part is not a whole number in the range of the format
+ */
+void packSamples(const ISMRMRD::Acquisition& acq, SampleFormat format, void* packed);
+
+/**
+ * Expands interleaved integer parts back into complex float samples
+ *
+ * @param packed Parts written by packSamples()
+ * @param format Format of the parts
+ * @param count Complex samples to expand
+ * @param samples Receives count samples
+ */
+void unpackSamples(const void* packed, SampleFormat format, size_t count, complex_float_t* samples);
+
+} // namespace GEToIsmrmrd
+
+#endif /* SAMPLE_FORMAT_H */
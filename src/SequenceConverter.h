@@ -4,6 +4,7 @@
 #define SEQUENCE_CONVERTER_H
 
 #include <iostream>
+#include <stdexcept>
 
 // Orchestra
 #include <Orchestra/Common/ArchiveHeader.h>
@@ -58,32 +59,164 @@ using namespace GERecon::Epi;
 // ISMRMRD
 #include "ismrmrd/ismrmrd.h"
 
+// Local
+#include "AcquisitionSink.h"
+#include "ConversionOptions.h"
+#include "ConversionRange.h"
+#include "LogStream.h"
+
 namespace GEToIsmrmrd {
 
+class ConversionContext;
+
 class SequenceConverter
 {
 public:
-    SequenceConverter() { }
-    ~SequenceConverter() { }
+    SequenceConverter() : log_(false) { }
+    virtual ~SequenceConverter() { }
+
+    /** Selects threading and other conversion settings for subsequent conversions */
+    void setOptions(const ConversionOptions &options) { options_ = options; }
+    const ConversionOptions& getOptions() const { return options_; }
+
+    /** Enables the diagnostics of the converter, written to std::clog */
+    void setLogging(bool enable) { log_.enabled = enable; }
 
     /**
-     * Create the ISMRMRD acquisitions corresponding to a given view in memory
+     * Convert the raw data into ISMRMRD acquisitions, handing each one to the
+     * sink as soon as it has been decoded
      *
+     * @param context Parameters of the raw file, built once when it was opened
      * @param P-file or Orchestra file object
-     * @param view_num View number
-     * @returns vector of ISMRMRD::Acquisitions
+     * @param range Slices, echoes, volumes and channels to convert
+     * @param sink Receiver of the converted acquisitions
+     *
+     * Data outside the range should not be read from the raw file at all.
      *
      * Pure virtual function templates
      */
 
-    virtual std::vector<ISMRMRD::Acquisition> getAcquisitions(GERecon::Legacy::PfilePointer &pfile,
-                                                              unsigned int view_num) = 0;
+    virtual void convertAcquisitions(const ConversionContext &context,
+                                     GERecon::Legacy::PfilePointer &pfile,
+                                     const ConversionRange &range, AcquisitionSink &sink) = 0;
+
+    virtual void convertAcquisitions(const ConversionContext &context,
+                                     GERecon::ScanArchivePointer &scanArchive,
+                                     const ConversionRange &range, AcquisitionSink &sink) = 0;
+
+    /**
+     * Convert the packets of a ScanArchive that is still being written, from
+     * packet firstPacket on
+     *
+     * The packets before firstPacket were converted by earlier calls. They are
+     * passed over without decoding them, but still counted, so that scan
+     * counters and repetitions continue where the last call left off.
+     *
+     * @returns the packet to start from in the next call, i.e. the number of
+     *          packets passed over or converted
+     * @throws std::runtime_error if the converter cannot follow a growing archive
+     */
+
+    virtual size_t convertNewAcquisitions(const ConversionContext &context,
+                                          GERecon::ScanArchivePointer &scanArchive,
+                                          const ConversionRange &range, size_t firstPacket,
+                                          AcquisitionSink &sink)
+    {
+        throw std::runtime_error("This converter cannot follow a ScanArchive while it is written");
+    }
+
+    /**
+     * Whether convertAcquisitions() may run on several threads at once for
+     * disjoint ranges of the same P-file, e.g. one slice per thread
+     */
+    virtual bool supportsConcurrentRanges() const { return false; }
+
+    /**
+     * Whether every sample convertAcquisitions() produces is a digitized value,
+     * at most moved or negated, so that integer sample formats store it without loss
+     */
+    virtual bool preservesSampleValues(const ConversionContext &context) const { return true; }
 
-    virtual std::vector<ISMRMRD::Acquisition> getAcquisitions(GERecon::ScanArchivePointer &scanArchive,
-                                                              unsigned int view_num) = 0;
+    /**
+     * Upper bound on the number of acquisitions convertAcquisitions() will produce
+     *
+     * @param context Parameters of the raw file, built once when it was opened
+     * @param P-file or Orchestra file object
+     * @param range Slices, echoes, volumes and channels to convert
+     * @returns maximum acquisition count, or 0 if it can't be determined up front
+     *
+     * Used to size output containers once, so that decoded acquisitions never
+     * have to be relocated while the scan is being converted.
+     */
+
+    virtual size_t estimateAcquisitionCount(const ConversionContext &context,
+                                            GERecon::Legacy::PfilePointer &pfile,
+                                            const ConversionRange &range) { return 0; }
+
+    virtual size_t estimateAcquisitionCount(const ConversionContext &context,
+                                            GERecon::ScanArchivePointer &scanArchive,
+                                            const ConversionRange &range) { return 0; }
+
+    /**
+     * Create the ISMRMRD acquisitions of a range of the scan in memory
+     *
+     * @param context Parameters of the raw file, built once when it was opened
+     * @param P-file or Orchestra file object
+     * @param range Slices, echoes, volumes and channels to convert
+     * @returns vector of ISMRMRD::Acquisitions
+     *
+     * Holds the whole scan in memory; prefer convertAcquisitions() for large files.
+     */
+
+    std::vector<ISMRMRD::Acquisition> getAcquisitions(const ConversionContext &context,
+                                                      GERecon::Legacy::PfilePointer &pfile,
+                                                      const ConversionRange &range)
+    {
+        std::vector<ISMRMRD::Acquisition> acqs;
+        acqs.reserve(estimateAcquisitionCount(context, pfile, range));
+        AcquisitionVectorSink sink(acqs);
+        convertAcquisitions(context, pfile, range, sink);
+        return acqs;
+    }
+
+    std::vector<ISMRMRD::Acquisition> getAcquisitions(const ConversionContext &context,
+                                                      GERecon::ScanArchivePointer &scanArchive,
+                                                      const ConversionRange &range)
+    {
+        std::vector<ISMRMRD::Acquisition> acqs;
+        acqs.reserve(estimateAcquisitionCount(context, scanArchive, range));
+        AcquisitionVectorSink sink(acqs);
+        convertAcquisitions(context, scanArchive, range, sink);
+        return acqs;
+    }
+
+protected:
+    ConversionOptions options_;
+    logstream log_;
 };
 
+/** Creates a converter; exported by plugin libraries as make_<ClassName> */
+typedef SequenceConverter* (*SequenceConverterFactory)();
+
+/** Deletes a converter made by the factory; exported as destroy_<ClassName> */
+typedef void (*SequenceConverterDestructor)(SequenceConverter*);
+
 } // namespace GEToIsmrmrd
 
+/**
+ * Exports the factory functions of a converter class from a plugin library, so
+ * that PluginRegistry can find the class by name after loading the library.
+ * Use once per class, in one source file, outside of any namespace.
+ */
+#define SEQUENCE_CONVERTER_FACTORY_DECLARE(CONVERTER)                               \
+    extern "C" GEToIsmrmrd::SequenceConverter* make_##CONVERTER()                   \
+    {                                                                               \
+        return new CONVERTER();                                                     \
+    }                                                                               \
+    extern "C" void destroy_##CONVERTER(GEToIsmrmrd::SequenceConverter* converter)  \
+    {                                                                               \
+        delete converter;                                                           \
+    }
+
 #endif /* SEQUENCE_CONVERTER_H */
 
@@ -0,0 +1,204 @@
+#include <chrono>
+#include <iostream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Boost
+#include <boost/program_options.hpp>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// GE
+#include "ShmRing.h"
+
+namespace po = boost::program_options;
+
+/**
+ * Sums the real and imaginary parts of count samples stored as Part
+ */
+template <typename Part>
+static float sumParts(const void* samples, size_t count)
+{
+   const Part* parts = static_cast<const Part*>(samples);
+   float sum = 0.0f;
+   for (size_t n = 0 ; n < 2 * count ; n++) {
+      sum += parts[n];
+   }
+   return sum;
+}
+
+/**
+ * Reads a conversion from a shared memory ring, the way a reconstruction would
+ *
+ * Every sample is read in place, so the reported throughput is that of a
+ * consumer actually touching the data. Records are released in groups of hold,
+ * which keeps the writer and reader from contending for the tail on every record.
+ *
+ * @returns true if the ring ended normally
+ */
+static bool consumeRing(const std::string& name, unsigned int timeoutMillis, unsigned int waitMicros, unsigned int hold)
+{
+   size_t acquisitions = 0, headerBytes = 0, sampleBytes = 0;
+   double sum = 0.0;
+   std::chrono::steady_clock::time_point start;
+
+   try {
+      GEToIsmrmrd::ShmRingReader reader(name, timeoutMillis, waitMicros);
+
+      GEToIsmrmrd::ShmRecord record;
+      unsigned int held = 0;
+      while (reader.next(record)) {
+         if (record.type == GEToIsmrmrd::SHM_RECORD_HEADER) {
+            // the clock starts when the writer has the header, as it would for a reconstruction
+            start = std::chrono::steady_clock::now();
+            headerBytes = record.size;
+         } else if (record.type == GEToIsmrmrd::SHM_RECORD_ACQUISITION) {
+            GEToIsmrmrd::ShmAcquisition acq = GEToIsmrmrd::ShmAcquisition::view(record, reader.sampleFormat());
+            size_t const samples = size_t(acq.head->number_of_samples) * acq.head->active_channels;
+            if (acq.format == GEToIsmrmrd::SAMPLE_FORMAT_INT16) {
+               sum += sumParts<int16_t>(acq.samples, samples);
+            } else if (acq.format == GEToIsmrmrd::SAMPLE_FORMAT_INT32) {
+               sum += sumParts<int32_t>(acq.samples, samples);
+            } else {
+               sum += sumParts<float>(acq.samples, samples);
+            }
+            sampleBytes += samples * 2 * GEToIsmrmrd::sampleComponentBytes(acq.format);
+            acquisitions++;
+         }
+
+         if (++held >= hold) {
+            reader.release();
+            held = 0;
+         }
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to read shared memory ring: " << e.what() << std::endl;
+      return false;
+   }
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   std::cout << "Received header (" << headerBytes << " bytes) and " << acquisitions << " acquisitions, "
+             << sampleBytes / (1024.0 * 1024.0) << " MiB of samples in " << elapsed.count() << " s" << std::endl;
+   if (elapsed.count() > 0) {
+      std::cout << "Throughput " << acquisitions / elapsed.count() << " acquisitions/s, "
+                << sampleBytes / elapsed.count() / 1e9 << " GB/s of samples" << std::endl;
+   }
+   std::cout << "Sum of samples " << sum << std::endl;
+
+   return true;
+}
+
+/**
+ * Writes synthetic acquisitions to a ring, as ge2ismrmrd --shm would
+ */
+static bool produceRing(const std::string& name, size_t capacity, unsigned int waitMicros, GEToIsmrmrd::SampleFormat format,
+                        size_t acquisitions, unsigned int samples, unsigned int channels)
+{
+   try {
+      GEToIsmrmrd::ShmRingWriter writer(name, capacity, waitMicros, format);
+      writer.writeHeader("<?xml version=\"1.0\"?><ismrmrdHeader xmlns=\"http://www.ismrm.org/ISMRMRD\"/>");
+
+      ISMRMRD::Acquisition acq;
+      acq.resize(samples, channels);
+      for (size_t n = 0 ; n < acq.getNumberOfDataElements() ; n++) {
+         acq.getDataPtr()[n] = complex_float_t(1.0f, 0.0f);
+      }
+
+      for (size_t n = 0 ; n < acquisitions ; n++) {
+         acq.scan_counter() = n;
+         writer.consume(acq);
+      }
+      writer.finish();
+
+      GEToIsmrmrd::ShmRingWriter::Statistics stats = writer.statistics();
+      std::cout << "Writer stalled " << stats.stalls << " times on a full ring ("
+                << stats.stallSeconds << " s)" << std::endl;
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to write shared memory ring: " << e.what() << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+int main (int argc, char *argv[])
+{
+   std::string name, sampleFormat;
+   unsigned int timeoutMillis, waitMicros, hold, samples, channels;
+   size_t acquisitions, ringMB;
+
+   std::string usage = std::string(argv[0]) + " [options] [shared memory name]";
+
+   po::options_description options("Options");
+   options.add_options()
+      ("help,h", "print help message")
+      ("name", po::value<std::string>(&name)->default_value("/ge2ismrmrd"), "shared memory ring written by ge2ismrmrd --shm")
+      ("timeout", po::value<unsigned int>(&timeoutMillis)->default_value(10000), "milliseconds to wait for the ring to appear")
+      ("wait", po::value<unsigned int>(&waitMicros)->default_value(50), "microseconds a stalled side sleeps between retries (0 = only yield)")
+      ("hold", po::value<unsigned int>(&hold)->default_value(16), "records read before their space is released")
+      ("benchmark", "write synthetic acquisitions from a child process and measure the throughput of the ring")
+      ("acquisitions", po::value<size_t>(&acquisitions)->default_value(100000), "acquisitions written in benchmark mode")
+      ("samples", po::value<unsigned int>(&samples)->default_value(512), "samples per channel in benchmark mode")
+      ("channels", po::value<unsigned int>(&channels)->default_value(32), "channels per acquisition in benchmark mode")
+      ("ring-mb", po::value<size_t>(&ringMB)->default_value(64), "data area of the ring in benchmark mode, in MiB")
+      ("sample-format", po::value<std::string>(&sampleFormat)->default_value("float"), "samples written in benchmark mode: float, int16 or int32")
+      ;
+
+   po::positional_options_description positionals;
+   positionals.add("name", 1);
+
+   po::variables_map vm;
+   try {
+      po::store(po::command_line_parser(argc, argv).options(options).positional(positionals).run(), vm);
+      po::notify(vm);
+   } catch (const po::error& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << usage << std::endl << options << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   if (vm.count("help")) {
+      std::cerr << usage << std::endl << options << std::endl;
+      return EXIT_SUCCESS;
+   }
+
+   if (hold == 0) {
+      hold = 1;
+   }
+
+   GEToIsmrmrd::SampleFormat format;
+   try {
+      format = GEToIsmrmrd::parseSampleFormat(sampleFormat);
+   } catch (const std::invalid_argument& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (format == GEToIsmrmrd::SAMPLE_FORMAT_NATIVE) {
+      std::cerr << "ERROR: synthetic samples have no native format" << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   if (!vm.count("benchmark")) {
+      return consumeRing(name, timeoutMillis, waitMicros, hold) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   // the writer runs in a process of its own, as ge2ismrmrd would
+   pid_t const writer = fork();
+   if (writer < 0) {
+      std::cerr << "Failed to start the writer process" << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (writer == 0) {
+      _exit(produceRing(name, ringMB * 1024 * 1024, waitMicros, format, acquisitions, samples, channels) ? 0 : 1);
+   }
+
+   bool const consumed = consumeRing(name, timeoutMillis, waitMicros, hold);
+
+   int status = 0;
+   waitpid(writer, &status, 0);
+   bool const produced = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+   return (consumed && produced) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,345 @@
+/** @file ShmRing.cpp */
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShmRing.h"
+
+namespace GEToIsmrmrd {
+
+// Bytes before the data area, which holds the control block
+static const uint64_t SHM_RING_CONTROL_BYTES = 4096;
+
+// Number of times a stalled side yields before it starts sleeping
+static const unsigned int SHM_RING_YIELD_ROUNDS = 64;
+
+static uint64_t alignUp(uint64_t size)
+{
+    return (size + SHM_RING_ALIGNMENT - 1) / SHM_RING_ALIGNMENT * SHM_RING_ALIGNMENT;
+}
+
+static void backoff(unsigned int attempt, unsigned int waitMicros)
+{
+    if (attempt < SHM_RING_YIELD_ROUNDS || waitMicros == 0) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(waitMicros));
+    }
+}
+
+static std::runtime_error systemError(const std::string& what, const std::string& name)
+{
+    return std::runtime_error(what + " " + name + ": " + strerror(errno));
+}
+
+uint64_t ShmAcquisition::trajectoryOffset()
+{
+    return alignUp(sizeof(ISMRMRD::ISMRMRD_AcquisitionHeader));
+}
+
+uint64_t ShmAcquisition::dataOffset(const ISMRMRD::ISMRMRD_AcquisitionHeader& head)
+{
+    uint64_t const trajBytes = uint64_t(head.trajectory_dimensions) * head.number_of_samples * sizeof(float);
+    return alignUp(trajectoryOffset() + trajBytes);
+}
+
+uint64_t ShmAcquisition::payloadSize(const ISMRMRD::ISMRMRD_AcquisitionHeader& head, SampleFormat format)
+{
+    uint64_t const dataBytes = uint64_t(head.number_of_samples) * head.active_channels * 2 * sampleComponentBytes(format);
+    return dataOffset(head) + dataBytes;
+}
+
+ShmAcquisition ShmAcquisition::view(const ShmRecord& record, SampleFormat format)
+{
+    ShmAcquisition acq;
+    acq.head = reinterpret_cast<const ISMRMRD::ISMRMRD_AcquisitionHeader*>(record.payload);
+    acq.traj = reinterpret_cast<const float*>(record.payload + trajectoryOffset());
+    acq.samples = record.payload + dataOffset(*acq.head);
+    acq.data = (format == SAMPLE_FORMAT_FLOAT) ? static_cast<const std::complex<float>*>(acq.samples) : NULL;
+    acq.format = format;
+    return acq;
+}
+
+ShmRingWriter::ShmRingWriter(const std::string& name, size_t capacity, unsigned int waitMicros, SampleFormat format)
+    : name_(name)
+    , mappedSize_(SHM_RING_CONTROL_BYTES + alignUp(capacity))
+    , control_(NULL)
+    , data_(NULL)
+    , waitMicros_(waitMicros)
+    , format_(format)
+    , head_(0)
+    , pending_(0)
+    , finished_(false)
+{
+    if (capacity == 0) {
+        throw std::runtime_error("Shared memory ring " + name + " needs a capacity");
+    }
+    if (format == SAMPLE_FORMAT_NATIVE) {
+        throw std::runtime_error("Shared memory ring " + name + " needs a resolved sample format");
+    }
+
+    // A ring left over by a writer that did not finish is of no use to anyone
+    shm_unlink(name_.c_str());
+
+    int const fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        throw systemError("Failed to create shared memory ring", name_);
+    }
+    if (ftruncate(fd, mappedSize_) != 0) {
+        std::runtime_error const error = systemError("Failed to size shared memory ring", name_);
+        close(fd);
+        shm_unlink(name_.c_str());
+        throw error;
+    }
+
+    void* memory = mmap(NULL, mappedSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        std::runtime_error const error = systemError("Failed to map shared memory ring", name_);
+        shm_unlink(name_.c_str());
+        throw error;
+    }
+
+    control_ = new (memory) ShmRingControl;
+    control_->version = SHM_RING_VERSION;
+    control_->capacity = alignUp(capacity);
+    control_->dataOffset = SHM_RING_CONTROL_BYTES;
+    control_->sampleFormat = format_;
+    control_->head.store(0);
+    control_->tail.store(0);
+    control_->writerState.store(SHM_RING_OPEN);
+    control_->readerState.store(SHM_RING_OPEN);
+    data_ = static_cast<char*>(memory) + SHM_RING_CONTROL_BYTES;
+
+    // Readers wait for the magic number, so it is set once everything else is
+    control_->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    if (!finished_) {
+        control_->writerState.store(SHM_RING_ABORTED, std::memory_order_release);
+    }
+    munmap(control_, mappedSize_);
+    shm_unlink(name_.c_str());
+}
+
+void ShmRingWriter::writeHeader(const std::string& xml)
+{
+    char* payload = reserve(SHM_RECORD_HEADER, xml.size());
+    memcpy(payload, xml.data(), xml.size());
+    publish();
+}
+
+void ShmRingWriter::consume(const ISMRMRD::Acquisition& acq)
+{
+    const ISMRMRD::ISMRMRD_AcquisitionHeader& head = acq.getHead();
+
+    char* payload = reserve(SHM_RECORD_ACQUISITION, ShmAcquisition::payloadSize(head, format_));
+    memcpy(payload, &head, sizeof(head));
+    memcpy(payload + ShmAcquisition::trajectoryOffset(), acq.getTrajPtr(), acq.getTrajSize());
+    if (format_ == SAMPLE_FORMAT_FLOAT) {
+        memcpy(payload + ShmAcquisition::dataOffset(head), acq.getDataPtr(), acq.getDataSize());
+    } else {
+        // Packed straight into the ring; a sample that does not fit leaves the record unpublished
+        packSamples(acq, format_, payload + ShmAcquisition::dataOffset(head));
+    }
+    publish();
+}
+
+void ShmRingWriter::finish()
+{
+    if (finished_) {
+        return;
+    }
+
+    reserve(SHM_RECORD_END, 0);
+    publish();
+    control_->writerState.store(SHM_RING_FINISHED, std::memory_order_release);
+
+    for (unsigned int attempt = 0 ; control_->tail.load(std::memory_order_acquire) != head_ ; attempt++) {
+        if (control_->readerState.load(std::memory_order_acquire) == SHM_RING_ABORTED) {
+            throw std::runtime_error("Reader of shared memory ring " + name_ + " gave up");
+        }
+        backoff(attempt, waitMicros_);
+    }
+    finished_ = true;
+}
+
+/**
+ * Waits for room for a record and writes its header; the payload follows the returned pointer
+ */
+char* ShmRingWriter::reserve(uint32_t type, uint64_t payloadSize)
+{
+    uint64_t const capacity = control_->capacity;
+    uint64_t const span = shmRecordSpan(payloadSize);
+    if (span > capacity || payloadSize > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Record of " + std::to_string(payloadSize) + " bytes does not fit in shared memory ring " + name_);
+    }
+
+    uint64_t offset = head_ % capacity;
+    if (offset + span > capacity) {
+        // Records never wrap, so the rest of the area is skipped
+        uint64_t const padding = capacity - offset;
+        waitForSpace(padding);
+
+        ShmRecordHeader* filler = reinterpret_cast<ShmRecordHeader*>(data_ + offset);
+        filler->type = SHM_RECORD_PADDING;
+        filler->size = padding - sizeof(ShmRecordHeader);
+        head_ += padding;
+        control_->head.store(head_, std::memory_order_release);
+        stats_.bytes += padding;
+        offset = 0;
+    }
+    waitForSpace(span);
+
+    ShmRecordHeader* header = reinterpret_cast<ShmRecordHeader*>(data_ + offset);
+    header->type = type;
+    header->size = payloadSize;
+    pending_ = span;
+
+    return data_ + offset + sizeof(ShmRecordHeader);
+}
+
+/**
+ * Makes the reserved record visible to the reader
+ */
+void ShmRingWriter::publish()
+{
+    head_ += pending_;
+    control_->head.store(head_, std::memory_order_release);
+    stats_.records++;
+    stats_.bytes += pending_;
+}
+
+void ShmRingWriter::waitForSpace(uint64_t span)
+{
+    uint64_t const capacity = control_->capacity;
+    if (capacity - (head_ - control_->tail.load(std::memory_order_acquire)) >= span) {
+        return;
+    }
+
+    stats_.stalls++;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int attempt = 0 ; capacity - (head_ - control_->tail.load(std::memory_order_acquire)) < span ; attempt++) {
+        if (control_->readerState.load(std::memory_order_acquire) == SHM_RING_ABORTED) {
+            throw std::runtime_error("Reader of shared memory ring " + name_ + " gave up");
+        }
+        backoff(attempt, waitMicros_);
+    }
+    stats_.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+ShmRingReader::ShmRingReader(const std::string& name, unsigned int timeoutMillis, unsigned int waitMicros)
+    : mappedSize_(0)
+    , control_(NULL)
+    , data_(NULL)
+    , waitMicros_(waitMicros)
+    , read_(0)
+    , ended_(false)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+
+    // The writer may not have created, sized or initialized the ring yet
+    for (;;) {
+        int const fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0 && errno != ENOENT) {
+            throw systemError("Failed to open shared memory ring", name);
+        }
+
+        if (fd >= 0) {
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > (off_t) SHM_RING_CONTROL_BYTES) {
+                mappedSize_ = info.st_size;
+                void* memory = mmap(NULL, mappedSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                close(fd);
+                if (memory == MAP_FAILED) {
+                    throw systemError("Failed to map shared memory ring", name);
+                }
+
+                control_ = static_cast<ShmRingControl*>(memory);
+                if (control_->magic.load(std::memory_order_acquire) == SHM_RING_MAGIC) {
+                    break;
+                }
+                munmap(memory, mappedSize_);
+                control_ = NULL;
+            } else {
+                close(fd);
+            }
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            throw std::runtime_error("Timed out waiting for shared memory ring " + name);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    if (control_->version != SHM_RING_VERSION ||
+            control_->dataOffset + control_->capacity != mappedSize_ ||
+            control_->sampleFormat > SAMPLE_FORMAT_INT32) {
+        munmap(control_, mappedSize_);
+        throw std::runtime_error("Shared memory ring " + name + " has an unsupported layout");
+    }
+    data_ = reinterpret_cast<const char*>(control_) + control_->dataOffset;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    if (!ended_) {
+        control_->readerState.store(SHM_RING_ABORTED, std::memory_order_release);
+    }
+    munmap(control_, mappedSize_);
+}
+
+bool ShmRingReader::next(ShmRecord& record)
+{
+    if (ended_) {
+        return false;
+    }
+
+    uint64_t const capacity = control_->capacity;
+    for (;;) {
+        for (unsigned int attempt = 0 ; control_->head.load(std::memory_order_acquire) == read_ ; attempt++) {
+            if (control_->writerState.load(std::memory_order_acquire) == SHM_RING_ABORTED) {
+                throw std::runtime_error("Writer of shared memory ring gave up");
+            }
+            backoff(attempt, waitMicros_);
+        }
+
+        uint64_t const offset = read_ % capacity;
+        const ShmRecordHeader* header = reinterpret_cast<const ShmRecordHeader*>(data_ + offset);
+        if (header->type == SHM_RECORD_PADDING) {
+            read_ += capacity - offset;
+            continue;
+        }
+
+        record.type = header->type;
+        record.size = header->size;
+        record.payload = data_ + offset + sizeof(ShmRecordHeader);
+        read_ += shmRecordSpan(header->size);
+
+        if (record.type == SHM_RECORD_END) {
+            ended_ = true;
+            release();
+            control_->readerState.store(SHM_RING_FINISHED, std::memory_order_release);
+            return false;
+        }
+        return true;
+    }
+}
+
+void ShmRingReader::release()
+{
+    control_->tail.store(read_, std::memory_order_release);
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,251 @@
+/** @file ShmRing.h */
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <string>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+// Local
+#include "AcquisitionSink.h"
+#include "SampleFormat.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * @page shmring Shared memory ring layout
+ *
+ * A conversion can be handed to a reconstruction on the same host through a
+ * POSIX shared memory object (shm_open), written by one ShmRingWriter and read
+ * by one ShmRingReader, or by any program following this layout. All integers
+ * are in host byte order.
+ *
+ * The object starts with a ShmRingControl block. Its data area, of
+ * ShmRingControl::capacity bytes, starts at ShmRingControl::dataOffset. The
+ * writer has written ShmRingControl::head bytes in total and the reader has
+ * released ShmRingControl::tail bytes; the bytes from tail to head, taken
+ * modulo capacity, hold records not released yet. Both counters only grow.
+ *
+ * Each record is a ShmRecordHeader followed by its payload, padded to a
+ * multiple of SHM_RING_ALIGNMENT. A record never wraps around the end of the
+ * data area, so its payload can be used where it lies. When a record does not
+ * fit before the end, the rest of the area is filled by a SHM_RECORD_PADDING
+ * record and the record starts at offset 0.
+ *
+ * Records are, in order: one SHM_RECORD_HEADER holding the ISMRMRD XML header,
+ * one SHM_RECORD_ACQUISITION per acquisition, then SHM_RECORD_END. An
+ * acquisition payload is an ISMRMRD_AcquisitionHeader, the trajectory as
+ * floats at trajectoryOffset() and the samples, channel by channel, at
+ * dataOffset(), both aligned to SHM_RING_ALIGNMENT. Samples are complex floats,
+ * or interleaved real and imaginary 16 or 32 bit integers as given by
+ * ShmRingControl::sampleFormat.
+ *
+ * The writer waits while a record does not fit in the free space, so a slow
+ * reader holds it back. After the end record it waits until the reader has
+ * released everything before it removes the object.
+ */
+
+static const uint32_t SHM_RING_MAGIC = 0x52493247;     ///< "G2IR"
+static const uint32_t SHM_RING_VERSION = 2;
+static const uint64_t SHM_RING_ALIGNMENT = 8;
+
+enum ShmRecordType
+{
+    SHM_RECORD_HEADER      = 1,    ///< ISMRMRD XML header, without terminating null
+    SHM_RECORD_ACQUISITION = 2,    ///< one acquisition
+    SHM_RECORD_PADDING     = 3,    ///< filler up to the end of the data area
+    SHM_RECORD_END         = 4     ///< no more records follow
+};
+
+enum ShmRingState
+{
+    SHM_RING_OPEN     = 0,
+    SHM_RING_FINISHED = 1,         ///< the writer wrote its end record
+    SHM_RING_ABORTED  = 2          ///< the writer or reader gave up
+};
+
+/** Control block at the start of the shared memory object */
+struct ShmRingControl
+{
+    std::atomic<uint32_t> magic;            ///< SHM_RING_MAGIC once the ring is ready to use
+    uint32_t version;                       ///< SHM_RING_VERSION
+    uint64_t capacity;                      ///< bytes in the data area, a multiple of SHM_RING_ALIGNMENT
+    uint64_t dataOffset;                    ///< offset of the data area in the object
+    uint32_t sampleFormat;                  ///< SampleFormat of the acquisition samples, never SAMPLE_FORMAT_NATIVE
+
+    alignas(64) std::atomic<uint64_t> head;                 ///< bytes written, set by the writer
+    alignas(64) std::atomic<uint64_t> tail;                 ///< bytes released, set by the reader
+    alignas(64) std::atomic<uint32_t> writerState;          ///< ShmRingState of the writer
+    std::atomic<uint32_t> readerState;                      ///< ShmRingState of the reader
+};
+
+/** Start of every record */
+struct ShmRecordHeader
+{
+    uint32_t type;      ///< ShmRecordType
+    uint32_t size;      ///< payload bytes, without padding
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "the ring counters must be lock-free to be shared between processes");
+
+/** Bytes a payload takes in the ring with its record header and padding */
+inline uint64_t shmRecordSpan(uint64_t payloadSize)
+{
+    uint64_t const size = sizeof(ShmRecordHeader) + payloadSize;
+    return (size + SHM_RING_ALIGNMENT - 1) / SHM_RING_ALIGNMENT * SHM_RING_ALIGNMENT;
+}
+
+/** A record as it lies in the ring */
+struct ShmRecord
+{
+    uint32_t type;
+    uint32_t size;
+    const char* payload;
+};
+
+/** The parts of an acquisition record, pointing into the ring */
+struct ShmAcquisition
+{
+    const ISMRMRD::ISMRMRD_AcquisitionHeader* head;
+    const float* traj;
+    const std::complex<float>* data;    ///< samples stored as floats, NULL in integer formats
+    const void* samples;                ///< samples in their stored format
+    SampleFormat format;
+
+    /** Offsets of the trajectory and samples in an acquisition payload */
+    static uint64_t trajectoryOffset();
+    static uint64_t dataOffset(const ISMRMRD::ISMRMRD_AcquisitionHeader& head);
+    static uint64_t payloadSize(const ISMRMRD::ISMRMRD_AcquisitionHeader& head, SampleFormat format);
+
+    /** Points into the payload of an acquisition record of a ring holding samples in format */
+    static ShmAcquisition view(const ShmRecord& record, SampleFormat format);
+};
+
+/**
+ * Publishes a conversion into a shared memory ring.
+ *
+ * Creates the object, replacing any left over by an earlier writer of the same
+ * name, and removes it when done. consume() copies each acquisition straight
+ * into the ring; it waits while the ring is full, first yielding and then
+ * sleeping waitMicros between retries.
+ */
+class ShmRingWriter : public AcquisitionSink
+{
+public:
+    struct Statistics
+    {
+        Statistics() : records(0), bytes(0), stalls(0), stallSeconds(0.0) { }
+
+        size_t records;         ///< records written
+        size_t bytes;           ///< ring bytes used, including record headers and padding
+        size_t stalls;          ///< times a record did not fit
+        double stallSeconds;    ///< time spent waiting for the reader
+    };
+
+    /**
+     * @param name Shared memory object name, e.g. "/ge2ismrmrd"
+     * @param capacity Bytes in the data area; rounded up to SHM_RING_ALIGNMENT
+     * @param waitMicros Sleep between retries while the ring is full (0 = only yield)
+     * @param format How samples are stored; resolved, i.e. not SAMPLE_FORMAT_NATIVE
+     * @throws std::runtime_error if the object cannot be created
+     */
+    ShmRingWriter(const std::string& name, size_t capacity, unsigned int waitMicros,
+                  SampleFormat format = SAMPLE_FORMAT_FLOAT);
+
+    /** Marks the ring aborted if finish() was not called, then removes it */
+    ~ShmRingWriter();
+
+    /** Publishes the ISMRMRD XML header, which must come first */
+    void writeHeader(const std::string& xml);
+
+    void consume(const ISMRMRD::Acquisition& acq);
+
+    /**
+     * Publishes the end record and waits until the reader has released every record
+     *
+     * @throws std::runtime_error if the reader gave up
+     */
+    void finish();
+
+    Statistics statistics() const { return stats_; }
+
+private:
+    // Non-copyable
+    ShmRingWriter(const ShmRingWriter& other);
+    ShmRingWriter& operator=(const ShmRingWriter& other);
+
+    char* reserve(uint32_t type, uint64_t payloadSize);
+    void publish();
+    void waitForSpace(uint64_t span);
+
+    std::string name_;
+    size_t mappedSize_;
+    ShmRingControl* control_;
+    char* data_;
+    unsigned int waitMicros_;
+    SampleFormat format_;
+
+    uint64_t head_;         // bytes written, including the records published
+    uint64_t pending_;      // span of the record reserved and not published yet
+    bool finished_;
+    Statistics stats_;
+};
+
+/**
+ * Reads a conversion from a shared memory ring without copying it.
+ *
+ * Records returned by next() stay in place until release(), so a reader can
+ * work on several acquisitions before it gives their space back.
+ */
+class ShmRingReader
+{
+public:
+    /**
+     * Attaches to the ring, waiting for its writer to create it
+     *
+     * @param name Shared memory object name given to the writer
+     * @param timeoutMillis How long to wait for the ring to appear
+     * @param waitMicros Sleep between retries while the ring is empty (0 = only yield)
+     * @throws std::runtime_error if the ring does not appear in time or is not compatible
+     */
+    ShmRingReader(const std::string& name, unsigned int timeoutMillis, unsigned int waitMicros);
+
+    /** Marks the ring aborted if the end record was not reached */
+    ~ShmRingReader();
+
+    /**
+     * Waits for the next record
+     *
+     * @returns false at the end record
+     * @throws std::runtime_error if the writer gave up
+     */
+    bool next(ShmRecord& record);
+
+    /** Gives back the space of every record returned by next() so far */
+    void release();
+
+    /** How the writer stores samples, for ShmAcquisition::view() */
+    SampleFormat sampleFormat() const { return static_cast<SampleFormat>(control_->sampleFormat); }
+
+private:
+    // Non-copyable
+    ShmRingReader(const ShmRingReader& other);
+    ShmRingReader& operator=(const ShmRingReader& other);
+
+    size_t mappedSize_;
+    ShmRingControl* control_;
+    const char* data_;
+    unsigned int waitMicros_;
+
+    uint64_t read_;         // bytes up to the end of the last record returned
+    bool ended_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* SHM_RING_H */
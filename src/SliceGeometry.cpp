@@ -0,0 +1,230 @@
+/** @file SliceGeometry.cpp */
+#include <cmath>
+
+#include "SliceGeometry.h"
+
+namespace GEToIsmrmrd {
+
+SliceGeometryTable::SliceGeometryTable(const GERecon::SliceInfoTable &sliceTable, unsigned int numSlices,
+                                       int patientEntry, int patientPosition)
+   : patientEntry_(patientEntry),
+     patientPosition_(patientPosition)
+{
+   slices_.reserve(numSlices);
+
+   for (unsigned int sliceNumber = 0 ; sliceNumber < numSlices ; sliceNumber++)
+   {
+      slices_.push_back(computeSliceVectors(sliceTable, sliceNumber, patientEntry, patientPosition));
+   }
+}
+
+
+
+geRawDataSliceVectors_t SliceGeometryTable::computeSliceVectors(const GERecon::SliceInfoTable &sliceTable,
+                                                                unsigned int sliceNumber,
+                                                                int entry, int position)
+{
+   geRawDataSliceVectors_t vectors;
+   geRawDataSliceVectors_t *vecs = &vectors;
+
+   float gwp1[3],   gwp2[3],   gwp3[3];
+   float gwp1_0[3], gwp2_0[3], gwp3_0[3];
+
+   GERecon::SliceCorners sliceCorners = sliceTable.AcquiredSliceCorners(sliceNumber);
+
+   /* TODO - need to make sure these are consistent with how they are treated in rotateVectorOnPatient function.
+    *
+    * These did not seem to be consisent.  'patientEntry' seemed okay though looked like it could get much more
+    * complicated.  'patientPosition' required more checking.
+    *
+
+    * int patientEntry    = processingControl->Value<int>("PatientEntry")    - 1;
+    * int patientPosition = processingControl->Value<int>("PatientPosition") - 1;
+
+    * grab the gw_points from this slice's info entry
+    * gwp1_0 = slice_info[sliceNumber].gw_point1;
+    * gwp2_0 = slice_info[sliceNumber].gw_point2;
+    * gwp3_0 = slice_info[sliceNumber].gw_point3;
+
+    */
+
+   int patientEntry, patientPosition;
+
+   switch (entry)
+   {
+      case 2 :
+         patientEntry = 1;      /* Feet first */
+         break;
+
+      default :
+         patientEntry = 0;      /* Head first */
+   }
+
+   switch (position)
+   {
+      case 2 :
+         patientPosition = 1;   /* Prone */
+         break;
+
+      case 4 :
+         patientPosition = 2;   /* Left Decubitus */
+         break;
+
+      case 8 :
+         patientPosition = 3;   /* Right Decubitus */
+         break;
+
+      default :
+         patientPosition = 0;   /* Supine */
+   }
+
+   gwp1_0[0] = sliceCorners.UpperLeft().X_mm();
+   gwp1_0[1] = sliceCorners.UpperLeft().Y_mm();
+   gwp1_0[2] = sliceCorners.UpperLeft().Z_mm();
+
+   gwp2_0[0] = sliceCorners.UpperRight().X_mm();
+   gwp2_0[1] = sliceCorners.UpperRight().Y_mm();
+   gwp2_0[2] = sliceCorners.UpperRight().Z_mm();
+
+   gwp3_0[0] = sliceCorners.LowerLeft().X_mm();
+   gwp3_0[1] = sliceCorners.LowerLeft().Y_mm();
+   gwp3_0[2] = sliceCorners.LowerLeft().Z_mm();
+
+   // rotate each coordinate according to the patient's position
+   // this also puts the coordinates into DICOM/patient coordinate space
+   rotateVectorOnPatient(patientEntry, patientPosition, gwp1_0, gwp1);
+   rotateVectorOnPatient(patientEntry, patientPosition, gwp2_0, gwp2);
+   rotateVectorOnPatient(patientEntry, patientPosition, gwp3_0, gwp3);
+
+   // // Add the Z table offset back to each coordinate
+   // // table_offset_z = image_hdr->ctr_S - (gwp3[2] + gwp2[2]) / 2;
+   // gwp1[2] += pfile->table_offset_z;
+   // gwp2[2] += pfile->table_offset_z;
+   // gwp3[2] += pfile->table_offset_z;
+
+   // calculate the direction cosines from the corners of the plane
+   float read_dir[3];
+   float phase_dir[3];
+   float slice_dir[3];
+   makeDirectionVectors(gwp1, gwp2, gwp3, read_dir, phase_dir, slice_dir);
+   vecs->read_dir.x  = read_dir[0];
+   vecs->read_dir.y  = read_dir[1];
+   vecs->read_dir.z  = read_dir[2];
+   vecs->phase_dir.x = phase_dir[0];
+   vecs->phase_dir.y = phase_dir[1];
+   vecs->phase_dir.z = phase_dir[2];
+   vecs->slice_dir.x = slice_dir[0];
+   vecs->slice_dir.y = slice_dir[1];
+   vecs->slice_dir.z = slice_dir[2];
+   vecs->center.x    = (gwp3[0] + gwp2[0]) / 2.0;
+   vecs->center.y    = (gwp3[1] + gwp2[1]) / 2.0;
+   vecs->center.z    = (gwp3[2] + gwp2[2]) / 2.0;
+
+   return vectors;
+}
+
+
+
+/**
+ * Rotate based on patient position and convert to patient coordinate system
+ * by swapping signs of X and Y
+ *
+ * @param entry 0="Head First", 1="Feet First"
+ * @param pos 0="Supine", 1="Prone", 2="Decubitus Left", 3="Decubitus Right"
+ * @param in original direction vector
+ * @param out rotated direction vector
+ * @returns 1 on success, -1 on failure
+ */
+int SliceGeometryTable::rotateVectorOnPatient(unsigned int entry, unsigned int pos,
+                                              float in[3], float out[3])
+{
+   if (entry > 1) {
+      return -1;
+   }
+   if (pos > 3) {
+      return -1;
+   }
+
+   float rot_hfs[3][3] = {{-1, 0, 0}, {0, -1, 0}, {0, 0, 1}};
+   float rot_hfp[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+   float rot_hfdl[3][3] = {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}};
+   float rot_hfdr[3][3] = {{0, 1, 0}, {-1, 0, 0}, {0, 0, 1}};
+   float rot_ffs[3][3] = {{1, 0, 0}, {0, -1, 0}, {0, 0, -1}};
+   float rot_ffp[3][3] = {{-1, 0, 0}, {0, 1, 0}, {0, 0, -1}};
+   float rot_ffdl[3][3] = {{0, -1, 0}, {-1, 0, 0}, {0, 0, -1}};
+   float rot_ffdr[3][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, -1}};
+
+   typedef float (*rot_mat_type)[3];
+   rot_mat_type patient_rotations[2][4] = {
+      { rot_hfs, rot_hfp, rot_hfdl, rot_hfdr },
+      { rot_ffs, rot_ffp, rot_ffdl, rot_ffdr }
+   };
+
+   rot_mat_type rot = patient_rotations[entry][pos];
+
+   out[0] = rot[0][0] * in[0] + rot[0][1] * in[1] + rot[0][2] * in[2];
+   out[1] = rot[1][0] * in[0] + rot[1][1] * in[1] + rot[1][2] * in[2];
+   out[2] = rot[2][0] * in[0] + rot[2][1] * in[1] + rot[2][2] * in[2];
+
+   return 1;
+}
+
+
+
+/**
+ * Calculates read, phase, and slice direction vectors from three corners of plane
+ *
+ * | r1 p1 s1 |   | x1 y1 z1 |
+ * | r2 p2 s2 | = | x2 y2 z2 |
+ * | r3 p3 s3 |   | x3 y3 z3 |
+ *
+ * @param
+ * @param
+ * @param
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+void SliceGeometryTable::makeDirectionVectors(float gwp1[3],     float gwp2[3],      float gwp3[3],
+                                              float read_dir[3], float phase_dir[3], float slice_dir[3])
+{
+   /****Angulation of acquisition ****/
+   /* Calculate rotation matrix */
+   float x1 = gwp1[0], y1 = gwp1[1], z1 = gwp1[2];
+   float x2 = gwp2[0], y2 = gwp2[1], z2 = gwp2[2];
+   float x3 = gwp3[0], y3 = gwp3[1], z3 = gwp3[2];
+
+   /* Calculate column 1 */
+   float r1, r2, r3, xd;
+   r1 = (x2 - x1);
+   r2 = (y2 - y1);
+   r3 = (z2 - z1);
+   xd = sqrt(r1 * r1 + r2 * r2 + r3 * r3);
+
+   /* Calculate column 2 */
+   float p1, p2, p3, yd;
+   p1 = (x3 - x1);
+   p2 = (y3 - y1);
+   p3 = (z3 - z1);
+   yd = sqrt(p1 * p1 + p2 * p2 + p3 * p3);
+
+   /* Calculate column 3, cross-product (column 1 x column 2) */
+   float s1, s2, s3, zd;
+   s1 = (r2 * p3) - (r3 * p2);
+   s2 = (r3 * p1) - (r1 * p3);
+   s3 = (r1 * p2) - (r2 * p1);
+   zd = sqrt(s1 * s1 + s2 * s2 + s3 * s3);
+
+   /* Fix cases where column length == 0 */
+   if (xd == 0.0l) { r1 = 1.0l; r2 = r3 = 0.0l; xd = 1.0l; }
+   if (yd == 0.0l) { p2 = 1.0l; p1 = p3 = 0.0l; yd = 1.0l; }
+   if (zd == 0.0l) { s3 = 1.0l; s1 = s2 = 0.0l; zd = 1.0l; }
+
+   /* Normalize columns */
+   read_dir[0] =  r1 / xd; read_dir[1]  = r2 / xd; read_dir[2]  = r3 / xd;
+   phase_dir[0] = p1 / yd; phase_dir[1] = p2 / yd; phase_dir[2] = p3 / yd;
+   slice_dir[0] = s1 / zd; slice_dir[1] = s2 / zd; slice_dir[2] = s3 / zd;
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,74 @@
+/** @file SliceGeometry.h */
+#ifndef SLICE_GEOMETRY_H
+#define SLICE_GEOMETRY_H
+
+#include <vector>
+
+#include "SequenceConverter.h"
+
+/** A 3-D vector representation */
+struct geRawDataVector {
+   float x;    /**< X-coordinate */
+   float y;    /**< Y-coordinate */
+   float z;    /**< Z-coordinate */
+};
+typedef struct geRawDataVector geRawDataVector_t;
+
+/** A convenience structure used to obtain slice vectors for a given slice */
+struct geRawDataSliceVectors {
+   geRawDataVector_t center;      /**< Center coordinate */
+   geRawDataVector_t read_dir;    /**< Readout direction vector */
+   geRawDataVector_t phase_dir;   /**< Phase direction vector */
+   geRawDataVector_t slice_dir;   /**< Slice direction vector */
+};
+typedef struct geRawDataSliceVectors geRawDataSliceVectors_t;
+
+namespace GEToIsmrmrd {
+
+/**
+ * Position and direction vectors of every slice of a scan, in patient coordinates.
+ *
+ * Computed once from the slice table when a raw file is opened, and indexed by
+ * geometric slice number. The table is never modified afterwards, so a single
+ * instance can be shared by any number of converter threads.
+ */
+class SliceGeometryTable
+{
+public:
+    SliceGeometryTable(const GERecon::SliceInfoTable &sliceTable, unsigned int numSlices,
+                       int patientEntry, int patientPosition);
+
+    /**
+     * Vectors of a geometric slice
+     *
+     * Slices beyond the table, which a raw file may still refer to, are computed
+     * from the slice table on every call, as they were before the table existed.
+     */
+    geRawDataSliceVectors_t                    vectors (const GERecon::SliceInfoTable &sliceTable,
+                                                       unsigned int sliceNumber) const
+    {
+        return (sliceNumber < slices_.size()) ? slices_[sliceNumber]
+            : computeSliceVectors(sliceTable, sliceNumber, patientEntry_, patientPosition_);
+    }
+
+    size_t                                       size () const { return slices_.size(); }
+
+    static geRawDataSliceVectors_t computeSliceVectors (const GERecon::SliceInfoTable &sliceTable,
+                                                       unsigned int sliceNumber,
+                                                       int patientEntry, int patientPosition);
+
+    static int                   rotateVectorOnPatient (unsigned int entry, unsigned int pos,
+                                                       float in[3], float out[3]);
+
+    static void                   makeDirectionVectors (float gwp1[3],     float gwp2[3],      float gwp3[3],
+                                                       float read_dir[3], float phase_dir[3], float slice_dir[3]);
+
+private:
+    std::vector<geRawDataSliceVectors_t> slices_;
+    int patientEntry_;
+    int patientPosition_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* SLICE_GEOMETRY_H */
@@ -0,0 +1,256 @@
+/** @file SpoolDaemon.cpp */
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local
+#include "SpoolDaemon.h"
+
+namespace GEToIsmrmrd {
+
+// Lock-free, so that it may be set from a signal handler
+static std::atomic<bool> g_stopRequested(false);
+
+// How often run() looks at g_stopRequested while no file arrives
+static const int POLL_MILLIS = 500;
+
+static bool exists(const std::string& path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+SpoolDaemon::SpoolDaemon(const std::string& spoolDir, const std::string& outputDir,
+                         BatchConversion& conversion, WorkStealingPool& pool)
+    : spoolDir_(spoolDir)
+    , outputDir_(outputDir.empty() ? "." : outputDir)
+    , conversion_(conversion)
+    , pool_(pool)
+    , inotify_(-1)
+    , queued_(0)
+{
+    if (spoolDir_.empty() || spoolDir_[spoolDir_.size() - 1] != '/') {
+        spoolDir_ += "/";
+    }
+    if (outputDir_[outputDir_.size() - 1] != '/') {
+        outputDir_ += "/";
+    }
+}
+
+SpoolDaemon::~SpoolDaemon()
+{
+    if (inotify_ >= 0) {
+        close(inotify_);
+    }
+}
+
+void SpoolDaemon::requestStop()
+{
+    g_stopRequested = true;
+}
+
+void SpoolDaemon::run()
+{
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_ < 0) {
+        throw std::runtime_error(std::string("Failed to initialize inotify: ") + strerror(errno));
+    }
+
+    // Watch before listing, so that no file arriving in between is missed
+    uint32_t const mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM;
+    if (inotify_add_watch(inotify_, spoolDir_.c_str(), mask) < 0) {
+        throw std::runtime_error("Failed to watch " + spoolDir_ + ": " + strerror(errno));
+    }
+    queueExisting();
+
+    // Large enough for several events with names of up to NAME_MAX
+    alignas(struct inotify_event) char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+    while (!g_stopRequested) {
+        struct pollfd fd;
+        fd.fd = inotify_;
+        fd.events = POLLIN;
+        fd.revents = 0;
+
+        int const ready = poll(&fd, 1, POLL_MILLIS);
+        if (ready < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("Failed to poll inotify: ") + strerror(errno));
+        }
+        if (ready <= 0) {
+            queueSettled();
+            continue;
+        }
+
+        ssize_t length;
+        while ((length = read(inotify_, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer ; p < buffer + length ; ) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    std::cerr << "Spool events were lost; files that arrived meanwhile are converted at the next restart" << std::endl;
+                } else if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                    continue;
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    removed(event->name);
+                } else {
+                    arrived(event->name, (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0);
+                }
+            }
+        }
+        queueSettled();
+    }
+
+    pool_.wait();
+}
+
+bool SpoolDaemon::FileStamp::operator==(const FileStamp& other) const
+{
+    return inode == other.inode && size == other.size &&
+           mtime == other.mtime && mtimeNanos == other.mtimeNanos;
+}
+
+/**
+ * Stamp of a regular file; false if there is none
+ */
+bool SpoolDaemon::stampOf(const std::string& path, FileStamp& stamp)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+
+    stamp.inode = info.st_ino;
+    stamp.size = info.st_size;
+    stamp.mtime = info.st_mtim.tv_sec;
+    stamp.mtimeNanos = info.st_mtim.tv_nsec;
+    return true;
+}
+
+/**
+ * Makes candidates of the files already in the spool directory that have not been converted
+ */
+void SpoolDaemon::queueExisting()
+{
+    DIR* dir = opendir(spoolDir_.c_str());
+    if (!dir) {
+        throw std::runtime_error("Failed to list " + spoolDir_ + ": " + strerror(errno));
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string const name = entry->d_name;
+        if (!exists(outputDir_ + BatchConversion::outputStem(name) + ".h5")) {
+            arrived(name, true);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * Notes a change to a file: one that was closed after writing or moved in
+ * becomes a candidate, a later change to a candidate restarts its wait
+ */
+void SpoolDaemon::arrived(const std::string& name, bool written)
+{
+    if (name.empty() || name[0] == '.') {
+        return;
+    }
+
+    std::string const path = spoolDir_ + name;
+
+    // Our own outputs, when they are written to the spool directory
+    if (outputs_.count(path) > 0) {
+        return;
+    }
+
+    std::map<std::string, Arrival>::iterator candidate = arrivals_.find(path);
+    if (candidate == arrivals_.end()) {
+        if (!written) {
+            return;
+        }
+        candidate = arrivals_.insert(std::make_pair(path, Arrival())).first;
+    }
+
+    if (!stampOf(path, candidate->second.stamp)) {
+        arrivals_.erase(candidate);
+        return;
+    }
+    candidate->second.changed = std::chrono::steady_clock::now();
+}
+
+/**
+ * Forgets a file that left the spool directory, so that a new file of that name is converted
+ */
+void SpoolDaemon::removed(const std::string& name)
+{
+    arrivals_.erase(spoolDir_ + name);
+    converted_.erase(spoolDir_ + name);
+}
+
+/**
+ * Queues the candidates that have not changed for SETTLE_MILLIS and differ from what was converted
+ */
+void SpoolDaemon::queueSettled()
+{
+    std::chrono::steady_clock::time_point const now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds const settle(SETTLE_MILLIS);
+
+    for (std::map<std::string, Arrival>::iterator candidate = arrivals_.begin() ; candidate != arrivals_.end() ; ) {
+        Arrival& arrival = candidate->second;
+        if (now - arrival.changed < settle) {
+            ++candidate;
+            continue;
+        }
+
+        // Changes inotify does not report, e.g. on network file systems, are caught here
+        FileStamp stamp;
+        bool const present = stampOf(candidate->first, stamp);
+        if (present && !(stamp == arrival.stamp)) {
+            arrival.stamp = stamp;
+            arrival.changed = now;
+            ++candidate;
+            continue;
+        }
+
+        std::map<std::string, FileStamp>::iterator done = converted_.find(candidate->first);
+        if (present && (done == converted_.end() || !(done->second == stamp))) {
+            converted_[candidate->first] = stamp;
+
+            BatchJob job;
+            job.rawFile = candidate->first;
+            job.outputFile = outputFor(BatchConversion::outputStem(job.rawFile));
+            conversion_.submit(job, pool_);
+            queued_++;
+        }
+
+        arrivals_.erase(candidate++);
+    }
+}
+
+/**
+ * Output for a stem that neither exists nor was given to an earlier file
+ */
+std::string SpoolDaemon::outputFor(const std::string& stem)
+{
+    std::string output = outputDir_ + stem + ".h5";
+    for (unsigned int n = 2 ; exists(output) || outputs_.count(output) > 0 ; n++) {
+        std::ostringstream numbered;
+        numbered << outputDir_ << stem << "_" << n << ".h5";
+        output = numbered.str();
+    }
+
+    outputs_.insert(output);
+    return output;
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,111 @@
+/** @file SpoolDaemon.h */
+#ifndef SPOOL_DAEMON_H
+#define SPOOL_DAEMON_H
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+
+#include <sys/types.h>
+
+// Local
+#include "BatchConversion.h"
+#include "WorkStealingPool.h"
+
+namespace GEToIsmrmrd {
+
+/**
+ * Converts raw files as they arrive in a spool directory, until stopped.
+ *
+ * The directory is watched with inotify. A file is a candidate once it is
+ * closed after writing or moved into the directory, and is queued when its
+ * size and modification time have then not changed for SETTLE_MILLIS, so a
+ * writer that closes and reopens the file is not read half way. Each input is
+ * converted once; it is converted again only if it changes afterwards. Names
+ * starting with a dot, which rsync and similar tools use while copying, are
+ * ignored. Files already in the directory at start-up are candidates unless
+ * their output exists.
+ *
+ * Everything that makes a cold start slow stays loaded from one file to the
+ * next: the Orchestra libraries, libxml2 and libxslt, the compiled stylesheets
+ * and the threads of the pool.
+ */
+class SpoolDaemon
+{
+public:
+    /**
+     * @param spoolDir Directory the raw files arrive in
+     * @param outputDir Directory the outputs are written to, as <stem>.h5 or
+     *                  <stem>_2.h5, ... if that exists already
+     * @param conversion Converts the files; its reporter is told of each finished file
+     * @param pool Threads the files are converted on
+     */
+    SpoolDaemon(const std::string& spoolDir, const std::string& outputDir,
+                BatchConversion& conversion, WorkStealingPool& pool);
+
+    ~SpoolDaemon();
+
+    /**
+     * Watches the spool directory until requestStop(), then waits for the queued files
+     *
+     * @throws std::runtime_error if the directory cannot be watched
+     */
+    void run();
+
+    /** Makes run() return; may be called from a signal handler */
+    static void requestStop();
+
+    /** Time a candidate's size and modification time must stay unchanged before it is queued */
+    static const int SETTLE_MILLIS = 2000;
+
+    /** Files queued so far */
+    size_t queued() const { return queued_; }
+
+private:
+    // Non-copyable
+    SpoolDaemon(const SpoolDaemon& other);
+    SpoolDaemon& operator=(const SpoolDaemon& other);
+
+    /** What a file was when it was last looked at */
+    struct FileStamp
+    {
+        FileStamp() : inode(0), size(0), mtime(0), mtimeNanos(0) { }
+        bool operator==(const FileStamp& other) const;
+
+        ino_t inode;
+        off_t size;
+        time_t mtime;
+        long mtimeNanos;
+    };
+
+    /** A candidate waiting for its file to settle */
+    struct Arrival
+    {
+        FileStamp stamp;
+        std::chrono::steady_clock::time_point changed;
+    };
+
+    static bool stampOf(const std::string& path, FileStamp& stamp);
+
+    void queueExisting();
+    void arrived(const std::string& name, bool written);
+    void removed(const std::string& name);
+    void queueSettled();
+    std::string outputFor(const std::string& stem);
+
+    std::string spoolDir_;
+    std::string outputDir_;
+    BatchConversion& conversion_;
+    WorkStealingPool& pool_;
+
+    int inotify_;
+    size_t queued_;
+    std::set<std::string> outputs_;     // outputs named so far, which may not exist yet
+    std::map<std::string, Arrival> arrivals_;       // candidates by raw file
+    std::map<std::string, FileStamp> converted_;    // raw files queued, as they were when queued
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* SPOOL_DAEMON_H */
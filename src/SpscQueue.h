@@ -0,0 +1,85 @@
+/** @file SpscQueue.h */
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Bounded lock-free queue between exactly one producer and one consumer thread.
+ *
+ * The slots are allocated once and reused, so elements that own buffers (such as
+ * ISMRMRD acquisitions) keep their storage from one pass around the ring to the next.
+ * The producer fills the slot returned by pushSlot() and publishes it with
+ * commitPush(); the consumer reads the slot returned by frontSlot() and releases
+ * it with commitPop().
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(size_t capacity) : slots_(capacity + 1), head_(0), tail_(0) { }
+
+    /** Maximum number of queued elements */
+    size_t capacity() const { return slots_.size() - 1; }
+
+    /** Number of queued elements; only exact when called from either end while the other is idle */
+    size_t size() const
+    {
+        size_t const head = head_.load(std::memory_order_acquire);
+        size_t const tail = tail_.load(std::memory_order_acquire);
+        return (tail + slots_.size() - head) % slots_.size();
+    }
+
+    /** Producer: slot to fill next, or NULL if the queue is full */
+    T* pushSlot()
+    {
+        size_t const tail = tail_.load(std::memory_order_relaxed);
+        if (next(tail) == head_.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &slots_[tail];
+    }
+
+    /** Producer: publishes the slot returned by pushSlot() */
+    void commitPush()
+    {
+        tail_.store(next(tail_.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    /** Consumer: oldest queued element, or NULL if the queue is empty */
+    T* frontSlot()
+    {
+        size_t const head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &slots_[head];
+    }
+
+    /** Consumer: hands the slot returned by frontSlot() back to the producer */
+    void commitPop()
+    {
+        head_.store(next(head_.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+private:
+    // Non-copyable
+    SpscQueue(const SpscQueue& other);
+    SpscQueue& operator=(const SpscQueue& other);
+
+    size_t next(size_t index) const { return (index + 1) % slots_.size(); }
+
+    std::vector<T> slots_;
+
+    // Keep the consumer and producer indices on separate cache lines
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* SPSC_QUEUE_H */
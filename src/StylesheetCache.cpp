@@ -0,0 +1,86 @@
+/** @file StylesheetCache.cpp */
+#include <functional>
+#include <stdexcept>
+
+#include <libxml/parser.h>
+#include <libxslt/xslt.h>
+#include <libxslt/xsltInternals.h>
+
+#include "StylesheetCache.h"
+
+namespace GEToIsmrmrd {
+
+StylesheetCache& StylesheetCache::instance()
+{
+    static StylesheetCache cache;
+    return cache;
+}
+
+std::shared_ptr<xsltStylesheet> StylesheetCache::get(const std::string& sheet)
+{
+    size_t const key = std::hash<std::string>()(sheet);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::unordered_map<size_t, Entry>::iterator it = entries_.find(key);
+    if (it != entries_.end() && it->second.text == sheet) {
+        hits_++;
+        return it->second.sheet;
+    }
+
+    Entry entry;
+    entry.text = sheet;
+    entry.sheet = compile(sheet);
+
+    misses_++;
+    entries_[key] = entry;
+
+    return entry.sheet;
+}
+
+void StylesheetCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+size_t StylesheetCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t StylesheetCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+size_t StylesheetCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+std::shared_ptr<xsltStylesheet> StylesheetCache::compile(const std::string& sheet)
+{
+    // Substitute entities and load external DTDs through parser options
+    // rather than the process-wide xmlSubstituteEntitiesDefault() settings
+    // Normal pointer here because the xsltStylesheet takes ownership
+    xmlDocPtr stylesheet_doc = xmlReadMemory(sheet.c_str(), sheet.size(), NULL, NULL,
+                                             XML_PARSE_NOENT | XML_PARSE_DTDLOAD);
+    if (NULL == stylesheet_doc) {
+        throw std::runtime_error("Failed to parse stylesheet");
+    }
+
+    std::shared_ptr<xsltStylesheet> compiled = std::shared_ptr<xsltStylesheet>(
+            xsltParseStylesheetDoc(stylesheet_doc), xsltFreeStylesheet);
+    if (!compiled) {
+        xmlFreeDoc(stylesheet_doc);
+        throw std::runtime_error("Failed to parse stylesheet");
+    }
+
+    return compiled;
+}
+
+} // namespace GEToIsmrmrd
@@ -0,0 +1,74 @@
+/** @file StylesheetCache.h */
+#ifndef STYLESHEET_CACHE_H
+#define STYLESHEET_CACHE_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Libxslt forward declarations
+struct _xsltStylesheet;
+
+namespace GEToIsmrmrd {
+
+/**
+ * Process-wide cache of compiled XSLT stylesheets, keyed by a hash of their text.
+ *
+ * Converting many series with the same stylesheet only parses and compiles it
+ * once. Compiled stylesheets are not modified by xsltApplyStylesheet(), so one
+ * stylesheet can be applied by several threads and GERawConverter instances at
+ * the same time. The cache itself is guarded by a mutex.
+ */
+class StylesheetCache
+{
+public:
+    /** The cache shared by all converters in this process */
+    static StylesheetCache& instance();
+
+    /**
+     * Gets the compiled form of a stylesheet, compiling it on a miss.
+     *
+     * @param sheet Text of the stylesheet
+     * @returns Compiled stylesheet, which stays valid after clear()
+     * @throws std::runtime_error if the stylesheet cannot be parsed or compiled
+     */
+    std::shared_ptr<struct _xsltStylesheet> get(const std::string& sheet);
+
+    /** Drops all cached stylesheets */
+    void clear();
+
+    /** Number of get() calls served from the cache */
+    size_t hits() const;
+
+    /** Number of get() calls that had to compile the stylesheet */
+    size_t misses() const;
+
+    /** Number of cached stylesheets */
+    size_t size() const;
+
+private:
+    StylesheetCache() : hits_(0), misses_(0) { }
+
+    // Non-copyable
+    StylesheetCache(const StylesheetCache& other);
+    StylesheetCache& operator=(const StylesheetCache& other);
+
+    struct Entry
+    {
+        std::string text; // to tell hash collisions apart
+        std::shared_ptr<struct _xsltStylesheet> sheet;
+    };
+
+    static std::shared_ptr<struct _xsltStylesheet> compile(const std::string& sheet);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<size_t, Entry> entries_;
+    size_t hits_;
+    size_t misses_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* STYLESHEET_CACHE_H */
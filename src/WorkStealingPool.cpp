@@ -0,0 +1,161 @@
+/** @file WorkStealingPool.cpp */
+#include <algorithm>
+
+#include "WorkStealingPool.h"
+
+namespace GEToIsmrmrd {
+
+// The pool and queue the calling thread works for, if it is a worker
+static thread_local const WorkStealingPool* t_pool = NULL;
+static thread_local size_t t_queue = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned int numThreads)
+    : queued_(0)
+    , pending_(0)
+    , stopping_(false)
+    , nextQueue_(0)
+    , executed_(0)
+    , stolen_(0)
+{
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int n = 0 ; n < numThreads ; n++) {
+        queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (unsigned int n = 0 ; n < numThreads ; n++) {
+        threads_.push_back(std::thread(&WorkStealingPool::run, this, n));
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]() { return pending_ == 0; });
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    for (size_t n = 0 ; n < threads_.size() ; n++) {
+        threads_[n].join();
+    }
+}
+
+void WorkStealingPool::submit(const std::function<void()>& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_++;
+        pending_++;
+    }
+
+    if (t_pool == this) {
+        // Split work runs next on the thread that split it
+        Queue& queue = *queues_[t_queue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_front(task);
+    } else {
+        Queue& queue = *queues_[nextQueue_++ % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+
+    wake_.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return pending_ == 0; });
+
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+WorkStealingPool::Statistics WorkStealingPool::statistics() const
+{
+    Statistics stats;
+    stats.executed = executed_;
+    stats.stolen = stolen_;
+    return stats;
+}
+
+/**
+ * Takes the next task of a worker: the front of its own queue, else the back of another one
+ */
+bool WorkStealingPool::take(size_t index, std::function<void()>& task)
+{
+    {
+        Queue& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task.swap(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t offset = 1 ; offset < queues_.size() ; offset++) {
+        Queue& victim = *queues_[(index + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task.swap(victim.tasks.back());
+            victim.tasks.pop_back();
+            stolen_++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkStealingPool::run(size_t index)
+{
+    t_pool = this;
+    t_queue = index;
+
+    for (;;) {
+        std::function<void()> task;
+
+        if (!take(index, task)) {
+            // A task may be counted before it is in its queue, so look again once woken
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this]() { return queued_ > 0 || stopping_; });
+            if (stopping_ && queued_ == 0) {
+                return;
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_--;
+        }
+
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+        executed_++;
+
+        bool idle = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle = (--pending_ == 0);
+        }
+        if (idle) {
+            idle_.notify_all();
+        }
+    }
+}
+
+} // namespace GEToIsmrmrd
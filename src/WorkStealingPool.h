@@ -0,0 +1,97 @@
+/** @file WorkStealingPool.h */
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GEToIsmrmrd {
+
+/**
+ * Fixed set of worker threads running tasks from per-worker queues.
+ *
+ * A task submitted from a worker goes to the front of that worker's own queue,
+ * so the units of work a task splits into are run next by the same thread, on
+ * data that is still in its cache. Other tasks are spread over the queues in
+ * turn at the back of the queues, behind any split work. A worker whose queue
+ * is empty steals from the back of another queue, away from the split work its
+ * owner runs next: that end holds the tasks submitted from outside the pool,
+ * usually whole inputs, or else the earliest split units. So one long task
+ * never leaves the other threads idle while work is queued behind it.
+ */
+class WorkStealingPool
+{
+public:
+    struct Statistics
+    {
+        Statistics() : executed(0), stolen(0) { }
+
+        size_t executed;    ///< tasks run
+        size_t stolen;      ///< tasks run by a worker other than the one they were queued on
+    };
+
+    /**
+     * @param numThreads Worker threads; 0 uses one per core
+     */
+    explicit WorkStealingPool(unsigned int numThreads);
+
+    /** Runs the tasks still queued and stops the workers */
+    ~WorkStealingPool();
+
+    /** Queues a task; may be called from tasks */
+    void submit(const std::function<void()>& task);
+
+    /**
+     * Waits until every submitted task, including the ones they submit, has run
+     *
+     * Must not be called from a task.
+     *
+     * @throws the first exception thrown by a task since the last wait()
+     */
+    void wait();
+
+    /** Number of worker threads */
+    size_t size() const { return threads_.size(); }
+
+    Statistics statistics() const;
+
+private:
+    // Non-copyable
+    WorkStealingPool(const WorkStealingPool& other);
+    WorkStealingPool& operator=(const WorkStealingPool& other);
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void run(size_t index);
+    bool take(size_t index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue> > queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;                  // guards the counts below and the condition variables
+    std::condition_variable wake_;      // signalled when a task is queued or the pool stops
+    std::condition_variable idle_;      // signalled when the last pending task has run
+    size_t queued_;                     // tasks in the queues
+    size_t pending_;                    // tasks queued or running
+    bool stopping_;
+    std::exception_ptr error_;
+
+    std::atomic<size_t> nextQueue_;
+    std::atomic<size_t> executed_;
+    std::atomic<size_t> stolen_;
+};
+
+} // namespace GEToIsmrmrd
+
+#endif /* WORK_STEALING_POOL_H */
@@ -11,14 +11,31 @@ extern "C" {
 
 class XMLWriter {
 public:
-    XMLWriter() {
+    /**
+     * @param toDocument build an xmlDoc tree (see takeDocument()) instead of
+     *                   serialized text (see getXML())
+     */
+    XMLWriter(bool toDocument = false) {
         int rc = 0;
         xmlTextWriterPtr writer;
-        xmlBufferPtr buf;
+        xmlBufferPtr buf = NULL;
+        xmlDocPtr doc = NULL;
 
         /* initialize libxml and check for a version mismatch */
         LIBXML_TEST_VERSION;
 
+        if (toDocument) {
+            /* create new XmlWriter building a document tree, which the caller then owns */
+            writer = xmlNewTextWriterDoc(&doc, 0);
+            if (writer == NULL) {
+                throw std::runtime_error("Error creating the xml writer");
+            }
+            doc_ = doc;
+            writer_ = writer;
+            buffer_ = buf;
+            return;
+        }
+
         /* create the XML buffer, to which the XML doc will be written */
         buf = xmlBufferCreate();
         if (buf == NULL) {
@@ -28,6 +45,7 @@ public:
         /* create new XmlWriter with no compression */
         writer = xmlNewTextWriterMemory(buf, 0);
         if (writer == NULL) {
+            xmlBufferFree(buf);
             throw std::runtime_error("Error creating the xml writer");
         }
 
@@ -43,12 +61,21 @@ public:
 
         writer_ = writer;
         buffer_ = buf;
+        doc_ = doc;
     }
 
+    /* xmlCleanupParser() is not called here: libxml2 is still in use by
+     * other writers, threads and the cached compiled stylesheets */
     ~XMLWriter() {
-        xmlFreeTextWriter(writer_);
-        xmlBufferFree(buffer_);
-        xmlCleanupParser();
+        if (writer_ != NULL) {
+            xmlFreeTextWriter(writer_);
+        }
+        if (buffer_ != NULL) {
+            xmlBufferFree(buffer_);
+        }
+        if (doc_ != NULL) {
+            xmlFreeDoc(doc_);
+        }
     }
 
     void startDocument() {
@@ -94,15 +121,32 @@ public:
     }
 
     std::string getXML() {
+        if (buffer_ == NULL) {
+            throw std::runtime_error("XML writer builds a document, not text");
+        }
         return std::string((char *) xmlBufferContent(buffer_));
     }
 
+    /* Hands the finished document over to the caller, who must xmlFreeDoc() it.
+     * The writer is closed first, as that completes the document; nothing can be
+     * written afterwards */
+    xmlDocPtr takeDocument() {
+        if (writer_ != NULL) {
+            xmlFreeTextWriter(writer_);
+            writer_ = NULL;
+        }
+        xmlDocPtr doc = doc_;
+        doc_ = NULL;
+        return doc;
+    }
+
     //xmlTextWriterPtr getWriter(void) { return writer_; }
     //xmlBufferPtr getBuffer(void) { return buffer_; }
 
 private:
     xmlTextWriterPtr writer_;
     xmlBufferPtr buffer_;
+    xmlDocPtr doc_;
 };
 
 #endif  // XMLWriter_h
@@ -1,5 +1,14 @@
 
+#include <algorithm>
+#include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <thread>
 
 // Boost
 #include <boost/program_options.hpp>
@@ -11,17 +20,146 @@
 
 // GE
 #include "GERawConverter.h"
+#include "DatasetSink.h"
+#include "PipelineSink.h"
+#include "BatchedDatasetSink.h"
+#include "ChecksumSink.h"
+#include "BatchConversion.h"
+#include "SpoolDaemon.h"
+#include "GadgetronSink.h"
+#include "ShmRing.h"
+#include "StylesheetCache.h"
 #include "ge_tools_path.h"
 
 namespace po = boost::program_options;
 
+static void stopDaemon(int)
+{
+   GEToIsmrmrd::SpoolDaemon::requestStop();
+}
+
+/**
+ * Converts a raw file on several threads at once, each with its own GERawConverter
+ *
+ * Every conversion must succeed and give the same header and acquisitions, so
+ * converters running concurrently in one process must not disturb each other.
+ *
+ * @param count Number of concurrent conversions
+ * @param open Creates and configures a converter for the raw file
+ * @param range Part of the scan each conversion converts
+ * @returns true if all conversions succeeded with the same output
+ */
+static bool runConcurrentConversions(unsigned int count,
+                                     const std::function<std::shared_ptr<GEToIsmrmrd::GERawConverter>()>& open,
+                                     const GEToIsmrmrd::ConversionRange& range)
+{
+   struct Result
+   {
+      Result() : checksum(0), acquisitions(0) { }
+      uint64_t checksum;
+      size_t acquisitions;
+      std::string error;
+   };
+
+   std::vector<Result> results(count);
+   std::vector<std::thread> threads;
+
+   auto start = std::chrono::steady_clock::now();
+   for (unsigned int n = 0 ; n < count ; n++) {
+      threads.push_back(std::thread([&open, &range, &results, n]() {
+         try {
+            std::shared_ptr<GEToIsmrmrd::GERawConverter> converter = open();
+            GEToIsmrmrd::ChecksumSink sink;
+            sink.add(converter->getIsmrmrdXMLHeader(range));
+            converter->convertAcquisitions(range, sink);
+            results[n].checksum = sink.checksum();
+            results[n].acquisitions = sink.count();
+         } catch (const std::exception& e) {
+            results[n].error = e.what();
+         }
+      }));
+   }
+   for (size_t n = 0 ; n < threads.size() ; n++) {
+      threads[n].join();
+   }
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   bool ok = true;
+   const Result* reference = NULL;
+   for (unsigned int n = 0 ; n < count ; n++) {
+      if (!results[n].error.empty()) {
+         std::cerr << "Conversion " << n << " failed: " << results[n].error << std::endl;
+         ok = false;
+      } else if (!reference) {
+         reference = &results[n];
+      } else if (results[n].checksum != reference->checksum || results[n].acquisitions != reference->acquisitions) {
+         std::cerr << "Conversion " << n << " differs from the others" << std::endl;
+         ok = false;
+      }
+   }
+
+   std::cout << count << " concurrent conversions in " << elapsed.count() << " s";
+   if (reference) {
+      std::cout << ", " << reference->acquisitions << " acquisitions, checksum "
+                << std::hex << reference->checksum << std::dec;
+   }
+   std::cout << (ok ? ", all identical" : ", FAILED") << std::endl;
+
+   return ok;
+}
+
+/**
+ * Appends an image a Gadgetron sent back to a dataset, as image_<series index>
+ * like the Gadgetron ISMRMRD client stores them
+ */
+template <typename T>
+static void appendImage(ISMRMRD::Dataset& dataset, const GEToIsmrmrd::GadgetronImage& returned)
+{
+   ISMRMRD::ImageHeader head;
+   memcpy(static_cast<ISMRMRD::ISMRMRD_ImageHeader*>(&head), &returned.head, sizeof(returned.head));
+
+   ISMRMRD::Image<T> image;
+   image.setHead(head);
+   image.setAttributeString(returned.attributes);
+   memcpy(image.getDataPtr(), returned.data.data(), std::min(image.getDataSize(), returned.data.size()));
+
+   dataset.appendImage("image_" + std::to_string(head.image_series_index), image);
+}
+
+/**
+ * Writes the images a Gadgetron sent back to an ISMRMRD file
+ */
+static void writeReturnedImages(const std::string& path, const std::vector<GEToIsmrmrd::GadgetronImage>& images)
+{
+   ISMRMRD::Dataset dataset(path.c_str(), "dataset", true);
+   for (const GEToIsmrmrd::GadgetronImage& image : images) {
+      switch (image.head.data_type) {
+         case ISMRMRD::ISMRMRD_USHORT:   appendImage<uint16_t>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_SHORT:    appendImage<int16_t>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_UINT:     appendImage<uint32_t>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_INT:      appendImage<int32_t>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_FLOAT:    appendImage<float>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_DOUBLE:   appendImage<double>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_CXFLOAT:  appendImage<complex_float_t>(dataset, image); break;
+         case ISMRMRD::ISMRMRD_CXDOUBLE: appendImage<complex_double_t>(dataset, image); break;
+      }
+   }
+}
+
 int main (int argc, char *argv[])
 {
-   std::string classname, stylesheet, rawFile, outfile;
+   std::string classname, stylesheet, rawFile, outfile, headerPath, probeFormat;
+   std::string sliceList, echoList, volumeList, channelList;
+   std::string libraryPath, configFile, manifest, outputDir, watchDir;
+   std::string gadgetronAddress, gadgetronConfig, gadgetronImages, shmName, sampleFormatName;
+   std::vector<std::string> rawFiles;
+   unsigned int numThreads, pfileReaders, queueWait, compareHeader, stressCount, poolThreads, oversampling;
+   GEToIsmrmrd::FollowOptions followOptions;
+   size_t queueDepth, batchSize, chunkKB, shmMB;
 
    std::string thisProgram = argv[0];
    std::string validInputs = "input P- or ScanArchive File";
-   std::string usage = thisProgram + " [options] <" + validInputs + ">";
+   std::string usage = thisProgram + " [options] <" + validInputs + ">...";
    std::string stylesheet_default = get_ge_tools_home() + "share/ge-tools/config/default.xsl";
    std::string sequence_class_default = "GenericConverter";
 
@@ -30,24 +168,89 @@ int main (int argc, char *argv[])
       ("help,h", "print help message")
       ("verbose,v", "enable verbose mode")
       ("plugin,p", po::value<std::string>(&classname)->default_value(sequence_class_default), "class/sequence name in library used for conversion")
+      ("library,l", po::value<std::string>(&libraryPath), "plugin library exporting the class (default: built-in classes)")
+      ("config,c", po::value<std::string>(&configFile), "conversion configuration mapping pulse sequences to plugins and stylesheets")
       ("stylesheet,x", po::value<std::string>(&stylesheet)->default_value(stylesheet_default), "XSL stylesheet file mapping values provided by Orchestra to those needed by ISMRMRD")
       ("output,o", po::value<std::string>(&outfile)->default_value("converted_data.h5"), "output HDF5 file")
       ("string,s", "only print the HDF5 XML header")
+      ("threads,t", po::value<unsigned int>(&numThreads)->default_value(1), "number of conversion threads (0 = one per core)")
+      ("pfile-readers", po::value<unsigned int>(&pfileReaders)->default_value(2), "P-file k-space reads at once; each reader beyond the first holds its own copy of the P-file")
+      ("packet-index", "reuse or save the ScanArchive packet index in a sidecar file (<input>.packets)")
+      ("stress", po::value<unsigned int>(&stressCount)->default_value(0), "run N conversions of the input concurrently in one process, check that they give the same output, then exit")
+      ;
+
+   po::options_description pipeline("Pipeline Options");
+   pipeline.add_options()
+      ("queue-depth,q", po::value<size_t>(&queueDepth)->default_value(256), "acquisitions queued between conversion and HDF5 writing (0 = write on the conversion thread)")
+      ("queue-wait", po::value<unsigned int>(&queueWait)->default_value(50), "microseconds a stalled conversion or writer thread sleeps between retries (0 = only yield)")
+      ("batch-size,b", po::value<size_t>(&batchSize)->default_value(0), "acquisitions written to HDF5 per extend/write (0 = one ISMRMRD append per acquisition)")
+      ("chunk-kb", po::value<size_t>(&chunkKB)->default_value(1024), "approximate sample data per HDF5 chunk in batched mode, rounded to whole readouts")
+      ("sample-format", po::value<std::string>(&sampleFormatName)->default_value("float"), "how HDF5 and shared memory outputs store samples: float, int16, int32 or native (the scanner's width); integers are checked to be lossless")
+      ("remove-oversampling", po::value<unsigned int>(&oversampling)->default_value(1)->implicit_value(2), "remove this readout oversampling from the acquisitions and the header (2 when given without a value, 1 = keep every sample; not for EPI)")
+      ;
+
+   po::options_description header("Header Options");
+   header.add_options()
+      ("header-path", po::value<std::string>(&headerPath)->default_value("auto"), "how the ISMRMRD header is built: auto, native (built-in stylesheets only) or xslt")
+      ("compare-header", po::value<unsigned int>(&compareHeader)->default_value(0), "build the header N times natively and with XSLT, report timings and whether they match, then exit")
+      ;
+
+   po::options_description probe("Probe Options");
+   probe.add_options()
+      ("probe", "only read the ISMRMRD header of each input file, without loading raw data, and report the time taken")
+      ("format", po::value<std::string>(&probeFormat)->default_value("xml"), "probe output: xml, or json with one object per file and line")
+      ;
+
+   po::options_description selection("Range Options");
+   selection.add_options()
+      ("slices", po::value<std::string>(&sliceList), "convert only these slices, e.g. 0-3,7 (default all)")
+      ("echoes", po::value<std::string>(&echoList), "convert only these echoes (default all)")
+      ("volumes", po::value<std::string>(&volumeList), "convert only these volumes / repetitions (default all)")
+      ("channels", po::value<std::string>(&channelList), "keep only these receiver channels (default all)")
+      ;
+
+   po::options_description batch("Batch Options");
+   batch.add_options()
+      ("manifest,m", po::value<std::string>(&manifest), "file listing raw files to convert, one per line, each optionally followed by its output file")
+      ("output-dir,d", po::value<std::string>(&outputDir)->default_value("."), "directory of the outputs of a batch, named after their input (<stem>.h5)")
+      ("pool-threads", po::value<unsigned int>(&poolThreads)->default_value(0), "worker threads shared by the files of a batch and their slices (0 = one per core)")
+      ("watch,w", po::value<std::string>(&watchDir), "stay resident and convert raw files as they arrive in this directory, until interrupted")
+      ;
+
+   po::options_description gadgetron("Gadgetron Options");
+   gadgetron.add_options()
+      ("gadgetron,g", po::value<std::string>(&gadgetronAddress), "stream the header and acquisitions to a Gadgetron at host:port instead of writing HDF5")
+      ("gadgetron-config", po::value<std::string>(&gadgetronConfig), "Gadgetron configuration to run (default: the recon config the sequence is mapped to with -c)")
+      ("gadgetron-images", po::value<std::string>(&gadgetronImages), "write the images the Gadgetron sends back to this ISMRMRD file")
+      ;
+
+   po::options_description shm("Shared Memory Options");
+   shm.add_options()
+      ("shm", po::value<std::string>(&shmName), "publish the header and acquisitions in a POSIX shared memory ring of this name (e.g. /ge2ismrmrd) instead of writing HDF5")
+      ("shm-mb", po::value<size_t>(&shmMB)->default_value(256), "data area of the shared memory ring, in MiB")
+      ;
+
+   po::options_description follow("Follow Options");
+   follow.add_options()
+      ("follow,f", "convert an EPI ScanArchive while it is written, emitting each volume as soon as its last slice arrives")
+      ("poll-ms", po::value<unsigned int>(&followOptions.pollMillis)->default_value(100), "milliseconds between looks at the archive in follow mode")
+      ("idle-s", po::value<unsigned int>(&followOptions.idleSeconds)->default_value(30), "stop following once the archive has not grown for this many seconds")
+      ("follow-volumes", po::value<unsigned int>(&followOptions.volumes)->default_value(0), "stop following once this many volumes were emitted (0 = when idle)")
       ;
 
    po::options_description input("Input Options");
    input.add_options()
-      ("input,i", po::value<std::string>(&rawFile), validInputs.c_str())
+      ("input,i", po::value<std::vector<std::string> >(&rawFiles), validInputs.c_str())
       ;
 
    po::options_description all_options("Options");
-   all_options.add(basic).add(input);
+   all_options.add(basic).add(pipeline).add(header).add(probe).add(selection).add(batch).add(gadgetron).add(shm).add(follow).add(input);
 
    po::options_description visible_options("Options");
-   visible_options.add(basic);
+   visible_options.add(basic).add(pipeline).add(header).add(probe).add(selection).add(batch).add(gadgetron).add(shm).add(follow);
 
    po::positional_options_description positionals;
-   positionals.add("input", 1);
+   positionals.add("input", -1);
 
    po::variables_map vm;
    try {
@@ -66,27 +269,259 @@ int main (int argc, char *argv[])
       return EXIT_SUCCESS;
    }
 
-   if (rawFile.size() == 0) {
+   // several inputs or a manifest are converted as a batch, each to its own output
+   bool const batchMode = !vm.count("probe") && (rawFiles.size() > 1 || vm.count("manifest"));
+   if (rawFiles.empty() && !batchMode && !vm.count("watch")) {
       std::cerr << usage << std::endl;
       return EXIT_FAILURE;
    }
+   if (!rawFiles.empty()) {
+      rawFile = rawFiles[0];
+   }
+   if (vm.count("follow") && (batchMode || vm.count("watch") || vm.count("probe"))) {
+      std::cerr << "ERROR: --follow converts a single ScanArchive" << std::endl;
+      return EXIT_FAILURE;
+   }
 
    bool verbose = false;
    if (vm.count("verbose")) {
        verbose = true;
    }
 
+   GEToIsmrmrd::ConversionOptions options;
+   options.numThreads = numThreads;
+   options.pfileReaders = pfileReaders;
+   options.packetIndexSidecar = (vm.count("packet-index") > 0);
+   options.readoutOversampling = oversampling;
+   if (vm.count("follow")) {
+      // The archive is still being written, so only the expected count gives the header its final volumes
+      options.headerVolumes = followOptions.volumes;
+   }
+   if (headerPath == "auto") {
+      options.headerPath = GEToIsmrmrd::HEADER_PATH_AUTO;
+   } else if (headerPath == "native") {
+      options.headerPath = GEToIsmrmrd::HEADER_PATH_NATIVE;
+   } else if (headerPath == "xslt") {
+      options.headerPath = GEToIsmrmrd::HEADER_PATH_XSLT;
+   } else {
+      std::cerr << "ERROR: unknown header path '" << headerPath << "'" << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   // samples stored as integers are written by the batched writer, which HDF5 converts back to floats on reading
+   GEToIsmrmrd::SampleFormat sampleFormat;
+   try {
+      sampleFormat = GEToIsmrmrd::parseSampleFormat(sampleFormatName);
+   } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (sampleFormat != GEToIsmrmrd::SAMPLE_FORMAT_FLOAT && vm.count("gadgetron")) {
+      std::cerr << "ERROR: the Gadgetron protocol only carries float samples" << std::endl;
+      return EXIT_FAILURE;
+   }
+   if (sampleFormat != GEToIsmrmrd::SAMPLE_FORMAT_FLOAT && oversampling > 1) {
+      std::cerr << "ERROR: samples with their oversampling removed are no longer integers" << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   // slices, echoes, volumes and channels to convert; an option that is not given selects all
+   GEToIsmrmrd::ConversionRange range;
+   try {
+      if (vm.count("slices")) {
+         range.slices = GEToIsmrmrd::ConversionRange::parseList(sliceList);
+      }
+      if (vm.count("echoes")) {
+         range.echoes = GEToIsmrmrd::ConversionRange::parseList(echoList);
+      }
+      if (vm.count("volumes")) {
+         range.volumes = GEToIsmrmrd::ConversionRange::parseList(volumeList);
+      }
+      if (vm.count("channels")) {
+         range.channels = GEToIsmrmrd::ConversionRange::parseList(channelList);
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   // if the user requested only the headers, open each file without its raw data
+   if (vm.count("probe")) {
+      bool const json = (probeFormat == "json");
+      if (!json && probeFormat != "xml") {
+         std::cerr << "ERROR: unknown probe format '" << probeFormat << "'" << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      std::ifstream stream(stylesheet.c_str(), std::ios::binary);
+      if (!stream) {
+         std::cerr << "Failed to read stylesheet: " << stylesheet << std::endl;
+         return EXIT_FAILURE;
+      }
+      std::string const sheet((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+      int status = EXIT_SUCCESS;
+      for (size_t n = 0 ; n < rawFiles.size() ; n++) {
+         auto start = std::chrono::steady_clock::now();
+         try {
+            GEToIsmrmrd::ProbeResult result = GEToIsmrmrd::GERawConverter::probe(rawFiles[n], sheet, options, verbose);
+            if (json) {
+               std::cout << GEToIsmrmrd::probeResultToJson(result) << std::endl;
+            } else {
+               std::cout << result.header << std::endl;
+               std::cerr << std::fixed << std::setprecision(3) << rawFiles[n] << ": opened in " << result.openMillis
+                         << " ms, header in " << result.headerMillis << " ms" << std::endl;
+            }
+         } catch (const std::exception& e) {
+            double const elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (json) {
+               std::cout << GEToIsmrmrd::probeErrorToJson(rawFiles[n], e.what(), elapsed) << std::endl;
+            } else {
+               std::cerr << "Failed to probe " << rawFiles[n] << ": " << e.what() << std::endl;
+            }
+            status = EXIT_FAILURE;
+         }
+      }
+      return status;
+   }
+
+   // Opens a raw file with the plugin, configuration and stylesheet given, for the stress and batch modes
+   auto openConverter = [&](const std::string& path) {
+      std::shared_ptr<GEToIsmrmrd::GERawConverter> c =
+         std::make_shared<GEToIsmrmrd::GERawConverter>(path, classname, libraryPath, false);
+      c->setOptions(options);
+      if (vm.count("config") && c->useConfigFilename(configFile) && !vm["plugin"].defaulted()) {
+         c->usePlugin(classname, libraryPath);
+      }
+      if (stylesheet.size() > 0 && (!c->hasStylesheet() || !vm["stylesheet"].defaulted())) {
+         c->useStylesheetFilename(stylesheet);
+      }
+      return c;
+   };
+
+   // if the user requested a daemon, convert files as they arrive until interrupted
+   if (vm.count("watch")) {
+      GEToIsmrmrd::WorkStealingPool pool(poolThreads);
+      GEToIsmrmrd::BatchConversion conversion(openConverter, range, batchSize, chunkKB * 1024, sampleFormat);
+      conversion.setReporter([&conversion, verbose](const GEToIsmrmrd::BatchFileResult& result) {
+         if (!result.error.empty()) {
+            std::cerr << "Failed to convert " << result.rawFile << ": " << result.error << std::endl;
+            return;
+         }
+         std::cout << result.rawFile << " -> " << result.outputFile << ": " << result.acquisitions << " acquisitions, latency "
+                   << result.waitSeconds + result.seconds << " s (queued " << result.waitSeconds << " s), queue depth "
+                   << conversion.inFlight() << std::endl;
+      });
+
+      GEToIsmrmrd::SpoolDaemon daemon(watchDir, outputDir, conversion, pool);
+      signal(SIGINT, stopDaemon);
+      signal(SIGTERM, stopDaemon);
+
+      std::cout << "Watching " << watchDir << " on " << pool.size() << " threads" << std::endl;
+      try {
+         daemon.run();
+      } catch (const std::exception& e) {
+         std::cerr << "ERROR: " << e.what() << std::endl;
+         pool.wait();
+         return EXIT_FAILURE;
+      }
+
+      GEToIsmrmrd::BatchSummary summary = conversion.totals();
+      std::cout << "Stopped after converting " << summary.files - summary.failed << " of " << summary.files
+                << " files, " << summary.acquisitions << " acquisitions" << std::endl;
+      if (verbose) {
+         GEToIsmrmrd::StylesheetCache& cache = GEToIsmrmrd::StylesheetCache::instance();
+         std::cout << "Stylesheet cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << std::endl;
+      }
+      return EXIT_SUCCESS;
+   }
+
+   // if the user requested a batch, convert every file on one shared pool of threads
+   if (batchMode) {
+      std::vector<GEToIsmrmrd::BatchJob> jobs;
+      try {
+         if (vm.count("manifest")) {
+            jobs = GEToIsmrmrd::BatchConversion::readManifest(manifest);
+         }
+      } catch (const std::exception& e) {
+         std::cerr << "ERROR: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+      for (size_t n = 0 ; n < rawFiles.size() ; n++) {
+         GEToIsmrmrd::BatchJob job;
+         job.rawFile = rawFiles[n];
+         jobs.push_back(job);
+      }
+      GEToIsmrmrd::BatchConversion::nameOutputs(jobs, outputDir);
+
+      GEToIsmrmrd::WorkStealingPool pool(poolThreads);
+      GEToIsmrmrd::BatchConversion conversion(openConverter, range, batchSize, chunkKB * 1024, sampleFormat);
+      GEToIsmrmrd::BatchSummary summary = conversion.run(jobs, pool, [verbose](const GEToIsmrmrd::BatchFileResult& result) {
+         if (!result.error.empty()) {
+            std::cerr << "Failed to convert " << result.rawFile << ": " << result.error << std::endl;
+         } else if (verbose) {
+            std::cout << result.rawFile << " -> " << result.outputFile << ": " << result.acquisitions
+                      << " acquisitions in " << result.seconds << " s (" << result.units << " tasks)" << std::endl;
+         }
+      });
+
+      std::cout << "Converted " << summary.files - summary.failed << " of " << summary.files << " files, "
+                << summary.acquisitions << " acquisitions, in " << summary.seconds << " s on "
+                << pool.size() << " threads" << std::endl;
+      if (summary.seconds > 0) {
+         std::cout << "Throughput " << summary.files / summary.seconds << " files/s, "
+                   << summary.rawBytes / summary.seconds / 1e9 << " GB/s read, "
+                   << summary.sampleBytes / summary.seconds / 1e9 << " GB/s of samples written" << std::endl;
+      }
+      if (verbose) {
+         std::cout << "Pool ran " << summary.pool.executed << " tasks, " << summary.pool.stolen << " stolen" << std::endl;
+      }
+
+      return (summary.failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   // if the user requested concurrent conversions, each one opens the input on its own
+   if (stressCount > 0) {
+      return runConcurrentConversions(stressCount, std::bind(openConverter, rawFile), range) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
    // Create a new Converter and give it a plugin configuration
    std::shared_ptr<GEToIsmrmrd::GERawConverter> converter;
    try {
-      converter = std::make_shared<GEToIsmrmrd::GERawConverter>(rawFile, classname, verbose);
+      converter = std::make_shared<GEToIsmrmrd::GERawConverter>(rawFile, classname, libraryPath, verbose);
    } catch (const std::exception& e) {
       std::cerr << "Failed to instantiate converter: " << e.what() << std::endl;
       return EXIT_FAILURE;
    }
 
+   try {
+      converter->setOptions(options);
+   } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   // Route the pulse sequence to its own plugin and stylesheet, unless they were given explicitly
+   bool mapped = false;
+   if (vm.count("config")) {
+      try {
+         mapped = converter->useConfigFilename(configFile);
+         if (mapped && !vm["plugin"].defaulted()) {
+            converter->usePlugin(classname, libraryPath);
+         }
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to apply conversion configuration: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      if (verbose && mapped) {
+         std::cout << "Sequence " << converter->getPsdName() << " mapped, recon config "
+                   << converter->getReconConfigName() << std::endl;
+      }
+   }
+
    // Override stylesheet if specified
-   if (stylesheet.size() > 0) {
+   if (stylesheet.size() > 0 && (!converter->hasStylesheet() || !vm["stylesheet"].defaulted())) {
       try {
          converter->useStylesheetFilename(stylesheet);
       } catch (const std::exception& e) {
@@ -95,15 +530,38 @@ int main (int argc, char *argv[])
       }
    }
 
+   // if the user requested only a comparison of the header paths:
+   if (compareHeader > 0) {
+      try {
+         return converter->compareHeaderPaths(compareHeader, std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to compare header paths: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+   }
+
+   // the sample format is settled once the plugin is, before the header or any output is made
+   try {
+      sampleFormat = converter->resolveSampleFormat(sampleFormat);
+   } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
    // Get the ISMRMRD Header String
    std::string xml_header;
    try {
-      xml_header = converter->getIsmrmrdXMLHeader();
+      xml_header = converter->getIsmrmrdXMLHeader(range);
    } catch (const std::exception& e) {
       std::cerr << "Failed to get header string: " << e.what() << std::endl;
       return EXIT_FAILURE;
    }
 
+   if (verbose) {
+      GEToIsmrmrd::StylesheetCache& cache = GEToIsmrmrd::StylesheetCache::instance();
+      std::cout << "Stylesheet cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << std::endl;
+   }
+
    if (xml_header.size() == 0) {
       std::cerr << "Empty ISMRMRD XML header... Exiting" << std::endl;
       return EXIT_FAILURE;
@@ -115,19 +573,200 @@ int main (int argc, char *argv[])
       return EXIT_SUCCESS;
    }
 
+   // in follow mode the archive is converted as it grows, and each volume is flushed to the output once complete
+   bool const following = (vm.count("follow") > 0);
+   auto followInto = [&](GEToIsmrmrd::AcquisitionSink& target, const std::function<void()>& flush) {
+      GEToIsmrmrd::FollowStatistics stats = converter->followAcquisitions(range, target, followOptions,
+                                                                          [&flush](unsigned int) { flush(); });
+
+      std::cout << "Followed " << rawFile << ": " << stats.volumes << " volumes from " << stats.packets << " packets";
+      if (stats.incompleteVolumes > 0) {
+         std::cout << ", " << stats.incompleteVolumes << " volumes incomplete";
+      }
+      std::cout << std::endl;
+      if (followOptions.volumes == 0) {
+         std::cout << "The header's volume count is provisional: it counts the volumes written when following started;"
+                   << " give --follow-volumes for the final count" << std::endl;
+      }
+      if (!stats.latencies.empty()) {
+         std::cout << "Volume latency p50 " << stats.latencyPercentile(50) << " s, p90 " << stats.latencyPercentile(90)
+                   << " s, p99 " << stats.latencyPercentile(99) << " s, max " << stats.latencyPercentile(100) << " s" << std::endl;
+      }
+      if (verbose) {
+         std::cout << "Polled " << stats.polls << " times, reopened the archive " << stats.reopens << " times ("
+                   << stats.failedReopens << " failed and retried)" << std::endl;
+      }
+   };
+
+   // if the user requested a Gadgetron, stream the conversion to it instead of writing a file
+   if (vm.count("gadgetron")) {
+      std::string const config = gadgetronConfig.empty() ? converter->getReconConfigName() : gadgetronConfig;
+      if (config.empty()) {
+         std::cerr << "ERROR: no Gadgetron configuration; give --gadgetron-config or map the sequence with -c" << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      try {
+         std::string host;
+         unsigned short port;
+         GEToIsmrmrd::GadgetronSink::parseAddress(gadgetronAddress, host, port);
+
+         auto start = std::chrono::steady_clock::now();
+         GEToIsmrmrd::GadgetronSink stream(host, port);
+         stream.sendConfigName(config);
+         stream.sendHeader(xml_header);
+
+         if (following) {
+            followInto(stream, [&stream]() { stream.flush(); });
+         } else if (queueDepth > 0) {
+            // send on a separate thread, so that sends overlap with decoding
+            GEToIsmrmrd::PipelineSink pipe(stream, queueDepth, queueWait);
+            converter->convertAcquisitions(range, pipe);
+            pipe.finish();
+         } else {
+            converter->convertAcquisitions(range, stream);
+         }
+         stream.flush();
+         std::chrono::duration<double> sent = std::chrono::steady_clock::now() - start;
+
+         stream.close();
+         std::chrono::duration<double> finished = std::chrono::steady_clock::now() - start;
+
+         std::cout << "Streamed " << stream.count() << " acquisitions to " << gadgetronAddress
+                   << " running " << config << std::endl;
+         for (const std::string& text : stream.texts()) {
+            std::cout << "Gadgetron: " << text << std::endl;
+         }
+         if (!gadgetronImages.empty()) {
+            writeReturnedImages(gadgetronImages, stream.images());
+            std::cout << "Wrote " << stream.images().size() << " returned images to " << gadgetronImages << std::endl;
+         } else if (!stream.images().empty()) {
+            std::cout << "Gadgetron sent back " << stream.images().size()
+                      << " images; give --gadgetron-images to keep them" << std::endl;
+         }
+         if (verbose) {
+            std::cout << "Sent " << stream.bytesSent() / (1024.0 * 1024.0) << " MiB in " << sent.count()
+                      << " s; Gadgetron finished after " << finished.count() << " s and sent back "
+                      << stream.bytesReceived() << " bytes:";
+            for (const auto& message : stream.messagesReceived()) {
+               std::cout << " " << message.second << " of message " << message.first;
+            }
+            std::cout << std::endl;
+         }
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to stream to Gadgetron: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      return EXIT_SUCCESS;
+   }
+
+   // if the user requested a shared memory ring, publish the conversion there for a reader on this host
+   if (vm.count("shm")) {
+      try {
+         auto start = std::chrono::steady_clock::now();
+         GEToIsmrmrd::ShmRingWriter ring(shmName, shmMB * 1024 * 1024, queueWait, sampleFormat);
+         ring.writeHeader(xml_header);
+         if (following) {
+            // every acquisition is visible to the reader as soon as it is published
+            followInto(ring, []() { });
+         } else {
+            converter->convertAcquisitions(range, ring);
+         }
+         ring.finish();
+         std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+         GEToIsmrmrd::ShmRingWriter::Statistics stats = ring.statistics();
+         std::cout << "Published " << stats.records - 2 << " acquisitions in shared memory ring " << shmName << std::endl;
+         if (verbose) {
+            std::cout << "Used " << stats.bytes / (1024.0 * 1024.0) << " MiB of ring in " << elapsed.count()
+                      << " s; stalled " << stats.stalls << " times on a full ring (" << stats.stallSeconds << " s)" << std::endl;
+         }
+      } catch (const std::exception& e) {
+         std::cerr << "Failed to publish to shared memory: " << e.what() << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      return EXIT_SUCCESS;
+   }
+
    // create hdf5 file
-   ISMRMRD::Dataset d(outfile.c_str(), "dataset", true);
+   std::shared_ptr<ISMRMRD::Dataset> d = std::make_shared<ISMRMRD::Dataset>(outfile.c_str(), "dataset", true);
 
    // write the ISMRMRD header to the dataset
-   d.writeHeader(xml_header);
+   d->writeHeader(xml_header);
+
+   // stream the acquisitions in this raw file into the hdf5 dataset as they are decoded
+   std::shared_ptr<GEToIsmrmrd::DatasetSink> datasetSink;
+   std::shared_ptr<GEToIsmrmrd::BatchedDatasetSink> batchedSink;
+   GEToIsmrmrd::AcquisitionSink* sink;
+
+   try {
+      if (batchSize > 0 || sampleFormat != GEToIsmrmrd::SAMPLE_FORMAT_FLOAT) {
+         // the batched writer opens the file itself, so close it here first
+         d.reset();
+         batchedSink = std::make_shared<GEToIsmrmrd::BatchedDatasetSink>(outfile, "dataset", batchSize, chunkKB * 1024,
+                                                                         sampleFormat);
+         sink = batchedSink.get();
+      } else {
+         datasetSink = std::make_shared<GEToIsmrmrd::DatasetSink>(*d);
+         sink = datasetSink.get();
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to open output file: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
 
-   // get the first acquisition in this raw file
-   std::vector<ISMRMRD::Acquisition> acqs = converter->getAcquisitions(0);
+   auto start = std::chrono::steady_clock::now();
+   try {
+      if (following) {
+         followInto(*sink, [&batchedSink]() {
+            if (batchedSink) {
+               batchedSink->flush();
+            }
+         });
+      } else if (queueDepth > 0) {
+         // write on a separate thread, so that HDF5 writes overlap with decoding
+         GEToIsmrmrd::PipelineSink pipe(*sink, queueDepth, queueWait);
+         converter->convertAcquisitions(range, pipe);
+         pipe.finish();
+
+         if (verbose) {
+            GEToIsmrmrd::PipelineSink::Statistics stats = pipe.statistics();
+            std::cout << "Pipeline queue depth " << queueDepth << ", max queued " << stats.maxQueued << std::endl;
+            std::cout << "Converter stalled " << stats.producerStalls << " times on a full queue ("
+                      << stats.producerStallSeconds << " s)" << std::endl;
+            std::cout << "Writer stalled " << stats.consumerStalls << " times on an empty queue ("
+                      << stats.consumerStallSeconds << " s)" << std::endl;
+         }
+      } else {
+         converter->convertAcquisitions(range, *sink);
+      }
 
-   std::cout << "Number of acquisitions stored in HDF5 file is " << acqs.size() << std::endl;
-   // add these acquisitions to the hdf5 dataset
-   for (int n = 0; n < acqs.size(); n++) {
-      d.appendAcquisition(acqs.at(n));
+      if (batchedSink) {
+         batchedSink->flush();
+      }
+   } catch (const std::exception& e) {
+      std::cerr << "Failed to convert acquisitions: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   size_t const stored = batchedSink ? batchedSink->count() : datasetSink->count();
+   size_t const bytes = batchedSink ? batchedSink->bytesWritten() : datasetSink->bytesWritten();
+
+   std::cout << "Number of acquisitions stored in HDF5 file is " << stored << std::endl;
+   if (verbose) {
+      std::cout << "Converted in " << elapsed.count() << " s" << std::endl;
+      if (elapsed.count() > 0) {
+         std::cout << "Throughput " << stored / elapsed.count() << " acquisitions/s, "
+                   << bytes / elapsed.count() / (1024 * 1024) << " MiB/s of samples" << std::endl;
+      }
+      if (batchedSink) {
+         std::cout << "Batches of " << std::max<size_t>(batchSize, 1) << " acquisitions of " << GEToIsmrmrd::sampleFormatName(sampleFormat)
+                   << " samples, " << batchedSink->chunkRecords()
+                   << " acquisitions per HDF5 chunk" << std::endl;
+      }
    }
 
    std::cout << "Swedished!" << std::endl;
@@ -0,0 +1,65 @@
+/** @file BatchConversionTest.cpp */
+#define BOOST_TEST_MODULE BatchConversionTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <set>
+
+#include "BatchConversion.h"
+
+using namespace GEToIsmrmrd;
+
+static std::vector<BatchJob> jobsFor(const std::vector<std::string>& rawFiles)
+{
+    std::vector<BatchJob> jobs;
+    for (size_t n = 0 ; n < rawFiles.size() ; n++) {
+        BatchJob job;
+        job.rawFile = rawFiles[n];
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+static std::vector<std::string> outputsOf(const std::vector<BatchJob>& jobs)
+{
+    std::vector<std::string> outputs;
+    for (size_t n = 0 ; n < jobs.size() ; n++) {
+        outputs.push_back(jobs[n].outputFile);
+    }
+    return outputs;
+}
+
+BOOST_AUTO_TEST_CASE(repeatedStemsAreNumbered)
+{
+    std::vector<BatchJob> jobs = jobsFor({ "a/P1.7", "b/P1.7", "c/P1.7", "P2.7" });
+    BatchConversion::nameOutputs(jobs, "out");
+
+    std::vector<std::string> const outputs = outputsOf(jobs);
+    std::vector<std::string> const expected = { "out/P1.h5", "out/P1_2.h5", "out/P1_3.h5", "out/P2.h5" };
+    BOOST_CHECK_EQUAL_COLLECTIONS(outputs.begin(), outputs.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(numberedNamesNeverCollide)
+{
+    std::vector<std::string> const orders[] = {
+        { "a/P1.7", "b/P1.7", "P1_2.7" },
+        { "P1_2.7", "a/P1.7", "b/P1.7" },
+        { "a/P1.7", "P1_2.7", "b/P1.7", "c/P1.7", "d/P1_2.7" }
+    };
+    for (const std::vector<std::string>& rawFiles : orders) {
+        std::vector<BatchJob> jobs = jobsFor(rawFiles);
+        BatchConversion::nameOutputs(jobs, "");
+
+        std::vector<std::string> const outputs = outputsOf(jobs);
+        BOOST_CHECK_EQUAL(std::set<std::string>(outputs.begin(), outputs.end()).size(), outputs.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(manifestNamesAreTaken)
+{
+    std::vector<BatchJob> jobs = jobsFor({ "a/P1.7", "b/P1.7" });
+    jobs[1].outputFile = "./P1.h5";
+    BatchConversion::nameOutputs(jobs, "");
+
+    BOOST_CHECK_EQUAL(jobs[0].outputFile, "./P1_2.h5");
+    BOOST_CHECK_EQUAL(jobs[1].outputFile, "./P1.h5");
+}
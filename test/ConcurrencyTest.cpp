@@ -0,0 +1,175 @@
+/** @file ConcurrencyTest.cpp */
+#define BOOST_TEST_MODULE ConcurrencyTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <functional>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libxml/parser.h>
+#include <libxslt/transform.h>
+#include <libxslt/xsltutils.h>
+
+#include "GERawConverter.h"
+#include "HeaderReferences.h"
+#include "NativeHeaderBuilder.h"
+#include "StylesheetCache.h"
+#include "XMLWriter.h"
+#include "TestHelpers.h"
+
+using namespace GEToIsmrmrd;
+
+// Enough to collide, few enough to run quickly under a thread sanitizer
+static const unsigned int THREADS = 8;
+static const unsigned int ITERATIONS = 50;
+
+/** Runs body(thread) on THREADS threads at once and waits for them */
+static void onThreads(const std::function<void(unsigned int)>& body)
+{
+    std::vector<std::thread> threads;
+    for (unsigned int n = 0 ; n < THREADS ; n++) {
+        threads.push_back(std::thread(body, n));
+    }
+    for (size_t n = 0 ; n < threads.size() ; n++) {
+        threads[n].join();
+    }
+}
+
+/** A small raw file header, built with XMLWriter as GERawConverter builds it */
+static std::shared_ptr<xmlDoc> rawHeader()
+{
+    XMLWriter writer(true);
+    writer.startDocument();
+    writer.startElement("Header");
+    writer.formatElement("SliceCount", "%d", 4);
+    writer.formatElement("ChannelCount", "%d", 8);
+    writer.formatElement("AcquiredXRes", "%d", 256);
+    writer.formatElement("AcquiredYRes", "%d", 128);
+    writer.startElement("Image");
+    writer.formatElement("EchoTime", "%s", "4.5");
+    writer.formatElement("PixelSizeX", "%f", 0.9375);
+    writer.endElement();
+    writer.endElement();
+    writer.endDocument();
+    return std::shared_ptr<xmlDoc>(writer.takeDocument(), xmlFreeDoc);
+}
+
+static std::string applyStylesheet(const std::string& sheet)
+{
+    std::shared_ptr<xsltStylesheet> compiled = StylesheetCache::instance().get(sheet);
+    std::shared_ptr<xmlDoc> header = rawHeader();
+    const char* params[1] = { NULL };
+    std::shared_ptr<xmlDoc> result(xsltApplyStylesheet(compiled.get(), header.get(), params), xmlFreeDoc);
+    if (!result) {
+        throw std::runtime_error("Failed to apply stylesheet");
+    }
+
+    xmlChar* output = NULL;
+    int len = 0;
+    if (xsltSaveResultToString(&output, &len, result.get(), compiled.get()) < 0) {
+        throw std::runtime_error("Failed to save converted doc to string");
+    }
+    std::string const text(reinterpret_cast<const char*>(output), len);
+    xmlFree(output);
+    return text;
+}
+
+struct XmlLibraries
+{
+    // As GERawConverter does once per process before the first converter
+    XmlLibraries() { xmlInitParser(); xsltInit(); }
+};
+
+BOOST_GLOBAL_FIXTURE(XmlLibraries);
+
+BOOST_AUTO_TEST_CASE(stylesheetsApplyConcurrently)
+{
+    std::string const sheets[] = { readFile(SOURCE_DIR + "/src/config/default.xsl"),
+                                   readFile(SOURCE_DIR + "/src/config/epi.xsl") };
+    std::string const expected[] = { applyStylesheet(sheets[0]), applyStylesheet(sheets[1]) };
+    BOOST_REQUIRE(!expected[0].empty() && !expected[1].empty());
+
+    std::vector<std::string> errors(THREADS);
+    onThreads([&](unsigned int thread) {
+        try {
+            for (unsigned int n = 0 ; n < ITERATIONS ; n++) {
+                unsigned int const which = (thread + n) % 2;
+                if (applyStylesheet(sheets[which]) != expected[which]) {
+                    errors[thread] = "stylesheet output differs";
+                    return;
+                }
+
+                // Every thread also recompiles after the cache is dropped under it
+                if (n % 10 == thread % 10) {
+                    StylesheetCache::instance().clear();
+                }
+            }
+        } catch (const std::exception& e) {
+            errors[thread] = e.what();
+        }
+    });
+
+    for (unsigned int n = 0 ; n < THREADS ; n++) {
+        BOOST_CHECK_MESSAGE(errors[n].empty(), "thread " << n << ": " << errors[n]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stylesheetsAreScannedConcurrently)
+{
+    std::string const sheet = readFile(SOURCE_DIR + "/src/config/epi.xsl");
+    std::set<std::string> const expected = HeaderReferences::fromStylesheet(sheet).paths();
+
+    std::vector<int> failures(THREADS, 0);
+    onThreads([&](unsigned int thread) {
+        for (unsigned int n = 0 ; n < ITERATIONS ; n++) {
+            if (HeaderReferences::fromStylesheet(sheet).paths() != expected ||
+                    NativeHeaderBuilder::identify(sheet) != NativeHeaderBuilder::EPI_MAPPING) {
+                failures[thread]++;
+            }
+        }
+    });
+
+    for (unsigned int n = 0 ; n < THREADS ; n++) {
+        BOOST_CHECK_EQUAL(failures[n], 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(writersLeaveLibxml2Usable)
+{
+    // XMLWriter used to call xmlCleanupParser() when destroyed, pulling libxml2 from under other threads
+    std::vector<std::string> texts(THREADS);
+    onThreads([&](unsigned int thread) {
+        for (unsigned int n = 0 ; n < ITERATIONS ; n++) {
+            XMLWriter writer;
+            writer.startDocument();
+            writer.startElement("Header");
+            writer.formatElement("Thread", "%u", thread);
+            writer.endElement();
+            writer.endDocument();
+            texts[thread] = writer.getXML();
+        }
+    });
+
+    for (unsigned int n = 0 ; n < THREADS ; n++) {
+        BOOST_CHECK(texts[n].find("<Thread>" + std::to_string(n) + "</Thread>") != std::string::npos);
+    }
+    BOOST_CHECK(rawHeader());
+}
+
+BOOST_AUTO_TEST_CASE(logstreamsWriteConcurrently)
+{
+    // The operators are inline in LogStream.h and write to std::clog, which is synchronized
+    onThreads([](unsigned int thread) {
+        logstream enabled(true);
+        logstream disabled(false);
+        for (unsigned int n = 0 ; n < ITERATIONS ; n++) {
+            enabled << "";
+            disabled << "thread " << thread << " line " << n << std::endl;
+        }
+    });
+    BOOST_CHECK(std::clog.good());
+}
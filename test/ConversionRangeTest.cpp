@@ -0,0 +1,89 @@
+/** @file ConversionRangeTest.cpp */
+#define BOOST_TEST_MODULE ConversionRangeTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <stdexcept>
+
+#include "ConversionRange.h"
+#include "TestHelpers.h"
+
+using namespace GEToIsmrmrd;
+
+/** Header of an 8 channel scan with 8 slices, 2 echoes and 5 volumes */
+static const char* const HEADER =
+    "<?xml version=\"1.0\"?>\n"
+    "<ismrmrdHeader xmlns=\"http://www.ismrm.org/ISMRMRD\">"
+    "<acquisitionSystemInformation><receiverChannels>8</receiverChannels></acquisitionSystemInformation>"
+    "<encoding><encodingLimits>"
+    "<slice><minimum>0</minimum><maximum>7</maximum><center>4</center></slice>"
+    "<contrast><minimum>0</minimum><maximum>1</maximum><center>0</center></contrast>"
+    "<repetition><minimum>0</minimum><maximum>4</maximum><center>0</center></repetition>"
+    "</encodingLimits></encoding>"
+    "</ismrmrdHeader>";
+
+BOOST_AUTO_TEST_CASE(indicesOutsideTheScanAreRejected)
+{
+    ConversionRange range;
+    range.channels = ConversionRange::parseList("50");
+    BOOST_CHECK_THROW(range.check(8, 2, 8, 5), std::invalid_argument);
+
+    range.channels = ConversionRange::parseList("0-7");
+    BOOST_CHECK_NO_THROW(range.check(8, 2, 8, 5));
+
+    range.slices = ConversionRange::parseList("3,8");
+    BOOST_CHECK_THROW(range.check(8, 2, 8, 5), std::invalid_argument);
+    range.slices.clear();
+
+    range.echoes = ConversionRange::parseList("2");
+    BOOST_CHECK_THROW(range.check(8, 2, 8, 5), std::invalid_argument);
+    range.echoes.clear();
+
+    // Volumes are only checked once their number is known
+    range.volumes = ConversionRange::parseList("5");
+    BOOST_CHECK_THROW(range.check(8, 2, 8, 5), std::invalid_argument);
+    BOOST_CHECK_NO_THROW(range.check(8, 2, 8, 0));
+}
+
+BOOST_AUTO_TEST_CASE(errorNamesTheIndex)
+{
+    ConversionRange range;
+    range.channels = ConversionRange::parseList("2,50");
+    try {
+        range.check(8, 2, 8, 0);
+        BOOST_ERROR("channel 50 was accepted");
+    } catch (const std::invalid_argument& e) {
+        BOOST_CHECK_EQUAL(std::string(e.what()), "channel 50 is not in the scan, which has 8 channels");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(headerDescribesTheSelection)
+{
+    ConversionRange range;
+    range.channels = ConversionRange::parseList("0,2,5");
+    range.slices = ConversionRange::parseList("2-3");
+    range.volumes = ConversionRange::parseList("1,9");
+
+    std::string const xml = range.updateHeader(HEADER);
+
+    BOOST_CHECK_EQUAL(elementText(xml, "receiverChannels"), "3");
+    BOOST_CHECK_EQUAL(elementText(xml, "slice/minimum"), "2");
+    BOOST_CHECK_EQUAL(elementText(xml, "slice/maximum"), "3");
+    BOOST_CHECK_EQUAL(elementText(xml, "slice/center"), "2");
+    BOOST_CHECK_EQUAL(elementText(xml, "contrast/minimum"), "0");
+    BOOST_CHECK_EQUAL(elementText(xml, "contrast/maximum"), "1");
+    BOOST_CHECK_EQUAL(elementText(xml, "repetition/minimum"), "1");
+    BOOST_CHECK_EQUAL(elementText(xml, "repetition/maximum"), "1");
+}
+
+BOOST_AUTO_TEST_CASE(headerWithoutChannelSelectionKeepsItsChannels)
+{
+    ConversionRange range;
+    range.echoes = ConversionRange::parseList("1");
+
+    std::string const xml = range.updateHeader(HEADER);
+
+    BOOST_CHECK_EQUAL(elementText(xml, "receiverChannels"), "8");
+    BOOST_CHECK_EQUAL(elementText(xml, "slice/maximum"), "7");
+    BOOST_CHECK_EQUAL(elementText(xml, "contrast/minimum"), "1");
+    BOOST_CHECK_EQUAL(elementText(xml, "contrast/center"), "1");
+}
@@ -0,0 +1,219 @@
+/** @file GadgetronSinkTest.cpp */
+#define BOOST_TEST_MODULE GadgetronSinkTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "GadgetronSink.h"
+
+using namespace GEToIsmrmrd;
+
+/**
+ * Endpoint on the loopback interface that records everything it is sent and,
+ * once the sink stops sending, answers with a prepared reply and hangs up
+ */
+class LoopbackEndpoint
+{
+public:
+    explicit LoopbackEndpoint(const std::string& reply)
+        : listener_(socket(AF_INET, SOCK_STREAM, 0))
+        , port_(0)
+        , reply_(reply)
+    {
+        BOOST_REQUIRE(listener_ >= 0);
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        BOOST_REQUIRE(bind(listener_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0);
+        BOOST_REQUIRE(listen(listener_, 1) == 0);
+        BOOST_REQUIRE(getsockname(listener_, reinterpret_cast<struct sockaddr*>(&address), &length) == 0);
+        port_ = ntohs(address.sin_port);
+
+        server_ = std::thread(&LoopbackEndpoint::serve, this);
+    }
+
+    ~LoopbackEndpoint()
+    {
+        if (server_.joinable()) {
+            server_.join();
+        }
+        close(listener_);
+    }
+
+    unsigned short port() const { return port_; }
+
+    /** Everything the sink sent; call after the sink is closed */
+    const std::string& received()
+    {
+        server_.join();
+        return received_;
+    }
+
+private:
+    void serve()
+    {
+        int const connection = accept(listener_, NULL, NULL);
+        if (connection < 0) {
+            return;
+        }
+
+        char buffer[65536];
+        ssize_t n;
+        while ((n = recv(connection, buffer, sizeof(buffer), 0)) > 0) {
+            received_.append(buffer, n);
+        }
+
+        send(connection, reply_.data(), reply_.size(), MSG_NOSIGNAL);
+        close(connection);
+    }
+
+    int listener_;
+    unsigned short port_;
+    std::string reply_;
+    std::string received_;
+    std::thread server_;
+};
+
+template <typename T>
+static void put(std::string& bytes, const T& value)
+{
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static T take(const std::string& bytes, size_t& offset)
+{
+    T value;
+    BOOST_REQUIRE(offset + sizeof(value) <= bytes.size());
+    memcpy(&value, bytes.data() + offset, sizeof(value));
+    offset += sizeof(value);
+    return value;
+}
+
+/** A 2 x 3 float image message of series 4, as a Gadgetron sends it back */
+static std::string imageMessage(const std::string& attributes)
+{
+    ISMRMRD::ISMRMRD_ImageHeader head;
+    memset(&head, 0, sizeof(head));
+    head.data_type = ISMRMRD::ISMRMRD_FLOAT;
+    head.matrix_size[0] = 2;
+    head.matrix_size[1] = 3;
+    head.matrix_size[2] = 1;
+    head.channels = 1;
+    head.image_series_index = 4;
+
+    std::string bytes;
+    put<uint16_t>(bytes, GadgetronSink::MESSAGE_IMAGE);
+    put(bytes, head);
+    put<uint64_t>(bytes, attributes.size() + 1);
+    bytes.append(attributes.c_str(), attributes.size() + 1);
+    for (int n = 0 ; n < 6 ; n++) {
+        put<float>(bytes, n * 0.5f);
+    }
+    return bytes;
+}
+
+BOOST_AUTO_TEST_CASE(streamIsSentAsTheGadgetronClientSendsIt)
+{
+    LoopbackEndpoint endpoint("");
+    std::string const xml = "<ismrmrdHeader/>";
+
+    ISMRMRD::Acquisition acq(4, 2, 1);
+    for (size_t n = 0 ; n < acq.getNumberOfDataElements() ; n++) {
+        acq.getDataPtr()[n] = complex_float_t(n, -1.0f * n);
+    }
+    for (size_t n = 0 ; n < acq.getNumberOfTrajElements() ; n++) {
+        acq.getTrajPtr()[n] = n;
+    }
+
+    {
+        GadgetronSink sink("127.0.0.1", endpoint.port(), 64);
+        sink.sendConfigName("default.xml");
+        sink.sendHeader(xml);
+        sink.consume(acq);
+        sink.consume(acq);
+        sink.close();
+        BOOST_CHECK_EQUAL(sink.count(), 2u);
+        BOOST_CHECK(sink.images().empty());
+    }
+
+    const std::string& bytes = endpoint.received();
+    size_t offset = 0;
+
+    BOOST_CHECK_EQUAL(take<uint16_t>(bytes, offset), GadgetronSink::MESSAGE_CONFIG_FILE);
+    BOOST_REQUIRE(offset + GadgetronSink::CONFIG_NAME_LENGTH <= bytes.size());
+    BOOST_CHECK_EQUAL(std::string(bytes.data() + offset), "default.xml");
+    offset += GadgetronSink::CONFIG_NAME_LENGTH;
+
+    BOOST_CHECK_EQUAL(take<uint16_t>(bytes, offset), GadgetronSink::MESSAGE_PARAMETER_SCRIPT);
+    uint32_t const length = take<uint32_t>(bytes, offset);
+    BOOST_REQUIRE_EQUAL(length, xml.size() + 1);
+    BOOST_CHECK_EQUAL(bytes.substr(offset, length), std::string(xml.c_str(), length));
+    offset += length;
+
+    for (int n = 0 ; n < 2 ; n++) {
+        BOOST_CHECK_EQUAL(take<uint16_t>(bytes, offset), GadgetronSink::MESSAGE_ACQUISITION);
+        BOOST_CHECK(memcmp(bytes.data() + offset, &acq.getHead(), sizeof(ISMRMRD::ISMRMRD_AcquisitionHeader)) == 0);
+        offset += sizeof(ISMRMRD::ISMRMRD_AcquisitionHeader);
+        BOOST_CHECK(memcmp(bytes.data() + offset, acq.getTrajPtr(), acq.getTrajSize()) == 0);
+        offset += acq.getTrajSize();
+        BOOST_CHECK(memcmp(bytes.data() + offset, acq.getDataPtr(), acq.getDataSize()) == 0);
+        offset += acq.getDataSize();
+    }
+
+    BOOST_CHECK_EQUAL(take<uint16_t>(bytes, offset), GadgetronSink::MESSAGE_CLOSE);
+    BOOST_CHECK_EQUAL(offset, bytes.size());
+}
+
+BOOST_AUTO_TEST_CASE(returnedImagesAndTextAreKept)
+{
+    std::string reply;
+    put<uint16_t>(reply, GadgetronSink::MESSAGE_TEXT);
+    put<uint32_t>(reply, 5);
+    reply += "hello";
+    reply += imageMessage("<ismrmrdMeta/>");
+    reply += imageMessage("");
+    put<uint16_t>(reply, GadgetronSink::MESSAGE_CLOSE);
+
+    LoopbackEndpoint endpoint(reply);
+    GadgetronSink sink("127.0.0.1", endpoint.port());
+    sink.sendConfigName("default.xml");
+    sink.close();
+
+    BOOST_CHECK_EQUAL(sink.bytesReceived(), reply.size());
+    BOOST_REQUIRE_EQUAL(sink.texts().size(), 1u);
+    BOOST_CHECK_EQUAL(sink.texts()[0], "hello");
+
+    BOOST_REQUIRE_EQUAL(sink.images().size(), 2u);
+    const GadgetronImage& image = sink.images()[0];
+    BOOST_CHECK_EQUAL(image.head.image_series_index, 4);
+    BOOST_CHECK_EQUAL(image.attributes, "<ismrmrdMeta/>");
+    BOOST_REQUIRE_EQUAL(image.data.size(), 6 * sizeof(float));
+    float samples[6];
+    memcpy(samples, image.data.data(), sizeof(samples));
+    BOOST_CHECK_EQUAL(samples[5], 2.5f);
+    BOOST_CHECK(sink.images()[1].attributes.empty());
+
+    BOOST_CHECK_EQUAL(sink.messagesReceived().at(GadgetronSink::MESSAGE_TEXT), 1u);
+    BOOST_CHECK_EQUAL(sink.messagesReceived().at(GadgetronSink::MESSAGE_IMAGE), 2u);
+    BOOST_CHECK_EQUAL(sink.messagesReceived().at(GadgetronSink::MESSAGE_CLOSE), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(truncatedReplyIsAnError)
+{
+    std::string const image = imageMessage("<ismrmrdMeta/>");
+    LoopbackEndpoint endpoint(image.substr(0, image.size() - 3));
+    GadgetronSink sink("127.0.0.1", endpoint.port());
+    BOOST_CHECK_THROW(sink.close(), std::runtime_error);
+}
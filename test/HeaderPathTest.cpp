@@ -0,0 +1,59 @@
+/** @file HeaderPathTest.cpp */
+#define BOOST_TEST_MODULE HeaderPathTest
+#include <boost/test/included/unit_test.hpp>
+
+
+#include "GERawConverter.h"
+#include "TestHelpers.h"
+
+using namespace GEToIsmrmrd;
+
+/** Header of a sample raw file with a built-in stylesheet, built one way */
+static std::string sampleHeader(const std::string& rawFile, const std::string& stylesheet, HeaderPath path)
+{
+    GERawConverter converter(SOURCE_DIR + "/sampleData/" + rawFile, "GenericConverter");
+
+    ConversionOptions options;
+    options.headerPath = path;
+    converter.setOptions(options);
+    converter.useStylesheetString(readFile(SOURCE_DIR + "/src/config/" + stylesheet));
+
+    return converter.getIsmrmrdXMLHeader();
+}
+
+BOOST_AUTO_TEST_CASE(builtInStylesheetsAreRecognised)
+{
+    // Fails when a stylesheet was edited without updating NativeHeaderBuilder and its hash
+    BOOST_CHECK_EQUAL(NativeHeaderBuilder::identify(readFile(SOURCE_DIR + "/src/config/default.xsl")),
+                      NativeHeaderBuilder::DEFAULT_MAPPING);
+    BOOST_CHECK_EQUAL(NativeHeaderBuilder::identify(readFile(SOURCE_DIR + "/src/config/epi.xsl")),
+                      NativeHeaderBuilder::EPI_MAPPING);
+}
+
+BOOST_AUTO_TEST_CASE(editedStylesheetIsNotRecognised)
+{
+    std::string const edited = readFile(SOURCE_DIR + "/src/config/default.xsl") + "<!-- edited -->\n";
+    BOOST_CHECK_EQUAL(NativeHeaderBuilder::identify(edited), NativeHeaderBuilder::NO_NATIVE_MAPPING);
+}
+
+BOOST_AUTO_TEST_CASE(pfileHeaderPathsAgree)
+{
+    for (const char* stylesheet : {"default.xsl", "epi.xsl"}) {
+        BOOST_TEST_CONTEXT("stylesheet " << stylesheet) {
+            std::string const native = sampleHeader("P20480_GRE.7", stylesheet, HEADER_PATH_NATIVE);
+            BOOST_CHECK(!native.empty());
+            BOOST_CHECK_EQUAL(native, sampleHeader("P20480_GRE.7", stylesheet, HEADER_PATH_XSLT));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scanArchiveHeaderPathsAgree)
+{
+    for (const char* stylesheet : {"default.xsl", "epi.xsl"}) {
+        BOOST_TEST_CONTEXT("stylesheet " << stylesheet) {
+            std::string const native = sampleHeader("ScanArchive_GRE.h5", stylesheet, HEADER_PATH_NATIVE);
+            BOOST_CHECK(!native.empty());
+            BOOST_CHECK_EQUAL(native, sampleHeader("ScanArchive_GRE.h5", stylesheet, HEADER_PATH_XSLT));
+        }
+    }
+}
@@ -0,0 +1,172 @@
+/** @file HeaderReferencesTest.cpp */
+#define BOOST_TEST_MODULE HeaderReferencesTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <set>
+
+#include "HeaderReferences.h"
+#include "TestHelpers.h"
+
+using namespace GEToIsmrmrd;
+
+/** References of a stylesheet whose root template holds body */
+static HeaderReferences rootTemplate(const std::string& body)
+{
+    return HeaderReferences::fromStylesheet(
+        "<xsl:stylesheet version=\"1.0\" xmlns:xsl=\"http://www.w3.org/1999/XSL/Transform\">\n"
+        "<xsl:template match=\"/\">" + body + "</xsl:template>\n"
+        "</xsl:stylesheet>\n");
+}
+
+/** Paths read by both shipped stylesheets */
+static const char* const COMMON_PATHS[] = {
+    "Header/AcquiredXRes", "Header/AcquiredYRes", "Header/AcquiredZRes", "Header/ChannelCount",
+    "Header/Equipment/DeviceSerialNumber", "Header/Equipment/Institution", "Header/Equipment/Manufacturer",
+    "Header/Equipment/ManufacturerModel", "Header/Equipment/Station",
+    "Header/Image/AcquisitionType", "Header/Image/EchoTime", "Header/Image/EchoTrainLength",
+    "Header/Image/FlipAngle", "Header/Image/ImageType", "Header/Image/ImagingFrequency",
+    "Header/Image/InversionTime", "Header/Image/MagneticFieldStrength", "Header/Image/PhaseEncodeDirection",
+    "Header/Image/PixelSizeX", "Header/Image/PixelSizeY", "Header/Image/RepetitionTime",
+    "Header/Image/ScanOptions", "Header/Image/ScanSequence", "Header/Image/SecondEcho",
+    "Header/Image/SequenceVariant", "Header/Image/SliceSpacing", "Header/Image/SliceThickness",
+    "Header/Image/TriggerTime", "Header/Is3DAcquisition",
+    "Header/Patient/Birthdate", "Header/Patient/Gender", "Header/Patient/ID", "Header/Patient/Name",
+    "Header/Patient/Weight", "Header/PatientPosition", "Header/ReferencedImageUIDs",
+    "Header/Series/Date", "Header/Series/Description", "Header/Series/Number", "Header/Series/ProtocolName",
+    "Header/Series/Time", "Header/Series/UID", "Header/SliceCount",
+    "Header/Study/AccessionNumber", "Header/Study/Date", "Header/Study/Description", "Header/Study/Number",
+    "Header/Study/ReferringPhysician", "Header/Study/Time", "Header/Study/UID",
+    "Header/TransformXRes", "Header/TransformYRes", "Header/TransformZRes"
+};
+
+static std::set<std::string> commonPaths()
+{
+    return std::set<std::string>(std::begin(COMMON_PATHS), std::end(COMMON_PATHS));
+}
+
+BOOST_AUTO_TEST_CASE(defaultStylesheet)
+{
+    HeaderReferences const refs = HeaderReferences::fromStylesheet(readFile(SOURCE_DIR + "/src/config/default.xsl"));
+    BOOST_REQUIRE(!refs.referencesEverything());
+
+    std::set<std::string> expected = commonPaths();
+    expected.insert("Header/EchoCount");
+    expected.insert("Header/RepetitionCount");
+    BOOST_CHECK_EQUAL_COLLECTIONS(refs.paths().begin(), refs.paths().end(), expected.begin(), expected.end());
+
+    BOOST_CHECK(refs.needs("Header/Image"));
+    BOOST_CHECK(!refs.needs("Header/Image/AcquisitionDate"));
+    BOOST_CHECK(!refs.needs("Header/OtherUID"));
+    BOOST_CHECK(!refs.needs("Header/Equipment/UID"));
+    BOOST_CHECK(!refs.needs("Header/epiParameters"));
+}
+
+BOOST_AUTO_TEST_CASE(epiStylesheet)
+{
+    HeaderReferences const refs = HeaderReferences::fromStylesheet(readFile(SOURCE_DIR + "/src/config/epi.xsl"));
+    BOOST_REQUIRE(!refs.referencesEverything());
+
+    std::set<std::string> expected = commonPaths();
+    expected.insert("Header/NumEchoes");
+    expected.insert("Header/UserVariables/rdb_hdr_user10");
+    expected.insert("Header/UserVariables/rdb_hdr_user11");
+    expected.insert("Header/UserVariables/rdb_hdr_user12");
+    expected.insert("Header/epiParameters/AcquiredYRes");
+    expected.insert("Header/epiParameters/NumRefViews");
+    expected.insert("Header/epiParameters/num_volumes");
+    expected.insert("Header/isEpiRampsampled");
+    BOOST_CHECK_EQUAL_COLLECTIONS(refs.paths().begin(), refs.paths().end(), expected.begin(), expected.end());
+
+    BOOST_CHECK(refs.needs("Header/epiParameters"));
+    BOOST_CHECK(!refs.needs("Header/Image/ImagePosition"));
+    BOOST_CHECK(!refs.needs("Header/OtherUID"));
+}
+
+BOOST_AUTO_TEST_CASE(needsMatchesAncestorsAndDescendants)
+{
+    HeaderReferences const refs = rootTemplate("<a><xsl:value-of select=\"Header/Image\"/></a>");
+    BOOST_CHECK(refs.needs("Header"));
+    BOOST_CHECK(refs.needs("Header/Image"));
+    BOOST_CHECK(refs.needs("Header/Image/EchoTime"));
+    BOOST_CHECK(!refs.needs("Header/ImageXRes"));
+    BOOST_CHECK(!refs.needs("Header/Series"));
+}
+
+BOOST_AUTO_TEST_CASE(expressionsAndAttributeTemplates)
+{
+    HeaderReferences const refs = rootTemplate(
+        "<a size=\"{Header/SliceCount * 2}\" label=\"{{literal}} {'Header/Study'}\">"
+        "<xsl:if test=\"Header/Image/EchoTime &gt; 0 and string-length(Header/Series/UID) mod 2\">"
+        "<xsl:value-of select=\"concat(Header/Patient/Name, '/Header/Patient/ID')\"/>"
+        "</xsl:if>"
+        "<xsl:value-of select=\"Header/Image[PixelSizeX &gt; 1]/PixelSizeY\"/>"
+        "<xsl:value-of select=\"Header/Equipment/@unit\"/>"
+        "<xsl:value-of select=\"Header/Study/Date/text()\"/>"
+        "</a>");
+    BOOST_REQUIRE(!refs.referencesEverything());
+
+    std::set<std::string> const expected = {
+        "Header/Equipment", "Header/Image/EchoTime", "Header/Image/PixelSizeX", "Header/Image/PixelSizeY",
+        "Header/Patient/Name", "Header/Series/UID", "Header/SliceCount", "Header/Study/Date"
+    };
+    BOOST_CHECK_EQUAL_COLLECTIONS(refs.paths().begin(), refs.paths().end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(forEachResolvesRelativePaths)
+{
+    HeaderReferences const refs = rootTemplate(
+        "<xsl:for-each select=\"Header/Image\">"
+        "<e><xsl:value-of select=\"EchoTime\"/><xsl:value-of select=\"../Series/UID\"/></e>"
+        "</xsl:for-each>");
+    BOOST_REQUIRE(!refs.referencesEverything());
+
+    std::set<std::string> const expected = { "Header/Image/EchoTime", "Header/Series/UID" };
+    BOOST_CHECK_EQUAL_COLLECTIONS(refs.paths().begin(), refs.paths().end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(contextFunctionsReadTheContextNode)
+{
+    HeaderReferences const refs = rootTemplate(
+        "<xsl:for-each select=\"Header/Image\"><e><xsl:value-of select=\"normalize-space()\"/></e></xsl:for-each>"
+        "<xsl:for-each select=\"Header/Series/UID\">"
+        "<e n=\"{string-length()}\"><xsl:value-of select=\"concat(string(), number())\"/></e>"
+        "</xsl:for-each>"
+        "<xsl:value-of select=\"Header/Study[string-length() &gt; 0]/Date\"/>"
+        "<xsl:value-of select=\"concat(position(), last(), normalize-space(Header/Patient/Name))\"/>");
+    BOOST_REQUIRE(!refs.referencesEverything());
+
+    std::set<std::string> const expected = {
+        "Header/Image", "Header/Patient/Name", "Header/Series/UID", "Header/Study", "Header/Study/Date"
+    };
+    BOOST_CHECK_EQUAL_COLLECTIONS(refs.paths().begin(), refs.paths().end(), expected.begin(), expected.end());
+    BOOST_CHECK(refs.needs("Header/Image/EchoTime"));
+
+    // At the root, the string value is all of the header text
+    BOOST_CHECK(rootTemplate("<xsl:value-of select=\"string()\"/>").referencesEverything());
+}
+
+BOOST_AUTO_TEST_CASE(unresolvableExpressionsReferenceEverything)
+{
+    const char* const bodies[] = {
+        "<xsl:value-of select=\"Header/*\"/>",
+        "<xsl:value-of select=\"//EchoTime\"/>",
+        "<xsl:value-of select=\"Header/descendant::EchoTime\"/>",
+        "<xsl:value-of select=\"$header/Image\"/>",
+        "<xsl:value-of select=\"(Header/Image)[1]/EchoTime\"/>",
+        "<xsl:value-of select=\".\"/>",
+        "<xsl:apply-templates/>",
+        "<xsl:for-each select=\"Header/Image | Header/Series\"><xsl:value-of select=\"UID\"/></xsl:for-each>",
+        "<xsl:value-of select=\"Header/Image[\"/>"
+    };
+    for (const char* body : bodies) {
+        BOOST_TEST_CONTEXT(body) {
+            BOOST_CHECK(rootTemplate(body).referencesEverything());
+        }
+    }
+
+    // No template for "/": the built-in templates copy every element's text
+    BOOST_CHECK(HeaderReferences::fromStylesheet(
+        "<xsl:stylesheet version=\"1.0\" xmlns:xsl=\"http://www.w3.org/1999/XSL/Transform\"/>").referencesEverything());
+    BOOST_CHECK(HeaderReferences::fromStylesheet("not a stylesheet").referencesEverything());
+    BOOST_CHECK(HeaderReferences().needs("Header/OtherUID"));
+}
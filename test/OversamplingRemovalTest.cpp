@@ -0,0 +1,181 @@
+/** @file OversamplingRemovalTest.cpp */
+#define BOOST_TEST_MODULE OversamplingRemovalTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "OversamplingRemoval.h"
+#include "TestHelpers.h"
+
+using namespace GEToIsmrmrd;
+
+static const double PI = 3.14159265358979323846;
+
+/** Header of a readout acquired with 2x oversampling: 256 samples over twice the prescribed field of view */
+static const char* const HEADER =
+    "<?xml version=\"1.0\"?>\n"
+    "<ismrmrdHeader xmlns=\"http://www.ismrm.org/ISMRMRD\">"
+    "<encoding>"
+    "<encodedSpace><matrixSize><x>256</x><y>128</y><z>1</z></matrixSize>"
+    "<fieldOfView_mm><x>480</x><y>240</y><z>5</z></fieldOfView_mm></encodedSpace>"
+    "<reconSpace><matrixSize><x>128</x><y>128</y><z>1</z></matrixSize>"
+    "<fieldOfView_mm><x>240</x><y>240</y><z>5</z></fieldOfView_mm></reconSpace>"
+    "</encoding>"
+    "</ismrmrdHeader>";
+
+/** Sample n of a readout of length samples holding one complex exponential of k cycles */
+static complex_float_t tone(int k, size_t n, size_t samples)
+{
+    double const phase = 2.0 * PI * k * static_cast<double>(n) / samples;
+    return complex_float_t(static_cast<float>(std::cos(phase)), static_cast<float>(std::sin(phase)));
+}
+
+/**
+ * Acquisition whose channel c holds the sum of the tones of cycles[c], with
+ * the header fields the removal adjusts
+ */
+static ISMRMRD::Acquisition readout(size_t samples, const std::vector<std::vector<int> >& cycles, uint32_t counter)
+{
+    ISMRMRD::Acquisition acq(samples, cycles.size());
+    acq.scan_counter() = counter;
+    acq.center_sample() = samples / 2;
+    acq.discard_pre() = 3;
+    acq.discard_post() = 4;
+    acq.sample_time_us() = 2.0f;
+
+    for (size_t c = 0 ; c < cycles.size() ; c++) {
+        for (size_t n = 0 ; n < samples ; n++) {
+            complex_float_t sum(0.0f, 0.0f);
+            for (int k : cycles[c]) {
+                sum += tone(k, n, samples);
+            }
+            acq.data(n, c) = sum;
+        }
+    }
+    return acq;
+}
+
+/** Largest difference between channel c of acq and the sum of the tones of cycles */
+static float largestError(const ISMRMRD::Acquisition& acq, uint16_t c, const std::vector<int>& cycles)
+{
+    float error = 0.0f;
+    for (size_t n = 0 ; n < acq.number_of_samples() ; n++) {
+        complex_float_t expected(0.0f, 0.0f);
+        for (int k : cycles) {
+            expected += tone(k, n, acq.number_of_samples());
+        }
+        error = std::max(error, std::abs(acq.data(n, c) - expected));
+    }
+    return error;
+}
+
+BOOST_AUTO_TEST_CASE(contentInsideTheFieldOfViewIsKept)
+{
+    // Tones of fewer than 16 cycles lie in the central half of a 64 sample readout
+    std::vector<std::vector<int> > const cycles = { { 0, 3, -7 }, { 15, -16, 9 } };
+    std::vector<ISMRMRD::Acquisition> out;
+    AcquisitionVectorSink sink(out);
+    {
+        OversamplingRemoval removal(sink, 2, 4);
+        for (uint32_t n = 0 ; n < 10 ; n++) {
+            removal.consume(readout(64, cycles, n));
+        }
+        removal.flush();
+    }
+
+    BOOST_REQUIRE_EQUAL(out.size(), 10u);
+    for (size_t n = 0 ; n < out.size() ; n++) {
+        BOOST_CHECK_EQUAL(out[n].scan_counter(), n);
+        BOOST_CHECK_EQUAL(out[n].number_of_samples(), 32u);
+        BOOST_CHECK_EQUAL(out[n].active_channels(), 2u);
+        BOOST_CHECK_SMALL(largestError(out[n], 0, cycles[0]), 1e-4f);
+        BOOST_CHECK_SMALL(largestError(out[n], 1, cycles[1]), 1e-4f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(contentOutsideTheFieldOfViewIsRemoved)
+{
+    // 20 and -24 cycles lie in the outer half; only the 5 cycle tone is left
+    std::vector<ISMRMRD::Acquisition> out;
+    AcquisitionVectorSink sink(out);
+    OversamplingRemoval removal(sink, 2);
+    removal.consume(readout(64, { { 5, 20, -24 } }, 0));
+    removal.flush();
+
+    BOOST_REQUIRE_EQUAL(out.size(), 1u);
+    BOOST_CHECK_SMALL(largestError(out[0], 0, { 5 }), 1e-4f);
+}
+
+BOOST_AUTO_TEST_CASE(headerFieldsFollowTheFactor)
+{
+    std::vector<ISMRMRD::Acquisition> out;
+    AcquisitionVectorSink sink(out);
+    OversamplingRemoval removal(sink, 4);
+    removal.consume(readout(64, { { 1 } }, 0));
+    removal.flush();
+
+    BOOST_REQUIRE_EQUAL(out.size(), 1u);
+    BOOST_CHECK_EQUAL(out[0].number_of_samples(), 16u);
+    BOOST_CHECK_EQUAL(out[0].center_sample(), 8u);
+    // Rounded up, so no sample that should be discarded is kept
+    BOOST_CHECK_EQUAL(out[0].discard_pre(), 1u);
+    BOOST_CHECK_EQUAL(out[0].discard_post(), 1u);
+    BOOST_CHECK_EQUAL(out[0].sample_time_us(), 8.0f);
+}
+
+BOOST_AUTO_TEST_CASE(changingShapeFlushesInOrder)
+{
+    std::vector<ISMRMRD::Acquisition> out;
+    AcquisitionVectorSink sink(out);
+    OversamplingRemoval removal(sink, 2, 8);
+    removal.consume(readout(64, { { 2 } }, 0));
+    removal.consume(readout(64, { { 3 } }, 1));
+    removal.consume(readout(128, { { 4 }, { -4 } }, 2));
+    removal.consume(readout(64, { { 5 } }, 3));
+    removal.flush();
+
+    BOOST_REQUIRE_EQUAL(out.size(), 4u);
+    int const expected[] = { 2, 3, 4, 5 };
+    for (size_t n = 0 ; n < out.size() ; n++) {
+        BOOST_CHECK_EQUAL(out[n].scan_counter(), n);
+        BOOST_CHECK_SMALL(largestError(out[n], 0, { expected[n] }), 1e-4f);
+    }
+    BOOST_CHECK_EQUAL(out[2].number_of_samples(), 64u);
+    BOOST_CHECK_SMALL(largestError(out[2], 1, { -4 }), 1e-4f);
+}
+
+BOOST_AUTO_TEST_CASE(readoutsThatCannotBeCroppedAreRejected)
+{
+    std::vector<ISMRMRD::Acquisition> out;
+    AcquisitionVectorSink sink(out);
+    BOOST_CHECK_THROW(OversamplingRemoval(sink, 1), std::runtime_error);
+
+    OversamplingRemoval removal(sink, 2);
+    BOOST_CHECK_THROW(removal.consume(readout(30, { { 0 } }, 0)), std::runtime_error);
+    BOOST_CHECK_THROW(removal.consume(ISMRMRD::Acquisition(64, 1, 2)), std::runtime_error);
+    BOOST_CHECK(out.empty());
+}
+
+BOOST_AUTO_TEST_CASE(headerDescribesTheCroppedReadout)
+{
+    std::string const xml = OversamplingRemoval::updateHeader(HEADER, 2);
+
+    BOOST_CHECK_EQUAL(elementText(xml, "encodedSpace/matrixSize/x"), "128");
+    BOOST_CHECK_EQUAL(elementText(xml, "encodedSpace/fieldOfView_mm/x"), "240");
+    BOOST_CHECK_EQUAL(elementText(xml, "encodedSpace/matrixSize/y"), "128");
+    BOOST_CHECK_EQUAL(elementText(xml, "encodedSpace/fieldOfView_mm/y"), "240");
+    BOOST_CHECK_EQUAL(elementText(xml, "reconSpace/matrixSize/x"), "128");
+    BOOST_CHECK_EQUAL(elementText(xml, "reconSpace/fieldOfView_mm/x"), "240");
+}
+
+BOOST_AUTO_TEST_CASE(headerAlreadyAtTheReconFieldOfViewKeepsIt)
+{
+    // Some stylesheets describe the prescribed field of view as the encoded one
+    std::string const xml = OversamplingRemoval::updateHeader(OversamplingRemoval::updateHeader(HEADER, 2), 2);
+
+    BOOST_CHECK_EQUAL(elementText(xml, "encodedSpace/matrixSize/x"), "64");
+    BOOST_CHECK_EQUAL(elementText(xml, "encodedSpace/fieldOfView_mm/x"), "240");
+}
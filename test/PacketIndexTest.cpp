@@ -0,0 +1,110 @@
+/** @file PacketIndexTest.cpp */
+#define BOOST_TEST_MODULE PacketIndexTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GERawConverter.h"
+#include "TestHelpers.h"
+
+using namespace GEToIsmrmrd;
+
+/** Copy of the sample ScanArchive in a fresh directory, so that sidecars can be written next to it */
+static std::string copySampleArchive()
+{
+    char directory[] = "/tmp/g2i-packet-index-XXXXXX";
+    BOOST_REQUIRE(mkdtemp(directory) != NULL);
+
+    std::string const copy = std::string(directory) + "/ScanArchive_GRE.h5";
+    std::ifstream in((SOURCE_DIR + "/sampleData/ScanArchive_GRE.h5").c_str(), std::ios::binary);
+    std::ofstream out(copy.c_str(), std::ios::binary);
+    out << in.rdbuf();
+    BOOST_REQUIRE(in && out.flush());
+    return copy;
+}
+
+static std::shared_ptr<GERawConverter> openArchive(const std::string& path, bool sidecar)
+{
+    std::shared_ptr<GERawConverter> converter(new GERawConverter(path, "GenericConverter"));
+    ConversionOptions options;
+    options.packetIndexSidecar = sidecar;
+    converter->setOptions(options);
+    return converter;
+}
+
+static void checkSameAcquisitions(const std::vector<ISMRMRD::Acquisition>& a,
+                                  const std::vector<ISMRMRD::Acquisition>& b)
+{
+    BOOST_REQUIRE_EQUAL(a.size(), b.size());
+    for (size_t n = 0 ; n < a.size() ; n++) {
+        BOOST_TEST_CONTEXT("acquisition " << n) {
+            BOOST_CHECK(memcmp(&a[n].idx(), &b[n].idx(), sizeof(ISMRMRD::EncodingCounters)) == 0);
+            BOOST_REQUIRE_EQUAL(a[n].getNumberOfDataElements(), b[n].getNumberOfDataElements());
+            BOOST_CHECK(memcmp(a[n].getDataPtr(), b[n].getDataPtr(),
+                               a[n].getNumberOfDataElements() * sizeof(complex_float_t)) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(conversionWithoutIndexMatchesIndexedConversion)
+{
+    std::string const archive = SOURCE_DIR + "/sampleData/ScanArchive_GRE.h5";
+
+    // Walks the archive once, describing each packet as it is read
+    std::shared_ptr<GERawConverter> single = openArchive(archive, false);
+    std::vector<ISMRMRD::Acquisition> const walked = single->getAcquisitions();
+    BOOST_CHECK(!single->getPacketIndex(false));
+
+    std::shared_ptr<GERawConverter> indexed = openArchive(archive, false);
+    BOOST_REQUIRE(indexed->getPacketIndex());
+    checkSameAcquisitions(walked, indexed->getAcquisitions());
+
+    ConversionRange range;
+    range.slices.insert(0);
+    checkSameAcquisitions(openArchive(archive, false)->getAcquisitions(range), indexed->getAcquisitions(range));
+}
+
+BOOST_AUTO_TEST_CASE(sidecarIsOnlyReusedForTheSameArchive)
+{
+    std::string const archive = copySampleArchive();
+    std::string const sidecar = PacketIndex::sidecarPath(archive);
+
+    std::shared_ptr<const PacketIndex> const built = openArchive(archive, true)->getPacketIndex();
+    BOOST_REQUIRE(built);
+
+    std::shared_ptr<const PacketIndex> const loaded = PacketIndex::load(sidecar, archive);
+    BOOST_REQUIRE(loaded);
+    BOOST_REQUIRE_EQUAL(loaded->size(), built->size());
+    for (size_t n = 0 ; n < built->size() ; n++) {
+        const PacketIndexEntry& x = (*built)[n];
+        const PacketIndexEntry& y = (*loaded)[n];
+        BOOST_CHECK(x.ordinal == y.ordinal && x.opcode == y.opcode && x.slice == y.slice &&
+                    x.firstView == y.firstView && x.viewStep == y.viewStep &&
+                    x.viewCount == y.viewCount && x.echo == y.echo);
+    }
+
+    // Rewritten within the same second, to the same size
+    struct stat info;
+    BOOST_REQUIRE(stat(archive.c_str(), &info) == 0);
+    struct timespec times[2] = { info.st_atim, info.st_mtim };
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000L;
+    BOOST_REQUIRE(utimensat(AT_FDCWD, archive.c_str(), times, 0) == 0);
+
+    struct stat changed;
+    BOOST_REQUIRE(stat(archive.c_str(), &changed) == 0);
+    if (changed.st_mtim.tv_nsec == info.st_mtim.tv_nsec) {
+        BOOST_TEST_MESSAGE("File system does not record sub-second modification times");
+    } else {
+        BOOST_CHECK(!PacketIndex::load(sidecar, archive));
+    }
+
+    std::remove(sidecar.c_str());
+    std::remove(archive.c_str());
+    rmdir(archive.substr(0, archive.rfind('/')).c_str());
+}
@@ -0,0 +1,169 @@
+/** @file PipelineSinkTest.cpp */
+#define BOOST_TEST_MODULE PipelineSinkTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PipelineSink.h"
+#include "SpscQueue.h"
+
+using namespace GEToIsmrmrd;
+
+static const unsigned int COUNT = 2000;
+
+/** Records the scan counter of every acquisition, optionally slowly, and fails at a given one */
+class RecordingSink : public AcquisitionSink
+{
+public:
+    explicit RecordingSink(unsigned int delayMicros = 0, int failAt = -1)
+        : delayMicros_(delayMicros), failAt_(failAt) { }
+
+    void consume(const ISMRMRD::Acquisition& acq)
+    {
+        if (static_cast<int>(acq.scan_counter()) == failAt_) {
+            throw std::runtime_error("downstream failed at " + std::to_string(failAt_));
+        }
+        if (delayMicros_ > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(delayMicros_));
+        }
+        counters.push_back(acq.scan_counter());
+        samples.push_back(acq.getDataPtr()[0].real());
+    }
+
+    std::vector<uint32_t> counters;
+    std::vector<float> samples;
+
+private:
+    unsigned int delayMicros_;
+    int failAt_;
+};
+
+static ISMRMRD::Acquisition numbered(uint32_t n)
+{
+    ISMRMRD::Acquisition acq(8, 2);
+    acq.scan_counter() = n;
+    acq.getDataPtr()[0] = complex_float_t(static_cast<float>(n), 0.0f);
+    return acq;
+}
+
+BOOST_AUTO_TEST_CASE(queueHoldsItsCapacity)
+{
+    SpscQueue<int> queue(2);
+    BOOST_CHECK_EQUAL(queue.capacity(), 2u);
+    BOOST_CHECK(queue.frontSlot() == NULL);
+
+    for (int n = 0 ; n < 2 ; n++) {
+        int* slot = queue.pushSlot();
+        BOOST_REQUIRE(slot != NULL);
+        *slot = n;
+        queue.commitPush();
+    }
+    BOOST_CHECK(queue.pushSlot() == NULL);
+    BOOST_CHECK_EQUAL(queue.size(), 2u);
+
+    BOOST_CHECK_EQUAL(*queue.frontSlot(), 0);
+    queue.commitPop();
+    BOOST_CHECK(queue.pushSlot() != NULL);
+    BOOST_CHECK_EQUAL(*queue.frontSlot(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(queueKeepsOrderAcrossThreads)
+{
+    SpscQueue<unsigned int> queue(2);
+    unsigned int const count = 100000;
+
+    std::thread producer([&]() {
+        for (unsigned int n = 0 ; n < count ; n++) {
+            unsigned int* slot;
+            while ((slot = queue.pushSlot()) == NULL) {
+                std::this_thread::yield();
+            }
+            *slot = n;
+            queue.commitPush();
+        }
+    });
+
+    unsigned int outOfOrder = 0;
+    for (unsigned int n = 0 ; n < count ; n++) {
+        unsigned int* slot;
+        while ((slot = queue.frontSlot()) == NULL) {
+            std::this_thread::yield();
+        }
+        if (*slot != n) {
+            outOfOrder++;
+        }
+        queue.commitPop();
+    }
+    producer.join();
+
+    BOOST_CHECK_EQUAL(outOfOrder, 0u);
+    BOOST_CHECK(queue.frontSlot() == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(acquisitionsArePassedOnInOrder)
+{
+    for (size_t depth : { 1, 2, 256 }) {
+        BOOST_TEST_CONTEXT("queue depth " << depth) {
+            RecordingSink downstream;
+            PipelineSink pipeline(downstream, depth, 10);
+            for (uint32_t n = 0 ; n < COUNT ; n++) {
+                pipeline.consume(numbered(n));
+            }
+            pipeline.finish();
+
+            BOOST_REQUIRE_EQUAL(downstream.counters.size(), COUNT);
+            for (uint32_t n = 0 ; n < COUNT ; n++) {
+                BOOST_REQUIRE_EQUAL(downstream.counters[n], n);
+                BOOST_REQUIRE_EQUAL(downstream.samples[n], static_cast<float>(n));
+            }
+            BOOST_CHECK_EQUAL(pipeline.statistics().acquisitions, COUNT);
+            BOOST_CHECK_LE(pipeline.statistics().maxQueued, depth);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(slowDownstreamHoldsTheConverterBack)
+{
+    for (size_t depth : { 1, 2 }) {
+        BOOST_TEST_CONTEXT("queue depth " << depth) {
+            RecordingSink downstream(200);
+            PipelineSink pipeline(downstream, depth, 10);
+            for (uint32_t n = 0 ; n < 50 ; n++) {
+                pipeline.consume(numbered(n));
+            }
+            pipeline.finish();
+
+            BOOST_CHECK_EQUAL(downstream.counters.size(), 50u);
+            BOOST_CHECK_GT(pipeline.statistics().producerStalls, 0u);
+            BOOST_CHECK_LE(pipeline.statistics().maxQueued, depth);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(finishRethrowsTheDownstreamError)
+{
+    RecordingSink downstream(0, 5);
+    PipelineSink pipeline(downstream, 2, 10);
+
+    // Once the writer has stopped, the queue fills and the converter is told
+    try {
+        for (uint32_t n = 0 ; n < COUNT ; n++) {
+            pipeline.consume(numbered(n));
+        }
+        BOOST_ERROR("the converter was never told the writer failed");
+    } catch (const std::runtime_error& e) {
+        BOOST_CHECK_EQUAL(std::string(e.what()), "PipelineSink: writer thread failed");
+    }
+
+    try {
+        pipeline.finish();
+        BOOST_ERROR("finish() did not rethrow");
+    } catch (const std::runtime_error& e) {
+        BOOST_CHECK_EQUAL(std::string(e.what()), "downstream failed at 5");
+    }
+    BOOST_CHECK_EQUAL(downstream.counters.size(), 5u);
+}
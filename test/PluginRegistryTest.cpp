@@ -0,0 +1,100 @@
+/** @file PluginRegistryTest.cpp */
+#define BOOST_TEST_MODULE PluginRegistryTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "PluginRegistry.h"
+
+using namespace GEToIsmrmrd;
+
+static const std::string PLUGIN = G2I_TEST_PLUGIN;
+
+static std::atomic<int> g_pluginOpens(0);
+
+/**
+ * Counts the times the test plugin is opened; the registry calls dlopen
+ * through the program, which defines it here in front of the C library
+ */
+extern "C" void* dlopen(const char* file, int mode)
+{
+    typedef void* (*Open)(const char*, int);
+    static Open const open = reinterpret_cast<Open>(dlsym(RTLD_NEXT, "dlopen"));
+
+    if (file && PLUGIN == file) {
+        g_pluginOpens++;
+    }
+    return open(file, mode);
+}
+
+BOOST_AUTO_TEST_CASE(unknownClassesAreErrors)
+{
+    PluginRegistry& registry = PluginRegistry::instance();
+
+    BOOST_CHECK_THROW(registry.create("NoSuchConverter"), std::runtime_error);
+    BOOST_CHECK_THROW(registry.create("NoSuchConverter", PLUGIN), std::runtime_error);
+    BOOST_CHECK_THROW(registry.create("TestConverter", "/nonexistent/libNoSuchPlugin.so"), std::runtime_error);
+
+    // Classes of a library are only found through that library
+    BOOST_CHECK_THROW(registry.create("TestConverter"), std::runtime_error);
+    BOOST_CHECK(registry.create("GenericConverter"));
+}
+
+BOOST_AUTO_TEST_CASE(pluginIsLoadedOnce)
+{
+    PluginRegistry& registry = PluginRegistry::instance();
+
+    std::shared_ptr<SequenceConverter> const first = registry.create("TestConverter", PLUGIN);
+    std::shared_ptr<SequenceConverter> const second = registry.create("TestConverter", PLUGIN);
+    BOOST_REQUIRE(first && second);
+    BOOST_CHECK(first != second);
+
+    // Opened by the failed lookup of the first test case, and never again
+    BOOST_CHECK_EQUAL(g_pluginOpens.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(lookupsAreSafeFromSeveralThreads)
+{
+    unsigned int const threads = 8;
+    unsigned int const iterations = 200;
+    PluginRegistry& registry = PluginRegistry::instance();
+
+    std::vector<int> failures(threads, 0);
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0 ; t < threads ; t++) {
+        workers.push_back(std::thread([&registry, &failures, t]() {
+            for (unsigned int n = 0 ; n < iterations ; n++) {
+                try {
+                    std::shared_ptr<SequenceConverter> const plugin = registry.create("TestConverter", PLUGIN);
+                    std::shared_ptr<SequenceConverter> const builtIn = registry.create("NIHepiConverter");
+                    if (!plugin || !builtIn || registry.classNames().size() < 3) {
+                        failures[t]++;
+                    }
+                } catch (const std::exception&) {
+                    failures[t]++;
+                }
+
+                try {
+                    registry.create("NoSuchConverter", PLUGIN);
+                    failures[t]++;
+                } catch (const std::runtime_error&) {
+                }
+            }
+        }));
+    }
+    for (size_t t = 0 ; t < workers.size() ; t++) {
+        workers[t].join();
+    }
+
+    for (unsigned int t = 0 ; t < threads ; t++) {
+        BOOST_CHECK_EQUAL(failures[t], 0);
+    }
+    BOOST_CHECK_EQUAL(g_pluginOpens.load(), 1);
+}
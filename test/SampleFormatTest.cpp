@@ -0,0 +1,240 @@
+/** @file SampleFormatTest.cpp */
+#define BOOST_TEST_MODULE SampleFormatTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <hdf5.h>
+
+#include "BatchedDatasetSink.h"
+#include "SampleFormat.h"
+#include "ShmRing.h"
+
+using namespace GEToIsmrmrd;
+
+static const SampleFormat FORMATS[] = { SAMPLE_FORMAT_FLOAT, SAMPLE_FORMAT_INT16, SAMPLE_FORMAT_INT32 };
+
+/** Acquisitions of 16 x 2 samples holding whole numbers up to the limits of a format */
+static std::vector<ISMRMRD::Acquisition> wholeAcquisitions(SampleFormat format, size_t count)
+{
+    float const highest = (format == SAMPLE_FORMAT_INT16) ? 32767.0f : 16777216.0f;
+    float const lowest = (format == SAMPLE_FORMAT_INT16) ? -32768.0f : -2147483648.0f;
+
+    std::vector<ISMRMRD::Acquisition> acqs;
+    for (size_t n = 0 ; n < count ; n++) {
+        ISMRMRD::Acquisition acq(16, 2);
+        acq.scan_counter() = n;
+        complex_float_t* data = acq.getDataPtr();
+        for (size_t i = 0 ; i < acq.getNumberOfDataElements() ; i++) {
+            data[i] = complex_float_t(static_cast<float>(i * 7 + n) - 100.0f, -static_cast<float>(i) * 3.0f);
+        }
+        data[0] = complex_float_t(highest, lowest);
+        data[1] = complex_float_t(-1.0f, 0.0f);
+        acqs.push_back(acq);
+    }
+    return acqs;
+}
+
+static void checkSameSamples(const complex_float_t* expected, const complex_float_t* actual, size_t count)
+{
+    BOOST_CHECK(memcmp(expected, actual, count * sizeof(complex_float_t)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(integersRoundTripExactly)
+{
+    for (SampleFormat format : { SAMPLE_FORMAT_INT16, SAMPLE_FORMAT_INT32 }) {
+        BOOST_TEST_CONTEXT(sampleFormatName(format)) {
+            ISMRMRD::Acquisition const acq = wholeAcquisitions(format, 1)[0];
+            size_t const count = acq.getNumberOfDataElements();
+
+            std::vector<char> packed(2 * count * sampleComponentBytes(format));
+            packSamples(acq, format, packed.data());
+
+            std::vector<complex_float_t> unpacked(count);
+            unpackSamples(packed.data(), format, count, unpacked.data());
+            checkSameSamples(acq.getDataPtr(), unpacked.data(), count);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(samplesThatAreNotIntegersAreRejected)
+{
+    float const rejected16[] = { 0.5f, 32768.0f, -32769.0f, std::numeric_limits<float>::quiet_NaN(),
+                                 std::numeric_limits<float>::infinity() };
+    float const rejected32[] = { -0.25f, 2147483648.0f, std::numeric_limits<float>::quiet_NaN() };
+
+    ISMRMRD::Acquisition acq(4, 1);
+    std::vector<char> packed(8 * sizeof(int32_t));
+    for (float value : rejected16) {
+        acq.getDataPtr()[2] = complex_float_t(1.0f, value);
+        BOOST_CHECK_THROW(packSamples(acq, SAMPLE_FORMAT_INT16, packed.data()), std::runtime_error);
+    }
+    for (float value : rejected32) {
+        acq.getDataPtr()[3] = complex_float_t(value, 1.0f);
+        BOOST_CHECK_THROW(packSamples(acq, SAMPLE_FORMAT_INT32, packed.data()), std::runtime_error);
+    }
+}
+
+/** Record of an ISMRMRD acquisition with only its samples, read back as floats by member name */
+struct SamplesRecord
+{
+    hvl_t data;
+};
+
+/** Reads the samples of the "data" dataset of a group as an ISMRMRD reader does, converted to floats */
+static std::vector<std::vector<float> > readSamples(const std::string& path)
+{
+    hid_t const file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    BOOST_REQUIRE(file >= 0);
+    hid_t const dataset = H5Dopen2(file, "/dataset/data", H5P_DEFAULT);
+    BOOST_REQUIRE(dataset >= 0);
+
+    hid_t const floats = H5Tvlen_create(H5T_NATIVE_FLOAT);
+    hid_t const type = H5Tcreate(H5T_COMPOUND, sizeof(SamplesRecord));
+    H5Tinsert(type, "data", HOFFSET(SamplesRecord, data), floats);
+
+    hid_t const space = H5Dget_space(dataset);
+    hsize_t count = 0;
+    H5Sget_simple_extent_dims(space, &count, NULL);
+
+    std::vector<SamplesRecord> records(count);
+    BOOST_REQUIRE(H5Dread(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, records.data()) >= 0);
+
+    std::vector<std::vector<float> > samples;
+    for (const SamplesRecord& record : records) {
+        const float* parts = static_cast<const float*>(record.data.p);
+        samples.push_back(std::vector<float>(parts, parts + record.data.len));
+    }
+
+    H5Dvlen_reclaim(type, space, H5P_DEFAULT, records.data());
+    H5Sclose(space);
+    H5Tclose(type);
+    H5Tclose(floats);
+    H5Dclose(dataset);
+    H5Fclose(file);
+    return samples;
+}
+
+static bool hasAttribute(const std::string& path, const char* name, std::string& format, double& scale)
+{
+    hid_t const file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    hid_t const dataset = H5Dopen2(file, "/dataset/data", H5P_DEFAULT);
+    bool const exists = H5Aexists(dataset, name) > 0;
+
+    if (exists && strcmp(name, BatchedDatasetSink::SAMPLE_FORMAT_ATTRIBUTE) == 0) {
+        hid_t const attribute = H5Aopen(dataset, name, H5P_DEFAULT);
+        hid_t const type = H5Aget_type(attribute);
+        std::vector<char> text(H5Tget_size(type) + 1, '\0');
+        H5Aread(attribute, type, text.data());
+        format = text.data();
+        H5Tclose(type);
+        H5Aclose(attribute);
+    } else if (exists) {
+        hid_t const attribute = H5Aopen(dataset, name, H5P_DEFAULT);
+        H5Aread(attribute, H5T_NATIVE_DOUBLE, &scale);
+        H5Aclose(attribute);
+    }
+
+    H5Dclose(dataset);
+    H5Fclose(file);
+    return exists;
+}
+
+BOOST_AUTO_TEST_CASE(hdf5RoundTripIsLossless)
+{
+    for (SampleFormat format : FORMATS) {
+        BOOST_TEST_CONTEXT(sampleFormatName(format)) {
+            char path[] = "/tmp/g2i-sample-format-XXXXXX";
+            int const fd = mkstemp(path);
+            BOOST_REQUIRE(fd >= 0);
+            close(fd);
+            H5Fclose(H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT));
+
+            // Two batches and a partial one
+            std::vector<ISMRMRD::Acquisition> const acqs = wholeAcquisitions(format, 10);
+            {
+                BatchedDatasetSink sink(path, "dataset", 4, 1024, format);
+                for (const ISMRMRD::Acquisition& acq : acqs) {
+                    sink.consume(acq);
+                }
+            }
+
+            std::vector<std::vector<float> > const samples = readSamples(path);
+            BOOST_REQUIRE_EQUAL(samples.size(), acqs.size());
+            for (size_t n = 0 ; n < acqs.size() ; n++) {
+                BOOST_REQUIRE_EQUAL(samples[n].size(), 2 * acqs[n].getNumberOfDataElements());
+                checkSameSamples(acqs[n].getDataPtr(), reinterpret_cast<const complex_float_t*>(samples[n].data()),
+                                 acqs[n].getNumberOfDataElements());
+            }
+
+            std::string name;
+            double scale = 0.0;
+            bool const described = hasAttribute(path, BatchedDatasetSink::SAMPLE_FORMAT_ATTRIBUTE, name, scale);
+            if (format == SAMPLE_FORMAT_FLOAT) {
+                BOOST_CHECK(!described);
+            } else {
+                BOOST_CHECK(described);
+                BOOST_CHECK_EQUAL(name, sampleFormatName(format));
+                BOOST_CHECK(hasAttribute(path, BatchedDatasetSink::SAMPLE_SCALE_ATTRIBUTE, name, scale));
+                BOOST_CHECK_EQUAL(scale, SAMPLE_SCALE);
+            }
+
+            unlink(path);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sharedMemoryRoundTripIsLossless)
+{
+    for (SampleFormat format : FORMATS) {
+        BOOST_TEST_CONTEXT(sampleFormatName(format)) {
+            std::string const name = "/g2i-sample-format-" + std::to_string(getpid());
+            std::vector<ISMRMRD::Acquisition> const acqs = wholeAcquisitions(format, 10);
+
+            // Small enough for the writer to wait for the reader and wrap around
+            ShmRingWriter writer(name, 4096, 0, format);
+            std::thread writing([&]() {
+                writer.writeHeader("<ismrmrdHeader/>");
+                for (const ISMRMRD::Acquisition& acq : acqs) {
+                    writer.consume(acq);
+                }
+                writer.finish();
+            });
+
+            std::vector<std::vector<complex_float_t> > received;
+            {
+                ShmRingReader reader(name, 5000, 0);
+                BOOST_CHECK_EQUAL(reader.sampleFormat(), format);
+
+                ShmRecord record;
+                while (reader.next(record)) {
+                    if (record.type == SHM_RECORD_ACQUISITION) {
+                        ShmAcquisition const acq = ShmAcquisition::view(record, reader.sampleFormat());
+                        size_t const count = acq.head->number_of_samples * acq.head->active_channels;
+                        std::vector<complex_float_t> samples(count);
+                        if (format == SAMPLE_FORMAT_FLOAT) {
+                            std::copy(acq.data, acq.data + count, samples.begin());
+                        } else {
+                            unpackSamples(acq.samples, format, count, samples.data());
+                        }
+                        received.push_back(samples);
+                    }
+                    reader.release();
+                }
+            }
+            writing.join();
+
+            BOOST_REQUIRE_EQUAL(received.size(), acqs.size());
+            for (size_t n = 0 ; n < acqs.size() ; n++) {
+                BOOST_REQUIRE_EQUAL(received[n].size(), acqs[n].getNumberOfDataElements());
+                checkSameSamples(acqs[n].getDataPtr(), received[n].data(), received[n].size());
+            }
+        }
+    }
+}
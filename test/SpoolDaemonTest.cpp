@@ -0,0 +1,127 @@
+/** @file SpoolDaemonTest.cpp */
+#define BOOST_TEST_MODULE SpoolDaemonTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "SpoolDaemon.h"
+
+using namespace GEToIsmrmrd;
+
+typedef std::chrono::steady_clock Clock;
+
+/** Gap between the chunks of a file, well inside the settle interval */
+static const int CHUNK_MILLIS = 400;
+
+/** Records when each raw file is opened for conversion, and fails it, so no output is written */
+class RecordingOpener
+{
+public:
+    std::shared_ptr<GERawConverter> operator()(const std::string& rawFile)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        opened_.push_back(std::make_pair(rawFile, Clock::now()));
+        throw std::runtime_error("not converted by this test");
+    }
+
+    std::vector<std::pair<std::string, Clock::time_point> > opened()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return opened_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::pair<std::string, Clock::time_point> > opened_;
+};
+
+static std::string temporaryDirectory()
+{
+    char path[] = "/tmp/g2i-spool-XXXXXX";
+    BOOST_REQUIRE(mkdtemp(path) != NULL);
+    return path;
+}
+
+/** Opens a file for writing, appends bytes to it, if any, and closes it, as a copying tool would */
+static void append(const std::string& path, const std::string& bytes)
+{
+    int const fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    BOOST_REQUIRE(fd >= 0);
+    BOOST_REQUIRE_EQUAL(write(fd, bytes.data(), bytes.size()), static_cast<ssize_t>(bytes.size()));
+    close(fd);
+}
+
+static void sleepMillis(int millis)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+}
+
+// requestStop() cannot be undone, so the daemon is run once for the whole scenario
+BOOST_AUTO_TEST_CASE(fileWrittenInChunksIsConvertedOnceAfterItSettles)
+{
+    std::string const spoolDir = temporaryDirectory();
+    std::string const outputDir = temporaryDirectory();
+    std::string const rawFile = spoolDir + "/ScanArchive_1.h5";
+
+    RecordingOpener opener;
+    BatchConversion conversion(std::ref(opener), ConversionRange(), 0, 0);
+    std::vector<BatchFileResult> results;
+    std::mutex resultsMutex;
+    conversion.setReporter([&](const BatchFileResult& result) {
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        results.push_back(result);
+    });
+
+    WorkStealingPool pool(2);
+    SpoolDaemon daemon(spoolDir, outputDir, conversion, pool);
+    std::thread watching([&]() { daemon.run(); });
+
+    // Closed and reopened between chunks, so each chunk is a new candidate of the same file
+    Clock::time_point lastWrite;
+    for (int chunk = 0 ; chunk < 4 ; chunk++) {
+        append(rawFile, std::string(4096, static_cast<char>('a' + chunk)));
+        lastWrite = Clock::now();
+        sleepMillis(CHUNK_MILLIS);
+    }
+    BOOST_CHECK(opener.opened().empty());
+
+    sleepMillis(SpoolDaemon::SETTLE_MILLIS + 1500);
+    std::vector<std::pair<std::string, Clock::time_point> > opened = opener.opened();
+    // Checked without stopping the test, which would leave the daemon thread running
+    BOOST_CHECK_EQUAL(opened.size(), 1u);
+    if (!opened.empty()) {
+        BOOST_CHECK_EQUAL(opened[0].first, rawFile);
+        BOOST_CHECK(opened[0].second - lastWrite >= std::chrono::milliseconds(SpoolDaemon::SETTLE_MILLIS));
+    }
+
+    // Reopened for writing without a change: a candidate again, but converted already
+    append(rawFile, "");
+    sleepMillis(SpoolDaemon::SETTLE_MILLIS + 1500);
+
+    SpoolDaemon::requestStop();
+    watching.join();
+
+    BOOST_CHECK_EQUAL(opener.opened().size(), 1u);
+    BOOST_CHECK_EQUAL(daemon.queued(), 1u);
+    {
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        BOOST_REQUIRE_EQUAL(results.size(), 1u);
+        BOOST_CHECK_EQUAL(results[0].rawFile, rawFile);
+        BOOST_CHECK_EQUAL(results[0].outputFile, outputDir + "/ScanArchive_1.h5");
+        BOOST_CHECK_EQUAL(results[0].error, "not converted by this test");
+    }
+
+    unlink(rawFile.c_str());
+    rmdir(spoolDir.c_str());
+    rmdir(outputDir.c_str());
+}
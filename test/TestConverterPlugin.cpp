@@ -0,0 +1,11 @@
+/** @file TestConverterPlugin.cpp */
+#include "GenericConverter.h"
+
+/**
+ * Converter exported by a plugin library, for PluginRegistryTest
+ */
+class TestConverter : public GEToIsmrmrd::GenericConverter
+{
+};
+
+SEQUENCE_CONVERTER_FACTORY_DECLARE(TestConverter)
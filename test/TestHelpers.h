@@ -0,0 +1,39 @@
+/** @file TestHelpers.h */
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+// Included after the Boost.Test header, whose assertions these use
+#include <fstream>
+#include <iterator>
+#include <string>
+
+/** Root of the source tree, for the sample data and stylesheets */
+static const std::string SOURCE_DIR = G2I_SOURCE_DIR;
+
+/** Whole contents of a file; fails the test if it cannot be read */
+inline std::string readFile(const std::string& path)
+{
+    std::ifstream stream(path.c_str(), std::ios::binary);
+    BOOST_REQUIRE_MESSAGE(stream, "cannot read " << path);
+    return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+/** Text of the element at a path of names, each found after the one before it */
+inline std::string elementText(const std::string& xml, const std::string& path)
+{
+    size_t pos = 0;
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        pos = xml.find("<" + path.substr(start, end - start) + ">", pos);
+        BOOST_REQUIRE_MESSAGE(pos != std::string::npos, "no " << path << " in " << xml);
+        start = end + 1;
+    }
+    size_t const open = xml.find('>', pos) + 1;
+    return xml.substr(open, xml.find('<', open) - open);
+}
+
+#endif /* TEST_HELPERS_H */